@@ -0,0 +1,243 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Microbenchmark comparing CharScanner's scalar and SIMD kernels over a corpus of typical browser request headers,
+// doing the same scanning as request parsing does: finding the end of the header, and then each line's end and
+// field name separator.
+// The corpus includes large (2-4KB) cookie-heavy Safari requests, which is where the SIMD kernels should help most,
+// as well as small ones, where their setup and tail handling costs matter more.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "utils/char_scanner.h"
+
+struct CorpusRequest
+{
+	const char*		name;
+	std::string		header;
+};
+
+// pseudo-random, but repeatable, cookie values
+static std::string makeCookies(unsigned int numCookies, unsigned int valueLength, unsigned int seed)
+{
+	static const char kValueChars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789%-_.";
+
+	std::string cookies;
+	for (unsigned int i = 0; i < numCookies; i++)
+	{
+		if (i > 0)
+		{
+			cookies += "; ";
+		}
+
+		cookies += "_ck" + std::to_string(i) + "=";
+		for (unsigned int j = 0; j < valueLength; j++)
+		{
+			seed = seed * 1103515245 + 12345;
+			cookies += kValueChars[(seed >> 16) % (sizeof(kValueChars) - 1)];
+		}
+	}
+
+	return cookies;
+}
+
+static std::vector<CorpusRequest> buildCorpus()
+{
+	std::vector<CorpusRequest> aCorpus;
+
+	aCorpus.push_back({ "curl", "GET /photos/ HTTP/1.1\r\nHost: photos.example.com\r\nUser-Agent: curl/8.4.0\r\nAccept: */*\r\n\r\n" });
+
+	aCorpus.push_back({ "chrome",
+		"GET /photos/2023/italy/ HTTP/1.1\r\n"
+		"Host: photos.example.com\r\n"
+		"Connection: keep-alive\r\n"
+		"sec-ch-ua: \"Chromium\";v=\"122\", \"Not(A:Brand\";v=\"24\", \"Google Chrome\";v=\"122\"\r\n"
+		"sec-ch-ua-mobile: ?0\r\n"
+		"sec-ch-ua-platform: \"macOS\"\r\n"
+		"Upgrade-Insecure-Requests: 1\r\n"
+		"User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/122.0.0.0 Safari/537.36\r\n"
+		"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+		"Sec-Fetch-Site: same-origin\r\n"
+		"Sec-Fetch-Mode: navigate\r\n"
+		"Sec-Fetch-User: ?1\r\n"
+		"Sec-Fetch-Dest: document\r\n"
+		"Referer: https://photos.example.com/photos/2023/\r\n"
+		"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+		"Accept-Language: en-GB,en-US;q=0.9,en;q=0.8\r\n"
+		"Cookie: " + makeCookies(4, 24, 1) + "\r\n"
+		"\r\n" });
+
+	aCorpus.push_back({ "firefox-image",
+		"GET /photos/2023/italy/IMG_1234.jpg HTTP/1.1\r\n"
+		"Host: photos.example.com\r\n"
+		"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:123.0) Gecko/20100101 Firefox/123.0\r\n"
+		"Accept: image/avif,image/webp,*/*\r\n"
+		"Accept-Language: en-GB,en;q=0.5\r\n"
+		"Accept-Encoding: gzip, deflate, br\r\n"
+		"Connection: keep-alive\r\n"
+		"Referer: https://photos.example.com/photos/2023/italy/\r\n"
+		"Sec-Fetch-Dest: image\r\n"
+		"Sec-Fetch-Mode: no-cors\r\n"
+		"Sec-Fetch-Site: same-origin\r\n"
+		"If-Modified-Since: Tue, 12 Sep 2023 10:15:32 GMT\r\n"
+		"If-None-Match: \"5f3a-64ff9b44\"\r\n"
+		"\r\n" });
+
+	aCorpus.push_back({ "safari-2KB",
+		"GET /photos/2023/italy/ HTTP/1.1\r\n"
+		"Host: photos.example.com\r\n"
+		"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+		"Sec-Fetch-Site: same-origin\r\n"
+		"Cookie: " + makeCookies(24, 60, 2) + "\r\n"
+		"Accept-Encoding: gzip, deflate, br\r\n"
+		"Sec-Fetch-Mode: navigate\r\n"
+		"User-Agent: Mozilla/5.0 (iPhone; CPU iPhone OS 17_3_1 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.3 Mobile/15E148 Safari/604.1\r\n"
+		"Accept-Language: en-GB,en;q=0.9\r\n"
+		"Referer: https://photos.example.com/photos/2023/\r\n"
+		"Sec-Fetch-Dest: document\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n" });
+
+	aCorpus.push_back({ "safari-4KB",
+		"GET /photos/2023/italy/?page=2 HTTP/1.1\r\n"
+		"Host: photos.example.com\r\n"
+		"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+		"Sec-Fetch-Site: same-origin\r\n"
+		"Cookie: " + makeCookies(40, 80, 3) + "\r\n"
+		"Accept-Encoding: gzip, deflate, br\r\n"
+		"Sec-Fetch-Mode: navigate\r\n"
+		"User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.3 Safari/605.1.15\r\n"
+		"Accept-Language: en-GB,en;q=0.9\r\n"
+		"Referer: https://photos.example.com/photos/2023/italy/\r\n"
+		"Sec-Fetch-Dest: document\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n" });
+
+	return aCorpus;
+}
+
+// scans the header the way RecvBuffer and WebRequest do, returning something which depends on all the results,
+// so none of the scanning can be optimised away.
+static size_t scanHeader(const std::string& header)
+{
+	const char* pData = header.data();
+	size_t headerEndPos = CharScanner::findHeaderEnd(pData, header.size());
+	if (headerEndPos == CharScanner::npos)
+		return 0;
+
+	size_t headerLength = headerEndPos + 4;
+	size_t checksum = headerLength;
+
+	size_t lineStart = 0;
+	while (lineStart < headerLength - 2)
+	{
+		size_t separatorPos = 0;
+		size_t lineLength = CharScanner::findLineEnd(pData + lineStart, headerLength - lineStart, separatorPos);
+		if (lineLength == CharScanner::npos)
+			break;
+
+		checksum += lineLength + separatorPos;
+		lineStart += lineLength + 1;
+	}
+
+	return checksum;
+}
+
+static const char* getKernelName(CharScanner::KernelType kernelType)
+{
+	switch (kernelType)
+	{
+		case CharScanner::eKernelSSE42:
+			return "sse4.2";
+		case CharScanner::eKernelAVX2:
+			return "avx2";
+		default:
+			return "scalar";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int numIterations = (argc > 1) ? (unsigned int)atoi(argv[1]) : 200000;
+
+	std::vector<CorpusRequest> aCorpus = buildCorpus();
+
+	fprintf(stdout, "%u iterations per request. Best supported kernel: %s\n\n", numIterations, getKernelName(CharScanner::getKernelType()));
+
+	fprintf(stdout, "%-16s %8s", "request", "bytes");
+	const CharScanner::KernelType aKernelTypes[] = { CharScanner::eKernelScalar, CharScanner::eKernelSSE42, CharScanner::eKernelAVX2 };
+	for (CharScanner::KernelType kernelType : aKernelTypes)
+	{
+		fprintf(stdout, "   %8s ns/req   GB/s", getKernelName(kernelType));
+	}
+	fprintf(stdout, "\n");
+
+	size_t totalChecksum = 0;
+
+	for (const CorpusRequest& request : aCorpus)
+	{
+		fprintf(stdout, "%-16s %8zu", request.name, request.header.size());
+
+		size_t expectedChecksum = 0;
+
+		for (CharScanner::KernelType kernelType : aKernelTypes)
+		{
+			if (!CharScanner::setKernelType(kernelType))
+			{
+				fprintf(stdout, "   %23s", "unsupported");
+				continue;
+			}
+
+			size_t checksum = scanHeader(request.header);
+			if (kernelType == CharScanner::eKernelScalar)
+			{
+				expectedChecksum = checksum;
+			}
+			else if (checksum != expectedChecksum)
+			{
+				fprintf(stdout, "\nError: %s kernel gave different results to the scalar one.\n", getKernelName(kernelType));
+				return 1;
+			}
+
+			auto startTime = std::chrono::steady_clock::now();
+
+			for (unsigned int i = 0; i < numIterations; i++)
+			{
+				totalChecksum += scanHeader(request.header);
+			}
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			double nsPerRequest = (seconds * 1.0e9) / (double)numIterations;
+			double gbPerSecond = ((double)request.header.size() * (double)numIterations) / (seconds * 1.0e9);
+
+			fprintf(stdout, "   %15.1f   %5.2f", nsPerRequest, gbPerSecond);
+		}
+
+		fprintf(stdout, "\n");
+	}
+
+	// so the scanning can't be optimised away
+	fprintf(stdout, "\n(checksum: %zu)\n", totalChecksum);
+
+	return 0;
+}
@@ -0,0 +1,272 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Microbenchmark comparing connection handoff from an accept thread to a pool of worker threads, using:
+//   - the original std::queue + mutex / condition variable (notify_all()) approach
+//   - the BoundedMPMCQueue + per-worker ThreadParker approach WebServerService uses now
+// Reports throughput, and the latency between the "accept" thread queueing an item and a worker taking it.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "utils/bounded_mpmc_queue.h"
+#include "utils/thread_parker.h"
+
+static int64_t getTimeNS()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchResults
+{
+	double				itemsPerSecond	= 0.0;
+	std::vector<int64_t> aLatencies;
+};
+
+static void printResults(const char* name, BenchResults& results)
+{
+	std::sort(results.aLatencies.begin(), results.aLatencies.end());
+	
+	double total = 0.0;
+	for (int64_t latency : results.aLatencies)
+	{
+		total += (double)latency;
+	}
+	
+	size_t count = results.aLatencies.size();
+	fprintf(stdout, "%-22s %12.0f items/s   latency mean: %8.1f us  p50: %8.1f us  p99: %8.1f us\n", name, results.itemsPerSecond,
+			(total / (double)count) / 1000.0, (double)results.aLatencies[count / 2] / 1000.0,
+			(double)results.aLatencies[(count * 99) / 100] / 1000.0);
+}
+
+// simulates the accept thread: items are produced with an optional gap between them, to measure the latency
+// of waking parked workers, rather than just the throughput with workers which never park.
+template<typename PushFunc>
+static void produceItems(unsigned int numItems, unsigned int gapNS, std::vector<int64_t>& aEnqueueTimes, PushFunc pushFunc)
+{
+	for (unsigned int i = 0; i < numItems; i++)
+	{
+		if (gapNS > 0)
+		{
+			int64_t endTime = getTimeNS() + gapNS;
+			while (getTimeNS() < endTime)
+			{
+			}
+		}
+		
+		aEnqueueTimes[i] = getTimeNS();
+		pushFunc(i);
+	}
+}
+
+static BenchResults runMutexCondVar(unsigned int numWorkers, unsigned int numItems, unsigned int gapNS)
+{
+	std::queue<unsigned int>	pending;
+	std::mutex					lock;
+	std::condition_variable		newItemEvent;
+	bool						active = true;
+	
+	std::vector<int64_t> aEnqueueTimes(numItems);
+	std::vector<int64_t> aDequeueTimes(numItems);
+	
+	std::vector<std::thread> aWorkers;
+	for (unsigned int i = 0; i < numWorkers; i++)
+	{
+		aWorkers.emplace_back([&]()
+		{
+			while (true)
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				newItemEvent.wait(guard, [&]{ return !pending.empty() || !active; });
+				if (pending.empty())
+					return;
+				
+				unsigned int item = pending.front();
+				pending.pop();
+				guard.unlock();
+				
+				aDequeueTimes[item] = getTimeNS();
+			}
+		});
+	}
+	
+	int64_t startTime = getTimeNS();
+	
+	produceItems(numItems, gapNS, aEnqueueTimes, [&](unsigned int item)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		pending.push(item);
+		newItemEvent.notify_all();
+	});
+	
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		active = false;
+		newItemEvent.notify_all();
+	}
+	
+	for (std::thread& worker : aWorkers)
+	{
+		worker.join();
+	}
+	
+	BenchResults results;
+	results.itemsPerSecond = (double)numItems / ((double)(getTimeNS() - startTime) / 1.0e9);
+	for (unsigned int i = 0; i < numItems; i++)
+	{
+		results.aLatencies.emplace_back(aDequeueTimes[i] - aEnqueueTimes[i]);
+	}
+	return results;
+}
+
+// this follows the same protocol as WebServerService::workerThreadFunction() and wakeIdleWorker()
+static BenchResults runMPMCParker(unsigned int numWorkers, unsigned int numItems, unsigned int gapNS)
+{
+	BoundedMPMCQueue<unsigned int>	pending(numItems);
+	BoundedMPMCQueue<unsigned int>	idleWorkers(numWorkers);
+	std::vector<ThreadParker*>		aParkers;
+	std::atomic<bool>				active(true);
+	std::atomic<unsigned int>		numTaken(0);
+	
+	for (unsigned int i = 0; i < numWorkers; i++)
+	{
+		aParkers.emplace_back(new ThreadParker());
+	}
+	
+	std::vector<int64_t> aEnqueueTimes(numItems);
+	std::vector<int64_t> aDequeueTimes(numItems);
+	
+	std::vector<std::thread> aWorkers;
+	for (unsigned int i = 0; i < numWorkers; i++)
+	{
+		aWorkers.emplace_back([&, i]()
+		{
+			ThreadParker* pParker = aParkers[i];
+			
+			while (active || numTaken < numItems)
+			{
+				unsigned int item = 0;
+				if (!pending.tryPop(item))
+				{
+					pParker->setParked(true);
+					
+					bool addedToIdleQueue = true;
+					if (pParker->markInIdleQueue())
+					{
+						addedToIdleQueue = idleWorkers.tryPush(i);
+						if (!addedToIdleQueue)
+						{
+							pParker->clearInIdleQueue();
+						}
+					}
+					
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (!pending.tryPop(item))
+					{
+						pParker->park(addedToIdleQueue ? 100 : 10);
+						pParker->setParked(false);
+						continue;
+					}
+					
+					pParker->setParked(false);
+				}
+				
+				aDequeueTimes[item] = getTimeNS();
+				numTaken += 1;
+			}
+		});
+	}
+	
+	int64_t startTime = getTimeNS();
+	
+	produceItems(numItems, gapNS, aEnqueueTimes, [&](unsigned int item)
+	{
+		pending.tryPush(item);
+		
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		
+		unsigned int workerIndex = 0;
+		while (idleWorkers.tryPop(workerIndex))
+		{
+			aParkers[workerIndex]->clearInIdleQueue();
+			if (aParkers[workerIndex]->claimUnpark())
+			{
+				aParkers[workerIndex]->unpark();
+				break;
+			}
+		}
+	});
+	
+	active = false;
+	for (ThreadParker* pParker : aParkers)
+	{
+		pParker->unpark();
+	}
+	
+	for (std::thread& worker : aWorkers)
+	{
+		worker.join();
+	}
+	
+	BenchResults results;
+	results.itemsPerSecond = (double)numItems / ((double)(getTimeNS() - startTime) / 1.0e9);
+	for (unsigned int i = 0; i < numItems; i++)
+	{
+		results.aLatencies.emplace_back(aDequeueTimes[i] - aEnqueueTimes[i]);
+	}
+	
+	for (ThreadParker* pParker : aParkers)
+	{
+		delete pParker;
+	}
+	
+	return results;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int numWorkers = (argc > 1) ? (unsigned int)atoi(argv[1]) : 8;
+	unsigned int numItems = (argc > 2) ? (unsigned int)atoi(argv[2]) : 200000;
+	
+	fprintf(stdout, "%u worker threads, %u items\n", numWorkers, numItems);
+	
+	// back-to-back (throughput), and spaced out, so that workers are mostly parked when items arrive (wake latency)
+	const unsigned int aGapsNS[] = { 0, 20000 };
+	for (unsigned int gapNS : aGapsNS)
+	{
+		unsigned int itemsForRun = (gapNS > 0) ? std::min(numItems, 20000u) : numItems;
+		fprintf(stdout, "\nGap between items: %u ns\n", gapNS);
+		
+		BenchResults mutexResults = runMutexCondVar(numWorkers, itemsForRun, gapNS);
+		printResults("mutex/condvar:", mutexResults);
+		
+		BenchResults mpmcResults = runMPMCParker(numWorkers, itemsForRun, gapNS);
+		printResults("mpmc/parker:", mpmcResults);
+	}
+	
+	return 0;
+}
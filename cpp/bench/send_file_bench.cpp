@@ -0,0 +1,264 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Benchmark comparing the CPU cost of sending file content to a client over a loopback TCP connection, using:
+//   - pread() into a 64KB buffer, and then Socket::send(), as WebResponseAdvancedBinaryFile does without sendFileData()
+//   - Socket::sendFile(), which uses sendfile(), so the data isn't copied through user space
+// Reports the sending thread's CPU time (user + system) per GB sent, and the throughput.
+// A separate thread receives and discards the data, so its cost isn't included.
+// Note: the file is read from the page cache (it's written just before), which is the common case for a busy server.
+//       Over loopback, some of the TCP stack's work is done in the receiving thread's context, so the absolute numbers
+//       are lower than for a real NIC, but the difference between the two methods (the copy through user space) isn't.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "utils/socket.h"
+#include "utils/logger.h"
+
+static const size_t kReadSendChunkSize = 64 * 1024;
+
+struct BenchResults
+{
+	double		cpuSeconds		= 0.0;
+	double		wallSeconds		= 0.0;
+	size_t		bytesSent		= 0;
+	bool		successful		= false;
+};
+
+static double getThreadCPUSeconds()
+{
+	struct rusage usage;
+#ifdef RUSAGE_THREAD
+	getrusage(RUSAGE_THREAD, &usage);
+#else
+	getrusage(RUSAGE_SELF, &usage);
+#endif
+	return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+			(double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+static void printResults(const char* name, const BenchResults& results)
+{
+	if (!results.successful)
+	{
+		fprintf(stdout, "%-16s failed.\n", name);
+		return;
+	}
+
+	double gigabytes = (double)results.bytesSent / (1024.0 * 1024.0 * 1024.0);
+	fprintf(stdout, "%-16s CPU: %8.1f ms/GB   throughput: %8.1f MB/s\n", name, (results.cpuSeconds * 1000.0) / gigabytes,
+			((double)results.bytesSent / (1024.0 * 1024.0)) / results.wallSeconds);
+}
+
+static bool createTestFile(const std::string& path, size_t fileSize)
+{
+	int fileFD = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+	if (fileFD == -1)
+		return false;
+
+	std::vector<char> aData(1024 * 1024);
+	for (size_t i = 0; i < aData.size(); i++)
+	{
+		aData[i] = (char)(i * 31);
+	}
+
+	size_t remaining = fileSize;
+	while (remaining > 0)
+	{
+		size_t thisSize = (remaining > aData.size()) ? aData.size() : remaining;
+		if (write(fileFD, aData.data(), thisSize) != (ssize_t)thisSize)
+		{
+			close(fileFD);
+			return false;
+		}
+		remaining -= thisSize;
+	}
+
+	close(fileFD);
+	return true;
+}
+
+// receives and discards everything until the sender closes the connection
+static void receiveThreadFunction(int port, size_t* pBytesReceived)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(sock, (struct sockaddr*)&address, sizeof(address)) == -1)
+	{
+		close(sock);
+		return;
+	}
+
+	std::vector<char> aBuffer(256 * 1024);
+	while (true)
+	{
+		ssize_t ret = recv(sock, aBuffer.data(), aBuffer.size(), 0);
+		if (ret <= 0)
+			break;
+
+		*pBytesReceived += (size_t)ret;
+	}
+
+	close(sock);
+}
+
+// sends the whole file numRepeats times over a new loopback connection with the given send function
+template<typename SendFunc>
+static BenchResults runBench(Logger& logger, const std::string& filePath, size_t fileSize, unsigned int numRepeats, SendFunc sendFunc)
+{
+	BenchResults results;
+
+	// bind to any free port, and then let Socket take it over, so the accepted socket is set up as the server's are
+	int listenFD = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = 0;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressLength = sizeof(address);
+	if (bind(listenFD, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listenFD, 1) == -1 ||
+		getsockname(listenFD, (struct sockaddr*)&address, &addressLength) == -1)
+	{
+		close(listenFD);
+		return results;
+	}
+
+	Socket listenSocket;
+	listenSocket.adoptListeningSocket(&logger, listenFD);
+
+	size_t bytesReceived = 0;
+	std::thread receiveThread(receiveThreadFunction, (int)ntohs(address.sin_port), &bytesReceived);
+
+	Socket connectionSocket;
+	connectionSocket.setLogger(&logger);
+	if (!listenSocket.accept(&connectionSocket))
+	{
+		receiveThread.join();
+		return results;
+	}
+
+	int fileFD = open(filePath.c_str(), O_RDONLY);
+
+	results.successful = true;
+
+	auto startTime = std::chrono::steady_clock::now();
+	double startCPUSeconds = getThreadCPUSeconds();
+
+	for (unsigned int i = 0; i < numRepeats; i++)
+	{
+		if (!sendFunc(connectionSocket, fileFD, fileSize))
+		{
+			results.successful = false;
+			break;
+		}
+
+		results.bytesSent += fileSize;
+	}
+
+	results.cpuSeconds = getThreadCPUSeconds() - startCPUSeconds;
+	results.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	close(fileFD);
+	connectionSocket.close();
+	receiveThread.join();
+
+	if (bytesReceived != results.bytesSent)
+	{
+		results.successful = false;
+	}
+
+	return results;
+}
+
+static bool sendWithReadSend(const Socket& socket, int fileFD, size_t fileSize)
+{
+	static std::vector<unsigned char> aBuffer(kReadSendChunkSize);
+
+	size_t offset = 0;
+	while (offset < fileSize)
+	{
+		size_t thisChunkSize = (fileSize - offset > kReadSendChunkSize) ? kReadSendChunkSize : fileSize - offset;
+		if (pread(fileFD, aBuffer.data(), thisChunkSize, offset) != (ssize_t)thisChunkSize)
+			return false;
+
+		if (!socket.send(aBuffer.data(), thisChunkSize))
+			return false;
+
+		offset += thisChunkSize;
+	}
+
+	return true;
+}
+
+static bool sendWithSendFile(const Socket& socket, int fileFD, size_t fileSize)
+{
+	return socket.sendFile(fileFD, 0, fileSize);
+}
+
+int main(int argc, char** argv)
+{
+	size_t fileSizeMB = (argc > 1) ? (size_t)atoi(argv[1]) : 64;
+	unsigned int numRepeats = (argc > 2) ? (unsigned int)atoi(argv[2]) : 16;
+	std::string filePath = (argc > 3) ? argv[3] : "/tmp/webserve_send_file_bench.dat";
+
+	size_t fileSize = fileSizeMB * 1024 * 1024;
+
+	fprintf(stdout, "%zu MB file, sent %u times per method\n", fileSizeMB, numRepeats);
+
+	if (!createTestFile(filePath, fileSize))
+	{
+		fprintf(stderr, "Can't create test file: %s\n", filePath.c_str());
+		return 1;
+	}
+
+	if (!Socket::isSendFileSupported())
+	{
+		fprintf(stdout, "Note: Socket::sendFile() isn't supported on this platform.\n");
+	}
+
+	Logger logger;
+
+	BenchResults readSendResults = runBench(logger, filePath, fileSize, numRepeats, sendWithReadSend);
+	printResults("pread + send:", readSendResults);
+
+	if (Socket::isSendFileSupported())
+	{
+		BenchResults sendFileResults = runBench(logger, filePath, fileSize, numRepeats, sendWithSendFile);
+		printResults("sendfile:", sendFileResults);
+	}
+
+	unlink(filePath.c_str());
+
+	return 0;
+}
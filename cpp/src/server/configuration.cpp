@@ -25,6 +25,18 @@
 
 Configuration::Configuration() :
 	m_workerThreads(16),
+	m_minWorkerThreads(0),
+	m_maxWorkerThreads(0),
+	m_workerThreadGrowQueueWaitMS(100),
+	m_numaAwarePlacement(false),
+	m_workerThreadIdleRetireTime(60),
+	m_connectionEngineType(eConnectionEngineThreadPool),
+	m_ioBackendType(eIOBackendStandard),
+	m_pendingConnectionQueueSize(1024),
+	m_overloadMaxQueueDepth(0),
+	m_overloadMaxQueueWaitMS(0),
+	m_overloadShedAction(eOverloadShed503),
+	m_overloadRetryAfter(5),
 	m_enableHTTPv4(true),
 	m_portNumberHTTPv4(9393),
 	m_enableHTTPSv4(false),
@@ -35,6 +47,8 @@ Configuration::Configuration() :
 	m_enableHTTPSv6(false),
 	m_portNumberHTTPSv6(9394),
 	m_enableHSTS(false),
+	m_enableKernelTLS(false),
+	m_enableHTTP2(false),
 	m_logOutputEnabled(true),
 	m_logOutputTarget("stderr"),
 	m_logOutputLevel("warning"),
@@ -47,9 +61,17 @@ Configuration::Configuration() :
 	m_keepAliveEnabled(true),
 	m_keepAliveTimeout(6),
 	m_keepAliveLimit(20),
+	m_sendTimeout(30),
+	m_maxRequestBodySize(10240),
+	m_maxRequestHeaderSize(32),
 	m_chunkedTransferJPEGsEnabled(false),
 	m_sendDateHeaderField(true),
-	m_tcpFastOpen(false)
+	m_tcpFastOpen(false),
+	m_perWorkerListeners(false),
+	m_perWorkerMaxConnections(256),
+	m_upgradeDrainTimeout(30),
+	m_coroutineHandlers(false),
+	m_coroutineBlockingThreads(4)
 {
 
 }
@@ -174,6 +196,110 @@ bool Configuration::loadFromFile(const std::string& configPath)
 			unsigned int intValue = atoi(value.c_str());
 			m_workerThreads = intValue;
 		}
+		else if (key == "minWorkerThreads")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_minWorkerThreads = intValue;
+		}
+		else if (key == "maxWorkerThreads")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_maxWorkerThreads = intValue;
+		}
+		else if (key == "workerThreadGrowQueueWaitMS")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_workerThreadGrowQueueWaitMS = intValue;
+		}
+		else if (key == "workerThreadIdleRetireTime")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_workerThreadIdleRetireTime = intValue;
+		}
+		else if (key == "workerThreadCPUs")
+		{
+			m_workerThreadCPUs = value;
+		}
+		else if (key == "acceptThreadCPUs")
+		{
+			m_acceptThreadCPUs = value;
+		}
+		else if (key == "statusThreadCPUs")
+		{
+			m_statusThreadCPUs = value;
+		}
+		else if (tryExtractBoolValue("numaAwarePlacement", key, value, m_numaAwarePlacement))
+		{
+
+		}
+		else if (key == "ioBackend")
+		{
+			if (value == "standard")
+			{
+				m_ioBackendType = eIOBackendStandard;
+			}
+			else if (value == "io_uring")
+			{
+				m_ioBackendType = eIOBackendIOUring;
+			}
+			else
+			{
+				fprintf(stderr, "Warning: Unrecognised ioBackend value: '%s' in WebServe config file...\n", value.c_str());
+			}
+		}
+		else if (key == "pendingConnectionQueueSize")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			if (intValue > 0)
+			{
+				m_pendingConnectionQueueSize = intValue;
+			}
+		}
+		else if (key == "overloadMaxQueueDepth")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_overloadMaxQueueDepth = intValue;
+		}
+		else if (key == "overloadMaxQueueWaitMS")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_overloadMaxQueueWaitMS = intValue;
+		}
+		else if (key == "overloadShedAction")
+		{
+			if (value == "503")
+			{
+				m_overloadShedAction = eOverloadShed503;
+			}
+			else if (value == "close")
+			{
+				m_overloadShedAction = eOverloadShedClose;
+			}
+			else
+			{
+				fprintf(stderr, "Warning: Unrecognised overloadShedAction value: '%s' in WebServe config file...\n", value.c_str());
+			}
+		}
+		else if (key == "overloadRetryAfter")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_overloadRetryAfter = intValue;
+		}
+		else if (key == "connectionEngine")
+		{
+			if (value == "threadPool")
+			{
+				m_connectionEngineType = eConnectionEngineThreadPool;
+			}
+			else if (value == "epoll")
+			{
+				m_connectionEngineType = eConnectionEngineEPoll;
+			}
+			else
+			{
+				fprintf(stderr, "Warning: Unrecognised connectionEngine value: '%s' in WebServe config file...\n", value.c_str());
+			}
+		}
 		else if (tryExtractBoolValue("enableHTTP", key, value, m_enableHTTPv4) || tryExtractBoolValue("enableHTTPv4", key, value, m_enableHTTPv4))
 		{
 			
@@ -239,6 +365,14 @@ bool Configuration::loadFromFile(const std::string& configPath)
 		else if (tryExtractBoolValue("enableHSTS", key, value, m_enableHSTS))
 		{
 			
+		}
+		else if (tryExtractBoolValue("enableKernelTLS", key, value, m_enableKernelTLS))
+		{
+
+		}
+		else if (tryExtractBoolValue("enableHTTP2", key, value, m_enableHTTP2))
+		{
+
 		}
 		else if (tryExtractBoolValue("logOutputEnabled", key, value, m_logOutputEnabled))
 		{
@@ -320,6 +454,22 @@ bool Configuration::loadFromFile(const std::string& configPath)
 			unsigned int intValue = atoi(value.c_str());
 			m_keepAliveLimit = intValue;
 		}
+		else if (key == "sendTimeout")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_sendTimeout = intValue;
+		}
+		else if (key == "maxRequestBodySize")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_maxRequestBodySize = intValue;
+		}
+		else if (key == "maxRequestHeaderSize")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			// we need to be able to receive something...
+			m_maxRequestHeaderSize = (intValue > 0) ? intValue : 1;
+		}
 		else if (tryExtractBoolValue("sendDateHeaderField", key, value, m_sendDateHeaderField))
 		{
 
@@ -331,6 +481,37 @@ bool Configuration::loadFromFile(const std::string& configPath)
 		else if (tryExtractBoolValue("tcpFastOpen", key, value, m_tcpFastOpen))
 		{
 
+		}
+		else if (tryExtractListenerTuningValue(key, value))
+		{
+
+		}
+		else if (tryExtractBoolValue("perWorkerListeners", key, value, m_perWorkerListeners))
+		{
+
+		}
+		else if (key == "perWorkerMaxConnections")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_perWorkerMaxConnections = intValue;
+		}
+		else if (key == "upgradeSocketPath")
+		{
+			m_upgradeSocketPath = value;
+		}
+		else if (key == "upgradeDrainTimeout")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_upgradeDrainTimeout = intValue;
+		}
+		else if (tryExtractBoolValue("coroutineHandlers", key, value, m_coroutineHandlers))
+		{
+
+		}
+		else if (key == "coroutineBlockingThreads")
+		{
+			unsigned int intValue = atoi(value.c_str());
+			m_coroutineBlockingThreads = intValue;
 		}
 		else
 		{
@@ -364,6 +545,68 @@ bool Configuration::tryExtractBoolValue(const std::string& tryKeyName, const std
 	return true;
 }
 
+bool Configuration::tryExtractListenerTuningValue(const std::string& key, const std::string& value)
+{
+	std::string optionName = key;
+	ListenerTuning* pTuningHTTP = &m_listenerTuningHTTP;
+	ListenerTuning* pTuningHTTPS = &m_listenerTuningHTTPS;
+
+	if (StringHelpers::endsWithStaticConst(key, "HTTPS"))
+	{
+		optionName = key.substr(0, key.size() - 5);
+		pTuningHTTP = nullptr;
+	}
+	else if (StringHelpers::endsWithStaticConst(key, "HTTP"))
+	{
+		optionName = key.substr(0, key.size() - 4);
+		pTuningHTTPS = nullptr;
+	}
+
+	ListenerTuning* aTunings[2] = { pTuningHTTP, pTuningHTTPS };
+
+	unsigned int intValue = atoi(value.c_str());
+
+	for (ListenerTuning* pTuning : aTunings)
+	{
+		if (!pTuning)
+			continue;
+
+		if (optionName == "listenBacklog")
+		{
+			if (intValue > 0)
+			{
+				pTuning->backlog = intValue;
+			}
+		}
+		else if (optionName == "tcpDeferAccept")
+		{
+			pTuning->deferAcceptTimeout = intValue;
+		}
+		else if (optionName == "tcpNoDelay")
+		{
+			tryExtractBoolValue(optionName, optionName, value, pTuning->noDelay);
+		}
+		else if (optionName == "tcpNotSentLowat")
+		{
+			pTuning->notSentLowat = intValue;
+		}
+		else if (optionName == "socketSendBufferSize")
+		{
+			pTuning->sendBufferSize = intValue;
+		}
+		else if (optionName == "socketRecvBufferSize")
+		{
+			pTuning->recvBufferSize = intValue;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 bool Configuration::getKeyValue(const std::string& configLine, std::string& key, std::string& value)
 {
 	size_t sepPos = configLine.find(':');
@@ -27,6 +27,24 @@ class Configuration
 {
 public:
 	Configuration();
+
+	// TCP / socket tuning for listening sockets (most of which the connections accepted from them inherit).
+	// These can be set separately for the HTTP and HTTPS listeners. 0 means leave the OS default as it is.
+	struct ListenerTuning
+	{
+		unsigned int	backlog = 50;
+		// max time (in seconds) the kernel holds new connections back from accept() until they've sent some data
+		// (TCP_DEFER_ACCEPT), so we're not woken up for idle connects. 0 means disabled.
+		unsigned int	deferAcceptTimeout = 0;
+		// Note: partial responses are already corked per-send with MSG_MORE, so disabling Nagle is generally safe.
+		bool			noDelay = false;
+		// max unsent bytes (in KB) the kernel buffers per connection before it reports the socket as writable
+		// (TCP_NOTSENT_LOWAT)
+		unsigned int	notSentLowat = 0;
+		// SO_SNDBUF / SO_RCVBUF sizes in KB
+		unsigned int	sendBufferSize = 0;
+		unsigned int	recvBufferSize = 0;
+	};
 	
 	class SiteConfig
 	{
@@ -93,6 +111,24 @@ public:
 		std::map<std::string, std::string>	m_aParams;
 	};
 
+	enum ConnectionEngineType
+	{
+		eConnectionEngineThreadPool,	// accept thread(s) pass connections to a pool of worker threads which own them for their lifetime
+		eConnectionEngineEPoll			// idle connections wait in an epoll-based poller, and workers only handle complete requests
+	};
+
+	enum IOBackendType
+	{
+		eIOBackendStandard,		// normal blocking socket syscalls
+		eIOBackendIOUring		// io_uring for non-secure connections where supported, falling back to standard otherwise
+	};
+
+	enum OverloadShedAction
+	{
+		eOverloadShed503,		// send a minimal 503 response with Retry-After (HTTP only - HTTPS connections are just closed)
+		eOverloadShedClose		// just close the connection
+	};
+
 	bool autoLoadFile();
 
 	bool loadFromFile(const std::string& configPath);
@@ -103,6 +139,83 @@ public:
 	{
 		return m_workerThreads;
 	}
+
+	// if not set explicitly, these are the same as getNumWorkerThreads(), meaning the worker pool is fixed-size
+	unsigned int getMinWorkerThreads() const
+	{
+		return (m_minWorkerThreads > 0) ? m_minWorkerThreads : m_workerThreads;
+	}
+
+	unsigned int getMaxWorkerThreads() const
+	{
+		unsigned int maxWorkers = (m_maxWorkerThreads > 0) ? m_maxWorkerThreads : m_workerThreads;
+		return (maxWorkers < getMinWorkerThreads()) ? getMinWorkerThreads() : maxWorkers;
+	}
+
+	const std::string& getWorkerThreadCPUs() const
+	{
+		return m_workerThreadCPUs;
+	}
+
+	const std::string& getAcceptThreadCPUs() const
+	{
+		return m_acceptThreadCPUs;
+	}
+
+	const std::string& getStatusThreadCPUs() const
+	{
+		return m_statusThreadCPUs;
+	}
+
+	bool getNUMAAwarePlacement() const
+	{
+		return m_numaAwarePlacement;
+	}
+
+	unsigned int getWorkerThreadGrowQueueWaitMS() const
+	{
+		return m_workerThreadGrowQueueWaitMS;
+	}
+
+	unsigned int getWorkerThreadIdleRetireTime() const
+	{
+		return m_workerThreadIdleRetireTime;
+	}
+
+	ConnectionEngineType getConnectionEngineType() const
+	{
+		return m_connectionEngineType;
+	}
+
+	IOBackendType getIOBackendType() const
+	{
+		return m_ioBackendType;
+	}
+
+	unsigned int getPendingConnectionQueueSize() const
+	{
+		return m_pendingConnectionQueueSize;
+	}
+
+	unsigned int getOverloadMaxQueueDepth() const
+	{
+		return m_overloadMaxQueueDepth;
+	}
+
+	unsigned int getOverloadMaxQueueWaitMS() const
+	{
+		return m_overloadMaxQueueWaitMS;
+	}
+
+	OverloadShedAction getOverloadShedAction() const
+	{
+		return m_overloadShedAction;
+	}
+
+	unsigned int getOverloadRetryAfter() const
+	{
+		return m_overloadRetryAfter;
+	}
 	
 	bool isHTTPv4Enabled() const
 	{
@@ -164,6 +277,16 @@ public:
 		return m_enableHSTS;
 	}
 
+	bool isKernelTLSEnabled() const
+	{
+		return m_enableKernelTLS;
+	}
+
+	bool isHTTP2Enabled() const
+	{
+		return m_enableHTTP2;
+	}
+
 	bool getLogOutputEnabled() const
 	{
 		return m_logOutputEnabled;
@@ -234,6 +357,23 @@ public:
 		return m_keepAliveLimit;
 	}
 
+	unsigned int getSendTimeout() const
+	{
+		return m_sendTimeout;
+	}
+
+	// in bytes, 0 means no limit
+	size_t getMaxRequestBodySize() const
+	{
+		return (size_t)m_maxRequestBodySize * 1024;
+	}
+
+	// in bytes
+	size_t getMaxRequestHeaderSize() const
+	{
+		return (size_t)m_maxRequestHeaderSize * 1024;
+	}
+
 	bool getSendDateHeaderField() const
 	{
 		return m_sendDateHeaderField;
@@ -248,6 +388,41 @@ public:
 	{
 		return m_tcpFastOpen;
 	}
+
+	const ListenerTuning& getListenerTuning(bool secure) const
+	{
+		return secure ? m_listenerTuningHTTPS : m_listenerTuningHTTP;
+	}
+
+	bool getPerWorkerListeners() const
+	{
+		return m_perWorkerListeners;
+	}
+
+	unsigned int getPerWorkerMaxConnections() const
+	{
+		return m_perWorkerMaxConnections;
+	}
+
+	const std::string& getUpgradeSocketPath() const
+	{
+		return m_upgradeSocketPath;
+	}
+
+	unsigned int getUpgradeDrainTimeout() const
+	{
+		return m_upgradeDrainTimeout;
+	}
+
+	bool getCoroutineHandlers() const
+	{
+		return m_coroutineHandlers;
+	}
+
+	unsigned int getCoroutineBlockingThreads() const
+	{
+		return m_coroutineBlockingThreads;
+	}
 	
 	const std::vector<SiteConfig>& getSiteConfigs() const
 	{
@@ -261,12 +436,50 @@ protected:
 
 	static bool getKeyValue(const std::string& configLine, std::string& key, std::string& value);
 
+	// returns whether the key was a listener tuning option, which can have an 'HTTP' or 'HTTPS' suffix to only
+	// apply it to those listeners, otherwise it applies to both.
+	bool tryExtractListenerTuningValue(const std::string& key, const std::string& value);
+
 	// note: this returns whether it extracted a value or not, not the actual value!!!
 	static bool getBoolValueFromString(const std::string& stringValue, bool& boolValue);
 
 protected:
 	// webserve stuff
 	unsigned int			m_workerThreads;
+
+	// elastic worker pool bounds (0 means use m_workerThreads)
+	unsigned int			m_minWorkerThreads;
+	unsigned int			m_maxWorkerThreads;
+	// how long connections can wait in the pending queue with all workers busy before we add another worker
+	unsigned int			m_workerThreadGrowQueueWaitMS;
+	// CPU lists (i.e. "0-7,16-23") to pin threads to - empty means don't pin
+	std::string				m_workerThreadCPUs;
+	std::string				m_acceptThreadCPUs;
+	std::string				m_statusThreadCPUs;
+	// whether worker threads should be grouped by NUMA node, with connections preferentially
+	// handled by a worker on the same node as the CPU which received them
+	bool					m_numaAwarePlacement;
+
+	// how long (in seconds) a worker thread above the minimum count can be idle for before it exits
+	unsigned int			m_workerThreadIdleRetireTime;
+
+	ConnectionEngineType	m_connectionEngineType;
+
+	IOBackendType			m_ioBackendType;
+
+	// max number of accepted connections which can be waiting for a worker thread
+	unsigned int			m_pendingConnectionQueueSize;
+
+	// overload admission control: 0 for the thresholds means disabled.
+	// With the threadPool engine, these apply to the pending connection queue. With the epoll engine, the queue depth
+	// is the number of connections (and resumed coroutine handlers) which have received something and are waiting in
+	// the ready queue for a worker thread (new connections are shed if there are too many), and the queue wait is
+	// how long a connection waited in it. With perWorkerListeners, there's no queue, so they don't apply (see
+	// m_perWorkerMaxConnections instead).
+	unsigned int			m_overloadMaxQueueDepth;
+	unsigned int			m_overloadMaxQueueWaitMS;
+	OverloadShedAction		m_overloadShedAction;
+	unsigned int			m_overloadRetryAfter;
 	
 	// TODO: something less duplicate than this, and arguably more flexible as well,
 	//       but this is at least something to work off functionally...
@@ -286,6 +499,11 @@ protected:
 	
 	bool					m_redirectToHTTPS;
 	bool					m_enableHSTS; // send HSTS headers to ensure HTTPS only is used
+	// hand the TLS record encryption of sends over to the kernel after the handshake (if it and s2n support it),
+	// so that files can be sent over HTTPS with sendfile().
+	bool					m_enableKernelTLS;
+	// offer HTTP/2 (via ALPN) for HTTPS connections. Only supported by the thread pool connection engine.
+	bool					m_enableHTTP2;
 
 	bool					m_logOutputEnabled;
 	std::string				m_logOutputTarget;
@@ -309,6 +527,15 @@ protected:
 	unsigned int			m_keepAliveTimeout;
 	unsigned int			m_keepAliveLimit;
 
+	// max time (in seconds) a single send to a client can take (i.e. a slow client not reading a large response
+	// fast enough) before the connection is given up on. 0 means no limit.
+	unsigned int			m_sendTimeout;
+
+	// max size (in KB) of request bodies we'll accept, 0 means there's no limit.
+	unsigned int			m_maxRequestBodySize;
+	// max size (in KB) of request headers (including the request line) we'll accept, larger ones get a 431 response.
+	unsigned int			m_maxRequestHeaderSize;
+
 	bool					m_chunkedTransferJPEGsEnabled;
 
 	// these things are slightly silly in that they're heavily recommended by the RFC, but it's useful for benchmarking
@@ -316,6 +543,30 @@ protected:
 
 	// TCP stuff
 	bool					m_tcpFastOpen;
+
+	ListenerTuning			m_listenerTuningHTTP;
+	ListenerTuning			m_listenerTuningHTTPS;
+
+	// if enabled, each worker thread has its own SO_REUSEPORT listening socket for each listener, and accepts
+	// connections on them itself, polling them along with the connections it's accepted, rather than there being
+	// a single accept thread per listener. Only supported with the threadPool connection engine, and not with
+	// the elastic worker pool (or upgrade handoff), as the listening sockets need their worker for the service's lifetime.
+	bool					m_perWorkerListeners;
+	// max number of connections each worker can have open with perWorkerListeners: once it has this many, new ones are
+	// left in its listening sockets' backlogs until some have been closed. 0 means no limit.
+	unsigned int			m_perWorkerMaxConnections;
+
+	// path of the UNIX domain socket used to hand the listening sockets over to a new (upgraded) process.
+	// Empty means upgrade handoff is disabled.
+	std::string				m_upgradeSocketPath;
+	// max time (in seconds) the old process waits for in-flight connections to finish once the new one has taken over
+	unsigned int			m_upgradeDrainTimeout;
+
+	// whether to use the coroutine variants of request handlers (only supported with the epoll connection engine,
+	// and if coroutine support is compiled in), so that handlers waiting on IO don't tie up worker threads.
+	bool					m_coroutineHandlers;
+	// number of threads the coroutine reactor uses for blocking IO (i.e. file reads)
+	unsigned int			m_coroutineBlockingThreads;
 	
 	std::vector<SiteConfig> m_aSiteConfigs;
 };
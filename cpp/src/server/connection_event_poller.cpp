@@ -0,0 +1,423 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#include "connection_event_poller.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <vector>
+
+#include "web_server_common.h"
+
+#include "utils/logger.h"
+
+static const unsigned int kMaxEventsPerWait = 64;
+// how often we wake up to check for timed-out connections if nothing else is happening
+static const int kTimeoutCheckIntervalMS = 500;
+
+ConnectionEventPoller::ConnectionEventPoller(Logger& logger) :
+	m_logger(logger),
+	m_epollFD(-1),
+	m_wakeupEventFD(-1),
+	m_active(false)
+{
+
+}
+
+ConnectionEventPoller::~ConnectionEventPoller()
+{
+	if (m_active)
+	{
+		stop();
+	}
+
+	if (m_wakeupEventFD != -1)
+	{
+		::close(m_wakeupEventFD);
+		m_wakeupEventFD = -1;
+	}
+
+	if (m_epollFD != -1)
+	{
+		::close(m_epollFD);
+		m_epollFD = -1;
+	}
+}
+
+bool ConnectionEventPoller::initialise()
+{
+#ifdef __linux__
+	m_epollFD = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epollFD == -1)
+	{
+		m_logger.error("Could not create epoll instance for connection event poller: %s", strerror(errno));
+		return false;
+	}
+
+	// used purely to wake up the poll thread when stopping
+	m_wakeupEventFD = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_wakeupEventFD == -1)
+	{
+		m_logger.error("Could not create eventfd for connection event poller: %s", strerror(errno));
+		return false;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = m_wakeupEventFD;
+	if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_wakeupEventFD, &event) == -1)
+	{
+		m_logger.error("Could not add eventfd to connection event poller: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+#else
+	m_logger.error("The epoll connection engine is only supported on Linux.");
+	return false;
+#endif
+}
+
+void ConnectionEventPoller::start()
+{
+	m_active = true;
+
+	m_pollThread = std::thread(&ConnectionEventPoller::pollThreadFunction, this);
+}
+
+void ConnectionEventPoller::stop()
+{
+	m_active = false;
+
+#ifdef __linux__
+	if (m_wakeupEventFD != -1)
+	{
+		uint64_t value = 1;
+		ssize_t ret = ::write(m_wakeupEventFD, &value, sizeof(value));
+		(void)ret;
+	}
+#endif
+
+	{
+		std::unique_lock<std::mutex> lock(m_readyLock);
+		m_readyEvent.notify_all();
+	}
+
+	if (m_pollThread.joinable())
+	{
+		m_pollThread.join();
+	}
+
+	freeRemainingConnections();
+}
+
+bool ConnectionEventPoller::addConnection(RequestConnection* pConnection, unsigned int timeoutSecs)
+{
+#ifdef __linux__
+	int socketFD = pConnection->pRawSocket->getSocketFD();
+
+	WatchedConnection watchedConnection;
+	watchedConnection.pConnection = pConnection;
+	watchedConnection.timeoutTime = std::chrono::steady_clock::now() + std::chrono::seconds(timeoutSecs);
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	// one-shot, so that only one worker can ever end up with the connection at once, and we don't
+	// get repeated events while it's in the ready queue.
+	event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+	event.data.fd = socketFD;
+
+	std::unique_lock<std::mutex> lock(m_watchedLock);
+
+	m_aWatchedConnections[socketFD] = watchedConnection;
+
+	if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, socketFD, &event) == -1)
+	{
+		m_aWatchedConnections.erase(socketFD);
+		m_logger.error("Could not add connection to event poller: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void ConnectionEventPoller::addReadyConnection(RequestConnection* pConnection)
+{
+	pConnection->enqueueTime = std::chrono::steady_clock::now();
+
+	std::unique_lock<std::mutex> lock(m_readyLock);
+
+	ReadyItem newItem;
+	newItem.pConnection = pConnection;
+	m_aReadyItems.emplace_back(newItem);
+	m_readyEvent.notify_one();
+}
+
+void ConnectionEventPoller::addReadyTask(void (*pTaskFunction)(void* pTaskData), void* pTaskData)
+{
+	std::unique_lock<std::mutex> lock(m_readyLock);
+
+	ReadyItem newItem;
+	newItem.pTaskFunction = pTaskFunction;
+	newItem.pTaskData = pTaskData;
+	m_aReadyItems.emplace_back(newItem);
+	m_readyEvent.notify_one();
+}
+
+bool ConnectionEventPoller::getNextReadyItem(ReadyItem& item)
+{
+	std::unique_lock<std::mutex> lock(m_readyLock);
+
+	m_readyEvent.wait(lock, [this]{ return !m_active || !m_aReadyItems.empty(); });
+
+	if (!m_active)
+		return false;
+
+	item = m_aReadyItems.front();
+	m_aReadyItems.pop_front();
+
+	return true;
+}
+
+size_t ConnectionEventPoller::getNumWatchedConnections() const
+{
+	std::unique_lock<std::mutex> lock(m_watchedLock);
+
+	return m_aWatchedConnections.size();
+}
+
+size_t ConnectionEventPoller::getNumReadyConnections() const
+{
+	std::unique_lock<std::mutex> lock(m_readyLock);
+
+	return m_aReadyItems.size();
+}
+
+void ConnectionEventPoller::pollThreadFunction()
+{
+#ifdef __linux__
+	struct epoll_event events[kMaxEventsPerWait];
+
+	std::chrono::steady_clock::time_point nextTimeoutCheck = std::chrono::steady_clock::now();
+
+	std::vector<RequestConnection*> aNewlyReadyConnections;
+	aNewlyReadyConnections.reserve(kMaxEventsPerWait);
+
+	while (m_active)
+	{
+		int numEvents = epoll_wait(m_epollFD, events, kMaxEventsPerWait, kTimeoutCheckIntervalMS);
+		if (numEvents == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			m_logger.error("epoll_wait() failed in connection event poller: %s", strerror(errno));
+			break;
+		}
+
+		if (!m_active)
+			break;
+
+		aNewlyReadyConnections.clear();
+
+		{
+			std::unique_lock<std::mutex> lock(m_watchedLock);
+
+			for (int i = 0; i < numEvents; i++)
+			{
+				int eventFD = events[i].data.fd;
+				if (eventFD == m_wakeupEventFD)
+					continue;
+
+				std::map<int, WatchedConnection>::iterator itFind = m_aWatchedConnections.find(eventFD);
+				if (itFind == m_aWatchedConnections.end())
+				{
+					// shouldn't happen, but...
+					continue;
+				}
+
+				// stop watching it, as a worker will own it now...
+				epoll_ctl(m_epollFD, EPOLL_CTL_DEL, eventFD, nullptr);
+
+				aNewlyReadyConnections.emplace_back(itFind->second.pConnection);
+				m_aWatchedConnections.erase(itFind);
+			}
+		}
+
+		if (!aNewlyReadyConnections.empty())
+		{
+			std::chrono::steady_clock::time_point readyTime = std::chrono::steady_clock::now();
+
+			std::unique_lock<std::mutex> lock(m_readyLock);
+
+			for (RequestConnection* pConnection : aNewlyReadyConnections)
+			{
+				pConnection->enqueueTime = readyTime;
+
+				ReadyItem newItem;
+				newItem.pConnection = pConnection;
+				m_aReadyItems.emplace_back(newItem);
+			}
+
+			if (aNewlyReadyConnections.size() == 1)
+			{
+				m_readyEvent.notify_one();
+			}
+			else
+			{
+				m_readyEvent.notify_all();
+			}
+		}
+
+		std::chrono::steady_clock::time_point timeNow = std::chrono::steady_clock::now();
+		if (timeNow >= nextTimeoutCheck)
+		{
+			checkForTimedOutConnections();
+
+			nextTimeoutCheck = timeNow + std::chrono::milliseconds(kTimeoutCheckIntervalMS);
+		}
+	}
+#endif
+}
+
+void ConnectionEventPoller::checkForTimedOutConnections()
+{
+#ifdef __linux__
+	std::vector<RequestConnection*> aTimedOutConnections;
+
+	std::chrono::steady_clock::time_point timeNow = std::chrono::steady_clock::now();
+
+	{
+		std::unique_lock<std::mutex> lock(m_watchedLock);
+
+		// TODO: this is linear in the number of watched connections, which is fine for the moment given
+		//       it's only done a couple of times a second, but a timer wheel or heap would scale better...
+		std::map<int, WatchedConnection>::iterator it = m_aWatchedConnections.begin();
+		while (it != m_aWatchedConnections.end())
+		{
+			if (it->second.timeoutTime <= timeNow)
+			{
+				epoll_ctl(m_epollFD, EPOLL_CTL_DEL, it->first, nullptr);
+
+				RequestConnection* pConnection = it->second.pConnection;
+				pConnection->idleTimedOut = true;
+				aTimedOutConnections.emplace_back(pConnection);
+
+				it = m_aWatchedConnections.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	if (aTimedOutConnections.empty())
+		return;
+
+	// hand these to the workers as well, so they can send any timeout response and close them, as that
+	// might block, so we don't want to do it in this thread...
+	std::unique_lock<std::mutex> lock(m_readyLock);
+
+	for (RequestConnection* pConnection : aTimedOutConnections)
+	{
+		pConnection->enqueueTime = timeNow;
+
+		ReadyItem newItem;
+		newItem.pConnection = pConnection;
+		m_aReadyItems.emplace_back(newItem);
+	}
+
+	m_readyEvent.notify_all();
+#endif
+}
+
+void ConnectionEventPoller::freeRemainingConnections()
+{
+	// run any remaining tasks first, as they could well give connections back to us (which will fail, as we're
+	// no longer active, so they'll be closed). Tasks can queue further tasks, so keep going until there are none.
+	while (true)
+	{
+		std::deque<ReadyItem> aRemainingTasks;
+		
+		{
+			std::unique_lock<std::mutex> lock(m_readyLock);
+			
+			std::deque<ReadyItem>::iterator it = m_aReadyItems.begin();
+			while (it != m_aReadyItems.end())
+			{
+				if (it->pTaskFunction)
+				{
+					aRemainingTasks.emplace_back(*it);
+					it = m_aReadyItems.erase(it);
+				}
+				else
+				{
+					++it;
+				}
+			}
+		}
+		
+		if (aRemainingTasks.empty())
+			break;
+		
+		for (ReadyItem& task : aRemainingTasks)
+		{
+			task.pTaskFunction(task.pTaskData);
+		}
+	}
+	
+	{
+		std::unique_lock<std::mutex> lock(m_watchedLock);
+
+		for (auto& itConnection : m_aWatchedConnections)
+		{
+			RequestConnection* pConnection = itConnection.second.pConnection;
+			pConnection->closeConnectionAndFreeSockets();
+			delete pConnection;
+		}
+
+		m_aWatchedConnections.clear();
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_readyLock);
+
+		for (ReadyItem& item : m_aReadyItems)
+		{
+			if (!item.pConnection)
+				continue;
+			
+			item.pConnection->closeConnectionAndFreeSockets();
+			delete item.pConnection;
+		}
+
+		m_aReadyItems.clear();
+	}
+}
@@ -0,0 +1,114 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef CONNECTION_EVENT_POLLER_H
+#define CONNECTION_EVENT_POLLER_H
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <map>
+#include <deque>
+
+class Logger;
+struct RequestConnection;
+
+// Holds connections which are idle (waiting for their first or next keep-alive request) or which have
+// only partially received a request, so that they don't tie up a worker thread while waiting.
+// Connections are watched with epoll (one-shot), and once there's something to receive on them, they're
+// moved to a ready queue which worker threads consume from.
+// Other work can also be queued for the worker threads (i.e. resuming suspended coroutine request handlers),
+// so that it doesn't end up being done on whichever thread noticed it could continue.
+// Currently this is Linux-only: initialise() will fail on other platforms.
+class ConnectionEventPoller
+{
+public:
+	ConnectionEventPoller(Logger& logger);
+	~ConnectionEventPoller();
+
+	bool initialise();
+
+	void start();
+	void stop();
+
+	// an item of work from the ready queue for a worker thread: either a connection, or a task function to call
+	struct ReadyItem
+	{
+		RequestConnection*		pConnection		= nullptr;
+		
+		void					(*pTaskFunction)(void* pTaskData) = nullptr;
+		void*					pTaskData		= nullptr;
+	};
+	
+	// hands ownership of the connection over to the poller until it's returned from getNextReadyItem(),
+	// either because there's data to receive, or because it's timed out (in which case idleTimedOut will be set).
+	// The connection's enqueueTime is set to when it was added to the ready queue, so the time it then waited
+	// for a worker thread can be worked out.
+	bool addConnection(RequestConnection* pConnection, unsigned int timeoutSecs);
+
+	// adds the connection straight to the ready queue without polling it, for cases where we know there's
+	// already something to process (i.e. data buffered within the TLS layer)
+	void addReadyConnection(RequestConnection* pConnection);
+	
+	// queues the task function to be called by a worker thread. If the poller's stopped before a worker
+	// gets to it, it's called from stop().
+	void addReadyTask(void (*pTaskFunction)(void* pTaskData), void* pTaskData);
+
+	// blocks until there's a connection or task ready, or returns false if the poller has been stopped.
+	bool getNextReadyItem(ReadyItem& item);
+
+	size_t getNumWatchedConnections() const;
+	// the number of connections (and tasks) which are ready, but haven't been taken by a worker thread yet
+	size_t getNumReadyConnections() const;
+
+protected:
+	void pollThreadFunction();
+
+	void checkForTimedOutConnections();
+
+	// runs any tasks still queued, and closes and frees any connections we still own, used when stopping
+	void freeRemainingConnections();
+
+protected:
+	struct WatchedConnection
+	{
+		RequestConnection*						pConnection;
+		std::chrono::steady_clock::time_point	timeoutTime;
+	};
+
+	Logger&								m_logger;
+
+	int									m_epollFD;
+	int									m_wakeupEventFD;
+
+	std::thread							m_pollThread;
+	std::atomic<bool>					m_active;
+
+	// keyed by socket fd
+	mutable std::mutex					m_watchedLock;
+	std::map<int, WatchedConnection>	m_aWatchedConnections;
+
+	mutable std::mutex					m_readyLock;
+	std::condition_variable				m_readyEvent;
+	std::deque<ReadyItem>				m_aReadyItems;
+};
+
+#endif // CONNECTION_EVENT_POLLER_H
@@ -26,11 +26,14 @@
 #include "utils/socket.h"
 
 struct ConnectionStatistics;
+class RecvBuffer;
 
 class ConnectionSocket
 {
 public:
-	ConnectionSocket(Logger& logger) : m_logger(logger)
+	ConnectionSocket(Logger& logger) : m_logger(logger),
+		m_inResponse(false),
+		m_responseDeadlineStarted(false)
 	{
 	}
 	
@@ -40,15 +43,56 @@ public:
 	
 	enum SPECIAL_FLAGS
 	{
-		SEND_IGNORE_FAILURES = 1 << 0
+		SEND_IGNORE_FAILURES = 1 << 0,
+		SEND_MORE_TO_FOLLOW = 1 << 1		// more data is about to be sent, so it's worth holding back a partial packet
 	};
 	
 	virtual bool send(const std::string& data, unsigned int flags = 0) const = 0;
 	virtual bool send(unsigned char* pData, size_t dataLength) const = 0;
 
-	virtual SocketRecvReturnCode recv(std::string& data) const = 0;
-	virtual SocketRecvReturnCode recvSmart(std::string& data, unsigned int timeoutSecs) const = 0;
-	virtual SocketRecvReturnCode recvWithTimeout(std::string& data, unsigned int timeoutSecs) const = 0;
+	// sends all the buffers in order, without them needing to be copied together first, with as few syscalls
+	// (or TLS records) as possible.
+	virtual bool sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags = 0) const = 0;
+
+	// convenience function for sending a separately-generated response header and body together
+	bool send(const std::string& header, const std::string& body, unsigned int flags = 0) const
+	{
+		struct iovec aIOVecs[2];
+		aIOVecs[0].iov_base = (void*)header.data();
+		aIOVecs[0].iov_len = header.size();
+		aIOVecs[1].iov_base = (void*)body.data();
+		aIOVecs[1].iov_len = body.size();
+
+		return sendv(aIOVecs, body.empty() ? 1 : 2, flags);
+	}
+
+	// waits up to timeoutSecs for data to be available, and then receives whatever's available directly into
+	// the buffer. Returns eSockRecv_TimedOutNoData if nothing arrived in time, and eSockRecv_PeerClosed if the
+	// other side closed the connection.
+	virtual SocketRecvReturnCode recv(RecvBuffer& buffer, unsigned int timeoutSecs) const = 0;
+
+	// receives whatever data is currently available without blocking, returning eSockRecv_NoData if there
+	// wasn't anything, and eSockRecv_PeerClosed if the other side closed the connection.
+	virtual SocketRecvReturnCode recvNonBlocking(RecvBuffer& buffer) const = 0;
+
+	// whether there's data which has already been received from the raw socket and is buffered internally
+	// (i.e. by a TLS layer), and so won't be signalled by polling the raw socket.
+	virtual bool hasBufferedRecvData() const
+	{
+		return false;
+	}
+	
+	// whether sendFileData() can be used to send file content directly, rather than the caller
+	// reading the file and calling send() itself.
+	virtual bool supportsSendFileData() const
+	{
+		return false;
+	}
+
+	virtual bool sendFileData(int fileFD, size_t offset, size_t length) const
+	{
+		return false;
+	}
 	
 	virtual void accumulateSocketConnectionStatistics(ConnectionStatistics& connStatistics) const
 	{
@@ -56,10 +100,45 @@ public:
 	}
 	
 	virtual bool close(bool deleteRawSocket) = 0;
+
+	// makes all the sends until endResponse() share a single deadline (the raw socket's send timeout, from the first
+	// of them), so a client which reads a response slowly can't take longer than that over the whole of it, by reading
+	// just enough to stop each separate send of it timing out.
+	void beginResponse()
+	{
+		m_inResponse = true;
+		m_responseDeadlineStarted = false;
+	}
+
+	void endResponse()
+	{
+		m_inResponse = false;
+	}
 	
+protected:
+	// the deadline for the current response (started by its first send), or nullptr if not within a response,
+	// in which case each send should get its own deadline.
+	const SendDeadline* getResponseSendDeadline(unsigned int sendTimeoutSecs) const
+	{
+		if (!m_inResponse)
+			return nullptr;
+
+		if (!m_responseDeadlineStarted)
+		{
+			m_responseSendDeadline = SendDeadline(sendTimeoutSecs);
+			m_responseDeadlineStarted = true;
+		}
+
+		return &m_responseSendDeadline;
+	}
+
 protected:
 	// not too happy with this, but don't really like pulling it through all the above either, so...
 	Logger&		m_logger;
+
+	bool					m_inResponse;
+	mutable bool			m_responseDeadlineStarted;
+	mutable SendDeadline	m_responseSendDeadline;
 };
 
 #endif // CONNECTION_SOCKET_H
@@ -0,0 +1,498 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#include "coroutine_reactor.h"
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "utils/logger.h"
+#include "utils/recv_buffer.h"
+
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0
+#endif
+
+static const unsigned int kMaxEventsPerWait = 64;
+// how often we wake up to check for timed-out waits if nothing else is happening
+static const int kTimeoutCheckIntervalMS = 500;
+
+CoroutineReactor::CoroutineReactor(Logger& logger) :
+	m_logger(logger),
+	m_epollFD(-1),
+	m_wakeupEventFD(-1),
+	m_active(false)
+{
+
+}
+
+CoroutineReactor::~CoroutineReactor()
+{
+	if (m_active)
+	{
+		stop();
+	}
+
+	if (m_wakeupEventFD != -1)
+	{
+		::close(m_wakeupEventFD);
+		m_wakeupEventFD = -1;
+	}
+
+	if (m_epollFD != -1)
+	{
+		::close(m_epollFD);
+		m_epollFD = -1;
+	}
+}
+
+bool CoroutineReactor::initialise()
+{
+#ifdef __linux__
+	m_epollFD = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epollFD == -1)
+	{
+		m_logger.error("Could not create epoll instance for coroutine reactor: %s", strerror(errno));
+		return false;
+	}
+
+	// used purely to wake up the reactor thread when stopping
+	m_wakeupEventFD = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_wakeupEventFD == -1)
+	{
+		m_logger.error("Could not create eventfd for coroutine reactor: %s", strerror(errno));
+		return false;
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = m_wakeupEventFD;
+	if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_wakeupEventFD, &event) == -1)
+	{
+		m_logger.error("Could not add eventfd to coroutine reactor: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+#else
+	m_logger.error("The coroutine reactor is only supported on Linux.");
+	return false;
+#endif
+}
+
+void CoroutineReactor::start(unsigned int numBlockingThreads)
+{
+	m_active = true;
+
+	m_reactorThread = std::thread(&CoroutineReactor::reactorThreadFunction, this);
+
+	if (numBlockingThreads == 0)
+	{
+		numBlockingThreads = 1;
+	}
+
+	for (unsigned int i = 0; i < numBlockingThreads; i++)
+	{
+		m_aBlockingThreads.emplace_back(std::thread(&CoroutineReactor::blockingThreadFunction, this));
+	}
+}
+
+void CoroutineReactor::stop()
+{
+	m_active = false;
+
+#ifdef __linux__
+	if (m_wakeupEventFD != -1)
+	{
+		uint64_t value = 1;
+		ssize_t ret = ::write(m_wakeupEventFD, &value, sizeof(value));
+		(void)ret;
+	}
+#endif
+
+	{
+		std::unique_lock<std::mutex> lock(m_blockingCallsLock);
+		m_blockingCallsEvent.notify_all();
+	}
+
+	if (m_reactorThread.joinable())
+	{
+		m_reactorThread.join();
+	}
+
+	// the blocking threads finish any calls still queued before exiting
+	for (std::thread& blockingThread : m_aBlockingThreads)
+	{
+		blockingThread.join();
+	}
+	m_aBlockingThreads.clear();
+
+	failRemainingWaits();
+}
+
+Task<SocketRecvReturnCode> CoroutineReactor::recv(const Socket& socket, RecvBuffer& buffer, unsigned int timeoutSecs)
+{
+	while (true)
+	{
+		SocketRecvReturnCode recvRetCode = socket.recvNonBlocking(buffer);
+		if (recvRetCode.type != eSockRecv_NoData)
+		{
+			co_return recvRetCode;
+		}
+
+		bool ready = co_await waitForSocket(socket.getSocketFD(), false, timeoutSecs);
+		if (!ready)
+		{
+			co_return SocketRecvReturnCode(eSockRecv_TimedOutNoData);
+		}
+	}
+}
+
+Task<SocketRecvReturnCode> CoroutineReactor::recvHTTPMessage(const Socket& socket, RecvBuffer& buffer, unsigned int timeoutSecs, bool headerOnlyResponse)
+{
+	size_t messageLength = 0;
+
+	while (!buffer.findCompleteResponse(messageLength, headerOnlyResponse))
+	{
+		SocketRecvReturnCode recvRetCode = co_await recv(socket, buffer, timeoutSecs);
+
+		bool haveData = !buffer.isEmpty();
+
+		if (recvRetCode.type == eSockRecv_PeerClosed)
+		{
+			// for HTTP/1.0-style responses without a Content-Length or chunked body, this is how the end is signalled,
+			// otherwise the connection was closed part way through the response.
+			if (!haveData)
+				co_return recvRetCode;
+
+			co_return SocketRecvReturnCode(buffer.isCloseDelimited() ? eSockRecv_OK : eSockRecv_Error);
+		}
+		else if (recvRetCode.type == eSockRecv_TimedOutNoData)
+		{
+			co_return haveData ? SocketRecvReturnCode(eSockRecv_TimedOutWithData) : recvRetCode;
+		}
+		else if (recvRetCode.type != eSockRecv_OK)
+		{
+			co_return recvRetCode;
+		}
+	}
+
+	if (buffer.hasOversizedHeader() || buffer.hasInvalidBodyFraming())
+	{
+		co_return SocketRecvReturnCode(eSockRecv_Error);
+	}
+
+	co_return SocketRecvReturnCode(eSockRecv_OK);
+}
+
+Task<bool> CoroutineReactor::send(const Socket& socket, const std::string& data, unsigned int timeoutSecs)
+{
+	size_t bytesSent = 0;
+
+	while (bytesSent < data.size())
+	{
+		ssize_t ret = ::send(socket.getSocketFD(), data.data() + bytesSent, data.size() - bytesSent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret > 0)
+		{
+			bytesSent += ret;
+			continue;
+		}
+
+		if (ret == -1 && errno == EINTR)
+			continue;
+
+		if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			bool ready = co_await waitForSocket(socket.getSocketFD(), true, timeoutSecs);
+			if (!ready)
+			{
+				co_return false;
+			}
+			continue;
+		}
+
+		co_return false;
+	}
+
+	co_return true;
+}
+
+Task<bool> CoroutineReactor::connect(Socket& socket)
+{
+	bool connected = false;
+
+	co_await runBlocking([&socket, &connected]()
+	{
+		connected = socket.connect();
+	});
+
+	co_return connected;
+}
+
+Task<long> CoroutineReactor::readFile(int fileFD, void* pBuffer, size_t length, size_t offset)
+{
+	long bytesRead = -1;
+
+	co_await runBlocking([fileFD, pBuffer, length, offset, &bytesRead]()
+	{
+		bytesRead = (long)::pread(fileFD, pBuffer, length, (off_t)offset);
+	});
+
+	co_return bytesRead;
+}
+
+size_t CoroutineReactor::getNumWaitingSockets() const
+{
+	std::unique_lock<std::mutex> lock(m_socketWaitsLock);
+	return m_aSocketWaits.size();
+}
+
+bool CoroutineReactor::addSocketWait(int socketFD, bool forWrite, unsigned int timeoutSecs, std::coroutine_handle<> handle, bool* pReady)
+{
+#ifdef __linux__
+	if (!m_active)
+		return false;
+
+	std::unique_lock<std::mutex> lock(m_socketWaitsLock);
+
+	SocketWait newWait;
+	newWait.handle = handle;
+	newWait.pReady = pReady;
+	// a timeout of 0 means wait indefinitely (until the reactor's stopped)
+	newWait.timeoutTime = (timeoutSecs > 0) ? std::chrono::steady_clock::now() + std::chrono::seconds(timeoutSecs) :
+											  std::chrono::steady_clock::time_point::max();
+
+	m_aSocketWaits[socketFD] = newWait;
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = (forWrite ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+	event.data.fd = socketFD;
+
+	// Note: as soon as this is added, the reactor thread can resume the coroutine (once we release the lock),
+	//       so we mustn't touch anything belonging to it after this.
+	if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, socketFD, &event) == -1)
+	{
+		m_logger.error("Could not add socket to coroutine reactor: %s", strerror(errno));
+		m_aSocketWaits.erase(socketFD);
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool CoroutineReactor::addBlockingCall(std::function<void()>* pFunction, std::coroutine_handle<> handle)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_blockingCallsLock);
+
+		if (m_active)
+		{
+			BlockingCall newCall;
+			newCall.pFunction = pFunction;
+			newCall.handle = handle;
+			m_aBlockingCalls.emplace_back(newCall);
+
+			m_blockingCallsEvent.notify_one();
+			return true;
+		}
+	}
+
+	// we've been stopped, so just do it directly
+	(*pFunction)();
+	return false;
+}
+
+void CoroutineReactor::reactorThreadFunction()
+{
+#ifdef __linux__
+	struct epoll_event events[kMaxEventsPerWait];
+
+	std::chrono::steady_clock::time_point nextTimeoutCheck = std::chrono::steady_clock::now();
+
+	std::vector<std::coroutine_handle<> > aReadyHandles;
+	aReadyHandles.reserve(kMaxEventsPerWait);
+
+	while (m_active)
+	{
+		int numEvents = epoll_wait(m_epollFD, events, kMaxEventsPerWait, kTimeoutCheckIntervalMS);
+		if (numEvents == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			m_logger.error("epoll_wait() failed in coroutine reactor: %s", strerror(errno));
+			break;
+		}
+
+		if (!m_active)
+			break;
+
+		aReadyHandles.clear();
+
+		{
+			std::unique_lock<std::mutex> lock(m_socketWaitsLock);
+
+			for (int i = 0; i < numEvents; i++)
+			{
+				int eventFD = events[i].data.fd;
+				if (eventFD == m_wakeupEventFD)
+					continue;
+
+				std::map<int, SocketWait>::iterator itFind = m_aSocketWaits.find(eventFD);
+				if (itFind == m_aSocketWaits.end())
+					continue;
+
+				epoll_ctl(m_epollFD, EPOLL_CTL_DEL, eventFD, nullptr);
+
+				// errors / hangups count as ready too, as the subsequent IO call will find out what happened
+				*itFind->second.pReady = true;
+				aReadyHandles.emplace_back(itFind->second.handle);
+				m_aSocketWaits.erase(itFind);
+			}
+		}
+
+		// resume them outside the lock, as they may well add new waits
+		for (std::coroutine_handle<>& handle : aReadyHandles)
+		{
+			resumeCoroutine(handle);
+		}
+
+		std::chrono::steady_clock::time_point timeNow = std::chrono::steady_clock::now();
+		if (timeNow >= nextTimeoutCheck)
+		{
+			checkForTimedOutWaits();
+
+			nextTimeoutCheck = timeNow + std::chrono::milliseconds(kTimeoutCheckIntervalMS);
+		}
+	}
+#endif
+}
+
+void CoroutineReactor::blockingThreadFunction()
+{
+	while (true)
+	{
+		BlockingCall call;
+
+		{
+			std::unique_lock<std::mutex> lock(m_blockingCallsLock);
+			m_blockingCallsEvent.wait(lock, [this]{ return !m_aBlockingCalls.empty() || !m_active; });
+
+			if (m_aBlockingCalls.empty())
+			{
+				// we've been stopped, and there's nothing left to do
+				break;
+			}
+
+			call = m_aBlockingCalls.front();
+			m_aBlockingCalls.pop_front();
+		}
+
+		(*call.pFunction)();
+
+		resumeCoroutine(call.handle);
+	}
+}
+
+void CoroutineReactor::checkForTimedOutWaits()
+{
+#ifdef __linux__
+	std::vector<std::coroutine_handle<> > aTimedOutHandles;
+
+	{
+		std::unique_lock<std::mutex> lock(m_socketWaitsLock);
+
+		std::chrono::steady_clock::time_point timeNow = std::chrono::steady_clock::now();
+
+		std::map<int, SocketWait>::iterator it = m_aSocketWaits.begin();
+		while (it != m_aSocketWaits.end())
+		{
+			if (timeNow >= it->second.timeoutTime)
+			{
+				epoll_ctl(m_epollFD, EPOLL_CTL_DEL, it->first, nullptr);
+
+				*it->second.pReady = false;
+				aTimedOutHandles.emplace_back(it->second.handle);
+				it = m_aSocketWaits.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	for (std::coroutine_handle<>& handle : aTimedOutHandles)
+	{
+		resumeCoroutine(handle);
+	}
+#endif
+}
+
+void CoroutineReactor::failRemainingWaits()
+{
+	std::vector<std::coroutine_handle<> > aRemainingHandles;
+
+	{
+		std::unique_lock<std::mutex> lock(m_socketWaitsLock);
+
+		for (std::pair<const int, SocketWait>& socketWait : m_aSocketWaits)
+		{
+#ifdef __linux__
+			epoll_ctl(m_epollFD, EPOLL_CTL_DEL, socketWait.first, nullptr);
+#endif
+			*socketWait.second.pReady = false;
+			aRemainingHandles.emplace_back(socketWait.second.handle);
+		}
+
+		m_aSocketWaits.clear();
+	}
+
+	// Note: these won't be able to suspend again, as we're no longer active
+	for (std::coroutine_handle<>& handle : aRemainingHandles)
+	{
+		resumeCoroutine(handle);
+	}
+}
+
+void CoroutineReactor::resumeCoroutine(std::coroutine_handle<> handle)
+{
+	if (m_resumeHandler)
+	{
+		m_resumeHandler(handle);
+	}
+	else
+	{
+		handle.resume();
+	}
+}
+
+#endif // WEBSERVE_ENABLE_COROUTINE_HANDLERS
@@ -0,0 +1,209 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef COROUTINE_REACTOR_H
+#define COROUTINE_REACTOR_H
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+
+#include <map>
+#include <deque>
+#include <vector>
+
+#include "coroutine_task.h"
+
+#include "utils/socket.h"
+
+class Logger;
+class RecvBuffer;
+
+// Small reactor which resumes coroutine request handlers once the IO they're waiting on is ready, so
+// that a slow upstream or disk only ties up a suspended coroutine frame, rather than a whole worker thread.
+// Sockets are waited on with epoll (one-shot) on a single reactor thread, and things epoll can't help with
+// (file reads, DNS lookups / blocking connects) are run on a small pool of blocking IO threads.
+// Coroutines whose waits have completed are passed to the resume handler (if one's been set), so that they
+// can be resumed on a worker thread, as otherwise the rest of the request (including any blocking sends)
+// would run on the reactor or blocking IO thread, holding up everything else waiting on them. Either way,
+// any work done after an await needs to be thread-safe in the same way as normal request handling.
+// Currently this is Linux-only: initialise() will fail on other platforms.
+class CoroutineReactor
+{
+public:
+	CoroutineReactor(Logger& logger);
+	~CoroutineReactor();
+
+	bool initialise();
+
+	// this needs to be set before start() is called
+	void setResumeHandler(std::function<void(std::coroutine_handle<>)> resumeHandler)
+	{
+		m_resumeHandler = resumeHandler;
+	}
+
+	void start(unsigned int numBlockingThreads);
+	// any coroutines still waiting are resumed with their waits having failed, so they can clean up
+	void stop();
+
+	class SocketWaitAwaitable
+	{
+	public:
+		SocketWaitAwaitable(CoroutineReactor& reactor, int socketFD, bool forWrite, unsigned int timeoutSecs) :
+			m_reactor(reactor), m_socketFD(socketFD), m_forWrite(forWrite), m_timeoutSecs(timeoutSecs), m_ready(false)
+		{
+		}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			return m_reactor.addSocketWait(m_socketFD, m_forWrite, m_timeoutSecs, handle, &m_ready);
+		}
+
+		// whether the socket is now ready, rather than having timed out / failed
+		bool await_resume() const noexcept
+		{
+			return m_ready;
+		}
+
+	protected:
+		CoroutineReactor&		m_reactor;
+		int						m_socketFD;
+		bool					m_forWrite;
+		unsigned int			m_timeoutSecs;
+		bool					m_ready;
+	};
+
+	class BlockingCallAwaitable
+	{
+	public:
+		BlockingCallAwaitable(CoroutineReactor& reactor, std::function<void()>&& function) :
+			m_reactor(reactor), m_function(std::move(function))
+		{
+		}
+
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle)
+		{
+			return m_reactor.addBlockingCall(&m_function, handle);
+		}
+
+		void await_resume() const noexcept
+		{
+		}
+
+	protected:
+		CoroutineReactor&		m_reactor;
+		std::function<void()>	m_function;
+	};
+
+	// suspends until the socket is readable (or writable), or the timeout is reached. A timeout of 0 means there's no timeout.
+	SocketWaitAwaitable waitForSocket(int socketFD, bool forWrite, unsigned int timeoutSecs)
+	{
+		return SocketWaitAwaitable(*this, socketFD, forWrite, timeoutSecs);
+	}
+
+	// runs the function on one of the blocking IO threads, resuming once it's done. If the reactor's
+	// been stopped, the function is just run directly.
+	BlockingCallAwaitable runBlocking(std::function<void()> function)
+	{
+		return BlockingCallAwaitable(*this, std::move(function));
+	}
+
+	// higher-level helpers for raw (non-TLS) sockets and files.
+
+	// receives whatever's available once there's something to receive, waiting up to timeoutSecs.
+	Task<SocketRecvReturnCode> recv(const Socket& socket, RecvBuffer& buffer, unsigned int timeoutSecs);
+	// keeps receiving until a complete HTTP response (based on the status code, Content-Length or chunked body) has
+	// been received, or for responses without either, until the peer closes the connection. headerOnlyResponse is for
+	// responses to HEAD requests.
+	Task<SocketRecvReturnCode> recvHTTPMessage(const Socket& socket, RecvBuffer& buffer, unsigned int timeoutSecs, bool headerOnlyResponse = false);
+	Task<bool> send(const Socket& socket, const std::string& data, unsigned int timeoutSecs);
+	// does any hostname lookup and the connection on a blocking IO thread
+	Task<bool> connect(Socket& socket);
+	// pread() on a blocking IO thread, returning the number of bytes read, or -1 on error
+	Task<long> readFile(int fileFD, void* pBuffer, size_t length, size_t offset);
+
+	size_t getNumWaitingSockets() const;
+
+protected:
+	// these return false if the coroutine should just be resumed immediately rather than suspending
+	bool addSocketWait(int socketFD, bool forWrite, unsigned int timeoutSecs, std::coroutine_handle<> handle, bool* pReady);
+	bool addBlockingCall(std::function<void()>* pFunction, std::coroutine_handle<> handle);
+
+	void reactorThreadFunction();
+	void blockingThreadFunction();
+
+	void checkForTimedOutWaits();
+
+	// resumes the coroutine via the resume handler, or directly if there isn't one
+	void resumeCoroutine(std::coroutine_handle<> handle);
+
+	// resumes (and removes) any socket waits still outstanding, as failed
+	void failRemainingWaits();
+
+protected:
+	struct SocketWait
+	{
+		std::coroutine_handle<>					handle;
+		bool*									pReady;
+		std::chrono::steady_clock::time_point	timeoutTime;
+	};
+
+	struct BlockingCall
+	{
+		std::function<void()>*					pFunction;
+		std::coroutine_handle<>					handle;
+	};
+
+	Logger&								m_logger;
+
+	int									m_epollFD;
+	int									m_wakeupEventFD;
+
+	std::thread							m_reactorThread;
+	std::vector<std::thread>			m_aBlockingThreads;
+	std::atomic<bool>					m_active;
+
+	// keyed by socket fd
+	mutable std::mutex					m_socketWaitsLock;
+	std::map<int, SocketWait>			m_aSocketWaits;
+
+	std::mutex							m_blockingCallsLock;
+	std::condition_variable				m_blockingCallsEvent;
+	std::deque<BlockingCall>			m_aBlockingCalls;
+
+	std::function<void(std::coroutine_handle<>)>	m_resumeHandler;
+};
+
+#endif // WEBSERVE_ENABLE_COROUTINE_HANDLERS
+
+#endif // COROUTINE_REACTOR_H
@@ -0,0 +1,164 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef COROUTINE_TASK_H
+#define COROUTINE_TASK_H
+
+// Note: this requires C++20
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+// Lazily-started coroutine returning a value of type T (which must be default-constructible), which
+// only runs when it's co_awaited, and resumes the awaiting coroutine when it finishes.
+// Continuations use symmetric transfer, so long chains of tasks which complete synchronously don't
+// grow the stack.
+template<typename T>
+class Task
+{
+public:
+	struct promise_type
+	{
+		Task get_return_object()
+		{
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept
+			{
+				return false;
+			}
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+			{
+				std::coroutine_handle<> continuation = handle.promise().continuation;
+				return continuation ? continuation : std::noop_coroutine();
+			}
+
+			void await_resume() noexcept
+			{
+			}
+		};
+
+		FinalAwaiter final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_value(T newValue)
+		{
+			value = std::move(newValue);
+		}
+
+		void unhandled_exception()
+		{
+			// we don't use exceptions
+			std::terminate();
+		}
+
+		T							value {};
+		std::coroutine_handle<>		continuation;
+	};
+
+	Task(Task&& rhs) noexcept : m_handle(rhs.m_handle)
+	{
+		rhs.m_handle = nullptr;
+	}
+
+	Task(const Task& rhs) = delete;
+	Task& operator=(const Task& rhs) = delete;
+
+	~Task()
+	{
+		if (m_handle)
+		{
+			m_handle.destroy();
+		}
+	}
+
+	// awaitable interface
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaitingHandle) noexcept
+	{
+		m_handle.promise().continuation = awaitingHandle;
+		return m_handle;
+	}
+
+	T await_resume()
+	{
+		return std::move(m_handle.promise().value);
+	}
+
+protected:
+	explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle)
+	{
+	}
+
+protected:
+	std::coroutine_handle<promise_type>		m_handle;
+};
+
+// Fire-and-forget coroutine which starts running immediately, and cleans itself up when it finishes.
+// Used as the top-level coroutine for a request, so the thread starting it can carry on with other
+// work if it suspends.
+struct DetachedTask
+{
+	struct promise_type
+	{
+		DetachedTask get_return_object()
+		{
+			return DetachedTask();
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void()
+		{
+		}
+
+		void unhandled_exception()
+		{
+			std::terminate();
+		}
+	};
+};
+
+#endif // WEBSERVE_ENABLE_COROUTINE_HANDLERS
+
+#endif // COROUTINE_TASK_H
@@ -76,7 +76,7 @@ WebRequestHandlerResult FilesRequestHandler::handleRequest(RequestConnection& re
 
 	WebRequestHandlerResult handleRequestResult;
 
-	WebResponseParams responseParams(configuration, requestConnection.https);
+	WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 	
 	std::string responseString;
 
@@ -93,6 +93,7 @@ WebRequestHandlerResult FilesRequestHandler::handleRequest(RequestConnection& re
 	std::string fullPath = FileHelpers::combinePaths(m_basePath, requestPath);
 
 	WebResponseAdvancedBinaryFile fileResponse(fullPath);
+	fileResponse.setRequest(&request);
 
 	WebResponseAdvancedBinaryFile::ValidationResult validationResult = fileResponse.validateResponse();
 
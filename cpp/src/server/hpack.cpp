@@ -0,0 +1,528 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+
+#include "hpack.h"
+
+// RFC 7541 Appendix A
+static const unsigned int kStaticTableSize = 61;
+
+struct StaticTableEntry
+{
+	const char*		name;
+	const char*		value;
+};
+
+static const StaticTableEntry kStaticTable[kStaticTableSize] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+
+// RFC 7541 Appendix B, indexed by symbol. The EOS symbol isn't needed, as it's never valid in a string.
+struct HuffmanCode
+{
+	uint32_t		code;
+	unsigned char	length;
+};
+
+static const HuffmanCode kHuffmanCodes[256] = {
+	{ 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 },
+	{ 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+	{ 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+	{ 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+	{ 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 },
+	{ 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+	{ 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 },
+	{ 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+	{ 0x00000014,  6 }, { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 },
+	{ 0x00001ff9, 13 }, { 0x00000015,  6 }, { 0x000000f8,  8 }, { 0x000007fa, 11 },
+	{ 0x000003fa, 10 }, { 0x000003fb, 10 }, { 0x000000f9,  8 }, { 0x000007fb, 11 },
+	{ 0x000000fa,  8 }, { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+	{ 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 }, { 0x00000019,  6 },
+	{ 0x0000001a,  6 }, { 0x0000001b,  6 }, { 0x0000001c,  6 }, { 0x0000001d,  6 },
+	{ 0x0000001e,  6 }, { 0x0000001f,  6 }, { 0x0000005c,  7 }, { 0x000000fb,  8 },
+	{ 0x00007ffc, 15 }, { 0x00000020,  6 }, { 0x00000ffb, 12 }, { 0x000003fc, 10 },
+	{ 0x00001ffa, 13 }, { 0x00000021,  6 }, { 0x0000005d,  7 }, { 0x0000005e,  7 },
+	{ 0x0000005f,  7 }, { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+	{ 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 }, { 0x00000066,  7 },
+	{ 0x00000067,  7 }, { 0x00000068,  7 }, { 0x00000069,  7 }, { 0x0000006a,  7 },
+	{ 0x0000006b,  7 }, { 0x0000006c,  7 }, { 0x0000006d,  7 }, { 0x0000006e,  7 },
+	{ 0x0000006f,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 }, { 0x00000072,  7 },
+	{ 0x000000fc,  8 }, { 0x00000073,  7 }, { 0x000000fd,  8 }, { 0x00001ffb, 13 },
+	{ 0x0007fff0, 19 }, { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022,  6 },
+	{ 0x00007ffd, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 }, { 0x00000004,  5 },
+	{ 0x00000024,  6 }, { 0x00000005,  5 }, { 0x00000025,  6 }, { 0x00000026,  6 },
+	{ 0x00000027,  6 }, { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 },
+	{ 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002a,  6 }, { 0x00000007,  5 },
+	{ 0x0000002b,  6 }, { 0x00000076,  7 }, { 0x0000002c,  6 }, { 0x00000008,  5 },
+	{ 0x00000009,  5 }, { 0x0000002d,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+	{ 0x00000079,  7 }, { 0x0000007a,  7 }, { 0x0000007b,  7 }, { 0x00007ffe, 15 },
+	{ 0x000007fc, 11 }, { 0x00003ffd, 14 }, { 0x00001ffd, 13 }, { 0x0ffffffc, 28 },
+	{ 0x000fffe6, 20 }, { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 },
+	{ 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+	{ 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 },
+	{ 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+	{ 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 },
+	{ 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+	{ 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+	{ 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+	{ 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0x000fffe9, 20 }, { 0x003fffdb, 22 },
+	{ 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+	{ 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 },
+	{ 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+	{ 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+	{ 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+	{ 0x000fffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 },
+	{ 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+	{ 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 }, { 0x0007fff1, 19 },
+	{ 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+	{ 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+	{ 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+	{ 0x0007fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 },
+	{ 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+	{ 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 },
+	{ 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+	{ 0x000fffec, 20 }, { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 },
+	{ 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+	{ 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 },
+	{ 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+	{ 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 },
+	{ 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+	{ 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+	{ 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+};
+
+// binary tree of the codes, built once, which is walked a bit at a time to decode. This isn't the fastest way
+// of doing it, but the strings are short (and are only Huffman-encoded by clients to begin with)...
+class HuffmanDecodeTree
+{
+public:
+	HuffmanDecodeTree()
+	{
+		// the root
+		m_aNodes.emplace_back();
+
+		for (unsigned int symbol = 0; symbol < 256; symbol++)
+		{
+			const HuffmanCode& huffmanCode = kHuffmanCodes[symbol];
+
+			unsigned int nodeIndex = 0;
+			for (int bit = huffmanCode.length - 1; bit >= 0; bit--)
+			{
+				unsigned int branch = (huffmanCode.code >> bit) & 1;
+				if (m_aNodes[nodeIndex].aChildren[branch] == 0)
+				{
+					m_aNodes[nodeIndex].aChildren[branch] = (uint16_t)m_aNodes.size();
+					m_aNodes.emplace_back();
+				}
+				nodeIndex = m_aNodes[nodeIndex].aChildren[branch];
+			}
+
+			m_aNodes[nodeIndex].symbol = (int16_t)symbol;
+		}
+	}
+
+	struct Node
+	{
+		// 0 (the root) means there's no child, as the root can't be one
+		uint16_t	aChildren[2] = { 0, 0 };
+		// -1 for internal nodes
+		int16_t		symbol = -1;
+	};
+
+	std::vector<Node>	m_aNodes;
+};
+
+static const HuffmanDecodeTree& getHuffmanDecodeTree()
+{
+	static const HuffmanDecodeTree decodeTree;
+	return decodeTree;
+}
+
+// the default SETTINGS_HEADER_TABLE_SIZE
+static const size_t kDefaultMaxDynamicTableSize = 4096;
+
+// each field counts as this much more than the length of its name and value, for both the dynamic table size
+// and the header list size
+static const size_t kFieldSizeOverhead = 32;
+
+HPACKDecoder::HPACKDecoder() :
+	m_dynamicTableSize(0),
+	m_maxDynamicTableSize(kDefaultMaxDynamicTableSize),
+	m_maxTableSizeLimit(kDefaultMaxDynamicTableSize),
+	m_maxHeaderListSize(0)
+{
+}
+
+HPACKDecoder::DecodeResult HPACKDecoder::decodeHeaderBlock(const unsigned char* pData, size_t length, std::vector<HPACKHeaderField>& aFields)
+{
+	const unsigned char* pPos = pData;
+	const unsigned char* pEnd = pData + length;
+
+	size_t headerListSize = 0;
+	bool headerListTooLarge = false;
+
+	// fields are decoded into this first, so once the header list is too large, they can be thrown away
+	HPACKHeaderField field;
+
+	while (pPos < pEnd)
+	{
+		unsigned char firstByte = *pPos;
+
+		if ((firstByte & 0xE0) == 0x20)
+		{
+			// dynamic table size update
+			uint64_t newMaxSize = 0;
+			if (!decodeInteger(pPos, pEnd, 5, newMaxSize))
+				return eDecodeInvalid;
+
+			if (newMaxSize > m_maxTableSizeLimit)
+				return eDecodeInvalid;
+
+			m_maxDynamicTableSize = (size_t)newMaxSize;
+			evictDynamicTableEntries(m_maxDynamicTableSize);
+			continue;
+		}
+
+		if (firstByte & 0x80)
+		{
+			// indexed field
+			uint64_t index = 0;
+			if (!decodeInteger(pPos, pEnd, 7, index))
+				return eDecodeInvalid;
+
+			if (!getIndexedField(index, field))
+				return eDecodeInvalid;
+		}
+		else
+		{
+			// literal field, either with incremental indexing (01), or without (0000) / never (0001) indexing,
+			// which are the same thing from our point of view.
+			bool addToTable = (firstByte & 0xC0) == 0x40;
+
+			uint64_t nameIndex = 0;
+			if (!decodeInteger(pPos, pEnd, addToTable ? 6 : 4, nameIndex))
+				return eDecodeInvalid;
+
+			if (nameIndex > 0)
+			{
+				if (!getIndexedField(nameIndex, field))
+					return eDecodeInvalid;
+			}
+			else if (!decodeString(pPos, pEnd, field.name))
+			{
+				return eDecodeInvalid;
+			}
+
+			if (!decodeString(pPos, pEnd, field.value))
+				return eDecodeInvalid;
+
+			if (addToTable)
+			{
+				addDynamicTableEntry(field);
+			}
+		}
+
+		if (headerListTooLarge)
+			continue;
+
+		headerListSize += field.name.size() + field.value.size() + kFieldSizeOverhead;
+		if (m_maxHeaderListSize > 0 && headerListSize > m_maxHeaderListSize)
+		{
+			headerListTooLarge = true;
+			continue;
+		}
+
+		aFields.emplace_back(std::move(field));
+	}
+
+	return headerListTooLarge ? eDecodeHeaderListTooLarge : eDecodeOK;
+}
+
+bool HPACKDecoder::getIndexedField(uint64_t index, HPACKHeaderField& field) const
+{
+	if (index == 0)
+		return false;
+
+	if (index <= kStaticTableSize)
+	{
+		const StaticTableEntry& entry = kStaticTable[index - 1];
+		field.name = entry.name;
+		field.value = entry.value;
+		return true;
+	}
+
+	uint64_t dynamicIndex = index - kStaticTableSize - 1;
+	if (dynamicIndex >= m_aDynamicTable.size())
+		return false;
+
+	field = m_aDynamicTable[dynamicIndex];
+	return true;
+}
+
+void HPACKDecoder::addDynamicTableEntry(const HPACKHeaderField& field)
+{
+	size_t entrySize = field.name.size() + field.value.size() + kFieldSizeOverhead;
+	if (entrySize > m_maxDynamicTableSize)
+	{
+		// adding an entry larger than the table just empties it
+		evictDynamicTableEntries(0);
+		return;
+	}
+
+	evictDynamicTableEntries(m_maxDynamicTableSize - entrySize);
+
+	m_aDynamicTable.emplace_front(field);
+	m_dynamicTableSize += entrySize;
+}
+
+void HPACKDecoder::evictDynamicTableEntries(size_t maxSize)
+{
+	while (m_dynamicTableSize > maxSize && !m_aDynamicTable.empty())
+	{
+		const HPACKHeaderField& oldestField = m_aDynamicTable.back();
+		m_dynamicTableSize -= oldestField.name.size() + oldestField.value.size() + kFieldSizeOverhead;
+		m_aDynamicTable.pop_back();
+	}
+}
+
+bool HPACKDecoder::decodeInteger(const unsigned char*& pPos, const unsigned char* pEnd, unsigned int prefixBits, uint64_t& value)
+{
+	if (pPos >= pEnd)
+		return false;
+
+	const uint64_t prefixMask = (1u << prefixBits) - 1;
+	value = *pPos++ & prefixMask;
+	if (value < prefixMask)
+		return true;
+
+	unsigned int shift = 0;
+	while (true)
+	{
+		// nothing we accept needs anywhere near this many bits, so it's either garbage or an attempt at overflowing
+		if (pPos >= pEnd || shift > 28)
+			return false;
+
+		unsigned char byte = *pPos++;
+		value += (uint64_t)(byte & 0x7F) << shift;
+		shift += 7;
+
+		if (!(byte & 0x80))
+			return true;
+	}
+}
+
+bool HPACKDecoder::decodeString(const unsigned char*& pPos, const unsigned char* pEnd, std::string& value)
+{
+	if (pPos >= pEnd)
+		return false;
+
+	bool huffmanEncoded = (*pPos & 0x80) != 0;
+
+	uint64_t length = 0;
+	if (!decodeInteger(pPos, pEnd, 7, length))
+		return false;
+
+	if (length > (uint64_t)(pEnd - pPos))
+		return false;
+
+	const unsigned char* pString = pPos;
+	pPos += length;
+
+	if (huffmanEncoded)
+	{
+		return decodeHuffmanString(pString, (size_t)length, value);
+	}
+
+	value.assign((const char*)pString, (size_t)length);
+	return true;
+}
+
+bool HPACKDecoder::decodeHuffmanString(const unsigned char* pData, size_t length, std::string& value)
+{
+	const std::vector<HuffmanDecodeTree::Node>& aNodes = getHuffmanDecodeTree().m_aNodes;
+
+	value.clear();
+	// the shortest codes are 5 bits
+	value.reserve(length * 8 / 5);
+
+	unsigned int nodeIndex = 0;
+	unsigned int bitsSinceSymbol = 0;
+	bool allOnesSinceSymbol = true;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char byte = pData[i];
+		for (int bit = 7; bit >= 0; bit--)
+		{
+			unsigned int branch = (byte >> bit) & 1;
+			nodeIndex = aNodes[nodeIndex].aChildren[branch];
+			// this is only possible with the EOS code (or the start of it), which isn't allowed
+			if (nodeIndex == 0)
+				return false;
+
+			bitsSinceSymbol++;
+			allOnesSinceSymbol = allOnesSinceSymbol && branch;
+
+			if (aNodes[nodeIndex].symbol >= 0)
+			{
+				value.push_back((char)aNodes[nodeIndex].symbol);
+				nodeIndex = 0;
+				bitsSinceSymbol = 0;
+				allOnesSinceSymbol = true;
+			}
+		}
+	}
+
+	// any padding at the end must be less than a byte, and the most-significant bits of EOS (all 1s)
+	return bitsSinceSymbol < 8 && allOnesSinceSymbol;
+}
+
+//
+
+void HPACKEncoder::encodeStatus(std::string& output, unsigned int statusCode)
+{
+	// the static table has the most common ones
+	unsigned int staticIndex = 0;
+	switch (statusCode)
+	{
+		case 200: staticIndex = 8; break;
+		case 204: staticIndex = 9; break;
+		case 206: staticIndex = 10; break;
+		case 304: staticIndex = 11; break;
+		case 400: staticIndex = 12; break;
+		case 404: staticIndex = 13; break;
+		case 500: staticIndex = 14; break;
+		default: break;
+	}
+
+	if (staticIndex > 0)
+	{
+		encodeInteger(output, 0x80, 7, staticIndex);
+		return;
+	}
+
+	// otherwise a literal value with the ':status' name from the static table
+	encodeInteger(output, 0x00, 4, 8);
+	encodeString(output, std::to_string(statusCode));
+}
+
+void HPACKEncoder::encodeHeaderField(std::string& output, std::string_view name, std::string_view value)
+{
+	// literal field without indexing, with an indexed name if it's in the static table (after the pseudo-header fields)
+	for (unsigned int i = 14; i < kStaticTableSize; i++)
+	{
+		if (name == kStaticTable[i].name)
+		{
+			encodeInteger(output, 0x00, 4, i + 1);
+			encodeString(output, value);
+			return;
+		}
+	}
+
+	output.push_back(0x00);
+	encodeString(output, name);
+	encodeString(output, value);
+}
+
+void HPACKEncoder::encodeInteger(std::string& output, unsigned char firstByteFlags, unsigned int prefixBits, uint64_t value)
+{
+	const uint64_t prefixMax = (1u << prefixBits) - 1;
+	if (value < prefixMax)
+	{
+		output.push_back((char)(firstByteFlags | value));
+		return;
+	}
+
+	output.push_back((char)(firstByteFlags | prefixMax));
+	value -= prefixMax;
+
+	while (value >= 0x80)
+	{
+		output.push_back((char)((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+
+	output.push_back((char)value);
+}
+
+void HPACKEncoder::encodeString(std::string& output, std::string_view value)
+{
+	// not Huffman-encoded
+	encodeInteger(output, 0x00, 7, value.size());
+	output.append(value);
+}
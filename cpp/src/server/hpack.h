@@ -0,0 +1,117 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// HPACK (RFC 7541) header compression, as used by HTTP/2 for header blocks.
+
+struct HPACKHeaderField
+{
+	HPACKHeaderField()
+	{
+	}
+
+	HPACKHeaderField(std::string_view fieldName, std::string_view fieldValue) : name(fieldName), value(fieldValue)
+	{
+	}
+
+	std::string		name;
+	std::string		value;
+};
+
+// Decoding state is per-connection (the dynamic table is shared by all the header blocks sent by the peer),
+// so there should be one of these for each connection, and every header block must be decoded, in order.
+class HPACKDecoder
+{
+public:
+	HPACKDecoder();
+
+	enum DecodeResult
+	{
+		eDecodeOK,
+		eDecodeHeaderListTooLarge,
+		eDecodeInvalid
+	};
+
+	// the limit we've told the peer (via SETTINGS_HEADER_TABLE_SIZE) it can set the dynamic table size to
+	void setMaxTableSizeLimit(size_t maxTableSizeLimit)
+	{
+		m_maxTableSizeLimit = maxTableSizeLimit;
+	}
+
+	// the limit we've told the peer (via SETTINGS_MAX_HEADER_LIST_SIZE) on the size of a decoded header list,
+	// which is the length of all the names and values, plus 32 bytes for each field. 0 means no limit.
+	void setMaxHeaderListSize(size_t maxHeaderListSize)
+	{
+		m_maxHeaderListSize = maxHeaderListSize;
+	}
+
+	// decodes a complete header block (i.e. from a HEADERS frame and any CONTINUATION frames after it),
+	// appending the fields to aFields.
+	// If the decoded fields are larger than the max header list size, the rest of the block is still decoded (so the
+	// dynamic table stays in sync with the peer's), but the fields from then on aren't kept, and
+	// eDecodeHeaderListTooLarge is returned, in which case the stream should be rejected.
+	// If the block is invalid, eDecodeInvalid is returned, in which case the decoding state can't be relied on any
+	// more, so the connection should be closed (with a COMPRESSION_ERROR).
+	DecodeResult decodeHeaderBlock(const unsigned char* pData, size_t length, std::vector<HPACKHeaderField>& aFields);
+
+protected:
+	bool getIndexedField(uint64_t index, HPACKHeaderField& field) const;
+	void addDynamicTableEntry(const HPACKHeaderField& field);
+	void evictDynamicTableEntries(size_t maxSize);
+
+	static bool decodeInteger(const unsigned char*& pPos, const unsigned char* pEnd, unsigned int prefixBits, uint64_t& value);
+	static bool decodeString(const unsigned char*& pPos, const unsigned char* pEnd, std::string& value);
+	static bool decodeHuffmanString(const unsigned char* pData, size_t length, std::string& value);
+
+protected:
+	// newest entries are at the front
+	std::deque<HPACKHeaderField>	m_aDynamicTable;
+	// as defined by HPACK: the length of all the names and values, plus 32 bytes of overhead for each entry
+	size_t							m_dynamicTableSize;
+	size_t							m_maxDynamicTableSize;
+	size_t							m_maxTableSizeLimit;
+
+	size_t							m_maxHeaderListSize;
+};
+
+// The encoder doesn't add anything to the dynamic table (or use Huffman encoding), so it doesn't need any state,
+// and the peer's SETTINGS_HEADER_TABLE_SIZE can be ignored. Response header blocks are small enough that this
+// doesn't cost much, and fields with static table names (i.e. most of them) only need their value sent.
+class HPACKEncoder
+{
+public:
+	static void encodeStatus(std::string& output, unsigned int statusCode);
+
+	// the name must already be lower-case
+	static void encodeHeaderField(std::string& output, std::string_view name, std::string_view value);
+
+protected:
+	static void encodeInteger(std::string& output, unsigned char firstByteFlags, unsigned int prefixBits, uint64_t value);
+	static void encodeString(std::string& output, std::string_view value);
+};
+
+#endif // HPACK_H
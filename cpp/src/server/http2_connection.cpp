@@ -0,0 +1,1324 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+
+#include "http2_connection.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "main_request_handler.h"
+#include "configuration.h"
+
+#include "utils/string_helpers.h"
+
+const char* HTTP2Connection::kProtocolID = "h2";
+
+static const char* kConnectionPreface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t kConnectionPrefaceLength = 24;
+
+static const size_t kFrameHeaderSize = 9;
+
+// we don't advertise anything different to the defaults for these
+static const uint32_t kMaxFrameSize = 16384;
+static const uint32_t kDefaultInitialWindowSize = 65535;
+
+static const uint32_t kMaxConcurrentStreams = 128;
+static const size_t kMaxHeaderBlockSize = 64 * 1024;
+
+static const size_t kMaxPendingResponseSize = 8 * 1024 * 1024;
+
+// request bodies are buffered until they're complete, so if there's no max request body size configured, these are
+// still limited to this, and the total of all the streams' to the larger of kMaxBufferedRequestBodySize and the
+// max for a single one.
+static const size_t kDefaultMaxStreamRequestBodySize = 16 * 1024 * 1024;
+static const size_t kMaxBufferedRequestBodySize = 64 * 1024 * 1024;
+// frames are buffered up to about this much before being sent
+static const size_t kMaxSendBufferSize = 64 * 1024;
+
+static const unsigned int kPrefaceRecvTimeout = 5;
+// how long to wait for the peer when it has streams open (i.e. it's sending a request body, or we're waiting for
+// it to open its flow control windows), as opposed to when the connection's idle.
+static const unsigned int kPeerRecvTimeout = 30;
+
+enum SettingsParameter
+{
+	eSettingHeaderTableSize			= 0x1,
+	eSettingEnablePush				= 0x2,
+	eSettingMaxConcurrentStreams	= 0x3,
+	eSettingInitialWindowSize		= 0x4,
+	eSettingMaxFrameSize			= 0x5,
+	eSettingMaxHeaderListSize		= 0x6
+};
+
+static uint32_t read32(const unsigned char* pData)
+{
+	return ((uint32_t)pData[0] << 24) | ((uint32_t)pData[1] << 16) | ((uint32_t)pData[2] << 8) | (uint32_t)pData[3];
+}
+
+static void write32(unsigned char* pData, uint32_t value)
+{
+	pData[0] = (unsigned char)(value >> 24);
+	pData[1] = (unsigned char)(value >> 16);
+	pData[2] = (unsigned char)(value >> 8);
+	pData[3] = (unsigned char)value;
+}
+
+HTTP2ResponseBodySegment::HTTP2ResponseBodySegment(HTTP2ResponseBodySegment&& other) noexcept :
+	data(std::move(other.data)),
+	dataSent(other.dataSent),
+	fileFD(other.fileFD),
+	fileOffset(other.fileOffset),
+	fileLength(other.fileLength)
+{
+	other.fileFD = -1;
+}
+
+HTTP2ResponseBodySegment::~HTTP2ResponseBodySegment()
+{
+	if (fileFD != -1)
+	{
+		::close(fileFD);
+	}
+}
+
+bool HTTP2StreamConnectionSocket::send(const std::string& data, unsigned int flags) const
+{
+	appendResponseData(data.data(), data.size());
+	return true;
+}
+
+bool HTTP2StreamConnectionSocket::send(unsigned char* pData, size_t dataLength) const
+{
+	appendResponseData((const char*)pData, dataLength);
+	return true;
+}
+
+bool HTTP2StreamConnectionSocket::sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags) const
+{
+	for (unsigned int i = 0; i < count; i++)
+	{
+		appendResponseData((const char*)pIOVecs[i].iov_base, pIOVecs[i].iov_len);
+	}
+	return true;
+}
+
+bool HTTP2StreamConnectionSocket::sendFileData(int fileFD, size_t offset, size_t length) const
+{
+	if (length == 0)
+		return true;
+
+	// the caller closes the file once the response has been "sent", which is before it's actually read
+	int ownFileFD = dup(fileFD);
+	if (ownFileFD == -1)
+		return false;
+
+	m_aResponseSegments.emplace_back();
+	HTTP2ResponseBodySegment& segment = m_aResponseSegments.back();
+	segment.fileFD = ownFileFD;
+	segment.fileOffset = offset;
+	segment.fileLength = length;
+
+	return true;
+}
+
+void HTTP2StreamConnectionSocket::appendResponseData(const char* pData, size_t dataLength) const
+{
+	if (m_aResponseSegments.empty())
+	{
+		m_response.append(pData, dataLength);
+		return;
+	}
+
+	// after file data, so it needs to stay in order after it
+	if (m_aResponseSegments.back().isFileRange())
+	{
+		m_aResponseSegments.emplace_back();
+	}
+
+	m_aResponseSegments.back().data.append(pData, dataLength);
+}
+
+SocketRecvReturnCode HTTP2StreamConnectionSocket::recv(RecvBuffer& buffer, unsigned int timeoutSecs) const
+{
+	return SocketRecvReturnCode(eSockRecv_PeerClosed);
+}
+
+SocketRecvReturnCode HTTP2StreamConnectionSocket::recvNonBlocking(RecvBuffer& buffer) const
+{
+	return SocketRecvReturnCode(eSockRecv_PeerClosed);
+}
+
+bool HTTP2StreamConnectionSocket::close(bool deleteRawSocket)
+{
+	return true;
+}
+
+//
+
+HTTP2Connection::HTTP2Connection(MainRequestHandler& mainRequestHandler, RequestConnection& requestConnection) :
+	m_mainRequestHandler(mainRequestHandler),
+	m_requestConnection(requestConnection),
+	m_logger(requestConnection.logger()),
+	m_streamSocket(requestConnection.logger()),
+	m_pendingResponseSize(0),
+	m_bufferedRequestBodySize(0),
+	m_lastStreamID(0),
+	m_goAwayStreamID(0),
+	m_headerBlockStreamID(0),
+	m_headerBlockEndStream(false),
+	m_peerInitialWindowSize(kDefaultInitialWindowSize),
+	m_peerMaxFrameSize(kMaxFrameSize),
+	m_connectionSendWindow(kDefaultInitialWindowSize),
+	m_connectionRecvWindow(kDefaultInitialWindowSize),
+	m_goAwaySent(false),
+	m_goAwayReceived(false),
+	m_failed(false)
+{
+	m_streamConnection.https = requestConnection.https;
+	m_streamConnection.pConnectionSocket = &m_streamSocket;
+	m_streamConnection.ipInfo = requestConnection.ipInfo;
+	m_streamConnection.pThreadConfig = requestConnection.pThreadConfig;
+	// the header list size limit should stop this being hit, but converting it to HTTP/1.1 can change its size slightly
+	m_streamConnection.recvBuffer.setMaxHeaderSize(requestConnection.pThreadConfig->pConfiguration->getMaxRequestHeaderSize());
+}
+
+HTTP2Connection::~HTTP2Connection()
+{
+	// it's not ours to delete
+	m_streamConnection.pConnectionSocket = nullptr;
+
+	m_requestConnection.connStatistics.httpRequests += m_streamConnection.connStatistics.httpRequests;
+	m_requestConnection.connStatistics.httpsRequests += m_streamConnection.connStatistics.httpsRequests;
+}
+
+void HTTP2Connection::run()
+{
+	const Configuration& configuration = *m_requestConnection.pThreadConfig->pConfiguration;
+	RecvBuffer& recvBuffer = m_requestConnection.recvBuffer;
+	ConnectionSocket* pConnectionSocket = m_requestConnection.pConnectionSocket;
+
+	if (!receivePreface())
+	{
+		m_logger.info("Invalid HTTP/2 connection preface received from client: %s. Aborting connection.", m_requestConnection.ipInfo.getIPAddress().c_str());
+		return;
+	}
+
+	// the same limit as for HTTP/1.1 request headers
+	size_t maxHeaderListSize = configuration.getMaxRequestHeaderSize();
+	m_headerDecoder.setMaxHeaderListSize(maxHeaderListSize);
+
+	// we never push, and limit how many streams can be open at once, and how big their request headers can be
+	unsigned char aSettings[18];
+	aSettings[0] = 0;
+	aSettings[1] = eSettingEnablePush;
+	write32(aSettings + 2, 0);
+	aSettings[6] = 0;
+	aSettings[7] = eSettingMaxConcurrentStreams;
+	write32(aSettings + 8, kMaxConcurrentStreams);
+	aSettings[12] = 0;
+	aSettings[13] = eSettingMaxHeaderListSize;
+	write32(aSettings + 14, (uint32_t)maxHeaderListSize);
+	queueFrame(eFrameSettings, 0, 0, aSettings, sizeof(aSettings));
+
+	if (!flushSendBuffer())
+		return;
+
+	while (!m_failed)
+	{
+		if (!processReceivedFrames() || !sendPendingData())
+			break;
+
+		if (!m_aPendingRequests.empty() && m_pendingResponseSize < kMaxPendingResponseSize)
+		{
+			handleNextRequest();
+
+			if (!sendPendingData())
+				break;
+
+			// pick up anything else which has arrived in the mean time (i.e. WINDOW_UPDATE frames) before handling
+			// the next request, but without waiting for anything
+			SocketRecvReturnCode recvRetCode = pConnectionSocket->recvNonBlocking(recvBuffer);
+			if (recvRetCode.type == eSockRecv_PeerClosed || recvRetCode.type == eSockRecv_Error)
+				break;
+
+			continue;
+		}
+
+		bool idle = m_aStreams.empty();
+
+		if (idle && (m_goAwaySent || m_goAwayReceived))
+			break;
+
+		// otherwise we need more from the peer: either more requests, more of a request, or for it to open
+		// its flow control windows so we can send more of the responses.
+		unsigned int timeout = idle ? configuration.getKeepAliveTimeout() : kPeerRecvTimeout;
+		SocketRecvReturnCode recvRetCode = pConnectionSocket->recv(recvBuffer, timeout);
+		if (recvRetCode.type == eSockRecv_TimedOutNoData)
+		{
+			if (idle)
+			{
+				m_logger.debug("HTTP/2 connection idle timeout. Closing.");
+				sendGoAway(eErrorNone);
+			}
+			else
+			{
+				m_logger.debug("HTTP/2 connection timed out waiting for client: %s. Closing.", m_requestConnection.ipInfo.getIPAddress().c_str());
+			}
+			break;
+		}
+		else if (recvRetCode.type != eSockRecv_OK)
+		{
+			break;
+		}
+	}
+}
+
+bool HTTP2Connection::receivePreface()
+{
+	RecvBuffer& recvBuffer = m_requestConnection.recvBuffer;
+
+	while (recvBuffer.getSize() < kConnectionPrefaceLength)
+	{
+		SocketRecvReturnCode recvRetCode = m_requestConnection.pConnectionSocket->recv(recvBuffer, kPrefaceRecvTimeout);
+		if (recvRetCode.type != eSockRecv_OK)
+			return false;
+	}
+
+	if (memcmp(recvBuffer.getData(), kConnectionPreface, kConnectionPrefaceLength) != 0)
+		return false;
+
+	recvBuffer.consume(kConnectionPrefaceLength);
+	return true;
+}
+
+bool HTTP2Connection::processReceivedFrames()
+{
+	RecvBuffer& recvBuffer = m_requestConnection.recvBuffer;
+
+	while (recvBuffer.getSize() >= kFrameHeaderSize)
+	{
+		const unsigned char* pData = (const unsigned char*)recvBuffer.getData();
+
+		FrameHeader frameHeader;
+		frameHeader.length = ((uint32_t)pData[0] << 16) | ((uint32_t)pData[1] << 8) | (uint32_t)pData[2];
+		frameHeader.type = pData[3];
+		frameHeader.flags = pData[4];
+		frameHeader.streamID = read32(pData + 5) & 0x7FFFFFFF;
+
+		if (frameHeader.length > kMaxFrameSize)
+			return connectionError(eErrorFrameSize, "frame too large");
+
+		if (recvBuffer.getSize() < kFrameHeaderSize + frameHeader.length)
+			break;
+
+		bool frameOK = processFrame(frameHeader, pData + kFrameHeaderSize);
+
+		recvBuffer.consume(kFrameHeaderSize + frameHeader.length);
+
+		if (!frameOK)
+			return false;
+	}
+
+	return true;
+}
+
+bool HTTP2Connection::processFrame(const FrameHeader& frameHeader, const unsigned char* pPayload)
+{
+	// a header block has to be continued by CONTINUATION frames, with nothing in between
+	if (m_headerBlockStreamID != 0 && (frameHeader.type != eFrameContinuation || frameHeader.streamID != m_headerBlockStreamID))
+		return connectionError(eErrorProtocol, "interrupted header block");
+
+	switch (frameHeader.type)
+	{
+		case eFrameData:
+			return processDataFrame(frameHeader, pPayload);
+		case eFrameHeaders:
+			return processHeadersFrame(frameHeader, pPayload);
+		case eFrameContinuation:
+			return processContinuationFrame(frameHeader, pPayload);
+		case eFramePriority:
+		{
+			// we don't do anything with priorities, as requests are handled in the order they're completed
+			if (frameHeader.streamID == 0)
+				return connectionError(eErrorProtocol, "PRIORITY frame on connection");
+			if (frameHeader.length != 5)
+				queueRSTStream(frameHeader.streamID, eErrorFrameSize);
+			return true;
+		}
+		case eFrameRSTStream:
+		{
+			if (frameHeader.streamID == 0 || frameHeader.streamID > m_lastStreamID)
+				return connectionError(eErrorProtocol, "RST_STREAM frame on idle stream");
+			if (frameHeader.length != 4)
+				return connectionError(eErrorFrameSize, "invalid RST_STREAM frame");
+			closeStream(frameHeader.streamID);
+			return true;
+		}
+		case eFrameSettings:
+			return processSettingsFrame(frameHeader, pPayload);
+		case eFramePushPromise:
+			return connectionError(eErrorProtocol, "PUSH_PROMISE frame from client");
+		case eFramePing:
+		{
+			if (frameHeader.streamID != 0)
+				return connectionError(eErrorProtocol, "PING frame on stream");
+			if (frameHeader.length != 8)
+				return connectionError(eErrorFrameSize, "invalid PING frame");
+			if (!(frameHeader.flags & eFlagAck))
+			{
+				queueFrame(eFramePing, eFlagAck, 0, pPayload, 8);
+			}
+			return true;
+		}
+		case eFrameGoAway:
+		{
+			if (frameHeader.streamID != 0)
+				return connectionError(eErrorProtocol, "GOAWAY frame on stream");
+			if (frameHeader.length < 8)
+				return connectionError(eErrorFrameSize, "invalid GOAWAY frame");
+			// we can carry on with the streams which are already open
+			m_goAwayReceived = true;
+			return true;
+		}
+		case eFrameWindowUpdate:
+			return processWindowUpdateFrame(frameHeader, pPayload);
+		default:
+			// unknown frame types have to be ignored
+			return true;
+	}
+}
+
+bool HTTP2Connection::connectionError(ErrorCode errorCode, const char* pReason)
+{
+	m_logger.info("HTTP/2 protocol error (%s) from client: %s. Aborting connection.", pReason, m_requestConnection.ipInfo.getIPAddress().c_str());
+
+	sendGoAway(errorCode);
+	m_failed = true;
+
+	return false;
+}
+
+bool HTTP2Connection::removePadding(const FrameHeader& frameHeader, const unsigned char*& pPayload, size_t& payloadLength)
+{
+	if (!(frameHeader.flags & eFlagPadded))
+		return true;
+
+	if (payloadLength < 1)
+		return false;
+
+	size_t paddingLength = pPayload[0];
+	pPayload += 1;
+	payloadLength -= 1;
+
+	if (paddingLength > payloadLength)
+		return false;
+
+	payloadLength -= paddingLength;
+	return true;
+}
+
+bool HTTP2Connection::processHeadersFrame(const FrameHeader& frameHeader, const unsigned char* pPayload)
+{
+	if (frameHeader.streamID == 0)
+		return connectionError(eErrorProtocol, "HEADERS frame on connection");
+
+	size_t payloadLength = frameHeader.length;
+	if (!removePadding(frameHeader, pPayload, payloadLength))
+		return connectionError(eErrorProtocol, "invalid padding");
+
+	if (frameHeader.flags & eFlagPriority)
+	{
+		// stream dependency and weight, which we ignore
+		if (payloadLength < 5)
+			return connectionError(eErrorFrameSize, "invalid HEADERS frame");
+
+		pPayload += 5;
+		payloadLength -= 5;
+	}
+
+	if (payloadLength > kMaxHeaderBlockSize)
+		return connectionError(eErrorEnhanceYourCalm, "header block too large");
+
+	m_headerBlock.assign((const char*)pPayload, payloadLength);
+
+	bool endStream = (frameHeader.flags & eFlagEndStream) != 0;
+
+	if (!(frameHeader.flags & eFlagEndHeaders))
+	{
+		m_headerBlockStreamID = frameHeader.streamID;
+		m_headerBlockEndStream = endStream;
+		return true;
+	}
+
+	return processHeaderBlock(frameHeader.streamID, endStream);
+}
+
+bool HTTP2Connection::processContinuationFrame(const FrameHeader& frameHeader, const unsigned char* pPayload)
+{
+	if (m_headerBlockStreamID == 0)
+		return connectionError(eErrorProtocol, "unexpected CONTINUATION frame");
+
+	m_headerBlock.append((const char*)pPayload, frameHeader.length);
+
+	if (m_headerBlock.size() > kMaxHeaderBlockSize)
+		return connectionError(eErrorEnhanceYourCalm, "header block too large");
+
+	if (!(frameHeader.flags & eFlagEndHeaders))
+		return true;
+
+	uint32_t streamID = m_headerBlockStreamID;
+	m_headerBlockStreamID = 0;
+
+	return processHeaderBlock(streamID, m_headerBlockEndStream);
+}
+
+bool HTTP2Connection::processHeaderBlock(uint32_t streamID, bool endStream)
+{
+	// this has to be done even if we're going to ignore the stream, to keep the decoder's state in sync with the peer
+	std::vector<HPACKHeaderField> aFields;
+	HPACKDecoder::DecodeResult decodeResult = m_headerDecoder.decodeHeaderBlock((const unsigned char*)m_headerBlock.data(),
+																				m_headerBlock.size(), aFields);
+	if (decodeResult == HPACKDecoder::eDecodeInvalid)
+		return connectionError(eErrorCompression, "invalid header block");
+
+	bool headerListTooLarge = decodeResult == HPACKDecoder::eDecodeHeaderListTooLarge;
+
+	StreamMap::iterator itStream = m_aStreams.find(streamID);
+	if (itStream != m_aStreams.end())
+	{
+		// a trailer section, which has to end the request
+		Stream& stream = itStream->second;
+		if (stream.requestComplete || !endStream)
+		{
+			queueRSTStream(streamID, stream.requestComplete ? eErrorStreamClosed : eErrorProtocol);
+			closeStream(streamID);
+			return true;
+		}
+
+		if (headerListTooLarge)
+		{
+			m_logger.warning("Request with too large a trailer section received from client: %s. Resetting stream.",
+							 m_requestConnection.ipInfo.getIPAddress().c_str());
+
+			queueRSTStream(streamID, eErrorEnhanceYourCalm);
+			closeStream(streamID);
+			return true;
+		}
+
+		// Note: the trailer fields themselves are thrown away, as there's no way of passing them on in the
+		//       HTTP/1.1 request (which has a Content-Length body).
+		stream.requestComplete = true;
+		m_aPendingRequests.push_back(streamID);
+		return true;
+	}
+
+	// new streams from the client have to have odd IDs, which always increase
+	if ((streamID & 1) == 0 || streamID <= m_lastStreamID)
+		return connectionError(eErrorProtocol, "invalid stream ID");
+
+	m_lastStreamID = streamID;
+
+	// once we've sent a GOAWAY, new streams are ignored
+	if (m_goAwaySent)
+		return true;
+
+	if (m_aStreams.size() >= kMaxConcurrentStreams)
+	{
+		queueRSTStream(streamID, eErrorRefusedStream);
+		return true;
+	}
+
+	if (headerListTooLarge)
+	{
+		// the equivalent of what we'd do for HTTP/1.1, without the stream ever being opened
+		m_logger.warning("Request with too large a header received from client: %s. Rejecting stream.", m_requestConnection.ipInfo.getIPAddress().c_str());
+
+		std::string headerBlock;
+		HPACKEncoder::encodeStatus(headerBlock, 431);
+		queueHeaderBlock(streamID, headerBlock, true);
+
+		if (!endStream)
+		{
+			// so the peer stops sending the request body
+			queueRSTStream(streamID, eErrorNone);
+		}
+		return true;
+	}
+
+	Stream& stream = m_aStreams[streamID];
+	stream.id = streamID;
+	stream.aRequestHeaders = std::move(aFields);
+	stream.sendWindow = m_peerInitialWindowSize;
+	stream.recvWindow = kDefaultInitialWindowSize;
+
+	if (endStream)
+	{
+		stream.requestComplete = true;
+		m_aPendingRequests.push_back(streamID);
+	}
+
+	return true;
+}
+
+bool HTTP2Connection::processDataFrame(const FrameHeader& frameHeader, const unsigned char* pPayload)
+{
+	if (frameHeader.streamID == 0)
+		return connectionError(eErrorProtocol, "DATA frame on connection");
+
+	if (frameHeader.streamID > m_lastStreamID)
+		return connectionError(eErrorProtocol, "DATA frame on idle stream");
+
+	size_t payloadLength = frameHeader.length;
+	if (!removePadding(frameHeader, pPayload, payloadLength))
+		return connectionError(eErrorProtocol, "invalid padding");
+
+	// the whole frame (including any padding) counts against the flow control windows, even if we end up discarding it
+	if (frameHeader.length > m_connectionRecvWindow)
+		return connectionError(eErrorFlowControl, "connection flow control window exceeded");
+
+	m_connectionRecvWindow -= frameHeader.length;
+
+	// request bodies are buffered by us (up to the max request body size), rather than being held back by flow
+	// control, so the whole frame is given straight back to the connection's window.
+	if (frameHeader.length > 0)
+	{
+		queueWindowUpdate(0, frameHeader.length);
+		m_connectionRecvWindow += frameHeader.length;
+	}
+
+	StreamMap::iterator itStream = m_aStreams.find(frameHeader.streamID);
+	if (itStream == m_aStreams.end() || itStream->second.requestComplete)
+	{
+		// the stream's either already been closed (possibly by us resetting it, in which case the peer might not have
+		// known yet when it sent this), or the request's already been completely received.
+		if (itStream != m_aStreams.end())
+		{
+			queueRSTStream(frameHeader.streamID, eErrorStreamClosed);
+			closeStream(frameHeader.streamID);
+		}
+		return true;
+	}
+
+	Stream& stream = itStream->second;
+
+	if (frameHeader.length > stream.recvWindow)
+	{
+		queueRSTStream(frameHeader.streamID, eErrorFlowControl);
+		closeStream(frameHeader.streamID);
+		return true;
+	}
+
+	stream.recvWindow -= frameHeader.length;
+
+	const Configuration& configuration = *m_requestConnection.pThreadConfig->pConfiguration;
+	size_t maxBodySize = configuration.getMaxRequestBodySize();
+	if (maxBodySize == 0)
+	{
+		maxBodySize = kDefaultMaxStreamRequestBodySize;
+	}
+
+	if (stream.requestBody.size() + payloadLength > maxBodySize)
+	{
+		m_logger.warning("Request with too large a body received from client: %s. Resetting stream.", m_requestConnection.ipInfo.getIPAddress().c_str());
+
+		queueRSTStream(frameHeader.streamID, eErrorCancel);
+		closeStream(frameHeader.streamID);
+		return true;
+	}
+
+	if (m_bufferedRequestBodySize + payloadLength > std::max(kMaxBufferedRequestBodySize, maxBodySize))
+	{
+		// too many large request bodies at once, but the peer can try again later
+		m_logger.warning("Too many large request bodies being received from client: %s. Refusing stream.", m_requestConnection.ipInfo.getIPAddress().c_str());
+
+		queueRSTStream(frameHeader.streamID, eErrorRefusedStream);
+		closeStream(frameHeader.streamID);
+		return true;
+	}
+
+	stream.requestBody.append((const char*)pPayload, payloadLength);
+	m_bufferedRequestBodySize += payloadLength;
+
+	if (frameHeader.flags & eFlagEndStream)
+	{
+		stream.requestComplete = true;
+		m_aPendingRequests.push_back(frameHeader.streamID);
+	}
+	else if (frameHeader.length > 0)
+	{
+		// as with the connection's window, the stream's is given straight back
+		queueWindowUpdate(frameHeader.streamID, frameHeader.length);
+		stream.recvWindow += frameHeader.length;
+	}
+
+	return true;
+}
+
+bool HTTP2Connection::processSettingsFrame(const FrameHeader& frameHeader, const unsigned char* pPayload)
+{
+	if (frameHeader.streamID != 0)
+		return connectionError(eErrorProtocol, "SETTINGS frame on stream");
+
+	if (frameHeader.flags & eFlagAck)
+	{
+		if (frameHeader.length != 0)
+			return connectionError(eErrorFrameSize, "invalid SETTINGS ACK frame");
+		return true;
+	}
+
+	if (frameHeader.length % 6 != 0)
+		return connectionError(eErrorFrameSize, "invalid SETTINGS frame");
+
+	for (size_t offset = 0; offset < frameHeader.length; offset += 6)
+	{
+		unsigned int parameter = ((unsigned int)pPayload[offset] << 8) | (unsigned int)pPayload[offset + 1];
+		uint32_t value = read32(pPayload + offset + 2);
+
+		if (parameter == eSettingEnablePush)
+		{
+			// we never push anyway
+			if (value > 1)
+				return connectionError(eErrorProtocol, "invalid SETTINGS_ENABLE_PUSH value");
+		}
+		else if (parameter == eSettingInitialWindowSize)
+		{
+			if (value > 0x7FFFFFFF)
+				return connectionError(eErrorFlowControl, "invalid SETTINGS_INITIAL_WINDOW_SIZE value");
+
+			// this applies to the windows of all the open streams, taking into account what's already been sent
+			int64_t delta = (int64_t)value - (int64_t)m_peerInitialWindowSize;
+			for (StreamMap::iterator itStream = m_aStreams.begin(); itStream != m_aStreams.end(); ++itStream)
+			{
+				itStream->second.sendWindow += delta;
+			}
+
+			m_peerInitialWindowSize = value;
+		}
+		else if (parameter == eSettingMaxFrameSize)
+		{
+			if (value < 16384 || value > 16777215)
+				return connectionError(eErrorProtocol, "invalid SETTINGS_MAX_FRAME_SIZE value");
+
+			m_peerMaxFrameSize = value;
+		}
+
+		// SETTINGS_HEADER_TABLE_SIZE doesn't matter, as our encoder doesn't use the dynamic table, and the rest are
+		// either limits on what we can send which we'll never get near, or unknown, which have to be ignored.
+	}
+
+	queueFrame(eFrameSettings, eFlagAck, 0, nullptr, 0);
+
+	return true;
+}
+
+bool HTTP2Connection::processWindowUpdateFrame(const FrameHeader& frameHeader, const unsigned char* pPayload)
+{
+	if (frameHeader.length != 4)
+		return connectionError(eErrorFrameSize, "invalid WINDOW_UPDATE frame");
+
+	uint32_t increment = read32(pPayload) & 0x7FFFFFFF;
+
+	if (frameHeader.streamID == 0)
+	{
+		if (increment == 0)
+			return connectionError(eErrorProtocol, "invalid WINDOW_UPDATE increment");
+
+		m_connectionSendWindow += increment;
+		if (m_connectionSendWindow > 0x7FFFFFFF)
+			return connectionError(eErrorFlowControl, "connection flow control window too large");
+
+		return true;
+	}
+
+	StreamMap::iterator itStream = m_aStreams.find(frameHeader.streamID);
+	if (itStream == m_aStreams.end())
+	{
+		// it might have only just been closed
+		return true;
+	}
+
+	Stream& stream = itStream->second;
+
+	if (increment == 0 || stream.sendWindow + increment > 0x7FFFFFFF)
+	{
+		queueRSTStream(frameHeader.streamID, increment == 0 ? eErrorProtocol : eErrorFlowControl);
+		closeStream(frameHeader.streamID);
+		return true;
+	}
+
+	stream.sendWindow += increment;
+
+	return true;
+}
+
+void HTTP2Connection::handleNextRequest()
+{
+	uint32_t streamID = m_aPendingRequests.front();
+	m_aPendingRequests.pop_front();
+
+	StreamMap::iterator itStream = m_aStreams.find(streamID);
+	if (itStream == m_aStreams.end())
+		return;
+
+	Stream& stream = itStream->second;
+
+	std::string request;
+	if (!buildHTTP1Request(stream, request))
+	{
+		m_logger.info("Malformed HTTP/2 request received from client: %s. Resetting stream.", m_requestConnection.ipInfo.getIPAddress().c_str());
+
+		queueRSTStream(streamID, eErrorProtocol);
+		closeStream(streamID);
+		return;
+	}
+
+	// the body's now in the request
+	m_bufferedRequestBodySize -= stream.requestBody.size();
+	std::string().swap(stream.requestBody);
+
+	RecvBuffer& streamRecvBuffer = m_streamConnection.recvBuffer;
+	streamRecvBuffer.clear();
+
+	char* pWrite = streamRecvBuffer.getWritePointer(request.size());
+	memcpy(pWrite, request.data(), request.size());
+	streamRecvBuffer.commitWrite(request.size());
+
+	size_t requestLength = 0;
+	if (!streamRecvBuffer.findCompleteRequest(requestLength))
+	{
+		queueRSTStream(streamID, eErrorInternal);
+		closeStream(streamID);
+		return;
+	}
+
+	m_streamSocket.clearResponse();
+
+	// each stream is a separate request, so the keep-alive request limit doesn't apply to them
+	m_streamConnection.keepAliveRequestCount = 0;
+
+	MainRequestHandler::RequestResult result = m_mainRequestHandler.handleSingleRequest(m_streamConnection, requestLength);
+
+	std::string& response = m_streamSocket.getResponse();
+
+	unsigned int statusCode = 0;
+	std::string headerBlock;
+	if (response.empty() || !convertHTTP1Response(response, m_streamSocket.getResponseSegments(), statusCode, headerBlock, stream.aResponseBody))
+	{
+		// i.e. the request was rejected without a response (as a malicious one would be)
+		m_streamSocket.clearResponse();
+		queueRSTStream(streamID, eErrorCancel);
+		closeStream(streamID);
+	}
+	else
+	{
+		for (const HTTP2ResponseBodySegment& segment : stream.aResponseBody)
+		{
+			stream.responseBodyRemaining += segment.getRemaining();
+			if (!segment.isFileRange())
+			{
+				stream.pendingResponseSize += segment.getRemaining();
+			}
+		}
+
+		queueHeaderBlock(streamID, headerBlock, stream.responseBodyRemaining == 0);
+
+		if (stream.responseBodyRemaining == 0)
+		{
+			closeStream(streamID);
+		}
+		else
+		{
+			m_pendingResponseSize += stream.pendingResponseSize;
+			m_aSendingStreams.push_back(streamID);
+		}
+	}
+
+	// the equivalent of closing an HTTP/1.1 connection after the request, i.e. keep-alive is disabled, or the server
+	// is draining: the streams which have already been opened are finished off, but no new ones are accepted.
+	if (result == MainRequestHandler::eRequestClose && !m_goAwaySent)
+	{
+		sendGoAway(eErrorNone);
+	}
+}
+
+bool HTTP2Connection::buildHTTP1Request(const Stream& stream, std::string& request)
+{
+	std::string_view method;
+	std::string_view path;
+	std::string_view authority;
+	std::string cookies;
+
+	std::string headerFields;
+
+	bool havePseudoHeaders = true;
+	for (const HPACKHeaderField& field : stream.aRequestHeaders)
+	{
+		// CR, LF and NUL aren't valid anywhere in fields (and would allow injecting fields into the HTTP/1.1 request)
+		if (field.name.empty() || field.name.find_first_of(std::string_view("\r\n\0 ", 4)) != std::string::npos ||
+			field.name.find(':', 1) != std::string::npos || field.value.find_first_of(std::string_view("\r\n\0", 3)) != std::string::npos)
+		{
+			return false;
+		}
+
+		if (field.name[0] == ':')
+		{
+			// pseudo-header fields have to come first
+			if (!havePseudoHeaders)
+				return false;
+
+			if (field.name == ":method")
+				method = field.value;
+			else if (field.name == ":path")
+				path = field.value;
+			else if (field.name == ":authority")
+				authority = field.value;
+			else if (field.name != ":scheme")
+				return false;
+
+			continue;
+		}
+
+		havePseudoHeaders = false;
+
+		// field names must be lower-case
+		if (std::any_of(field.name.begin(), field.name.end(), [](char c) { return c >= 'A' && c <= 'Z'; }))
+			return false;
+
+		// connection-specific fields make the request malformed
+		if (field.name == "connection" || field.name == "keep-alive" || field.name == "proxy-connection" ||
+			field.name == "transfer-encoding" || field.name == "upgrade")
+		{
+			return false;
+		}
+
+		if (field.name == "te")
+		{
+			if (field.value != "trailers")
+				return false;
+			continue;
+		}
+
+		// we provide this ourselves, from the length of the body we've received, and as the body's already been
+		// received, there's nothing for a handler to expect (and not reading it would mean the stream's request
+		// failed).
+		if (field.name == "content-length" || field.name == "expect")
+			continue;
+
+		if (field.name == "host")
+		{
+			if (authority.empty())
+				authority = field.value;
+			continue;
+		}
+
+		// cookies can be split into separate fields (to compress better), so need to be joined back together
+		if (field.name == "cookie")
+		{
+			if (!cookies.empty())
+				cookies += "; ";
+			cookies += field.value;
+			continue;
+		}
+
+		headerFields += field.name;
+		headerFields += ": ";
+		headerFields += field.value;
+		headerFields += "\r\n";
+	}
+
+	if (method.empty() || path.empty() || path.find(' ') != std::string_view::npos)
+		return false;
+
+	request.reserve(method.size() + path.size() + authority.size() + cookies.size() + headerFields.size() + stream.requestBody.size() + 64);
+
+	request.append(method);
+	request += ' ';
+	request.append(path);
+	request += " HTTP/1.1\r\n";
+
+	if (!authority.empty())
+	{
+		request += "Host: ";
+		request.append(authority);
+		request += "\r\n";
+	}
+
+	if (!cookies.empty())
+	{
+		request += "Cookie: ";
+		request += cookies;
+		request += "\r\n";
+	}
+
+	request += headerFields;
+
+	if (!stream.requestBody.empty() || method == "POST")
+	{
+		request += "Content-Length: ";
+		request += std::to_string(stream.requestBody.size());
+		request += "\r\n";
+	}
+
+	request += "\r\n";
+	request += stream.requestBody;
+
+	return true;
+}
+
+bool HTTP2Connection::convertHTTP1Response(std::string& response, HTTP2ResponseBody& aResponseSegments, unsigned int& statusCode,
+										   std::string& headerBlock, HTTP2ResponseBody& aBody)
+{
+	aBody.clear();
+
+	size_t headerEnd = response.find("\r\n\r\n");
+	if (headerEnd == std::string::npos)
+		return false;
+
+	std::string_view header(response.data(), headerEnd + 2);
+
+	// i.e. "HTTP/1.1 200 OK"
+	size_t lineEnd = header.find("\r\n");
+	std::string_view statusLine = header.substr(0, lineEnd);
+	size_t spacePos = statusLine.find(' ');
+	if (spacePos == std::string_view::npos)
+		return false;
+
+	statusCode = (unsigned int)atoi(std::string(statusLine.substr(spacePos + 1, 3)).c_str());
+	if (statusCode < 100 || statusCode > 999)
+		return false;
+
+	HPACKEncoder::encodeStatus(headerBlock, statusCode);
+
+	bool chunked = false;
+	std::string fieldName;
+
+	size_t lineStart = lineEnd + 2;
+	while (lineStart < header.size())
+	{
+		lineEnd = header.find("\r\n", lineStart);
+		std::string_view line = header.substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd + 2;
+
+		size_t colonPos = line.find(':');
+		if (colonPos == std::string_view::npos)
+			continue;
+
+		fieldName = line.substr(0, colonPos);
+		StringHelpers::toLowerInPlace(fieldName);
+
+		std::string_view fieldValue = line.substr(colonPos + 1);
+		while (!fieldValue.empty() && (fieldValue.front() == ' ' || fieldValue.front() == '\t'))
+			fieldValue.remove_prefix(1);
+		while (!fieldValue.empty() && (fieldValue.back() == ' ' || fieldValue.back() == '\t'))
+			fieldValue.remove_suffix(1);
+
+		// connection-specific fields aren't allowed in HTTP/2
+		if (fieldName == "connection" || fieldName == "keep-alive" || fieldName == "proxy-connection" || fieldName == "upgrade")
+			continue;
+
+		if (fieldName == "transfer-encoding")
+		{
+			chunked = fieldValue.find("chunked") != std::string_view::npos;
+			continue;
+		}
+
+		HPACKEncoder::encodeHeaderField(headerBlock, fieldName, fieldValue);
+	}
+
+	if (chunked)
+	{
+		// chunked responses are only ever generated in memory
+		if (!aResponseSegments.empty())
+			return false;
+
+		aBody.emplace_back();
+		return decodeChunkedBody(std::string_view(response).substr(headerEnd + 4), aBody.back().data);
+	}
+
+	if (response.size() > headerEnd + 4)
+	{
+		// avoid copying the body, as it might be large
+		response.erase(0, headerEnd + 4);
+		aBody.emplace_back();
+		aBody.back().data.swap(response);
+	}
+
+	for (HTTP2ResponseBodySegment& segment : aResponseSegments)
+	{
+		aBody.emplace_back(std::move(segment));
+	}
+	aResponseSegments.clear();
+
+	return true;
+}
+
+bool HTTP2Connection::decodeChunkedBody(std::string_view chunkedBody, std::string& body)
+{
+	body.clear();
+	body.reserve(chunkedBody.size());
+
+	size_t pos = 0;
+	while (true)
+	{
+		size_t lineEnd = chunkedBody.find("\r\n", pos);
+		if (lineEnd == std::string_view::npos)
+			return false;
+
+		// any chunk extensions are ignored by strtoul()
+		std::string chunkSizeString(chunkedBody.substr(pos, lineEnd - pos));
+		char* pEnd = nullptr;
+		unsigned long chunkSize = strtoul(chunkSizeString.c_str(), &pEnd, 16);
+		if (pEnd == chunkSizeString.c_str())
+			return false;
+
+		pos = lineEnd + 2;
+
+		if (chunkSize == 0)
+			return true;
+
+		if (chunkSize > chunkedBody.size() - pos)
+			return false;
+
+		body.append(chunkedBody.substr(pos, chunkSize));
+		pos += chunkSize + 2;
+	}
+}
+
+bool HTTP2Connection::sendPendingData()
+{
+	// the streams take it in turns to send a frame, so they all make progress
+	while (!m_aSendingStreams.empty() && m_connectionSendWindow > 0)
+	{
+		bool sentFrame = false;
+
+		size_t numStreams = m_aSendingStreams.size();
+		for (size_t i = 0; i < numStreams && m_connectionSendWindow > 0; i++)
+		{
+			uint32_t streamID = m_aSendingStreams.front();
+			m_aSendingStreams.pop_front();
+
+			StreamMap::iterator itStream = m_aStreams.find(streamID);
+			if (itStream == m_aStreams.end())
+				continue;
+
+			Stream& stream = itStream->second;
+
+			// frames don't span segments, so that file content can be read straight into the send buffer
+			HTTP2ResponseBodySegment& segment = stream.aResponseBody.front();
+
+			int64_t window = std::min(stream.sendWindow, m_connectionSendWindow);
+			size_t frameLength = std::min(segment.getRemaining(), std::min((size_t)m_peerMaxFrameSize, kMaxSendBufferSize));
+			frameLength = (window > 0) ? std::min(frameLength, (size_t)window) : 0;
+
+			if (frameLength == 0)
+			{
+				// waiting for a WINDOW_UPDATE for the stream
+				m_aSendingStreams.push_back(streamID);
+				continue;
+			}
+
+			bool endStream = frameLength == stream.responseBodyRemaining;
+			unsigned char flags = endStream ? eFlagEndStream : 0;
+
+			if (segment.isFileRange())
+			{
+				if (!queueFileDataFrame(flags, streamID, segment.fileFD, segment.fileOffset, frameLength))
+				{
+					// i.e. the file's been truncated since the response header was sent
+					m_logger.error("Error reading file content for HTTP/2 response. Resetting stream.");
+
+					queueRSTStream(streamID, eErrorInternal);
+					closeStream(streamID);
+					continue;
+				}
+
+				segment.fileOffset += frameLength;
+				segment.fileLength -= frameLength;
+			}
+			else
+			{
+				queueFrame(eFrameData, flags, streamID, segment.data.data() + segment.dataSent, frameLength);
+
+				segment.dataSent += frameLength;
+				stream.pendingResponseSize -= frameLength;
+				m_pendingResponseSize -= frameLength;
+			}
+
+			if (segment.getRemaining() == 0)
+			{
+				stream.aResponseBody.pop_front();
+			}
+
+			stream.responseBodyRemaining -= frameLength;
+			stream.sendWindow -= frameLength;
+			m_connectionSendWindow -= frameLength;
+			sentFrame = true;
+
+			if (endStream)
+			{
+				closeStream(streamID);
+			}
+			else
+			{
+				m_aSendingStreams.push_back(streamID);
+			}
+
+			if (m_sendBuffer.size() >= kMaxSendBufferSize && !flushSendBuffer())
+				return false;
+		}
+
+		if (!sentFrame)
+			break;
+	}
+
+	return flushSendBuffer();
+}
+
+void HTTP2Connection::queueFrameHeader(unsigned char type, unsigned char flags, uint32_t streamID, size_t payloadLength)
+{
+	unsigned char aFrameHeader[kFrameHeaderSize];
+	aFrameHeader[0] = (unsigned char)(payloadLength >> 16);
+	aFrameHeader[1] = (unsigned char)(payloadLength >> 8);
+	aFrameHeader[2] = (unsigned char)payloadLength;
+	aFrameHeader[3] = type;
+	aFrameHeader[4] = flags;
+	write32(aFrameHeader + 5, streamID);
+
+	m_sendBuffer.append((const char*)aFrameHeader, kFrameHeaderSize);
+}
+
+void HTTP2Connection::queueFrame(unsigned char type, unsigned char flags, uint32_t streamID, const void* pPayload, size_t payloadLength)
+{
+	queueFrameHeader(type, flags, streamID, payloadLength);
+
+	if (payloadLength > 0)
+	{
+		m_sendBuffer.append((const char*)pPayload, payloadLength);
+	}
+}
+
+bool HTTP2Connection::queueFileDataFrame(unsigned char flags, uint32_t streamID, int fileFD, size_t offset, size_t length)
+{
+	size_t frameStart = m_sendBuffer.size();
+
+	queueFrameHeader(eFrameData, flags, streamID, length);
+
+	// read it straight into the send buffer
+	size_t payloadStart = m_sendBuffer.size();
+	m_sendBuffer.resize(payloadStart + length);
+
+	ssize_t dataRead = pread(fileFD, &m_sendBuffer[payloadStart], length, offset);
+	if (dataRead != (ssize_t)length)
+	{
+		m_sendBuffer.resize(frameStart);
+		return false;
+	}
+
+	return true;
+}
+
+void HTTP2Connection::queueHeaderBlock(uint32_t streamID, const std::string& headerBlock, bool endStream)
+{
+	// anything which doesn't fit in the HEADERS frame goes in CONTINUATION frames
+	size_t offset = 0;
+	do
+	{
+		size_t fragmentLength = std::min(headerBlock.size() - offset, (size_t)m_peerMaxFrameSize);
+		bool endHeaders = offset + fragmentLength == headerBlock.size();
+
+		unsigned char flags = endHeaders ? eFlagEndHeaders : 0;
+		if (offset == 0 && endStream)
+		{
+			flags |= eFlagEndStream;
+		}
+
+		queueFrame(offset == 0 ? eFrameHeaders : eFrameContinuation, flags, streamID, headerBlock.data() + offset, fragmentLength);
+		offset += fragmentLength;
+	}
+	while (offset < headerBlock.size());
+}
+
+void HTTP2Connection::queueRSTStream(uint32_t streamID, ErrorCode errorCode)
+{
+	unsigned char aPayload[4];
+	write32(aPayload, errorCode);
+	queueFrame(eFrameRSTStream, 0, streamID, aPayload, sizeof(aPayload));
+}
+
+void HTTP2Connection::queueWindowUpdate(uint32_t streamID, uint32_t increment)
+{
+	unsigned char aPayload[4];
+	write32(aPayload, increment);
+	queueFrame(eFrameWindowUpdate, 0, streamID, aPayload, sizeof(aPayload));
+}
+
+bool HTTP2Connection::flushSendBuffer()
+{
+	if (m_sendBuffer.empty())
+		return true;
+
+	bool sent = m_requestConnection.pConnectionSocket->send(m_sendBuffer);
+	m_sendBuffer.clear();
+
+	if (!sent)
+	{
+		m_failed = true;
+	}
+
+	return sent;
+}
+
+void HTTP2Connection::sendGoAway(ErrorCode errorCode)
+{
+	// the last stream we'll handle, which doesn't change if we've already sent one
+	if (!m_goAwaySent)
+	{
+		m_goAwayStreamID = m_lastStreamID;
+	}
+
+	unsigned char aPayload[8];
+	write32(aPayload, m_goAwayStreamID);
+	write32(aPayload + 4, errorCode);
+	queueFrame(eFrameGoAway, 0, 0, aPayload, sizeof(aPayload));
+
+	m_goAwaySent = true;
+
+	flushSendBuffer();
+}
+
+void HTTP2Connection::closeStream(uint32_t streamID)
+{
+	StreamMap::iterator itStream = m_aStreams.find(streamID);
+	if (itStream == m_aStreams.end())
+		return;
+
+	// only what's actually been added for the stream (and not sent yet)
+	const Stream& stream = itStream->second;
+	m_pendingResponseSize -= stream.pendingResponseSize;
+	m_bufferedRequestBodySize -= stream.requestBody.size();
+
+	m_aStreams.erase(itStream);
+
+	m_aPendingRequests.erase(std::remove(m_aPendingRequests.begin(), m_aPendingRequests.end(), streamID), m_aPendingRequests.end());
+	m_aSendingStreams.erase(std::remove(m_aSendingStreams.begin(), m_aSendingStreams.end(), streamID), m_aSendingStreams.end());
+}
@@ -0,0 +1,310 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+
+#ifndef HTTP2_CONNECTION_H
+#define HTTP2_CONNECTION_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include "connection_socket.h"
+#include "web_server_common.h"
+#include "hpack.h"
+
+class MainRequestHandler;
+
+// Part of a response body: either data in memory, or a range of a file, which is only read as it's sent.
+// File ranges own a duplicate of the file descriptor, which is closed when the segment is destroyed.
+struct HTTP2ResponseBodySegment
+{
+	HTTP2ResponseBodySegment()
+	{
+	}
+
+	HTTP2ResponseBodySegment(HTTP2ResponseBodySegment&& other) noexcept;
+	~HTTP2ResponseBodySegment();
+
+	HTTP2ResponseBodySegment(const HTTP2ResponseBodySegment&) = delete;
+	HTTP2ResponseBodySegment& operator=(const HTTP2ResponseBodySegment&) = delete;
+
+	bool isFileRange() const
+	{
+		return fileFD != -1;
+	}
+
+	size_t getRemaining() const
+	{
+		return isFileRange() ? fileLength : data.size() - dataSent;
+	}
+
+	std::string		data;
+	size_t			dataSent = 0;
+
+	int				fileFD = -1;
+	size_t			fileOffset = 0;
+	size_t			fileLength = 0;
+};
+
+typedef std::deque<HTTP2ResponseBodySegment> HTTP2ResponseBody;
+
+// Stands in for the real connection socket while a single HTTP/2 stream's request is handled as if it was an
+// HTTP/1.1 one, capturing the HTTP/1.1 response the handlers send, so it can be converted into HTTP/2 frames.
+// File content sent with sendFileData() isn't read here, but kept as a file range, so it can be read as it's sent.
+// The whole request (including any body) is already in the stream's receive buffer, so nothing is ever received.
+class HTTP2StreamConnectionSocket : public ConnectionSocket
+{
+public:
+	HTTP2StreamConnectionSocket(Logger& logger) : ConnectionSocket(logger)
+	{
+	}
+
+	virtual bool send(const std::string& data, unsigned int flags = 0) const override;
+	virtual bool send(unsigned char* pData, size_t dataLength) const override;
+	virtual bool sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags = 0) const override;
+
+	virtual SocketRecvReturnCode recv(RecvBuffer& buffer, unsigned int timeoutSecs) const override;
+	virtual SocketRecvReturnCode recvNonBlocking(RecvBuffer& buffer) const override;
+
+	virtual bool supportsSendFileData() const override
+	{
+		return true;
+	}
+
+	virtual bool sendFileData(int fileFD, size_t offset, size_t length) const override;
+
+	virtual bool close(bool deleteRawSocket) override;
+
+	// everything sent before the first sendFileData() (i.e. the response header, and any body sent along with it)
+	std::string& getResponse()
+	{
+		return m_response;
+	}
+
+	// everything sent from the first sendFileData() onwards
+	HTTP2ResponseBody& getResponseSegments()
+	{
+		return m_aResponseSegments;
+	}
+
+	void clearResponse()
+	{
+		m_response.clear();
+		m_aResponseSegments.clear();
+	}
+
+protected:
+	void appendResponseData(const char* pData, size_t dataLength) const;
+
+protected:
+	// the send functions are const, as they are for real sockets...
+	mutable std::string			m_response;
+	mutable HTTP2ResponseBody	m_aResponseSegments;
+};
+
+// Handles an HTTP/2 connection (RFC 7540) which has been negotiated via ALPN for its entire lifetime.
+// Each stream's request is converted to an HTTP/1.1 one and handled through the MainRequestHandler's normal
+// routing by MainRequestHandler::handleSingleRequest(), and the response is converted back into HEADERS and
+// DATA frames. Requests are handled one at a time in the order they were completed, but the DATA frames of the
+// responses are interleaved as the flow control windows allow, so a slow (or large) response doesn't hold up
+// the ones after it any more than it has to.
+// Note: responses (other than file content, which is read as it's sent) are held in memory until they've been sent,
+//       so no more requests are handled while there's more than kMaxPendingResponseSize bytes of them waiting for
+//       the peer to open its flow control windows. Request bodies are also held in memory until they're complete.
+class HTTP2Connection
+{
+public:
+	HTTP2Connection(MainRequestHandler& mainRequestHandler, RequestConnection& requestConnection);
+	~HTTP2Connection();
+
+	// the ALPN protocol ID
+	static const char* kProtocolID;
+
+	// handles the connection until either side has finished with it, but doesn't close it.
+	void run();
+
+protected:
+	enum FrameType
+	{
+		eFrameData				= 0x0,
+		eFrameHeaders			= 0x1,
+		eFramePriority			= 0x2,
+		eFrameRSTStream			= 0x3,
+		eFrameSettings			= 0x4,
+		eFramePushPromise		= 0x5,
+		eFramePing				= 0x6,
+		eFrameGoAway			= 0x7,
+		eFrameWindowUpdate		= 0x8,
+		eFrameContinuation		= 0x9
+	};
+
+	enum FrameFlags
+	{
+		eFlagEndStream			= 0x1,
+		eFlagAck				= 0x1,
+		eFlagEndHeaders			= 0x4,
+		eFlagPadded				= 0x8,
+		eFlagPriority			= 0x20
+	};
+
+	enum ErrorCode
+	{
+		eErrorNone				= 0x0,
+		eErrorProtocol			= 0x1,
+		eErrorInternal			= 0x2,
+		eErrorFlowControl		= 0x3,
+		eErrorStreamClosed		= 0x5,
+		eErrorFrameSize			= 0x6,
+		eErrorRefusedStream		= 0x7,
+		eErrorCancel			= 0x8,
+		eErrorCompression		= 0x9,
+		eErrorEnhanceYourCalm	= 0xB
+	};
+
+	struct FrameHeader
+	{
+		uint32_t		length;
+		unsigned char	type;
+		unsigned char	flags;
+		uint32_t		streamID;
+	};
+
+	struct Stream
+	{
+		uint32_t		id = 0;
+
+		// the request
+		std::vector<HPACKHeaderField>	aRequestHeaders;
+		std::string		requestBody;
+		// whether the request has been completely received (END_STREAM)
+		bool			requestComplete = false;
+
+		// the body of the response, which is sent as the flow control windows allow
+		HTTP2ResponseBody	aResponseBody;
+		size_t			responseBodyRemaining = 0;
+		// how much of m_pendingResponseSize is this stream's (the in-memory parts of the response body not sent yet)
+		size_t			pendingResponseSize = 0;
+
+		int64_t			sendWindow = 0;
+		// how much of the request body the peer can send before we send a WINDOW_UPDATE for the stream
+		int64_t			recvWindow = 0;
+	};
+
+	typedef std::map<uint32_t, Stream> StreamMap;
+
+protected:
+	bool receivePreface();
+
+	// processes any complete frames which have been received. Returns false if there was a connection error
+	// (in which case a GOAWAY frame has been sent), or the connection otherwise can't continue.
+	bool processReceivedFrames();
+	bool processFrame(const FrameHeader& frameHeader, const unsigned char* pPayload);
+
+	// sends a GOAWAY frame with the error code, after which the connection can't be used any more. Always returns false.
+	bool connectionError(ErrorCode errorCode, const char* pReason);
+
+	// removes the padding from a frame with the PADDED flag set, returning false if it's invalid
+	static bool removePadding(const FrameHeader& frameHeader, const unsigned char*& pPayload, size_t& payloadLength);
+
+	bool processHeadersFrame(const FrameHeader& frameHeader, const unsigned char* pPayload);
+	bool processContinuationFrame(const FrameHeader& frameHeader, const unsigned char* pPayload);
+	bool processHeaderBlock(uint32_t streamID, bool endStream);
+	bool processDataFrame(const FrameHeader& frameHeader, const unsigned char* pPayload);
+	bool processSettingsFrame(const FrameHeader& frameHeader, const unsigned char* pPayload);
+	bool processWindowUpdateFrame(const FrameHeader& frameHeader, const unsigned char* pPayload);
+	void processRSTStreamFrame(const FrameHeader& frameHeader, const unsigned char* pPayload);
+
+	// handles the next complete request, queueing its response to be sent
+	void handleNextRequest();
+	// builds the HTTP/1.1 equivalent of the stream's request, returning false if it's malformed
+	static bool buildHTTP1Request(const Stream& stream, std::string& request);
+	// converts the captured HTTP/1.1 response (the start of it, and any segments after it) into a header block and
+	// the response body, returning false if it can't be parsed
+	static bool convertHTTP1Response(std::string& response, HTTP2ResponseBody& aResponseSegments, unsigned int& statusCode,
+									 std::string& headerBlock, HTTP2ResponseBody& aBody);
+	static bool decodeChunkedBody(std::string_view chunkedBody, std::string& body);
+
+	// sends as many DATA frames of the pending responses as the flow control windows allow
+	bool sendPendingData();
+
+	void queueFrameHeader(unsigned char type, unsigned char flags, uint32_t streamID, size_t payloadLength);
+	void queueFrame(unsigned char type, unsigned char flags, uint32_t streamID, const void* pPayload, size_t payloadLength);
+	// queues a DATA frame with the payload read from the file, returning false if it couldn't be read
+	bool queueFileDataFrame(unsigned char flags, uint32_t streamID, int fileFD, size_t offset, size_t length);
+	void queueHeaderBlock(uint32_t streamID, const std::string& headerBlock, bool endStream);
+	void queueRSTStream(uint32_t streamID, ErrorCode errorCode);
+	void queueWindowUpdate(uint32_t streamID, uint32_t increment);
+	bool flushSendBuffer();
+
+	// sends a GOAWAY frame, after which no new streams are accepted
+	void sendGoAway(ErrorCode errorCode);
+
+	void closeStream(uint32_t streamID);
+
+protected:
+	MainRequestHandler&		m_mainRequestHandler;
+	RequestConnection&		m_requestConnection;
+	Logger&					m_logger;
+
+	// each stream's request is handled through this, which shares everything but the socket and receive
+	// buffer with the real connection
+	RequestConnection				m_streamConnection;
+	HTTP2StreamConnectionSocket		m_streamSocket;
+
+	HPACKDecoder			m_headerDecoder;
+
+	StreamMap				m_aStreams;
+	// streams whose requests have been completely received, waiting to be handled, in order
+	std::deque<uint32_t>	m_aPendingRequests;
+	// streams with response DATA still to send
+	std::deque<uint32_t>	m_aSendingStreams;
+	size_t					m_pendingResponseSize;
+	// the total size of the request bodies being received
+	size_t					m_bufferedRequestBodySize;
+
+	// the highest stream ID the peer has opened
+	uint32_t				m_lastStreamID;
+	// the highest stream ID we told the peer we'd handle in our GOAWAY
+	uint32_t				m_goAwayStreamID;
+
+	// a header block which is being continued with CONTINUATION frames
+	uint32_t				m_headerBlockStreamID;
+	bool					m_headerBlockEndStream;
+	std::string				m_headerBlock;
+
+	// the peer's settings
+	uint32_t				m_peerInitialWindowSize;
+	uint32_t				m_peerMaxFrameSize;
+
+	int64_t					m_connectionSendWindow;
+	// how much the peer can send (in DATA frames) before we send a WINDOW_UPDATE for the connection
+	int64_t					m_connectionRecvWindow;
+
+	// frames waiting to be sent, so that several of them can be sent together
+	std::string				m_sendBuffer;
+
+	bool					m_goAwaySent;
+	bool					m_goAwayReceived;
+	bool					m_failed;
+};
+
+#endif // HTTP2_CONNECTION_H
@@ -0,0 +1,203 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef HTTP_HEADER_FIELDS_H
+#define HTTP_HEADER_FIELDS_H
+
+#include <string_view>
+
+// Well-known HTTP header fields, which WebRequest indexes directly, so they can be looked up without
+// having to search through all the fields in the request.
+enum HTTPHeaderField
+{
+	eHeaderHost,
+	eHeaderConnection,
+	eHeaderUserAgent,
+	eHeaderCookie,
+	eHeaderAuthorization,
+	eHeaderAccept,
+	eHeaderAcceptEncoding,
+	eHeaderAcceptLanguage,
+	eHeaderAcceptCharset,
+	eHeaderCacheControl,
+	eHeaderPragma,
+	eHeaderIfNoneMatch,
+	eHeaderIfModifiedSince,
+	eHeaderIfMatch,
+	eHeaderIfUnmodifiedSince,
+	eHeaderIfRange,
+	eHeaderRange,
+	eHeaderContentLength,
+	eHeaderContentType,
+	eHeaderTransferEncoding,
+	eHeaderTE,
+	eHeaderExpect,
+	eHeaderUpgrade,
+	eHeaderReferer,
+	eHeaderOrigin,
+	eHeaderDNT,
+	eHeaderXForwardedFor,
+	eHeaderXForwardedProto,
+	eHeaderXRealIP,
+	eHeaderForwarded,
+	eHeaderKeepAlive,
+	eHeaderUpgradeInsecureRequests,
+	eHeaderSecFetchDest,
+	eHeaderSecFetchMode,
+	eHeaderSecFetchSite,
+	eHeaderSecFetchUser,
+	eHeaderVia,
+
+	eNumKnownHeaderFields,
+	eHeaderUnknown = eNumKnownHeaderFields
+};
+
+namespace HTTPHeaderFields
+{
+
+// in the same order as HTTPHeaderField, and lower-case, as field names are case-insensitive
+constexpr std::string_view kNames[eNumKnownHeaderFields] = {
+	"host",
+	"connection",
+	"user-agent",
+	"cookie",
+	"authorization",
+	"accept",
+	"accept-encoding",
+	"accept-language",
+	"accept-charset",
+	"cache-control",
+	"pragma",
+	"if-none-match",
+	"if-modified-since",
+	"if-match",
+	"if-unmodified-since",
+	"if-range",
+	"range",
+	"content-length",
+	"content-type",
+	"transfer-encoding",
+	"te",
+	"expect",
+	"upgrade",
+	"referer",
+	"origin",
+	"dnt",
+	"x-forwarded-for",
+	"x-forwarded-proto",
+	"x-real-ip",
+	"forwarded",
+	"keep-alive",
+	"upgrade-insecure-requests",
+	"sec-fetch-dest",
+	"sec-fetch-mode",
+	"sec-fetch-site",
+	"sec-fetch-user",
+	"via"
+};
+
+constexpr unsigned int kHashTableSize = 64;
+
+// lower-cases letters, and leaves the other characters valid in field names alone (apart from a few punctuation
+// characters, which don't appear in any of the known names, so it doesn't matter).
+constexpr unsigned int lowerChar(char c)
+{
+	return (unsigned char)c | 0x20;
+}
+
+// Perfect hash (for the known names) based on the length and a few of the characters, so it's cheap to work out.
+// The multipliers were found by brute-force search, and kHashTable below checks there are no collisions at compile
+// time, so any names added will need them re-finding if it fails.
+constexpr unsigned int hashName(std::string_view name)
+{
+	size_t length = name.size();
+	if (length == 0)
+		return 0;
+
+	unsigned int hash = (unsigned int)length * 9 + lowerChar(name[0]) * 39 + lowerChar(name[length - 1]) * 27 +
+						lowerChar(name[length / 2]) * 4 + lowerChar(name[(length >= 3) ? length - 3 : 0]);
+	return hash % kHashTableSize;
+}
+
+struct HashTable
+{
+	// indices into kNames, or eHeaderUnknown for empty slots
+	unsigned char	aSlots[kHashTableSize] = {};
+	bool			collisionFree = true;
+};
+
+constexpr HashTable buildHashTable()
+{
+	HashTable table;
+	for (unsigned int i = 0; i < kHashTableSize; i++)
+	{
+		table.aSlots[i] = eHeaderUnknown;
+	}
+
+	for (unsigned int i = 0; i < eNumKnownHeaderFields; i++)
+	{
+		unsigned int slot = hashName(kNames[i]);
+		if (table.aSlots[slot] != eHeaderUnknown)
+		{
+			table.collisionFree = false;
+		}
+		table.aSlots[slot] = (unsigned char)i;
+	}
+
+	return table;
+}
+
+constexpr HashTable kHashTable = buildHashTable();
+static_assert(kHashTable.collisionFree, "HTTP header field name hash has collisions - the multipliers need re-finding.");
+
+constexpr bool equalsIgnoreCase(std::string_view name, std::string_view lowerCaseName)
+{
+	if (name.size() != lowerCaseName.size())
+		return false;
+
+	for (size_t i = 0; i < name.size(); i++)
+	{
+		char c = name[i];
+		if (c >= 'A' && c <= 'Z')
+		{
+			c += 'a' - 'A';
+		}
+
+		if (c != lowerCaseName[i])
+			return false;
+	}
+
+	return true;
+}
+
+// returns the known field for the (case-insensitive) name, or eHeaderUnknown
+constexpr HTTPHeaderField lookupField(std::string_view name)
+{
+	unsigned char index = kHashTable.aSlots[hashName(name)];
+	if (index == eHeaderUnknown || !equalsIgnoreCase(name, kNames[index]))
+		return eHeaderUnknown;
+
+	return (HTTPHeaderField)index;
+}
+
+static_assert(lookupField("If-None-Match") == eHeaderIfNoneMatch, "");
+static_assert(lookupField("X-Unknown") == eHeaderUnknown, "");
+
+} // namespace HTTPHeaderFields
+
+#endif // HTTP_HEADER_FIELDS_H
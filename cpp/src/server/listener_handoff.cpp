@@ -0,0 +1,384 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#include "listener_handoff.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include "utils/logger.h"
+
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_CMSG_CLOEXEC
+	#define MSG_CMSG_CLOEXEC 0
+#endif
+
+static const unsigned int kMaxListeners = 8;
+
+// "WSLH"
+static const uint32_t kHandoffMagic = 0x57534c48;
+
+static const char kReadyMessage = 'R';
+static const char kDoneMessage = 'D';
+
+// how long the new process waits for the old one to acknowledge the ready message
+static const unsigned int kDoneTimeoutSecs = 10;
+
+// sent from the old process to the new one, along with the listening socket file descriptors
+struct HandoffMessage
+{
+	uint32_t	magic;
+	uint32_t	numListeners;
+	uint32_t	aListenerTypes[kMaxListeners];
+};
+
+static bool fillSocketAddress(const std::string& socketPath, struct sockaddr_un& address)
+{
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (socketPath.size() >= sizeof(address.sun_path))
+		return false;
+
+	strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+	return true;
+}
+
+ListenerHandoff::ListenerHandoff(Logger& logger, const std::string& socketPath) :
+	m_logger(logger),
+	m_socketPath(socketPath),
+	m_oldProcessFD(-1),
+	m_listenFD(-1),
+	m_active(false)
+{
+
+}
+
+ListenerHandoff::~ListenerHandoff()
+{
+	stop();
+
+	if (m_oldProcessFD != -1)
+	{
+		::close(m_oldProcessFD);
+		m_oldProcessFD = -1;
+	}
+}
+
+bool ListenerHandoff::receiveListeners(std::vector<Listener>& aListeners)
+{
+	struct sockaddr_un address;
+	if (!fillSocketAddress(m_socketPath, address))
+	{
+		m_logger.error("Upgrade socket path: '%s' is too long.", m_socketPath.c_str());
+		return false;
+	}
+
+	int socketFD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (socketFD == -1)
+		return false;
+
+	if (::connect(socketFD, (struct sockaddr*)&address, sizeof(address)) == -1)
+	{
+		// this is the normal situation if there isn't an existing process running
+		::close(socketFD);
+		return false;
+	}
+
+	HandoffMessage message;
+	memset(&message, 0, sizeof(message));
+
+	struct iovec messageIOVec;
+	messageIOVec.iov_base = &message;
+	messageIOVec.iov_len = sizeof(message);
+
+	char controlBuffer[CMSG_SPACE(sizeof(int) * kMaxListeners)];
+	memset(controlBuffer, 0, sizeof(controlBuffer));
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &messageIOVec;
+	msg.msg_iovlen = 1;
+	msg.msg_control = controlBuffer;
+	msg.msg_controllen = sizeof(controlBuffer);
+
+	ssize_t ret = ::recvmsg(socketFD, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	if (ret != sizeof(message) || message.magic != kHandoffMagic || message.numListeners > kMaxListeners)
+	{
+		m_logger.error("Invalid listener handoff message received from existing process.");
+		::close(socketFD);
+		return false;
+	}
+
+	std::vector<int> aReceivedFDs;
+	for (struct cmsghdr* pCMsg = CMSG_FIRSTHDR(&msg); pCMsg != nullptr; pCMsg = CMSG_NXTHDR(&msg, pCMsg))
+	{
+		if (pCMsg->cmsg_level != SOL_SOCKET || pCMsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		size_t numFDs = (pCMsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		const int* pFDs = (const int*)CMSG_DATA(pCMsg);
+		for (size_t i = 0; i < numFDs; i++)
+		{
+			aReceivedFDs.emplace_back(pFDs[i]);
+		}
+	}
+
+	if (aReceivedFDs.size() != message.numListeners || (msg.msg_flags & MSG_CTRUNC))
+	{
+		m_logger.error("Unexpected number of listening sockets received from existing process.");
+		for (int fd : aReceivedFDs)
+		{
+			::close(fd);
+		}
+		::close(socketFD);
+		return false;
+	}
+
+	for (unsigned int i = 0; i < message.numListeners; i++)
+	{
+		Listener newListener;
+		newListener.type = (ListenerType)message.aListenerTypes[i];
+		newListener.fd = aReceivedFDs[i];
+		aListeners.emplace_back(newListener);
+	}
+
+	// keep this open, so we can tell the old process when we're ready
+	m_oldProcessFD = socketFD;
+
+	return true;
+}
+
+void ListenerHandoff::notifyReady()
+{
+	if (m_oldProcessFD == -1)
+		return;
+
+	char message = kReadyMessage;
+	if (::send(m_oldProcessFD, &message, 1, MSG_NOSIGNAL) == 1)
+	{
+		// wait for the old process to acknowledge, which it does once it's stopped listening on the socket path,
+		// so we know we can take it over. We don't really care what the reply is (or if there isn't one).
+		struct timeval timeout;
+		timeout.tv_sec = kDoneTimeoutSecs;
+		timeout.tv_usec = 0;
+		setsockopt(m_oldProcessFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		char reply = 0;
+		ssize_t ret = ::recv(m_oldProcessFD, &reply, 1, 0);
+		(void)ret;
+	}
+
+	::close(m_oldProcessFD);
+	m_oldProcessFD = -1;
+
+	m_logger.notice("Notified previous process that we're ready to serve requests.");
+}
+
+bool ListenerHandoff::startListening(const std::vector<Listener>& aListeners, std::function<void()> readyFunction)
+{
+	struct sockaddr_un address;
+	if (!fillSocketAddress(m_socketPath, address))
+	{
+		m_logger.error("Upgrade socket path: '%s' is too long.", m_socketPath.c_str());
+		return false;
+	}
+
+	m_aListeners = aListeners;
+	m_readyFunction = readyFunction;
+
+	m_listenFD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_listenFD == -1)
+	{
+		m_logger.error("Could not create upgrade socket: %s", strerror(errno));
+		return false;
+	}
+
+	// remove any stale socket file left by a previous process - if there was actually still a process listening on it,
+	// we would have taken over from it in receiveListeners().
+	::unlink(m_socketPath.c_str());
+
+	if (::bind(m_listenFD, (struct sockaddr*)&address, sizeof(address)) == -1)
+	{
+		m_logger.error("Could not bind upgrade socket: %s, %s", m_socketPath.c_str(), strerror(errno));
+		closeListenSocket(false);
+		return false;
+	}
+
+	// only processes running as the same user should be able to take over the listeners
+	::chmod(m_socketPath.c_str(), S_IRUSR | S_IWUSR);
+
+	if (::listen(m_listenFD, 1) == -1)
+	{
+		m_logger.error("Could not listen on upgrade socket: %s", strerror(errno));
+		closeListenSocket(true);
+		return false;
+	}
+
+	m_active = true;
+	m_listenThread = std::thread(&ListenerHandoff::listenThreadFunction, this);
+
+	return true;
+}
+
+void ListenerHandoff::stop()
+{
+	m_active = false;
+
+	if (m_listenThread.joinable())
+	{
+		m_listenThread.join();
+	}
+
+	// if we've handed over to a new process, the listen socket will already have been closed, and the socket
+	// file now belongs to the new process, so we mustn't remove it.
+	closeListenSocket(true);
+}
+
+void ListenerHandoff::listenThreadFunction()
+{
+	while (m_active)
+	{
+		struct pollfd fd;
+		fd.fd = m_listenFD;
+		fd.events = POLLIN;
+		fd.revents = 0;
+
+		// have a timeout so that we notice m_active being unset...
+		int pollRet = poll(&fd, 1, 1000);
+		if (pollRet <= 0)
+			continue;
+
+		int connectionFD = ::accept(m_listenFD, nullptr, nullptr);
+		if (connectionFD == -1)
+			continue;
+
+		if (handOverToNewProcess(connectionFD))
+		{
+			m_readyFunction();
+			break;
+		}
+	}
+}
+
+bool ListenerHandoff::handOverToNewProcess(int connectionFD)
+{
+	m_logger.notice("New process connected to upgrade socket. Handing over %u listening sockets.", (unsigned int)m_aListeners.size());
+
+	HandoffMessage message;
+	memset(&message, 0, sizeof(message));
+	message.magic = kHandoffMagic;
+	message.numListeners = (uint32_t)m_aListeners.size();
+
+	struct iovec messageIOVec;
+	messageIOVec.iov_base = &message;
+	messageIOVec.iov_len = sizeof(message);
+
+	char controlBuffer[CMSG_SPACE(sizeof(int) * kMaxListeners)];
+	memset(controlBuffer, 0, sizeof(controlBuffer));
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &messageIOVec;
+	msg.msg_iovlen = 1;
+
+	if (!m_aListeners.empty())
+	{
+		msg.msg_control = controlBuffer;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * m_aListeners.size());
+
+		struct cmsghdr* pCMsg = CMSG_FIRSTHDR(&msg);
+		pCMsg->cmsg_level = SOL_SOCKET;
+		pCMsg->cmsg_type = SCM_RIGHTS;
+		pCMsg->cmsg_len = CMSG_LEN(sizeof(int) * m_aListeners.size());
+
+		int* pFDs = (int*)CMSG_DATA(pCMsg);
+		for (size_t i = 0; i < m_aListeners.size() && i < kMaxListeners; i++)
+		{
+			message.aListenerTypes[i] = (uint32_t)m_aListeners[i].type;
+			pFDs[i] = m_aListeners[i].fd;
+		}
+	}
+
+	if (::sendmsg(connectionFD, &msg, MSG_NOSIGNAL) != sizeof(message))
+	{
+		m_logger.error("Could not send listening sockets to new process: %s", strerror(errno));
+		::close(connectionFD);
+		return false;
+	}
+
+	// now wait (for as long as it takes the new process to start up) for it to say it's ready. We carry on
+	// accepting connections on the listening sockets in the meantime.
+	while (m_active)
+	{
+		struct pollfd fd;
+		fd.fd = connectionFD;
+		fd.events = POLLIN;
+		fd.revents = 0;
+
+		int pollRet = poll(&fd, 1, 1000);
+		if (pollRet <= 0)
+			continue;
+
+		char reply = 0;
+		ssize_t ret = ::recv(connectionFD, &reply, 1, 0);
+		if (ret != 1 || reply != kReadyMessage)
+		{
+			m_logger.warning("New process disconnected from upgrade socket before it was ready. Continuing as normal.");
+			::close(connectionFD);
+			return false;
+		}
+
+		// stop listening first, so that the new process can take over the socket path once we've acknowledged
+		closeListenSocket(false);
+
+		char doneMessage = kDoneMessage;
+		ret = ::send(connectionFD, &doneMessage, 1, MSG_NOSIGNAL);
+		(void)ret;
+
+		::close(connectionFD);
+		return true;
+	}
+
+	::close(connectionFD);
+	return false;
+}
+
+void ListenerHandoff::closeListenSocket(bool removeSocketFile)
+{
+	if (m_listenFD == -1)
+		return;
+
+	::close(m_listenFD);
+	m_listenFD = -1;
+
+	if (removeSocketFile)
+	{
+		::unlink(m_socketPath.c_str());
+	}
+}
@@ -0,0 +1,100 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef LISTENER_HANDOFF_H
+#define LISTENER_HANDOFF_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+class Logger;
+
+// Allows a new server process to take over the listening sockets of an existing one (i.e. when upgrading
+// the binary), so that there's no window where connections are refused while the new one starts up:
+// - The running process listens on a UNIX domain socket at the configured path.
+// - A new process connects to it at startup, and is sent the bound listening sockets (with SCM_RIGHTS),
+//   which it uses instead of binding its own. The old process carries on accepting connections on them
+//   meanwhile, so slow startup work in the new process (i.e. building photo catalogues) isn't noticed.
+// - Once the new process is ready to serve, it sends a ready message, at which point the old process stops
+//   accepting, drains its existing connections and exits, and the new process takes over listening on the
+//   UNIX socket for the next upgrade.
+class ListenerHandoff
+{
+public:
+	ListenerHandoff(Logger& logger, const std::string& socketPath);
+	~ListenerHandoff();
+
+	enum ListenerType
+	{
+		eListenerHTTPv4,
+		eListenerHTTPSv4,
+		eListenerHTTPv6,
+		eListenerHTTPSv6
+	};
+
+	struct Listener
+	{
+		ListenerType	type;
+		int				fd;
+	};
+
+	// new process side: if there's an existing process listening on the socket path, receives its listening sockets,
+	// keeping the connection to it open until notifyReady() is called. Returns false if there isn't an existing process
+	// (or the handoff failed), in which case the caller should just bind its own sockets.
+	bool receiveListeners(std::vector<Listener>& aListeners);
+
+	// new process side: tells the old process (if there was one) that we're ready to serve, and waits for it to
+	// stop listening on the socket path.
+	void notifyReady();
+
+	// current process side: starts listening on the socket path for a new process to hand the listeners to.
+	// readyFunction is called (on the handoff thread) once a new process has taken over and said it's ready,
+	// after which no further handoffs are done by this process.
+	bool startListening(const std::vector<Listener>& aListeners, std::function<void()> readyFunction);
+
+	void stop();
+
+protected:
+	void listenThreadFunction();
+
+	// sends the listeners to the new process, and waits for it to say it's ready.
+	// Returns false if it disconnected before then.
+	bool handOverToNewProcess(int connectionFD);
+
+	void closeListenSocket(bool removeSocketFile);
+
+protected:
+	Logger&					m_logger;
+	std::string				m_socketPath;
+
+	// connection to the old process, only valid between receiveListeners() and notifyReady()
+	int						m_oldProcessFD;
+
+	int						m_listenFD;
+	// we don't own these - they're the WebServerService's sockets
+	std::vector<Listener>	m_aListeners;
+	std::function<void()>	m_readyFunction;
+
+	std::thread				m_listenThread;
+	std::atomic<bool>		m_active;
+};
+
+#endif // LISTENER_HANDOFF_H
@@ -20,6 +20,8 @@
 
 #include "web_server_common.h"
 #include "web_request.h"
+#include "request_body_reader.h"
+#include "http2_connection.h"
 #include "web_response.h"
 
 #include "configuration.h"
@@ -33,6 +35,9 @@
 #include "files_handler/files_request_handler.h"
 #include "proxy_handler/proxy_request_handler.h"
 
+// timeout for each wait for more of a request body which wasn't received with the header
+static const unsigned int kRequestBodyRecvTimeout = 10;
+
 MainRequestHandler::MainRequestHandler() :
 	m_accessControlEnabled(false),
 	m_404NotFoundResponsesEnabled(true),
@@ -40,7 +45,8 @@ MainRequestHandler::MainRequestHandler() :
 	m_photosType(eSSOff), // Note: this doesn't match the default of Configuration.
 	m_haveDirSubRequestHandlers(false),
 	m_haveHostSubRequestHandlers(false),
-	m_fallbackHandler(nullptr)
+	m_fallbackHandler(nullptr),
+	m_draining(false)
 {
 
 }
@@ -86,6 +92,19 @@ void MainRequestHandler::configure(const Configuration& configuration, Logger& l
 	}
 }
 
+bool MainRequestHandler::acceptConnection(RequestConnection& requestConnection)
+{
+	// see if we should agressively abort the connection due to a client ban
+	if (!m_accessController.shouldAcceptConnection(requestConnection))
+	{
+		// we shouldn't accept it, so close it from our side...
+		requestConnection.closeConnectionAndFreeSockets();
+		return false;
+	}
+
+	return true;
+}
+
 void MainRequestHandler::handleRequest(RequestConnection& requestConnection)
 {
 	Logger& logger = requestConnection.logger();
@@ -94,19 +113,25 @@ void MainRequestHandler::handleRequest(RequestConnection& requestConnection)
 	logger.debug("Request received at handleRequest() for IP: %s.", requestConnection.ipInfo.getIPAddress().c_str());
 
 	// first of all, see if we should agressively abort the connection due to a client ban
-	if (!m_accessController.shouldAcceptConnection(requestConnection))
+	if (!acceptConnection(requestConnection))
 	{
-		// we shouldn't accept it, so close it from our side...
-		requestConnection.closeConnectionAndFreeSockets();
 		return;
 	}
 
-	unsigned int connectionKeepAliveCount = 0;
-	bool shouldKeepAliveNextTime = configuration.getKeepAliveEnabled();
+	if (requestConnection.http2)
+	{
+		// each of its streams is handled through handleSingleRequest()
+		HTTP2Connection http2Connection(*this, requestConnection);
+		http2Connection.run();
+
+		requestConnection.closeConnectionAndFreeSockets();
+		return;
+	}
 
-	std::string requestString;
-	// TODO: add timeout here...
-	SocketRecvReturnCode recvRetCode = requestConnection.pConnectionSocket->recvSmart(requestString, 5);
+	size_t requestLength = 0;
+	
+	// TODO: make this timeout configurable?
+	SocketRecvReturnCode recvRetCode = receiveRequest(requestConnection, 5, requestLength);
 
 	if (recvRetCode.type == eSockRecv_Error)
 	{
@@ -119,15 +144,17 @@ void MainRequestHandler::handleRequest(RequestConnection& requestConnection)
 		logger.info("Empty response received. Aborting connection.");
 	}
 	
+	else if (recvRetCode.type == eSockRecv_TimedOutWithData)
+	{
+		logger.info("Incomplete request received from client: %s. Aborting connection.", requestConnection.ipInfo.getIPAddress().c_str());
+	}
+	
 	if (recvRetCode.type == eSockRecv_PeerClosed)
 	{
 		logger.debug("Closing connection due to peer close from IP : %s.", requestConnection.ipInfo.getIPAddress().c_str());
 	}
 
-	if (recvRetCode.type == eSockRecv_Error ||
-		recvRetCode.type == eSockRecv_NoData ||
-		recvRetCode.type == eSockRecv_PeerClosed ||
-		recvRetCode.type == eSockRecv_TimedOutNoData)
+	if (recvRetCode.type != eSockRecv_OK)
 	{
 		requestConnection.closeConnectionAndFreeSockets();
 		return;
@@ -135,282 +162,483 @@ void MainRequestHandler::handleRequest(RequestConnection& requestConnection)
 	
 	bool closedKeepAliveConnectionDueToTimeout = false;
 
-	do
+	// Note: anything received after each request is kept in the receive buffer, so any further pipelined requests
+	//       are handled (and responded to) in order, without waiting to receive anything more.
+	while (handleSingleRequest(requestConnection, requestLength) == eRequestKeepAlive)
 	{
-		WebRequest newRequest(requestString);
-
-		if (!newRequest.parse(logger))
+		// if we don't already have another complete request, do a receive with a timeout, such that we can abort this
+		// connection and close it if it's not being used
+		recvRetCode = receiveRequest(requestConnection, configuration.getKeepAliveTimeout(), requestLength);
+		if (recvRetCode.type != eSockRecv_OK)
 		{
-			logger.error("Invalid Request received from client: %s. Ignoring and aborting connection.", requestConnection.ipInfo.getIPAddress().c_str());
-
-			requestConnection.closeConnectionAndFreeSockets();
-			return;
+			logger.debug("Request socket Keep Alive receive failed/timed out. Closing");
+			// TODO: we probably want to try and isolate this to just the timeout event, and not a failure as well as currently happens?
+			closedKeepAliveConnectionDueToTimeout = true;
+			break;
 		}
-
-		if (newRequest.getPath().empty())
+		else
 		{
-			requestConnection.closeConnectionAndFreeSockets();
-			return;
+			logger.debug("Request socket Keep Alive received further request: %u", requestConnection.keepAliveRequestCount);
 		}
-		
-		if (!requestConnection.https)
+	}
+	
+	if (closedKeepAliveConnectionDueToTimeout)
+	{
+		sendKeepAliveTimeoutResponse(requestConnection);
+	}
+
+	requestConnection.closeConnectionAndFreeSockets();
+}
+
+MainRequestHandler::RequestResult MainRequestHandler::handleSingleRequest(RequestConnection& requestConnection, size_t requestLength)
+{
+	if (!checkRequestBody(requestConnection))
+	{
+		return eRequestClose;
+	}
+
+	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
+	RecvBuffer& recvBuffer = requestConnection.recvBuffer;
+
+	RequestBodyReader bodyReader(requestConnection, recvBuffer.getHeaderLength(), recvBuffer.getContentLength(), recvBuffer.isChunkedBody(),
+								 configuration.getMaxRequestBodySize(), kRequestBodyRecvTimeout);
+
+	WebRequest newRequest(recvBuffer.getView(requestLength));
+	newRequest.setBodyReader(&bodyReader);
+	bodyReader.setExpectContinue(newRequest.expectsContinue());
+
+	RequestRouting routing;
+
+	if (!routeRequest(requestConnection, newRequest, routing))
+	{
+		return eRequestClose;
+	}
+
+	requestConnection.pConnectionSocket->beginResponse();
+
+	WebRequestHandlerResult handleRequestResult;
+	if (routing.pSubRequestHandler)
+	{
+		handleRequestResult = routing.pSubRequestHandler->handleRequest(requestConnection, newRequest, routing.handlerURI);
+	}
+
+	if (m_fallbackHandler && !handleRequestResult.wasHandled)
+	{
+		handleRequestResult = m_fallbackHandler->handleRequest(requestConnection, newRequest, routing.requestPath);
+	}
+
+	RequestResult result = finishRequest(requestConnection, newRequest, routing, handleRequestResult);
+
+	requestConnection.pConnectionSocket->endResponse();
+
+	return finishRequestBody(bodyReader, result);
+}
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+Task<MainRequestHandler::RequestResult> MainRequestHandler::handleSingleRequestAsync(RequestConnection& requestConnection, size_t requestLength)
+{
+	if (!checkRequestBody(requestConnection))
+	{
+		co_return eRequestClose;
+	}
+
+	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
+	RecvBuffer& recvBuffer = requestConnection.recvBuffer;
+
+	RequestBodyReader bodyReader(requestConnection, recvBuffer.getHeaderLength(), recvBuffer.getContentLength(), recvBuffer.isChunkedBody(),
+								 configuration.getMaxRequestBodySize(), kRequestBodyRecvTimeout);
+
+	WebRequest newRequest(recvBuffer.getView(requestLength));
+	newRequest.setBodyReader(&bodyReader);
+	bodyReader.setExpectContinue(newRequest.expectsContinue());
+
+	RequestRouting routing;
+
+	if (!routeRequest(requestConnection, newRequest, routing))
+	{
+		co_return eRequestClose;
+	}
+
+	requestConnection.pConnectionSocket->beginResponse();
+
+	WebRequestHandlerResult handleRequestResult;
+	if (routing.pSubRequestHandler)
+	{
+		handleRequestResult = co_await routing.pSubRequestHandler->handleRequestAsync(requestConnection, newRequest, routing.handlerURI);
+	}
+
+	if (m_fallbackHandler && !handleRequestResult.wasHandled)
+	{
+		handleRequestResult = co_await m_fallbackHandler->handleRequestAsync(requestConnection, newRequest, routing.requestPath);
+	}
+
+	RequestResult result = finishRequest(requestConnection, newRequest, routing, handleRequestResult);
+
+	requestConnection.pConnectionSocket->endResponse();
+
+	co_return finishRequestBody(bodyReader, result);
+}
+#endif
+
+SocketRecvReturnCode MainRequestHandler::receiveRequest(RequestConnection& requestConnection, unsigned int timeoutSecs, size_t& requestLength)
+{
+	RecvBuffer& recvBuffer = requestConnection.recvBuffer;
+	
+	while (!recvBuffer.findCompleteRequest(requestLength))
+	{
+		SocketRecvReturnCode recvRetCode = requestConnection.pConnectionSocket->recv(recvBuffer, timeoutSecs);
+		if (recvRetCode.type == eSockRecv_TimedOutNoData && !recvBuffer.isEmpty())
 		{
-			requestConnection.connStatistics.httpRequests += 1;
+			return SocketRecvReturnCode(eSockRecv_TimedOutWithData);
 		}
-		else
+		else if (recvRetCode.type != eSockRecv_OK)
 		{
-			requestConnection.connStatistics.httpsRequests += 1;
+			return recvRetCode;
 		}
+	}
+	
+	return SocketRecvReturnCode(eSockRecv_OK);
+}
 
-		// web browsers (and even wget and CURL these days) seem to sanitise this sort of stuff much better up-front these days, but
-		// there's still telnet / custom apps to allow arbitrary relative path requests, so let's attempt to kill these connections
-		// immediately...
-		// TODO: need to have a real think about how to do this properly and robustly, especially with regards to future
-		//       subsite expansion functionality...
-		if (newRequest.getPath().find("../") != std::string::npos ||
-			newRequest.getPath().find("//") != std::string::npos ||
-			newRequest.getPath().find('~') != std::string::npos ||
-			newRequest.getPath().find(".php") != std::string::npos ||
-			newRequest.getPath().find(".sql") != std::string::npos ||
-			newRequest.getPath().find(".asp") != std::string::npos)
-		{
-			logger.warning("Probable malicious request: '%s' received from client: %s. Aborting connection.", newRequest.getPath().c_str(), requestConnection.ipInfo.getIPAddress().c_str());
-			
-			if (m_accessControlEnabled)
-			{
-				m_accessController.addFailedConnection(requestConnection, true);
-			}
+bool MainRequestHandler::routeRequest(RequestConnection& requestConnection, WebRequest& newRequest, RequestRouting& routing)
+{
+	Logger& logger = requestConnection.logger();
+	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
 
-			requestConnection.closeConnectionAndFreeSockets();
-			return;
-		}
+	if (!newRequest.parse(logger))
+	{
+		logger.error("Invalid Request received from client: %s. Ignoring and aborting connection.", requestConnection.ipInfo.getIPAddress().c_str());
 
-		shouldKeepAliveNextTime = configuration.getKeepAliveEnabled() && newRequest.getConnectionType() == WebRequest::eConnectionKeepAlive;
+		return false;
+	}
 
-		WebRequestHandlerResult handleRequestResult;
+	if (newRequest.getPath().empty())
+	{
+		return false;
+	}
+	
+	if (!requestConnection.https)
+	{
+		requestConnection.connStatistics.httpRequests += 1;
+	}
+	else
+	{
+		requestConnection.connStatistics.httpsRequests += 1;
+	}
 
-		std::string requestPath = newRequest.getPath();
+	// web browsers (and even wget and CURL these days) seem to sanitise this sort of stuff much better up-front these days, but
+	// there's still telnet / custom apps to allow arbitrary relative path requests, so let's attempt to kill these connections
+	// immediately...
+	// TODO: need to have a real think about how to do this properly and robustly, especially with regards to future
+	//       subsite expansion functionality...
+	const std::string_view path = newRequest.getPath();
+	if (path.find("../") != std::string_view::npos ||
+		path.find("//") != std::string_view::npos ||
+		path.find('~') != std::string_view::npos ||
+		path.find(".php") != std::string_view::npos ||
+		path.find(".sql") != std::string_view::npos ||
+		path.find(".asp") != std::string_view::npos)
+	{
+		logger.warning("Probable malicious request: '%s' received from client: %s. Aborting connection.", std::string(path).c_str(), requestConnection.ipInfo.getIPAddress().c_str());
 		
-		// see if we need to redirect to HTTPS
-		if (!requestConnection.https && configuration.isRedirectToHTTPSEnabled())
+		if (m_accessControlEnabled)
 		{
-			// TODO: GET params as well..
-			
-			std::string targetURL;
-			
-			// we might need to re-write the host for different port numbers...
-			if (m_hostnamePortRewriteRequiredForHTTPSRedirect)
-			{
-				std::string newHost;
-				// see if we have a port number on the existing host
-				const std::string& requestedHost = newRequest.getHost();
-				// TODO: cache the position?
-				if (requestedHost.find(':') != std::string::npos)
-				{
-					// we do have a port, so extract just the host bit without it
-					newHost = requestedHost.substr(0, requestedHost.find(':'));
-				}
-				else
-				{
-					// we don't have an existing port number, so can just replace
-					newHost = requestedHost;
-				}
-				
-				if (configuration.getHTTPSv4PortNumber() != 443)
-				{
-					// we need to add the non-standard port
-					newHost += ":" + std::to_string(configuration.getHTTPSv4PortNumber());
-				}
-				
-				targetURL = "https://" + newHost + newRequest.getPath();
-			}
-			else
-			{
-				// hostname should be the same, so just create the new URI...
-				targetURL = "https://" + newRequest.getHost() + newRequest.getPath();
-			}
-			
-			WebResponseGeneratorRedirect redirectResponse(targetURL, 301);
-			
-			WebResponseParams emptyParams(configuration, requestConnection.https);
-			
-			std::string responseString = redirectResponse.getResponseString(emptyParams);
-			
-			logger.debug("Sending redirect to HTTPS response for IP: %s.", requestConnection.ipInfo.getIPAddress().c_str());
-
-			// send the response
-			requestConnection.pConnectionSocket->send(responseString);
-			
-			// we can't re-use the connection...
-			requestConnection.closeConnectionAndFreeSockets();
-			
-			return;
+			m_accessController.addFailedConnection(requestConnection, true);
 		}
 
-		// TODO: authentication
+		return false;
+	}
 
+	routing.shouldKeepAliveNextTime = configuration.getKeepAliveEnabled() && newRequest.getConnectionType() == WebRequest::eConnectionKeepAlive;
 
-		// knock the leading slash off so everything' relative to our root...
-		requestPath = requestPath.substr(1);
-		
-		// route request through any registered sub request handlers we have
+	std::string& requestPath = routing.requestPath;
+	requestPath = path;
+	
+	// see if we need to redirect to HTTPS
+	if (!requestConnection.https && configuration.isRedirectToHTTPSEnabled())
+	{
+		// TODO: GET params as well..
 		
-		bool wasFailedHostname = false;
+		std::string targetURL;
 		
-		// try hosts first
-		if (m_haveHostSubRequestHandlers)
+		// we might need to re-write the host for different port numbers...
+		if (m_hostnamePortRewriteRequiredForHTTPSRedirect)
 		{
-			SRHandlerMap::const_iterator itFind = m_hostHandlerLookup.find(newRequest.getHost());
-			if (itFind != m_hostHandlerLookup.end())
-			{
-				SubRequestHandler* pSubRequestHandler = itFind->second;
-				handleRequestResult = pSubRequestHandler->handleRequest(requestConnection, newRequest, requestPath);
-			}
-			else
-			{
-				wasFailedHostname = true;
-			}
-		}
-		else if (m_haveDirSubRequestHandlers)
-		{
-			// work out if we have a first level sub-dir
-			std::string directory;
-			std::string remainingURI;
-
-			if (URIHelpers::splitFirstLevelDirectoryAndRemainder(requestPath, directory, remainingURI))
+			std::string newHost;
+			// see if we have a port number on the existing host
+			const std::string_view requestedHost = newRequest.getHost();
+			// TODO: cache the position?
+			if (requestedHost.find(':') != std::string_view::npos)
 			{
-				// do nothing more
+				// we do have a port, so extract just the host bit without it
+				newHost = requestedHost.substr(0, requestedHost.find(':'));
 			}
 			else
 			{
-				// maybe there wasn't a trailing slash...				
-				directory = requestPath;
+				// we don't have an existing port number, so can just replace
+				newHost = requestedHost;
 			}
 			
-			if (!directory.empty())
+			if (configuration.getHTTPSv4PortNumber() != 443)
 			{
-				SRHandlerMap::const_iterator itFind = m_dirHandlerLookup.find(directory);
-				if (itFind != m_dirHandlerLookup.end())
-				{
-					SubRequestHandler* pSubRequestHandler = itFind->second;
-					handleRequestResult = pSubRequestHandler->handleRequest(requestConnection, newRequest, remainingURI);
-				}
+				// we need to add the non-standard port
+				newHost += ":" + std::to_string(configuration.getHTTPSv4PortNumber());
 			}
+			
+			targetURL = "https://" + newHost;
+			targetURL.append(path);
 		}
-
-		if (m_fallbackHandler && !handleRequestResult.wasHandled)
+		else
 		{
-			handleRequestResult = m_fallbackHandler->handleRequest(requestConnection, newRequest, requestPath);
+			// hostname should be the same, so just create the new URI...
+			targetURL = "https://";
+			targetURL.append(newRequest.getHost());
+			targetURL.append(path);
 		}
 		
-		if (handleRequestResult.accessFailure && m_accessControlEnabled)
+		WebResponseGeneratorRedirect redirectResponse(targetURL, 301);
+		
+		WebResponseParams emptyParams(configuration, requestConnection.https, newRequest.isHeadRequest());
+		
+		std::string responseString = redirectResponse.getResponseString(emptyParams);
+		
+		logger.debug("Sending redirect to HTTPS response for IP: %s.", requestConnection.ipInfo.getIPAddress().c_str());
+
+		// send the response
+		requestConnection.pConnectionSocket->send(responseString);
+		
+		// we can't re-use the connection...
+		return false;
+	}
+
+	// TODO: authentication
+
+
+	// knock the leading slash off so everything' relative to our root...
+	requestPath = requestPath.substr(1);
+	
+	// route request through any registered sub request handlers we have
+	
+	// try hosts first
+	if (m_haveHostSubRequestHandlers)
+	{
+		SRHandlerMap::const_iterator itFind = m_hostHandlerLookup.find(newRequest.getHost());
+		if (itFind != m_hostHandlerLookup.end())
 		{
-			m_accessController.addFailedConnection(requestConnection, false);
+			routing.pSubRequestHandler = itFind->second;
+			routing.handlerURI = requestPath;
 		}
+		else
+		{
+			routing.wasFailedHostname = true;
+		}
+	}
+	else if (m_haveDirSubRequestHandlers)
+	{
+		// work out if we have a first level sub-dir
+		std::string directory;
+		std::string remainingURI;
 
-		// TODO: something better than this...
-		if (!handleRequestResult.wasHandled)
+		if (URIHelpers::splitFirstLevelDirectoryAndRemainder(requestPath, directory, remainingURI))
 		{
-			if (m_accessControlEnabled)
-			{
-				// ignore certain things like 'favicon.ico'
-				// TODO: this is silly really, but actual browsers (especially Safari) seem to be quite agressive with requesting favicon.ico,
-				//       so it's fairly easy to rack up failed requests with a valid web browser (compared to bots), so giving it a bit of leeway
-				//       is slightly advantagous for the moment. We also don't really want to log all those invalid requests, as even for valid usage
-				//       there are quite a lot of them (clients don't seem to remember the 404 response, so regularly ask again on subsequent requests).
-				
-				bool potentiallyMalicious = wasFailedHostname;
-				m_accessController.addFailedConnection(requestConnection, potentiallyMalicious);
-				
-				if (requestPath != "favicon.ico")
-				{
-					// for the moment, don't log these, as valid browsers send these requests quite agressively...
-					if (requestPath.size() < 10000)
-					{
-						logger.warning("Unhandled request: %s for host: %s from client: %s", requestPath.c_str(), newRequest.getHost().c_str(), requestConnection.ipInfo.getIPAddress().c_str());
-					}
-				}
-			}
-			else
+			// do nothing more
+		}
+		else
+		{
+			// maybe there wasn't a trailing slash...				
+			directory = requestPath;
+		}
+		
+		if (!directory.empty())
+		{
+			SRHandlerMap::const_iterator itFind = m_dirHandlerLookup.find(directory);
+			if (itFind != m_dirHandlerLookup.end())
 			{
-				if (requestPath != "favicon.ico")
-				{
-					logger.info("Unhandled request: %s for host: %s from client: %s", requestPath.c_str(), newRequest.getHost().c_str(), requestConnection.ipInfo.getIPAddress().c_str());
-				}
+				routing.pSubRequestHandler = itFind->second;
+				routing.handlerURI = remainingURI;
 			}
+		}
+	}
+
+	return true;
+}
 
-			// Note: if we have access control enabled, we need to return *something* in this situation,
-			//       as otherwise, clients send multiple requests for the same single request understandably thinking
-			//       there's something wrong and re-trying, so we need to return a 404 to prevent this from happening
-			//       and allowing access control to work properly...
+MainRequestHandler::RequestResult MainRequestHandler::finishRequest(RequestConnection& requestConnection, const WebRequest& newRequest, const RequestRouting& routing,
+																	const WebRequestHandlerResult& handleRequestResult)
+{
+	Logger& logger = requestConnection.logger();
+	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
 
-			if (m_404NotFoundResponsesEnabled)
+	const std::string& requestPath = routing.requestPath;
+	bool wasFailedHostname = routing.wasFailedHostname;
+	bool shouldKeepAliveNextTime = routing.shouldKeepAliveNextTime;
+
+	if (handleRequestResult.accessFailure && m_accessControlEnabled)
+	{
+		m_accessController.addFailedConnection(requestConnection, false);
+	}
+
+	// TODO: something better than this...
+	if (!handleRequestResult.wasHandled)
+	{
+		if (m_accessControlEnabled)
+		{
+			// ignore certain things like 'favicon.ico'
+			// TODO: this is silly really, but actual browsers (especially Safari) seem to be quite agressive with requesting favicon.ico,
+			//       so it's fairly easy to rack up failed requests with a valid web browser (compared to bots), so giving it a bit of leeway
+			//       is slightly advantagous for the moment. We also don't really want to log all those invalid requests, as even for valid usage
+			//       there are quite a lot of them (clients don't seem to remember the 404 response, so regularly ask again on subsequent requests).
+			
+			bool potentiallyMalicious = wasFailedHostname;
+			m_accessController.addFailedConnection(requestConnection, potentiallyMalicious);
+			
+			if (requestPath != "favicon.ico")
 			{
-				if (wasFailedHostname)
+				// for the moment, don't log these, as valid browsers send these requests quite agressively...
+				if (requestPath.size() < 10000)
 				{
-					// Note: in the case of unknown/invalid virtual hosts, RFC 2616 (section 5.2) states that
-					//       the server response to these MUST be 400 (Bad Request) error.
-					//       However, I don't like that, as it potentially allows easier sniffing of valid/invalid
-					//       hosts supported, so for the moment, just return 404.
+					logger.warning("Unhandled request: %s for host: %s from client: %s", requestPath.c_str(), std::string(newRequest.getHost()).c_str(), requestConnection.ipInfo.getIPAddress().c_str());
 				}
-				
-				WebResponseParams responseParams(configuration, requestConnection.https);
-				WebResponseGeneratorBasicText textResponse(404, "Not found.");
-
-				std::string responseString = textResponse.getResponseString(responseParams);
-
-				// send the response
-				requestConnection.pConnectionSocket->send(responseString);
 			}
-			else
+		}
+		else
+		{
+			if (requestPath != "favicon.ico")
 			{
-				// otherwise we (badly in terms of HTTP compliance and niceness) don't want to respond at all...
-				break;
+				logger.info("Unhandled request: %s for host: %s from client: %s", requestPath.c_str(), std::string(newRequest.getHost()).c_str(), requestConnection.ipInfo.getIPAddress().c_str());
 			}
 		}
 
-		shouldKeepAliveNextTime = shouldKeepAliveNextTime && connectionKeepAliveCount++ < configuration.getKeepAliveLimit();
+		// Note: if we have access control enabled, we need to return *something* in this situation,
+		//       as otherwise, clients send multiple requests for the same single request understandably thinking
+		//       there's something wrong and re-trying, so we need to return a 404 to prevent this from happening
+		//       and allowing access control to work properly...
 
-		if (shouldKeepAliveNextTime)
+		if (m_404NotFoundResponsesEnabled)
 		{
-			// do a receive with a timeout, such that we can abort this connection and close it if it's not being used
-			requestString = "";
-
-			recvRetCode = requestConnection.pConnectionSocket->recvWithTimeout(requestString, configuration.getKeepAliveTimeout());
-			if (recvRetCode.type == eSockRecv_NoData ||
-				recvRetCode.type == eSockRecv_PeerClosed ||
-				recvRetCode.type == eSockRecv_Error)
-			{
-				logger.debug("Request socket Keep Alive receive failed/timed out. Closing");
-				// TODO: we probably want to try and isolate this to just the timeout event, and not a failure as well as currently happens?
-				closedKeepAliveConnectionDueToTimeout = true;
-				break;
-			}
-			else
+			if (wasFailedHostname)
 			{
-				logger.debug("Request socket Keep Alive received further request: %i", connectionKeepAliveCount);
+				// Note: in the case of unknown/invalid virtual hosts, RFC 2616 (section 5.2) states that
+				//       the server response to these MUST be 400 (Bad Request) error.
+				//       However, I don't like that, as it potentially allows easier sniffing of valid/invalid
+				//       hosts supported, so for the moment, just return 404.
 			}
+			
+			WebResponseParams responseParams(configuration, requestConnection.https, newRequest.isHeadRequest());
+			WebResponseGeneratorBasicText textResponse(404, "Not found.");
+
+			std::string responseString = textResponse.getResponseString(responseParams);
+
+			// send the response
+			requestConnection.pConnectionSocket->send(responseString);
+		}
+		else
+		{
+			// otherwise we (badly in terms of HTTP compliance and niceness) don't want to respond at all...
+			return eRequestClose;
 		}
 	}
-	while (shouldKeepAliveNextTime);
+
+	shouldKeepAliveNextTime = shouldKeepAliveNextTime && requestConnection.keepAliveRequestCount++ < configuration.getKeepAliveLimit();
 	
-	if (closedKeepAliveConnectionDueToTimeout)
+	// Note: the response will have already been sent with a keep-alive header in this case, but clients have to
+	//       cope with servers closing idle keep-alive connections anyway.
+	if (m_draining)
 	{
-		// attempt to nicely tell the client that we're closing the connection...
-		WebResponseParams responseParams(configuration, requestConnection.https);
-		
-		WebResponseGeneratorBasicText response(408, "timeout");
-		
-		// so as to send Connection: close
-		responseParams.keepAliveEnabled = false;
-		
-		std::string stringResponse = response.getResponseString(responseParams);
-		
-		// don't worry if we can't send - it's likely the client will close it anyway...
-		requestConnection.pConnectionSocket->send(stringResponse, ConnectionSocket::SEND_IGNORE_FAILURES);
+		shouldKeepAliveNextTime = false;
 	}
 
-	requestConnection.closeConnectionAndFreeSockets();
+	return shouldKeepAliveNextTime ? eRequestKeepAlive : eRequestClose;
+}
+
+bool MainRequestHandler::checkRequestBody(RequestConnection& requestConnection)
+{
+	Logger& logger = requestConnection.logger();
+	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
+	const RecvBuffer& recvBuffer = requestConnection.recvBuffer;
+
+	if (recvBuffer.hasOversizedHeader())
+	{
+		logger.warning("Request with too large a header received from client: %s. Aborting connection.", requestConnection.ipInfo.getIPAddress().c_str());
+
+		sendErrorResponse(requestConnection, 431, "Request header fields too large.");
+		return false;
+	}
+
+	if (recvBuffer.hasInvalidBodyFraming())
+	{
+		// we can't work out where the body ends, so can't safely carry on using the connection either...
+		logger.warning("Request with invalid body framing received from client: %s. Aborting connection.", requestConnection.ipInfo.getIPAddress().c_str());
+
+		sendErrorResponse(requestConnection, 400, "Bad request.");
+		return false;
+	}
+
+	// Note: chunked bodies are checked against the max size as they're read by RequestBodyReader
+	size_t maxBodySize = configuration.getMaxRequestBodySize();
+	if (maxBodySize > 0 && !recvBuffer.isChunkedBody() && recvBuffer.getContentLength() > maxBodySize)
+	{
+		logger.warning("Request with too large a body (%zu bytes) received from client: %s. Aborting connection.", recvBuffer.getContentLength(),
+					   requestConnection.ipInfo.getIPAddress().c_str());
+
+		sendErrorResponse(requestConnection, 413, "Payload too large.");
+		return false;
+	}
+
+	return true;
+}
+
+MainRequestHandler::RequestResult MainRequestHandler::finishRequestBody(RequestBodyReader& bodyReader, RequestResult result)
+{
+	if (result != eRequestKeepAlive)
+	{
+		// the connection's going to be closed, so there's no point reading any more of the body
+		return result;
+	}
+
+	if (!bodyReader.discardRemaining())
+	{
+		return eRequestClose;
+	}
+
+	// keep anything received after the request for the next one
+	bodyReader.consumeRequest();
+
+	return eRequestKeepAlive;
+}
+
+void MainRequestHandler::sendErrorResponse(RequestConnection& requestConnection, int returnCode, const std::string& text)
+{
+	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
+
+	WebResponseParams responseParams(configuration, requestConnection.https);
+
+	WebResponseGeneratorBasicText response(returnCode, text);
+
+	// so as to send Connection: close, as the caller's going to close the connection
+	responseParams.keepAliveEnabled = false;
+
+	std::string stringResponse = response.getResponseString(responseParams);
+
+	requestConnection.pConnectionSocket->send(stringResponse, ConnectionSocket::SEND_IGNORE_FAILURES);
+}
+
+void MainRequestHandler::sendKeepAliveTimeoutResponse(RequestConnection& requestConnection)
+{
+	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
+
+	// attempt to nicely tell the client that we're closing the connection...
+	WebResponseParams responseParams(configuration, requestConnection.https);
+	
+	WebResponseGeneratorBasicText response(408, "timeout");
+	
+	// so as to send Connection: close
+	responseParams.keepAliveEnabled = false;
+	
+	std::string stringResponse = response.getResponseString(responseParams);
+	
+	// don't worry if we can't send - it's likely the client will close it anyway...
+	requestConnection.pConnectionSocket->send(stringResponse, ConnectionSocket::SEND_IGNORE_FAILURES);
 }
 
 bool MainRequestHandler::configureSubRequestHandlers(const Configuration& configuration, Logger& logger)
@@ -20,16 +20,26 @@
 #define MAIN_REQUEST_HANDLER_H
 
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
+#include <atomic>
 
 #include "request_handler_common.h"
 #include "access_controller.h"
 
+#include "utils/socket.h"
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+#include "coroutine_task.h"
+#endif
+
 struct RequestConnection;
+class WebRequest;
 class Configuration;
 class SubRequestHandler;
 class Logger;
+class RequestBodyReader;
 
 class MainRequestHandler
 {
@@ -40,13 +50,85 @@ public:
 	// TODO: pass through some kind of configuration config context instead, containing both?
 	void configure(const Configuration& configuration, Logger& logger);
 
+	enum RequestResult
+	{
+		eRequestKeepAlive,	// the connection can be kept alive for further requests
+		eRequestClose		// the connection should be closed by the caller
+	};
+
+	// checks whether the connection should be accepted at all (i.e. the client isn't banned), closing it if not.
+	bool acceptConnection(RequestConnection& requestConnection);
+
+	// handles a connection for its entire lifetime, including any keep-alive requests, and closes it at the end.
 	void handleRequest(RequestConnection& requestConnection);
+
+	// handles a single complete request which has already been received, but doesn't receive anything further
+	// or close the connection - this is left to the caller based on the return value. This is what the event-based
+	// connection engine uses, as it owns the receiving / waiting side of things itself.
+	// requestLength is the length of the request at the start of the connection's receive buffer (as found by
+	// RecvBuffer::findCompleteRequest()), which is removed from it once the request has been handled, along with
+	// any body which wasn't buffered with it.
+	RequestResult handleSingleRequest(RequestConnection& requestConnection, size_t requestLength);
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+	// coroutine version of the above, which calls the sub request handlers' coroutine variants, so can suspend
+	// while they wait on IO. The connection's receive buffer must not be touched until the task completes.
+	// Note: reading a request body which wasn't buffered with the header still blocks.
+	Task<RequestResult> handleSingleRequestAsync(RequestConnection& requestConnection, size_t requestLength);
+#endif
+
+	void sendKeepAliveTimeoutResponse(RequestConnection& requestConnection);
+
+	// when draining (i.e. a new process has taken over after an upgrade), connections aren't kept alive
+	// after the current request.
+	void setDraining(bool draining)
+	{
+		m_draining = draining;
+	}
 	
 protected:
 	bool configureSubRequestHandlers(const Configuration& configuration, Logger& logger);
 
+	// receives into the connection's receive buffer until it contains a complete request, returning its length.
+	// If the buffer already contains a complete request (i.e. a pipelined one), nothing more is received.
+	// Note: the timeout applies to each wait for more data, rather than to the request as a whole.
+	SocketRecvReturnCode receiveRequest(RequestConnection& requestConnection, unsigned int timeoutSecs, size_t& requestLength);
+
+	// where a request is going to be handled, worked out by routeRequest()
+	struct RequestRouting
+	{
+		SubRequestHandler*		pSubRequestHandler = nullptr;
+		// the URI relative to the sub request handler
+		std::string				handlerURI;
+		// the URI relative to our root, used for the fallback handler
+		std::string				requestPath;
+		bool					wasFailedHostname = false;
+		bool					shouldKeepAliveNextTime = false;
+	};
+
+	// parses and validates the request, and works out which sub request handler should handle it. Returns false if
+	// the connection should just be closed without handling the request any further (a response may have been sent).
+	bool routeRequest(RequestConnection& requestConnection, WebRequest& newRequest, RequestRouting& routing);
+
+	// does any access control / not found handling after the request has been handled (or not), and works out whether
+	// the connection can be kept alive.
+	RequestResult finishRequest(RequestConnection& requestConnection, const WebRequest& newRequest, const RequestRouting& routing,
+								const WebRequestHandlerResult& handleRequestResult);
+
+	// checks the header of the request at the start of the connection's receive buffer isn't larger than we allow,
+	// and that its body framing is valid and the body isn't larger than we allow, sending an error response if not,
+	// in which case the connection should be closed.
+	bool checkRequestBody(RequestConnection& requestConnection);
+
+	// reads past any of the request body the handler didn't read, and removes the request from the connection's
+	// receive buffer, so the connection can be used for the next request.
+	RequestResult finishRequestBody(RequestBodyReader& bodyReader, RequestResult result);
+
+	void sendErrorResponse(RequestConnection& requestConnection, int returnCode, const std::string& text);
+
 protected:
-	typedef std::map<std::string, SubRequestHandler*> SRHandlerMap;
+	// Note: std::less<> so they can be looked up by string_view (i.e. the request's host) without a copy
+	typedef std::map<std::string, SubRequestHandler*, std::less<> > SRHandlerMap;
 
 protected:
 	bool						m_accessControlEnabled;
@@ -75,6 +157,8 @@ protected:
 
 	// Note: this is not stored in the m_aSubRequestHandlers vector
 	SubRequestHandler*			m_fallbackHandler;
+
+	std::atomic<bool>			m_draining;
 };
 
 #endif // MAIN_REQUEST_HANDLER_H
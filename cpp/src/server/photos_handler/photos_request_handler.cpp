@@ -29,6 +29,7 @@
 #include "utils/file_helpers.h"
 #include "utils/string_helpers.h"
 #include "utils/logger.h"
+#include "utils/system.h"
 
 #include "photos_handler/photos_html_helpers.h"
 
@@ -81,6 +82,12 @@ void PhotosRequestHandler::configure(const Configuration::SiteConfig& siteConfig
 
 	m_photosHTMLHelpers.setMainWebContentPath(m_mainWebContentPath);
 	
+	std::vector<unsigned int> aStatusThreadCPUs;
+	if (!mainConfig.getStatusThreadCPUs().empty() && System::parseCPUList(mainConfig.getStatusThreadCPUs(), aStatusThreadCPUs))
+	{
+		m_statusService.setTimerThreadCPUs(aStatusThreadCPUs);
+	}
+	
 	m_statusService.start();
 }
 
@@ -104,7 +111,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 
 	WebRequestHandlerResult handleRequestResult;
 
-	WebResponseParams responseParams(configuration, requestConnection.https);
+	WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 
 	// see if it's a file request - if so, short-circuit it to handle it immediately
 	// TODO: make this more robust
@@ -122,7 +129,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 				if (extension != "css")
 				{
 					// if it's not .css, don't allow...
-					WebResponseParams responseParams(configuration, requestConnection.https);
+					WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 					WebResponseGeneratorBasicText textResponse(404, "Not found.");
 	
 					std::string responseString = textResponse.getResponseString(responseParams);
@@ -136,7 +143,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 			}
 		}
 		
-		// currently photo items themselves are jpg files, everything else is web content
+		// currently photo items themselves are jpg files (or movie files), everything else is web content
 		std::string fullPath;
 		bool isLargeBinary = false;
 		if (extension == "jpg")
@@ -146,6 +153,12 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 
 			responseParams.useChunkedLargeFiles = configuration.getChunkedTransferJPEGsEnabled();
 		}
+		else if (extension == "mp4" || extension == "mov" || extension == "m4v")
+		{
+			// these need to support range requests for seeking, so are never sent chunked
+			fullPath = m_photosBasePath + requestPath;
+			isLargeBinary = true;
+		}
 		else
 		{
 			fullPath = m_mainWebContentPath + requestPath;
@@ -159,6 +172,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 			responseParams.setCacheControlParams(WebResponseParams::CC_PUBLIC | WebResponseParams::CC_MAX_AGE, 60 * 24 * 25);
 
 			WebResponseAdvancedBinaryFile fileResponse(fullPath);
+			fileResponse.setRequest(&request);
 
 			// TODO: the return of false from this can be due to many different things,
 			//       so it's not clear how to handle the different issues...
@@ -179,14 +193,17 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 			// TODO: is this really worth doing separately any more?
 
 			WebResponseGeneratorFile fileResponse(fullPath);
+			fileResponse.setRequest(&request);
 
 			// TODO: during development we'll keep this max-age value small, but eventually this should be increased significantly...
 			responseParams.setCacheControlParams(WebResponseParams::CC_PUBLIC | WebResponseParams::CC_MAX_AGE, 60 * 24 * 2);
 
-			std::string responseString = fileResponse.getResponseString(responseParams);
+			std::string responseHeader;
+			std::string responseBody;
+			fileResponse.getResponse(responseParams, responseHeader, responseBody);
 
 			// send the response
-			requestConnection.pConnectionSocket->send(responseString);
+			requestConnection.pConnectionSocket->send(responseHeader, responseBody);
 		}
 
 		handleRequestResult.wasHandled = true;
@@ -199,7 +216,8 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 
 	bool unknown = false;
 
-	std::string responseString;
+	std::string responseHeader;
+	std::string responseBody;
 
 	if (!URIHelpers::splitFirstLevelDirectoryAndRemainder(requestPath, nextLevel, remainingURI))
 	{
@@ -216,7 +234,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 		if (!requestAuthenticationState.isAuthenticated())
 		{
 			// don't allow...
-			WebResponseParams responseParams(configuration, requestConnection.https);
+			WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 			WebResponseGeneratorBasicText textResponse(404, "Not found.");
 
 			std::string responseString = textResponse.getResponseString(responseParams);
@@ -256,7 +274,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 		std::string item = "test/gallery_simple3.tmpl";
 
 		WebResponseGeneratorTemplateFile galleryResponse(FileHelpers::combinePaths(m_mainWebContentPath, item), photosListHTML);
-		responseString = galleryResponse.getResponseString(responseParams);
+		galleryResponse.getResponse(responseParams, responseHeader, responseBody);
 	}
 	else if (nextLevel == "gallery_advanced")
 	{
@@ -264,7 +282,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 		std::string item = "test/gallery_advanced2.tmpl";
 
 		WebResponseGeneratorTemplateFile galleryResponse(FileHelpers::combinePaths(m_mainWebContentPath, item), photosListHTML);
-		responseString = galleryResponse.getResponseString(responseParams);
+		galleryResponse.getResponse(responseParams, responseHeader, responseBody);
 	}
 	else if (nextLevel == "slide_show")
 	{
@@ -275,7 +293,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 		std::string item = "test/slideshow1.tmpl";
 
 		WebResponseGeneratorTemplateFile slideShowResponse(FileHelpers::combinePaths(m_mainWebContentPath, item), photosListJS);
-		responseString = slideShowResponse.getResponseString(responseParams);
+		slideShowResponse.getResponse(responseParams, responseHeader, responseBody);
 	}
 */	else
 	{
@@ -290,7 +308,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 			{
 				// don't allow...
 				// TODO: redirect to login?
-				WebResponseParams responseParams(configuration, requestConnection.https);
+				WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 				WebResponseGeneratorBasicText textResponse(404, "Not found.");
 
 				std::string responseString = textResponse.getResponseString(responseParams);
@@ -303,6 +321,11 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 			}
 		}
 		
+		if (responseParams.headerOnly)
+		{
+			return sendHeaderOnlyPageResponse(requestConnection, responseParams, "photos_main.tmpl");
+		}
+
 		std::string siteNavHeaderHTML = m_photosHTMLHelpers.generateMainSitenavCode(PhotosHTMLHelpers::GenMainSitenavCodeParams(false, false, ""));
 
 		if (requestAuthenticationState.state == WebRequestAuthenticationState::eSAuthenticated)
@@ -314,11 +337,11 @@ WebRequestHandlerResult PhotosRequestHandler::handleRequest(RequestConnection& r
 			siteNavHeaderHTML += "<br><br>Logged out.<br>\n";
 		}
 		WebResponseGeneratorTemplateFile responseGen(FileHelpers::combinePaths(m_mainWebContentPath, "photos_main.tmpl"), m_htmlBaseHRef, siteNavHeaderHTML);
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 
 	// send the response
-	requestConnection.pConnectionSocket->send(responseString);
+	requestConnection.pConnectionSocket->send(responseHeader, responseBody);
 
 	handleRequestResult.wasHandled = true;
 	return handleRequestResult;
@@ -328,19 +351,20 @@ WebRequestHandlerResult PhotosRequestHandler::handleLoginRequest(RequestConnecti
 {
 	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
 
-	WebResponseParams responseParams(configuration, requestConnection.https);
+	WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 
 	WebRequestHandlerResult handleRequestResult;
 
-	std::string responseString;
+	std::string responseHeader;
+	std::string responseBody;
 
-	if (request.getRequestType() == WebRequest::eRequestGET)
+	if (request.getRequestType() == WebRequest::eRequestGET || request.isHeadRequest())
 	{
 		// it's a GET type, so display the login form
 
 		std::string siteNavHeaderHTML = m_photosHTMLHelpers.generateMainSitenavCode(PhotosHTMLHelpers::GenMainSitenavCodeParams(false, false, ""));
 		WebResponseGeneratorTemplateFile responseGen(FileHelpers::combinePaths(m_mainWebContentPath, "login.tmpl"), m_htmlBaseHRef, siteNavHeaderHTML);
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 	else if (request.getRequestType() == WebRequest::eRequestPOST)
 	{
@@ -357,7 +381,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleLoginRequest(RequestConnecti
 			responseGen.setCookieHttpOnly(true);
 			responseGen.setCookieMaxAge(loginResult.newSessionExpiry);
 
-			responseString = responseGen.getResponseString(responseParams);
+			responseGen.getResponse(responseParams, responseHeader, responseBody);
 		}
 		else
 		{
@@ -365,7 +389,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleLoginRequest(RequestConnecti
 			
 			WebResponseGeneratorBasicText responseGen(503, "Invalid login credentials.");
 			
-			responseString = responseGen.getResponseString(responseParams);
+			responseGen.getResponse(responseParams, responseHeader, responseBody);
 			
 			handleRequestResult.accessFailure = true;
 		}
@@ -377,7 +401,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleLoginRequest(RequestConnecti
 	}
 
 	// send the response
-	requestConnection.pConnectionSocket->send(responseString);
+	requestConnection.pConnectionSocket->send(responseHeader, responseBody);
 
 	handleRequestResult.wasHandled = true;
 	return handleRequestResult;
@@ -388,11 +412,12 @@ WebRequestHandlerResult PhotosRequestHandler::handlePhotostreamRequest(RequestCo
 {
 	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
 
-	WebResponseParams responseParams(configuration, requestConnection.https);
+	WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 
 	WebRequestHandlerResult handleRequestResult;
 
-	std::string responseString;
+	std::string responseHeader;
+	std::string responseBody;
 
 	unsigned int perPage = request.getParamAsInt("perPage", 100);
 	unsigned int startIndex = request.getParamAsInt("startIndex", 0);
@@ -421,14 +446,19 @@ WebRequestHandlerResult PhotosRequestHandler::handlePhotostreamRequest(RequestCo
 		// if not, short-circuit with a redirect to the main photostream page
 		WebResponseGeneratorRedirect redirectResponse("photostream/");
 
-		responseString = redirectResponse.getResponseString(responseParams);
+		redirectResponse.getResponse(responseParams, responseHeader, responseBody);
 
 		// send the response
-		requestConnection.pConnectionSocket->send(responseString);
+		requestConnection.pConnectionSocket->send(responseHeader, responseBody);
 
 		handleRequestResult.wasHandled = true;
 		return handleRequestResult;
 	}
+
+	if (responseParams.headerOnly)
+	{
+		return sendHeaderOnlyPageResponse(requestConnection, responseParams, isSlideShow ? "photostream_slideshow.tmpl" : "photostream_gallery.tmpl");
+	}
 	
 	// TODO: generateMainSitenavCode() shows up in profiles - can we cache it?
 	PhotosHTMLHelpers::GenMainSitenavCodeParams params(!isSlideShow, !isSlideShow, "photostream_");
@@ -457,7 +487,7 @@ WebRequestHandlerResult PhotosRequestHandler::handlePhotostreamRequest(RequestCo
 													 m_htmlBaseHRef, siteNavHeaderHTML,
 													 contentAndPaginationHTML, photosListJS);
 
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 	else
 	{
@@ -490,11 +520,11 @@ WebRequestHandlerResult PhotosRequestHandler::handlePhotostreamRequest(RequestCo
 													 photosListHTML,
 													 paginationHTML);
 
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 
 	// send the response
-	requestConnection.pConnectionSocket->send(responseString);
+	requestConnection.pConnectionSocket->send(responseHeader, responseBody);
 
 	handleRequestResult.wasHandled = true;
 	return handleRequestResult;
@@ -505,16 +535,22 @@ WebRequestHandlerResult PhotosRequestHandler::handleDatesRequest(RequestConnecti
 {
 	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
 
-	WebResponseParams responseParams(configuration, requestConnection.https);
+	WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 
 	WebRequestHandlerResult handleRequestResult;
 
 	bool specifyDateValsAsDirs = true;
 
-	std::string responseString;
+	std::string responseHeader;
+	std::string responseBody;
 	
 	unsigned int slideShow = request.getParamAsInt("slideshow", 0);
 
+	if (responseParams.headerOnly)
+	{
+		return sendHeaderOnlyPageResponse(requestConnection, responseParams, slideShow == 1 ? "dates_slideshow.tmpl" : "dates_gallery.tmpl");
+	}
+
 	PhotoQueryEngine::QueryParams queryParams;
 	bool wantSLR = request.getParamOrCookieAsInt("typeSLR", "dates_typeSLR", 1) == 1;
 	bool wantDrone = request.getParamOrCookieAsInt("typeDrone", "dates_typeDrone", 0) == 1;
@@ -555,7 +591,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleDatesRequest(RequestConnecti
 		WebResponseGeneratorTemplateFile responseGen(FileHelpers::combinePaths(m_mainWebContentPath, "dates_slideshow.tmpl"),
 													 m_htmlBaseHRef, siteNavHeaderHTML, contentHTML, photosListJS);
 
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 	else
 	{
@@ -588,11 +624,11 @@ WebRequestHandlerResult PhotosRequestHandler::handleDatesRequest(RequestConnecti
 													 datesBarHTML,
 													 contentHTML);
 	
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 
 	// send the response
-	requestConnection.pConnectionSocket->send(responseString);
+	requestConnection.pConnectionSocket->send(responseHeader, responseBody);
 
 	handleRequestResult.wasHandled = true;
 	return handleRequestResult;
@@ -603,15 +639,27 @@ WebRequestHandlerResult PhotosRequestHandler::handleLocationsRequest(RequestConn
 {
 	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
 
-	WebResponseParams responseParams(configuration, requestConnection.https);
+	WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
 
 	WebRequestHandlerResult handleRequestResult;
 
-	std::string responseString;
+	std::string responseHeader;
+	std::string responseBody;
 
 	unsigned int slideShow = request.getParamAsInt("slideshow", 0);
 	unsigned int gallery = request.getParamAsInt("gallery", 0);
 
+	if (responseParams.headerOnly)
+	{
+		std::string templateFilename = "locations_overview.tmpl";
+		if (!request.getParam("locationPath").empty() && (slideShow == 1 || gallery == 1))
+		{
+			templateFilename = (slideShow == 1) ? "locations_slideshow.tmpl" : "locations_gallery.tmpl";
+		}
+
+		return sendHeaderOnlyPageResponse(requestConnection, responseParams, templateFilename);
+	}
+
 	unsigned int perPage = request.getParamAsInt("perPage", 100);
 	unsigned int startIndex = request.getParamAsInt("startIndex", 0);
 
@@ -664,7 +712,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleLocationsRequest(RequestConn
 		WebResponseGeneratorTemplateFile responseGen(FileHelpers::combinePaths(m_mainWebContentPath, "locations_slideshow.tmpl"),
 													 m_htmlBaseHRef, siteNavHeaderHTML, contentAndPaginationHTML, photosListJS);
 
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 	else if (!locationPath.empty() && gallery == 1)
 	{
@@ -712,7 +760,7 @@ WebRequestHandlerResult PhotosRequestHandler::handleLocationsRequest(RequestConn
 													 photosListHTML,
 													 paginationHTML);
 
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 	else
 	{
@@ -730,11 +778,11 @@ WebRequestHandlerResult PhotosRequestHandler::handleLocationsRequest(RequestConn
 													 locationBarHTML,
 													 contentHTML);
 
-		responseString = responseGen.getResponseString(responseParams);
+		responseGen.getResponse(responseParams, responseHeader, responseBody);
 	}
 
 	// send the response
-	requestConnection.pConnectionSocket->send(responseString);
+	requestConnection.pConnectionSocket->send(responseHeader, responseBody);
 
 	handleRequestResult.wasHandled = true;
 	return handleRequestResult;
@@ -747,21 +795,47 @@ WebRequestHandlerResult PhotosRequestHandler::handleStatusRequest(RequestConnect
 	
 	const Configuration& configuration = *requestConnection.pThreadConfig->pConfiguration;
 
-	WebResponseParams responseParams(configuration, requestConnection.https);
+	WebResponseParams responseParams(configuration, requestConnection.https, request.isHeadRequest());
+
+	if (responseParams.headerOnly)
+	{
+		return sendHeaderOnlyPageResponse(requestConnection, responseParams, "status.tmpl");
+	}
 	
 	std::string siteNavHeaderHTML = m_photosHTMLHelpers.generateMainSitenavCode(PhotosHTMLHelpers::GenMainSitenavCodeParams(false, false, ""));
 	
-	std::string statusHTML = m_statusService.getCurrentStatusHTML();
+	std::string statusHTML = m_statusService.getCurrentStatusHTML(requestConnection.pThreadConfig->pServerStatistics);
 	
 	WebResponseGeneratorTemplateFile responseGen(FileHelpers::combinePaths(m_mainWebContentPath, "status.tmpl"),
 												 m_htmlBaseHRef,
 												 siteNavHeaderHTML,
 												 statusHTML);
 	
-	std::string responseString = responseGen.getResponseString(responseParams);
+	std::string responseHeader;
+	std::string responseBody;
+	responseGen.getResponse(responseParams, responseHeader, responseBody);
 	
 	// send the response
-	requestConnection.pConnectionSocket->send(responseString);
+	requestConnection.pConnectionSocket->send(responseHeader, responseBody);
+
+	handleRequestResult.wasHandled = true;
+	return handleRequestResult;
+}
+
+WebRequestHandlerResult PhotosRequestHandler::sendHeaderOnlyPageResponse(RequestConnection& requestConnection, const WebResponseParams& responseParams,
+																		   const std::string& templateFilename)
+{
+	WebRequestHandlerResult handleRequestResult;
+
+	// in header-only mode the template isn't rendered (or even read), so no content is needed for it
+	WebResponseGeneratorTemplateFile responseGen(FileHelpers::combinePaths(m_mainWebContentPath, templateFilename), "");
+
+	std::string responseHeader;
+	std::string responseBody;
+	responseGen.getResponse(responseParams, responseHeader, responseBody);
+
+	// send the response
+	requestConnection.pConnectionSocket->send(responseHeader, responseBody);
 
 	handleRequestResult.wasHandled = true;
 	return handleRequestResult;
@@ -33,6 +33,7 @@
 
 class Logger;
 struct WebRequestAuthenticationState;
+struct WebResponseParams;
 
 class PhotosRequestHandler : public SubRequestHandler
 {
@@ -55,6 +56,10 @@ protected:
 	WebRequestHandlerResult handleStatusRequest(RequestConnection& requestConnection, const WebRequest& request,
 												const WebRequestAuthenticationState& authenticationState);
 
+	// for HEAD requests for pages, so the page content doesn't need to be generated just to send the header
+	WebRequestHandlerResult sendHeaderOnlyPageResponse(RequestConnection& requestConnection, const WebResponseParams& responseParams,
+													   const std::string& templateFilename);
+
 	DateParams getDateParamsFromRequest(const WebRequest& request, bool checkURLPath, const std::string& refinedURI) const;
 
 protected:
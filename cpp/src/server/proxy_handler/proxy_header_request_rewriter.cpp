@@ -44,7 +44,8 @@ void ProxyHeaderRequestRewriter::initialise(const std::string& targetHostname, i
 std::string ProxyHeaderRequestRewriter::generateRewrittenProxyHeaderRequest(const WebRequest& originalRequest, const std::string& refinedURI) const
 {
 	if (originalRequest.getRequestType() != WebRequest::eRequestGET &&
-		originalRequest.getRequestType() != WebRequest::eRequestPOST)
+		originalRequest.getRequestType() != WebRequest::eRequestPOST &&
+		originalRequest.getRequestType() != WebRequest::eRequestHEAD)
 	{
 		return "";
 	}
@@ -55,7 +56,12 @@ std::string ProxyHeaderRequestRewriter::generateRewrittenProxyHeaderRequest(cons
 	StringHelpers::split(originalRequest.getRawRequest(), lines);
 	
 	// generate the first request line directly...
-	newHeaderRequest += ((originalRequest.getRequestType() == WebRequest::eRequestGET) ? "GET" : "POST");
+	if (originalRequest.getRequestType() == WebRequest::eRequestGET)
+		newHeaderRequest += "GET";
+	else if (originalRequest.getRequestType() == WebRequest::eRequestHEAD)
+		newHeaderRequest += "HEAD";
+	else
+		newHeaderRequest += "POST";
 	newHeaderRequest += " ";
 	
 	std::string newProxyRequestPath = refinedURI;
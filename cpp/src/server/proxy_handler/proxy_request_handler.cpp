@@ -29,11 +29,18 @@
 #include "utils/file_helpers.h"
 #include "utils/string_helpers.h"
 #include "utils/logger.h"
+#include "utils/recv_buffer.h"
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+#include "coroutine_reactor.h"
+#endif
 
 // Reverse Proxy implementation
 
 ProxyRequestHandler::ProxyRequestHandler() :
-    SubRequestHandler()
+    SubRequestHandler(),
+    m_targetPort(80),
+    m_timeout(30)
 {
 	
 }
@@ -47,6 +54,9 @@ void ProxyRequestHandler::configure(const Configuration::SiteConfig& siteConfig,
 {
 	std::string target = siteConfig.getParam("target");
 	
+	// 0 means no timeout
+	m_timeout = siteConfig.getParamAsUInt("timeout", 30);
+	
 	if (target.substr(0, 7) != "http://")
 	{
 		logger.error("Proxy request handler cannot handle target of: %s", target.c_str());
@@ -131,7 +141,7 @@ WebRequestHandlerResult ProxyRequestHandler::handleRequest(RequestConnection& re
 	}
 	
 	std::string responseString;
-	if (proxySocket.recvSmart(responseString).type == eSockRecv_Error)
+	if (proxySocket.recvSmart(responseString, request.isHeadRequest()).type == eSockRecv_Error)
 	{
 		logger.error("Error receiving response from proxy target.");
 		return handleRequestResult;
@@ -143,3 +153,51 @@ WebRequestHandlerResult ProxyRequestHandler::handleRequest(RequestConnection& re
 	handleRequestResult.wasHandled = true;
 	return handleRequestResult;
 }
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+Task<WebRequestHandlerResult> ProxyRequestHandler::handleRequestAsync(RequestConnection& requestConnection, const WebRequest& request, const std::string& refinedURI)
+{
+	CoroutineReactor* pReactor = requestConnection.pThreadConfig->pCoroutineReactor;
+	if (!pReactor)
+	{
+		co_return handleRequest(requestConnection, request, refinedURI);
+	}
+	
+	Logger& logger = requestConnection.logger();
+	
+	const std::string& requestPath = refinedURI;
+	
+	WebRequestHandlerResult handleRequestResult;
+	
+	Socket proxySocket(&logger, m_targetHostname, m_targetPort, false);
+	if (!co_await pReactor->connect(proxySocket))
+	{
+		logger.error("Error connecting to proxy target.");
+		co_return handleRequestResult;
+	}
+	
+	std::string rewrittenHTTPRequest = m_headerRewriter.generateRewrittenProxyHeaderRequest(request, requestPath);
+	
+	if (!co_await pReactor->send(proxySocket, rewrittenHTTPRequest, m_timeout))
+	{
+		logger.error("Couldn't send request to proxy target.");
+		co_return handleRequestResult;
+	}
+	
+	RecvBuffer responseBuffer;
+	SocketRecvReturnCode recvRetCode = co_await pReactor->recvHTTPMessage(proxySocket, responseBuffer, m_timeout, request.isHeadRequest());
+	if (recvRetCode.type == eSockRecv_Error || recvRetCode.type == eSockRecv_TimedOutNoData)
+	{
+		logger.error("Error receiving response from proxy target.");
+		co_return handleRequestResult;
+	}
+	
+	// send the response
+	// Note: this is still a blocking send, as the client connection socket might be using TLS, which the
+	//       reactor doesn't currently support.
+	requestConnection.pConnectionSocket->send((unsigned char*)responseBuffer.getData(), responseBuffer.getSize());
+	
+	handleRequestResult.wasHandled = true;
+	co_return handleRequestResult;
+}
+#endif
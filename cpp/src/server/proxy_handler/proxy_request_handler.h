@@ -39,6 +39,11 @@ public:
 	virtual void configure(const Configuration::SiteConfig& siteConfig, const Configuration& mainConfig, Logger& logger) override;
 
 	virtual WebRequestHandlerResult handleRequest(RequestConnection& requestConnection, const WebRequest& request, const std::string& refinedURI) override;
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+	// same as above, but doesn't block the worker thread while waiting for the proxy target
+	virtual Task<WebRequestHandlerResult> handleRequestAsync(RequestConnection& requestConnection, const WebRequest& request, const std::string& refinedURI) override;
+#endif
 	
 protected:
 	
@@ -50,6 +55,9 @@ protected:
 	
 	std::string		m_targetPath;
 	
+	// how long to wait for the proxy target with the async handler, in seconds (0 for no timeout)
+	unsigned int	m_timeout;
+	
 };
 
 #endif // PROXY_REQUEST_HANDLER_H
@@ -0,0 +1,333 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#include "request_body_reader.h"
+
+#include <cstring>
+
+#include "web_server_common.h"
+
+static const size_t kRecvChunkSize = 16 * 1024;
+
+// chunk size and trailer lines longer than this are treated as an error
+static const size_t kMaxFramingLineLength = 4096;
+
+// if more than this much of a body is left unread by the request handler, it's not worth reading it all
+// just to keep the connection alive, so it's closed instead.
+static const size_t kMaxDiscardLength = 256 * 1024;
+
+static const std::string kContinueResponse = "HTTP/1.1 100 Continue\r\n\r\n";
+
+RequestBodyReader::RequestBodyReader(RequestConnection& requestConnection, size_t headerLength, size_t contentLength, bool chunked,
+									 size_t maxBodySize, unsigned int timeoutSecs) :
+	m_requestConnection(requestConnection),
+	m_connectionBuffer(requestConnection.recvBuffer),
+	m_headerLength(headerLength),
+	m_contentLength(contentLength),
+	m_chunked(chunked),
+	m_maxBodySize(maxBodySize),
+	m_timeoutSecs(timeoutSecs),
+	m_state(eStateDone),
+	m_remaining(0),
+	m_bodyBytesRead(0),
+	m_exceededMaxSize(false),
+	m_continuePending(false),
+	m_connectionBufferUsed(0)
+{
+	if (m_chunked)
+	{
+		m_state = eStateChunkSize;
+	}
+	else if (m_contentLength > 0)
+	{
+		m_state = eStateData;
+		m_remaining = m_contentLength;
+
+		if (m_maxBodySize > 0 && m_contentLength > m_maxBodySize)
+		{
+			// the caller should really have checked this up-front, but just in case...
+			m_exceededMaxSize = true;
+			m_state = eStateError;
+		}
+	}
+}
+
+long RequestBodyReader::read(char* pBuffer, size_t maxLength)
+{
+	while (true)
+	{
+		if (m_state == eStateDone)
+			return 0;
+		else if (m_state == eStateError)
+			return -1;
+
+		if (m_state != eStateData)
+		{
+			if (!processFramingLine())
+				return fail();
+
+			continue;
+		}
+
+		if (m_remaining == 0)
+		{
+			m_state = m_chunked ? eStateChunkDataEnd : eStateDone;
+			continue;
+		}
+
+		const char* pData = nullptr;
+		size_t available = getAvailable(pData);
+		if (available == 0)
+		{
+			if (!receiveMore())
+				return fail();
+
+			continue;
+		}
+
+		size_t length = available;
+		if (length > m_remaining)
+			length = m_remaining;
+		if (length > maxLength)
+			length = maxLength;
+
+		memcpy(pBuffer, pData, length);
+		consumeAvailable(length);
+
+		m_remaining -= length;
+		m_bodyBytesRead += length;
+
+		return (long)length;
+	}
+}
+
+bool RequestBodyReader::readAll(std::string& body)
+{
+	if (!m_chunked)
+	{
+		body.reserve(body.size() + m_remaining);
+	}
+
+	char buffer[4096];
+	while (true)
+	{
+		long ret = read(buffer, sizeof(buffer));
+		if (ret == 0)
+			return true;
+		else if (ret < 0)
+			return false;
+
+		body.append(buffer, ret);
+	}
+}
+
+bool RequestBodyReader::discardRemaining()
+{
+	if (m_state == eStateDone)
+		return true;
+	else if (m_state == eStateError)
+		return false;
+
+	if (!m_chunked && m_remaining > kMaxDiscardLength)
+		return false;
+
+	// the client's waiting to be told to send the body, and as a final response has now been sent, it won't be,
+	// so we don't know whether the client will send it or not.
+	if (m_continuePending)
+		return false;
+
+	size_t discarded = 0;
+
+	char buffer[4096];
+	while (true)
+	{
+		long ret = read(buffer, sizeof(buffer));
+		if (ret == 0)
+			return true;
+		else if (ret < 0)
+			return false;
+
+		discarded += ret;
+		if (discarded > kMaxDiscardLength)
+			return false;
+	}
+}
+
+void RequestBodyReader::consumeRequest()
+{
+	m_connectionBuffer.consume(m_headerLength + m_connectionBufferUsed);
+
+	if (!m_streamBuffer.isEmpty())
+	{
+		// we received beyond the end of the body, so this is the start of the next request. Everything in the connection's
+		// buffer will have been used before anything was received into the stream buffer, so it's now empty.
+		size_t length = m_streamBuffer.getSize();
+		char* pWritePointer = m_connectionBuffer.getWritePointer(length);
+		memcpy(pWritePointer, m_streamBuffer.getData(), length);
+		m_connectionBuffer.commitWrite(length);
+
+		m_streamBuffer.clear();
+	}
+}
+
+size_t RequestBodyReader::getAvailable(const char*& pData) const
+{
+	size_t connectionBufferAvailable = m_connectionBuffer.getSize() - m_headerLength - m_connectionBufferUsed;
+	if (connectionBufferAvailable > 0)
+	{
+		pData = m_connectionBuffer.getData() + m_headerLength + m_connectionBufferUsed;
+		return connectionBufferAvailable;
+	}
+
+	pData = m_streamBuffer.getData();
+	return m_streamBuffer.getSize();
+}
+
+void RequestBodyReader::consumeAvailable(size_t length)
+{
+	size_t connectionBufferAvailable = m_connectionBuffer.getSize() - m_headerLength - m_connectionBufferUsed;
+	if (connectionBufferAvailable > 0)
+	{
+		m_connectionBufferUsed += length;
+		return;
+	}
+
+	m_streamBuffer.consume(length);
+}
+
+bool RequestBodyReader::receiveMore()
+{
+	// move anything left in the connection's buffer (i.e. a partial chunk size line) over to the stream buffer first,
+	// so that everything available is contiguous.
+	size_t connectionBufferAvailable = m_connectionBuffer.getSize() - m_headerLength - m_connectionBufferUsed;
+	if (connectionBufferAvailable > 0)
+	{
+		char* pWritePointer = m_streamBuffer.getWritePointer(connectionBufferAvailable + kRecvChunkSize);
+		memcpy(pWritePointer, m_connectionBuffer.getData() + m_headerLength + m_connectionBufferUsed, connectionBufferAvailable);
+		m_streamBuffer.commitWrite(connectionBufferAvailable);
+
+		m_connectionBufferUsed += connectionBufferAvailable;
+	}
+
+	if (m_continuePending)
+	{
+		m_continuePending = false;
+
+		if (!m_requestConnection.pConnectionSocket->send(kContinueResponse))
+			return false;
+	}
+
+	m_streamBuffer.getWritePointer(kRecvChunkSize);
+
+	SocketRecvReturnCode recvRetCode = m_requestConnection.pConnectionSocket->recv(m_streamBuffer, m_timeoutSecs);
+	return recvRetCode.type == eSockRecv_OK;
+}
+
+bool RequestBodyReader::peekLine(std::string_view& line, size_t& lineLength)
+{
+	while (true)
+	{
+		const char* pData = nullptr;
+		size_t available = getAvailable(pData);
+
+		const char* pLineEnd = available > 0 ? (const char*)memchr(pData, '\n', available) : nullptr;
+		if (pLineEnd)
+		{
+			lineLength = (pLineEnd - pData) + 1;
+
+			size_t contentLength = lineLength - 1;
+			if (contentLength > 0 && pData[contentLength - 1] == '\r')
+			{
+				contentLength -= 1;
+			}
+
+			line = std::string_view(pData, contentLength);
+			return true;
+		}
+
+		if (available > kMaxFramingLineLength)
+			return false;
+
+		if (!receiveMore())
+			return false;
+	}
+}
+
+bool RequestBodyReader::processFramingLine()
+{
+	std::string_view line;
+	size_t lineLength = 0;
+	if (!peekLine(line, lineLength))
+		return false;
+
+	if (m_state == eStateChunkSize)
+	{
+		// hex chunk size, optionally followed by chunk extensions, which we ignore
+		size_t chunkSize = 0;
+		size_t numDigits = 0;
+		for (char c : line)
+		{
+			unsigned int digitValue = 0;
+			if (c >= '0' && c <= '9')
+				digitValue = c - '0';
+			else if (c >= 'a' && c <= 'f')
+				digitValue = c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				digitValue = c - 'A' + 10;
+			else
+				break;
+
+			// stop silly sizes from overflowing
+			if (numDigits++ >= 15)
+				return false;
+
+			chunkSize = (chunkSize * 16) + digitValue;
+		}
+
+		if (numDigits == 0)
+			return false;
+
+		if (m_maxBodySize > 0 && m_bodyBytesRead + chunkSize > m_maxBodySize)
+		{
+			m_exceededMaxSize = true;
+			return false;
+		}
+
+		m_remaining = chunkSize;
+		m_state = (chunkSize > 0) ? eStateData : eStateTrailers;
+	}
+	else if (m_state == eStateChunkDataEnd)
+	{
+		if (!line.empty())
+			return false;
+
+		m_state = eStateChunkSize;
+	}
+	else if (m_state == eStateTrailers)
+	{
+		// we ignore any trailer fields, and just wait for the empty line at the end
+		if (line.empty())
+		{
+			m_state = eStateDone;
+		}
+	}
+
+	consumeAvailable(lineLength);
+
+	return true;
+}
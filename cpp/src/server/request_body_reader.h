@@ -0,0 +1,153 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef REQUEST_BODY_READER_H
+#define REQUEST_BODY_READER_H
+
+#include <string>
+#include <string_view>
+
+#include "utils/recv_buffer.h"
+
+struct RequestConnection;
+
+// Streams a request's body (either Content-Length or chunked Transfer-Encoding framed) to a request handler
+// in pieces, so large bodies don't need to be held in memory all at once.
+// Any of the body which was received along with the header is read from the connection's receive buffer
+// first (without modifying it, as the request may be a view into it), and the rest is received as needed.
+// Note: receiving more of the body blocks the calling thread, with the given timeout for each wait.
+class RequestBodyReader
+{
+public:
+	// headerLength, contentLength and chunked should come from the connection's receive buffer framing state.
+	// A maxBodySize of 0 means there's no limit.
+	RequestBodyReader(RequestConnection& requestConnection, size_t headerLength, size_t contentLength, bool chunked,
+					  size_t maxBodySize, unsigned int timeoutSecs);
+
+	bool hasBody() const
+	{
+		return m_chunked || m_contentLength > 0;
+	}
+
+	bool isChunked() const
+	{
+		return m_chunked;
+	}
+
+	// for requests with "Expect: 100-continue", the client waits for an interim "100 Continue" response before sending
+	// the body, so this makes the first receive of the body send one. If the request's handled without reading
+	// the body, it's never sent, and the connection can't be kept alive.
+	void setExpectContinue(bool expectContinue)
+	{
+		m_continuePending = expectContinue;
+	}
+
+	// 0 for chunked bodies, as it's not known up-front
+	size_t getContentLength() const
+	{
+		return m_chunked ? 0 : m_contentLength;
+	}
+
+	// reads up to maxLength bytes of the body into pBuffer, receiving more from the connection if needed.
+	// Returns the number of bytes read, 0 once the end of the body has been reached, or -1 on error (including
+	// the body exceeding the max allowed size, in which case exceededMaxSize() will return true).
+	long read(char* pBuffer, size_t maxLength);
+
+	// convenience function to read the rest of the body into a string - should only be used when the body is
+	// known to be small.
+	bool readAll(std::string& body);
+
+	// reads and throws away any of the body not read by the request handler, so that the connection can be used
+	// for the next request. Returns false if this wasn't possible (or sensible, if there's lots of it remaining).
+	bool discardRemaining();
+
+	bool isComplete() const
+	{
+		return m_state == eStateDone;
+	}
+
+	bool exceededMaxSize() const
+	{
+		return m_exceededMaxSize;
+	}
+
+	// removes the request (the header and body) from the connection's receive buffer, keeping anything received
+	// after it (i.e. a pipelined request). Must only be called once the body is complete, after the request
+	// has been handled.
+	void consumeRequest();
+
+protected:
+	enum BodyState
+	{
+		eStateData,				// within a Content-Length body or chunk's data
+		eStateChunkSize,		// expecting a chunk size line
+		eStateChunkDataEnd,		// expecting the CRLF after a chunk's data
+		eStateTrailers,			// expecting trailer lines after the last chunk, or the final empty line
+		eStateDone,
+		eStateError
+	};
+
+	// the body data we've got available to read currently (either left in the connection's receive buffer,
+	// or in our own stream buffer)
+	size_t getAvailable(const char*& pData) const;
+	void consumeAvailable(size_t length);
+
+	// receives more of the body from the connection, into the stream buffer
+	bool receiveMore();
+
+	// finds the next complete line of the available data, receiving more if needed. The line isn't consumed,
+	// as the view points into the available data, so consumeAvailable() should be called with lineLength afterwards.
+	bool peekLine(std::string_view& line, size_t& lineLength);
+
+	// processes the chunk framing lines
+	bool processFramingLine();
+
+	long fail()
+	{
+		m_state = eStateError;
+		return -1;
+	}
+
+protected:
+	RequestConnection&	m_requestConnection;
+	RecvBuffer&			m_connectionBuffer;
+
+	size_t				m_headerLength;
+	size_t				m_contentLength;
+	bool				m_chunked;
+
+	size_t				m_maxBodySize;
+	unsigned int		m_timeoutSecs;
+
+	BodyState			m_state;
+	// bytes remaining in the current chunk, or whole body for Content-Length bodies
+	size_t				m_remaining;
+	// total body bytes read so far (excluding chunk framing)
+	size_t				m_bodyBytesRead;
+	bool				m_exceededMaxSize;
+	// whether we still need to send "100 Continue" before receiving any of the body
+	bool				m_continuePending;
+
+	// how much of the connection's receive buffer after the header we've used (including chunk framing)
+	size_t				m_connectionBufferUsed;
+	// anything received from the connection once what was in the connection's receive buffer has been used.
+	// This is only allocated if it's needed.
+	RecvBuffer			m_streamBuffer;
+};
+
+#endif // REQUEST_BODY_READER_H
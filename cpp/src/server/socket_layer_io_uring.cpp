@@ -0,0 +1,511 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#include "socket_layer_io_uring.h"
+
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+#include <liburing.h>
+#endif
+
+// each batch has a read and a send submission for each half of the buffers, plus a pending header send
+static const unsigned int kRingNumEntries = IOUringSocketLayerThreadContext::kNumRegisteredBuffers * 2;
+
+// data sent with SEND_MORE_TO_FOLLOW which is bigger than this is sent straight away
+static const size_t kMaxPendingSendDataSize = 16 * 1024;
+
+// user data for the cancel submissions made when a batch times out, so their completions can be told apart
+static const uint64_t kCancelUserData = ~(uint64_t)0;
+
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+// waits for the next completion, but only until the deadline (if it's enabled), returning -ETIME if it passes first.
+static int waitForCompletion(struct io_uring* pRing, struct io_uring_cqe** ppCQE, const SendDeadline& deadline)
+{
+	if (!deadline.enabled)
+		return io_uring_wait_cqe(pRing, ppCQE);
+
+	auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time - std::chrono::steady_clock::now());
+	int64_t remainingNS = remaining.count() > 0 ? (int64_t)remaining.count() : 0;
+
+	struct __kernel_timespec timeout;
+	timeout.tv_sec = remainingNS / 1000000000;
+	timeout.tv_nsec = remainingNS % 1000000000;
+
+	return io_uring_wait_cqe_timeout(pRing, ppCQE, &timeout);
+}
+#endif
+
+ConnectionSocketIOUring::ConnectionSocketIOUring(Socket* pRawSocket, Logger& logger, IOUringSocketLayerThreadContext* pThreadContext) :
+	ConnectionSocketPlain(pRawSocket, logger),
+	m_pThreadContext(pThreadContext)
+{
+
+}
+
+ConnectionSocketIOUring::~ConnectionSocketIOUring()
+{
+
+}
+
+bool ConnectionSocketIOUring::send(const std::string& data, unsigned int flags) const
+{
+	struct iovec dataIOVec;
+	dataIOVec.iov_base = (void*)data.data();
+	dataIOVec.iov_len = data.size();
+	
+	return sendv(&dataIOVec, 1, flags);
+}
+
+bool ConnectionSocketIOUring::send(unsigned char* pData, size_t dataLength) const
+{
+	struct iovec dataIOVec;
+	dataIOVec.iov_base = pData;
+	dataIOVec.iov_len = dataLength;
+	
+	return sendv(&dataIOVec, 1, 0);
+}
+
+bool ConnectionSocketIOUring::sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags) const
+{
+	size_t totalSize = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		totalSize += pIOVecs[i].iov_len;
+	}
+	
+	if ((flags & SEND_MORE_TO_FOLLOW) && m_pendingSendData.size() + totalSize <= kMaxPendingSendDataSize)
+	{
+		// hold it back, so that if it's followed by file data, it can be sent as part of the same submission
+		for (unsigned int i = 0; i < count; i++)
+		{
+			m_pendingSendData.append((const char*)pIOVecs[i].iov_base, pIOVecs[i].iov_len);
+		}
+		return true;
+	}
+	
+	if (m_pendingSendData.empty())
+	{
+		return ConnectionSocketPlain::sendv(pIOVecs, count, flags);
+	}
+	
+	std::vector<struct iovec> aIOVecs(count + 1);
+	aIOVecs[0].iov_base = (void*)m_pendingSendData.data();
+	aIOVecs[0].iov_len = m_pendingSendData.size();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		aIOVecs[i + 1] = pIOVecs[i];
+	}
+	
+	bool wasSuccessful = ConnectionSocketPlain::sendv(aIOVecs.data(), count + 1, flags);
+	m_pendingSendData.clear();
+	return wasSuccessful;
+}
+
+SocketRecvReturnCode ConnectionSocketIOUring::recv(RecvBuffer& buffer, unsigned int timeoutSecs) const
+{
+	// the other side's not going to send anything if it's waiting for what we're holding back
+	if (!flushPendingSendData())
+		return eSockRecv_Error;
+	
+	return ConnectionSocketPlain::recv(buffer, timeoutSecs);
+}
+
+SocketRecvReturnCode ConnectionSocketIOUring::recvNonBlocking(RecvBuffer& buffer) const
+{
+	if (!flushPendingSendData())
+		return eSockRecv_Error;
+	
+	return ConnectionSocketPlain::recvNonBlocking(buffer);
+}
+
+bool ConnectionSocketIOUring::supportsSendFileData() const
+{
+	return true;
+}
+
+bool ConnectionSocketIOUring::sendFileData(int fileFD, size_t offset, size_t length) const
+{
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+	struct io_uring* pRing = m_pThreadContext->m_pRing;
+
+	const unsigned int numBuffersPerHalf = IOUringSocketLayerThreadContext::kNumRegisteredBuffers / 2;
+	const size_t bufferSize = IOUringSocketLayerThreadContext::kRegisteredBufferSize;
+
+	size_t bytesRemaining = length;
+	size_t fileOffset = offset;
+
+	// as with the other sends, all of the response has to have been sent by the deadline, but as the sends here
+	// are done by the kernel (with MSG_WAITALL), we have to enforce it when waiting for their completions.
+	const SendDeadline* pResponseDeadline = getResponseSendDeadline(m_pRawSocket->getSendTimeout());
+	SendDeadline deadline = pResponseDeadline ? *pResponseDeadline : SendDeadline(m_pRawSocket->getSendTimeout());
+
+	// the chunk sizes which have been read into each half of the buffers, but not sent yet
+	size_t aChunkSizes[2][numBuffersPerHalf];
+	unsigned int aNumChunks[2] = { 0, 0 };
+	
+	// the expected result of each submission in a batch, indexed by its user data
+	int aExpectedResults[kRingNumEntries];
+
+	unsigned int readHalf = 0;
+
+	while (bytesRemaining > 0 || aNumChunks[readHalf ^ 1] > 0 || !m_pendingSendData.empty())
+	{
+		const unsigned int sendHalf = readHalf ^ 1;
+		unsigned int numSubmitted = 0;
+		
+		// read the next chunks into this half of the buffers. These are independent, so can all happen at once,
+		// and at the same time as the sends below.
+		unsigned int numReadChunks = 0;
+		for (; numReadChunks < numBuffersPerHalf && bytesRemaining > 0; numReadChunks++)
+		{
+			size_t thisChunkSize = (bytesRemaining >= bufferSize) ? bufferSize : bytesRemaining;
+			aChunkSizes[readHalf][numReadChunks] = thisChunkSize;
+			
+			unsigned int bufferIndex = readHalf * numBuffersPerHalf + numReadChunks;
+			unsigned char* pBuffer = m_pThreadContext->m_pBuffers + (bufferIndex * bufferSize);
+
+			struct io_uring_sqe* pReadSQE = io_uring_get_sqe(pRing);
+			io_uring_prep_read_fixed(pReadSQE, fileFD, pBuffer, thisChunkSize, fileOffset, bufferIndex);
+			io_uring_sqe_set_data64(pReadSQE, numSubmitted);
+			aExpectedResults[numSubmitted++] = (int)thisChunkSize;
+
+			fileOffset += thisChunkSize;
+			bytesRemaining -= thisChunkSize;
+		}
+		
+		// now send the header (if there is one), and the chunks which were read into the other half of the buffers
+		// last time, as one chain, so that the sends are guaranteed to happen in order, and if any one fails,
+		// the remaining ones are cancelled.
+		unsigned int numSends = aNumChunks[sendHalf] + (m_pendingSendData.empty() ? 0 : 1);
+		unsigned int sendIndex = 0;
+		
+		if (!m_pendingSendData.empty())
+		{
+			struct io_uring_sqe* pSendSQE = io_uring_get_sqe(pRing);
+			io_uring_prep_send(pSendSQE, IOUringSocketLayerThreadContext::kSocketFixedFileIndex, m_pendingSendData.data(),
+							   m_pendingSendData.size(), MSG_NOSIGNAL | MSG_WAITALL | MSG_MORE);
+			io_uring_sqe_set_flags(pSendSQE, IOSQE_FIXED_FILE | ((++sendIndex < numSends) ? IOSQE_IO_LINK : 0));
+			io_uring_sqe_set_data64(pSendSQE, numSubmitted);
+			aExpectedResults[numSubmitted++] = (int)m_pendingSendData.size();
+		}
+		
+		for (unsigned int i = 0; i < aNumChunks[sendHalf]; i++)
+		{
+			unsigned int bufferIndex = sendHalf * numBuffersPerHalf + i;
+			unsigned char* pBuffer = m_pThreadContext->m_pBuffers + (bufferIndex * bufferSize);
+			
+			// MSG_WAITALL so that short sends are retried within the kernel, rather than breaking the chain
+			int sendFlags = MSG_NOSIGNAL | MSG_WAITALL;
+			if (bytesRemaining > 0 || numReadChunks > 0)
+			{
+				sendFlags |= MSG_MORE;
+			}
+			
+			struct io_uring_sqe* pSendSQE = io_uring_get_sqe(pRing);
+			io_uring_prep_send(pSendSQE, IOUringSocketLayerThreadContext::kSocketFixedFileIndex, pBuffer, aChunkSizes[sendHalf][i], sendFlags);
+			io_uring_sqe_set_flags(pSendSQE, IOSQE_FIXED_FILE | ((++sendIndex < numSends) ? IOSQE_IO_LINK : 0));
+			io_uring_sqe_set_data64(pSendSQE, numSubmitted);
+			aExpectedResults[numSubmitted++] = (int)aChunkSizes[sendHalf][i];
+		}
+
+		int submitRet = io_uring_submit_and_wait(pRing, numSubmitted);
+		if (submitRet < 0)
+		{
+			m_logger.error("io_uring_submit_and_wait() failed: %s", strerror(-submitRet));
+			m_pendingSendData.clear();
+			return false;
+		}
+
+		// we need to reap all the completions, even if one failed (or we timed out), so the ring's in a consistent
+		// state for next time
+		bool batchSuccessful = true;
+		bool timedOut = false;
+		bool aCompleted[kRingNumEntries] = { false };
+		unsigned int numCompletionsRemaining = numSubmitted;
+		while (numCompletionsRemaining > 0)
+		{
+			struct io_uring_cqe* pCQE = nullptr;
+			// once we've timed out and cancelled everything, the remaining completions shouldn't take long
+			int waitRet = timedOut ? io_uring_wait_cqe(pRing, &pCQE) : waitForCompletion(pRing, &pCQE, deadline);
+			if (waitRet == -ETIME)
+			{
+				m_logger.info("Timed out sending to client. Aborting transfer.");
+				timedOut = true;
+				batchSuccessful = false;
+
+				// cancel whatever's still outstanding (cancelling a send in a chain also cancels the ones linked
+				// after it), and shut the socket down, so any send the kernel's already started can't block any longer.
+				unsigned int numCancelled = 0;
+				for (unsigned int i = 0; i < numSubmitted; i++)
+				{
+					if (aCompleted[i])
+						continue;
+
+					struct io_uring_sqe* pCancelSQE = io_uring_get_sqe(pRing);
+					if (!pCancelSQE)
+						break;
+
+					io_uring_prep_cancel64(pCancelSQE, i, 0);
+					io_uring_sqe_set_data64(pCancelSQE, kCancelUserData);
+					numCancelled++;
+				}
+				io_uring_submit(pRing);
+				numCompletionsRemaining += numCancelled;
+
+				::shutdown(m_pRawSocket->getSocketFD(), SHUT_RDWR);
+				continue;
+			}
+			else if (waitRet < 0)
+			{
+				// this really shouldn't happen, and we can't really recover the ring state if it does...
+				m_logger.error("io_uring_wait_cqe() failed: %s", strerror(-waitRet));
+				m_pendingSendData.clear();
+				return false;
+			}
+
+			uint64_t submissionIndex = pCQE->user_data;
+			if (submissionIndex < numSubmitted)
+			{
+				aCompleted[submissionIndex] = true;
+				if (pCQE->res != aExpectedResults[submissionIndex])
+				{
+					batchSuccessful = false;
+				}
+			}
+			else if (submissionIndex != kCancelUserData)
+			{
+				batchSuccessful = false;
+			}
+
+			io_uring_cqe_seen(pRing, pCQE);
+			numCompletionsRemaining--;
+		}
+		
+		m_pendingSendData.clear();
+
+		if (!batchSuccessful)
+		{
+			// on the assumption that the socket was closed by the other side (or the file was truncated)...
+			return false;
+		}
+		
+		aNumChunks[sendHalf] = 0;
+		aNumChunks[readHalf] = numReadChunks;
+		readHalf = sendHalf;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool ConnectionSocketIOUring::flushPendingSendData() const
+{
+	if (m_pendingSendData.empty())
+		return true;
+	
+	bool wasSuccessful = ConnectionSocketPlain::send(m_pendingSendData, 0);
+	m_pendingSendData.clear();
+	return wasSuccessful;
+}
+
+bool ConnectionSocketIOUring::close(bool deleteRawSocket)
+{
+	flushPendingSendData();
+	
+	// unregister the socket from the ring first, as otherwise the ring would keep a reference to it
+	m_pThreadContext->setSocketFixedFile(-1);
+
+	return ConnectionSocketPlain::close(deleteRawSocket);
+}
+
+//
+
+IOUringSocketLayerThreadContext::IOUringSocketLayerThreadContext() :
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+	m_pRing(nullptr),
+#endif
+	m_pBuffers(nullptr)
+{
+
+}
+
+IOUringSocketLayerThreadContext::~IOUringSocketLayerThreadContext()
+{
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+	if (m_pRing)
+	{
+		// this also unregisters the buffers and files
+		io_uring_queue_exit(m_pRing);
+		delete m_pRing;
+		m_pRing = nullptr;
+	}
+#endif
+
+	if (m_pBuffers)
+	{
+		free(m_pBuffers);
+		m_pBuffers = nullptr;
+	}
+}
+
+bool IOUringSocketLayerThreadContext::initialise(Logger& logger)
+{
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+	m_pRing = new struct io_uring;
+	int ret = io_uring_queue_init(kRingNumEntries, m_pRing, 0);
+	if (ret < 0)
+	{
+		logger.error("Could not create io_uring instance: %s", strerror(-ret));
+		delete m_pRing;
+		m_pRing = nullptr;
+		return false;
+	}
+
+	// page-align the buffers, as they're going to be pinned by the kernel
+	if (posix_memalign((void**)&m_pBuffers, 4096, kNumRegisteredBuffers * kRegisteredBufferSize) != 0)
+	{
+		m_pBuffers = nullptr;
+		return false;
+	}
+
+	struct iovec aBufferIOVecs[kNumRegisteredBuffers];
+	for (unsigned int i = 0; i < kNumRegisteredBuffers; i++)
+	{
+		aBufferIOVecs[i].iov_base = m_pBuffers + (i * kRegisteredBufferSize);
+		aBufferIOVecs[i].iov_len = kRegisteredBufferSize;
+	}
+
+	ret = io_uring_register_buffers(m_pRing, aBufferIOVecs, kNumRegisteredBuffers);
+	if (ret < 0)
+	{
+		logger.error("Could not register io_uring buffers: %s", strerror(-ret));
+		return false;
+	}
+
+	// register an empty (sparse) slot for the socket, which we update for each connection
+	int emptyFD = -1;
+	ret = io_uring_register_files(m_pRing, &emptyFD, 1);
+	if (ret < 0)
+	{
+		logger.error("Could not register io_uring files: %s", strerror(-ret));
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool IOUringSocketLayerThreadContext::setSocketFixedFile(int socketFD)
+{
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+	int ret = io_uring_register_files_update(m_pRing, kSocketFixedFileIndex, &socketFD, 1);
+	return ret == 1;
+#else
+	return false;
+#endif
+}
+
+//
+
+SocketLayerIOUring::SocketLayerIOUring(Logger& logger) : SocketLayer(logger),
+	m_available(false)
+{
+
+}
+
+SocketLayerIOUring::~SocketLayerIOUring()
+{
+
+}
+
+bool SocketLayerIOUring::configure(const Configuration& configuration)
+{
+	m_available = isSupported();
+	if (!m_available)
+	{
+		m_logger.warning("io_uring is not supported by the running kernel. Falling back to standard socket IO.");
+	}
+
+	// connections can still fall back to plain sockets (i.e. with the event connection engine), which use sendfile()
+	if (Socket::isSendFileSupported())
+	{
+		SocketLayerPlain::disableSIGPIPE(m_logger);
+	}
+
+	// we can always fall back to plain sockets, so this never fails
+	return true;
+}
+
+SocketLayerThreadContext* SocketLayerIOUring::allocatePerThreadContext()
+{
+	IOUringSocketLayerThreadContext* pNewThreadContext = new IOUringSocketLayerThreadContext();
+	if (!pNewThreadContext->initialise(m_logger))
+	{
+		// connections handled by this thread will just use plain sockets
+		delete pNewThreadContext;
+		return nullptr;
+	}
+
+	return pNewThreadContext;
+}
+
+ReturnCodeType SocketLayerIOUring::allocateSpecialisedConnectionSocket(RequestConnection& connection)
+{
+	IOUringSocketLayerThreadContext* pThreadContext = nullptr;
+	if (m_available && connection.pThreadConfig->pNonSecureSLThreadContext)
+	{
+		pThreadContext = static_cast<IOUringSocketLayerThreadContext*>(connection.pThreadConfig->pNonSecureSLThreadContext);
+	}
+
+	if (pThreadContext && pThreadContext->setSocketFixedFile(connection.pRawSocket->getSocketFD()))
+	{
+		connection.pConnectionSocket = new ConnectionSocketIOUring(connection.pRawSocket, m_logger, pThreadContext);
+	}
+	else
+	{
+		// we don't have a thread context (i.e. the event connection engine's in use), so just use a plain socket
+		connection.pConnectionSocket = new ConnectionSocketPlain(connection.pRawSocket, m_logger);
+	}
+
+	return eReturnOK;
+}
+
+bool SocketLayerIOUring::isSupported()
+{
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+	struct io_uring testRing;
+	if (io_uring_queue_init(2, &testRing, 0) < 0)
+		return false;
+
+	io_uring_queue_exit(&testRing);
+	return true;
+#else
+	return false;
+#endif
+}
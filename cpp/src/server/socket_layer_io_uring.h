@@ -0,0 +1,122 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef SOCKET_LAYER_IO_URING_H
+#define SOCKET_LAYER_IO_URING_H
+
+#include "connection_socket.h"
+#include "socket_layer_interface.h"
+#include "socket_layer_plain.h"
+
+#include "utils/socket.h"
+
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+struct io_uring;
+#endif
+
+class IOUringSocketLayerThreadContext;
+
+// Non-secure connection socket which uses a per-thread io_uring instance for sending file data,
+// so that file reads and socket sends can be submitted as batches, with a single syscall per batch,
+// rather than a read() and send() syscall for each chunk. The reads of each batch are done while
+// the previous batch is being sent, and a response header sent (with SEND_MORE_TO_FOLLOW) just
+// before the file data is held back and sent as part of the first batch. If the response's send deadline
+// passes while waiting for a batch, the outstanding submissions are cancelled, and the send fails.
+// Note: receiving, and sending of other data just uses the normal socket functions, as with a
+//       thread per connection there's nothing to batch them with, so they'd still need a syscall each.
+class ConnectionSocketIOUring : public ConnectionSocketPlain
+{
+public:
+	ConnectionSocketIOUring(Socket* pRawSocket, Logger& logger, IOUringSocketLayerThreadContext* pThreadContext);
+	virtual ~ConnectionSocketIOUring();
+
+	virtual bool send(const std::string& data, unsigned int flags = 0) const override;
+	virtual bool send(unsigned char* pData, size_t dataLength) const override;
+	virtual bool sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags = 0) const override;
+
+	virtual SocketRecvReturnCode recv(RecvBuffer& buffer, unsigned int timeoutSecs) const override;
+	virtual SocketRecvReturnCode recvNonBlocking(RecvBuffer& buffer) const override;
+
+	virtual bool supportsSendFileData() const override;
+	virtual bool sendFileData(int fileFD, size_t offset, size_t length) const override;
+
+	virtual bool close(bool deleteRawSocket) override;
+
+protected:
+	// sends any data held back from a previous sendv() on its own
+	bool flushPendingSendData() const;
+
+protected:
+	// we don't own this
+	IOUringSocketLayerThreadContext*	m_pThreadContext;
+
+	// small amounts of data (i.e. response headers) sent with SEND_MORE_TO_FOLLOW, which haven't actually been sent yet
+	mutable std::string					m_pendingSendData;
+};
+
+class IOUringSocketLayerThreadContext : public SocketLayerThreadContext
+{
+public:
+	IOUringSocketLayerThreadContext();
+	virtual ~IOUringSocketLayerThreadContext();
+
+	bool initialise(Logger& logger);
+
+	// the registered (fixed) file index the current connection's socket is registered at
+	static const unsigned int kSocketFixedFileIndex = 0;
+
+	// registers the socket as the ring's fixed socket file, or pass -1 to unregister it
+	bool setSocketFixedFile(int socketFD);
+
+	// these are used as two halves, so that one half can be read into while the other half is being sent
+	static const unsigned int kNumRegisteredBuffers = 8;
+	static const unsigned int kRegisteredBufferSize = 64 * 1024;
+
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+	struct io_uring*		m_pRing;
+#endif
+
+	unsigned char*			m_pBuffers;
+};
+
+class SocketLayerIOUring : public SocketLayer
+{
+public:
+	SocketLayerIOUring(Logger& logger);
+	virtual ~SocketLayerIOUring();
+
+	virtual bool configure(const Configuration& configuration) override;
+
+	virtual bool supportsPerThreadContext() const override
+	{
+		return m_available;
+	}
+
+	virtual SocketLayerThreadContext* allocatePerThreadContext() override;
+
+	virtual ReturnCodeType allocateSpecialisedConnectionSocket(RequestConnection& connection) override;
+
+	// probes whether io_uring is actually usable with the running kernel (and sandboxing, etc).
+	static bool isSupported();
+
+protected:
+	// whether io_uring is usable - if not, we just allocate plain connection sockets
+	bool				m_available;
+};
+
+#endif // SOCKET_LAYER_IO_URING_H
@@ -18,6 +18,8 @@
 
 #include "socket_layer_plain.h"
 
+#include <signal.h>
+
 ConnectionSocketPlain::ConnectionSocketPlain(Socket* pRawSocket, Logger& logger) : ConnectionSocket(logger),
 				m_pRawSocket(pRawSocket)
 {
@@ -31,27 +33,37 @@ ConnectionSocketPlain::~ConnectionSocketPlain()
 
 bool ConnectionSocketPlain::send(const std::string& data, unsigned int flags) const
 {
-	return m_pRawSocket->send(data);
+	return m_pRawSocket->send(data, getResponseSendDeadline(m_pRawSocket->getSendTimeout()));
 }
 
 bool ConnectionSocketPlain::send(unsigned char* pData, size_t dataLength) const
 {
-	return m_pRawSocket->send(pData, dataLength);
+	return m_pRawSocket->send(pData, dataLength, getResponseSendDeadline(m_pRawSocket->getSendTimeout()));
+}
+
+bool ConnectionSocketPlain::sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags) const
+{
+	return m_pRawSocket->sendv(pIOVecs, count, (flags & SEND_MORE_TO_FOLLOW) != 0, getResponseSendDeadline(m_pRawSocket->getSendTimeout()));
+}
+
+SocketRecvReturnCode ConnectionSocketPlain::recv(RecvBuffer& buffer, unsigned int timeoutSecs) const
+{
+	return m_pRawSocket->recv(buffer, timeoutSecs);
 }
 
-SocketRecvReturnCode ConnectionSocketPlain::recv(std::string& data) const
+SocketRecvReturnCode ConnectionSocketPlain::recvNonBlocking(RecvBuffer& buffer) const
 {
-	return m_pRawSocket->recv(data);
+	return m_pRawSocket->recvNonBlocking(buffer);
 }
 
-SocketRecvReturnCode ConnectionSocketPlain::recvSmart(std::string& data, unsigned int timeoutSecs) const
+bool ConnectionSocketPlain::supportsSendFileData() const
 {
-	return m_pRawSocket->recvSmartWithTimeout(data, timeoutSecs);
+	return Socket::isSendFileSupported();
 }
 
-SocketRecvReturnCode ConnectionSocketPlain::recvWithTimeout(std::string& data, unsigned int timeoutSecs) const
+bool ConnectionSocketPlain::sendFileData(int fileFD, size_t offset, size_t length) const
 {
-	return m_pRawSocket->recvWithTimeout(data, timeoutSecs);
+	return m_pRawSocket->sendFile(fileFD, offset, length, getResponseSendDeadline(m_pRawSocket->getSendTimeout()));
 }
 
 bool ConnectionSocketPlain::close(bool deleteRawSocket)
@@ -80,9 +92,31 @@ SocketLayerPlain::~SocketLayerPlain()
 	
 }
 
+bool SocketLayerPlain::configure(const Configuration& configuration)
+{
+	if (Socket::isSendFileSupported())
+	{
+		disableSIGPIPE(m_logger);
+	}
+
+	return true;
+}
+
 ReturnCodeType SocketLayerPlain::allocateSpecialisedConnectionSocket(RequestConnection& connection)
 {
 	connection.pConnectionSocket = new ConnectionSocketPlain(connection.pRawSocket, m_logger);
 	
 	return eReturnOK;
 }
+
+void SocketLayerPlain::disableSIGPIPE(Logger& logger)
+{
+	struct sigaction act;
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = SIG_IGN;
+	act.sa_flags = SA_RESTART;
+	if (sigaction(SIGPIPE, &act, NULL) != 0)
+	{
+		logger.error("Error disabling SIGPIPE. It's very likely connections won't work reliably.");
+	}
+}
@@ -34,10 +34,14 @@ public:
 	
 	virtual bool send(const std::string& data, unsigned int flags = 0) const override;
 	virtual bool send(unsigned char* pData, size_t dataLength) const override;
+	virtual bool sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags = 0) const override;
 
-	virtual SocketRecvReturnCode recv(std::string& data) const override;
-	virtual SocketRecvReturnCode recvSmart(std::string& data, unsigned int timeoutSecs) const override;
-	virtual SocketRecvReturnCode recvWithTimeout(std::string& data, unsigned int timeoutSecs) const override;
+	virtual SocketRecvReturnCode recv(RecvBuffer& buffer, unsigned int timeoutSecs) const override;
+	virtual SocketRecvReturnCode recvNonBlocking(RecvBuffer& buffer) const override;
+
+	// uses sendfile() where it's supported
+	virtual bool supportsSendFileData() const override;
+	virtual bool sendFileData(int fileFD, size_t offset, size_t length) const override;
 	
 	virtual bool close(bool deleteRawSocket) override;
 	
@@ -51,8 +55,14 @@ class SocketLayerPlain : public SocketLayer
 public:
 	SocketLayerPlain(Logger& logger);
 	virtual ~SocketLayerPlain();
+
+	virtual bool configure(const Configuration& configuration) override;
 	
 	virtual ReturnCodeType allocateSpecialisedConnectionSocket(RequestConnection& connection) override;
+
+	// sendfile() can't be passed MSG_NOSIGNAL, so SIGPIPE needs to be ignored for the whole process if it's going
+	// to be used, otherwise clients closing connections mid-transfer would kill us.
+	static void disableSIGPIPE(Logger& logger);
 };
 
 #endif // SOCKET_LAYER_PLAIN_H
@@ -21,23 +21,32 @@
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
 #include <s2n.h>
 #include <signal.h>
+#if WEBSERVE_ENABLE_S2N_KTLS_SUPPORT
+#include <s2n/unstable/ktls.h>
+#endif
 #endif
 
 #include <unistd.h>
 #include <poll.h>
 
+#include <chrono>
+#include <cstring>
+
 #include "web_server_common.h"
+#include "http2_connection.h"
 
 #include "utils/file_helpers.h"
-#include "utils/string_helpers.h"
+#include "utils/recv_buffer.h"
 
 static const unsigned int kMaxRecvLengthS2N = 4096;
 
-ConnectionSocketS2N::ConnectionSocketS2N(Logger& logger, Socket* pRawSocket, struct s2n_connection* pS2NConnection, bool ownConnection)
+ConnectionSocketS2N::ConnectionSocketS2N(Logger& logger, Socket* pRawSocket, struct s2n_connection* pS2NConnection, bool ownConnection,
+										 bool kernelTLSSend)
 		: ConnectionSocket(logger),
 			m_active(true),
 			m_pRawSocket(pRawSocket),
-			m_ownConnection(ownConnection)
+			m_ownConnection(ownConnection),
+			m_kernelTLSSend(kernelTLSSend)
 {
 	m_pS2NConnection = pS2NConnection;
 }
@@ -57,23 +66,68 @@ ConnectionSocketS2N::~ConnectionSocketS2N()
 }
 
 bool ConnectionSocketS2N::send(const std::string& data, unsigned int flags) const
+{
+	struct iovec dataIOVec;
+	dataIOVec.iov_base = (void*)data.c_str();
+	dataIOVec.iov_len = data.size();
+	
+	return sendv(&dataIOVec, 1, flags);
+}
+
+bool ConnectionSocketS2N::send(unsigned char* pData, size_t dataLength) const
+{
+	struct iovec dataIOVec;
+	dataIOVec.iov_base = pData;
+	dataIOVec.iov_len = dataLength;
+	
+	return sendv(&dataIOVec, 1, 0);
+}
+
+bool ConnectionSocketS2N::sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags) const
 {
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
 	s2n_blocked_status blocked;
-	
-	const char* pBuffer = data.c_str();
-	size_t bytesRemaining = data.size();
+
+	ssize_t totalLength = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		totalLength += pIOVecs[i].iov_len;
+	}
+
+	const SendDeadline* pResponseDeadline = getResponseSendDeadline(m_pRawSocket->getSendTimeout());
+	SendDeadline deadline = pResponseDeadline ? *pResponseDeadline : SendDeadline(m_pRawSocket->getSendTimeout());
+
+	// s2n packs the buffers into records itself, so they don't need to be copied together first.
+	// Note: SEND_MORE_TO_FOLLOW doesn't make any difference here.
+	ssize_t offset = 0;
 	ssize_t bytesSent = 0;
 	do
 	{
-		bytesSent = s2n_send(m_pS2NConnection, pBuffer, bytesRemaining, &blocked);
+		bytesSent = s2n_sendv_with_offset(m_pS2NConnection, pIOVecs, count, offset, &blocked);
 		if (bytesSent < 0)
 		{
 			int localErrno = errno;
-			
+
+			if (s2n_error_get_type(s2n_errno) == S2N_ERR_T_BLOCKED)
+			{
+				// the raw socket's send timed out (partially) writing a record, because the client isn't reading fast enough.
+				// s2n keeps the rest of the record to send next time, so wait until the socket's writable and try again.
+				if (m_pRawSocket->waitForWritable(deadline))
+				{
+					bytesSent = 0;
+					continue;
+				}
+
+				if (!(flags & SEND_IGNORE_FAILURES))
+				{
+					m_logger.info("Timed out sending to client. Aborting transfer.");
+				}
+				return false;
+			}
+
 			if (flags & SEND_IGNORE_FAILURES)
 				return false;
-			
+
 			// ignore printing error for 104 - connection reset by peer, as well as 32 - EPIPE
 			if (localErrno != ECONNRESET && localErrno != EPIPE)
 			{
@@ -82,237 +136,208 @@ bool ConnectionSocketS2N::send(const std::string& data, unsigned int flags) cons
 			return false;
 		}
 
-		bytesRemaining -= bytesSent;
-		pBuffer += bytesSent;
+		offset += bytesSent;
 	}
-	while (bytesRemaining || blocked);
-	
-	return bytesRemaining == 0;
+	while (offset < totalLength || blocked);
+
+	return offset == totalLength;
 #else
-	return false;	
+	return false;
 #endif
 }
 
-bool ConnectionSocketS2N::send(unsigned char* pData, size_t dataLength) const
+bool ConnectionSocketS2N::supportsSendFileData() const
 {
-#if WEBSERVE_ENABLE_HTTPS_SUPPORT
-	s2n_blocked_status blocked;
-	
-	const unsigned char* pBuffer = pData;
-	size_t bytesRemaining = dataLength;
-	ssize_t bytesSent = 0;
-	do
+	return m_kernelTLSSend;
+}
+
+bool ConnectionSocketS2N::sendFileData(int fileFD, size_t offset, size_t length) const
+{
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT && WEBSERVE_ENABLE_S2N_KTLS_SUPPORT
+	if (!m_kernelTLSSend)
+		return false;
+
+	const SendDeadline* pResponseDeadline = getResponseSendDeadline(m_pRawSocket->getSendTimeout());
+	SendDeadline deadline = pResponseDeadline ? *pResponseDeadline : SendDeadline(m_pRawSocket->getSendTimeout());
+
+	// the kernel's doing the record encryption, so s2n can just sendfile() the file content straight to the socket
+	off_t fileOffset = (off_t)offset;
+	size_t bytesRemaining = length;
+	while (bytesRemaining > 0)
 	{
-		bytesSent = s2n_send(m_pS2NConnection, pBuffer, bytesRemaining, &blocked);
-		if (bytesSent < 0)
+		s2n_blocked_status blocked = S2N_NOT_BLOCKED;
+		size_t bytesWritten = 0;
+		int ret = s2n_sendfile(m_pS2NConnection, fileFD, fileOffset, bytesRemaining, &bytesWritten, &blocked);
+
+		fileOffset += bytesWritten;
+		bytesRemaining -= bytesWritten;
+
+		if (ret < 0)
 		{
+			if (s2n_error_get_type(s2n_errno) == S2N_ERR_T_BLOCKED)
+			{
+				if (m_pRawSocket->waitForWritable(deadline))
+					continue;
+
+				m_logger.info("Timed out sending to client. Aborting transfer.");
+				return false;
+			}
+
 			int localErrno = errno;
 			// ignore printing error for 104 - connection reset by peer, as well as 32 - EPIPE
 			if (localErrno != ECONNRESET && localErrno != EPIPE)
 			{
-				m_logger.debug("Error writing to connection: '%s'", s2n_strerror(s2n_errno, "EN"));
+				m_logger.debug("Error sending file to connection: '%s'", s2n_strerror(s2n_errno, "EN"));
 			}
 			return false;
 		}
-
-		bytesRemaining -= bytesSent;
-		pBuffer += bytesSent;
+		else if (bytesWritten == 0)
+		{
+			// the file's shorter than expected
+			return false;
+		}
 	}
-	while (bytesRemaining || blocked);
-	
-	return bytesRemaining == 0;
+
+	return true;
 #else
 	return false;
 #endif
 }
 
-SocketRecvReturnCode ConnectionSocketS2N::recv(std::string& data) const
+SocketRecvReturnCode ConnectionSocketS2N::recv(RecvBuffer& buffer, unsigned int timeoutSecs) const
 {
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
+	if (!m_pRawSocket->isValid())
+		return SocketRecvReturnCode(eSockRecv_Error);
+
+	// if s2n already has decrypted data buffered, there's no point waiting on the raw socket, which might not
+	// have anything more for us.
+	if (timeoutSecs > 0 && s2n_peek(m_pS2NConnection) == 0)
+	{
+		struct pollfd fd;
+		fd.fd = m_pRawSocket->getSocketFD();
+		fd.events = POLLIN | POLLPRI;
+		// Note: we don't need to specify POLLERR or POLLHUP, as these are automatic according
+		//       to the poll() man page. If either is set, s2n_recv() below will tell us what happened.
+		int pollResult = poll(&fd, 1, timeoutSecs * 1000);
+		if (pollResult == -1)
+		{
+			return SocketRecvReturnCode(eSockRecv_Error);
+		}
+		else if (pollResult == 0)
+		{
+			return SocketRecvReturnCode(eSockRecv_TimedOutNoData);
+		}
+	}
+
 	s2n_blocked_status blocked;
 
-	char buffer[kMaxRecvLengthS2N];
-	int bytesRead = 0;
+	size_t dataLength = 0;
+
 	do
 	{
-		bytesRead = s2n_recv(m_pS2NConnection, buffer, kMaxRecvLengthS2N, &blocked);
+		char* pWritePointer = buffer.getWritePointer(kMaxRecvLengthS2N);
+
+		int bytesRead = s2n_recv(m_pS2NConnection, pWritePointer, buffer.getWriteSpace(), &blocked);
 		if (bytesRead == 0)
 		{
-			// TODO: is this correct?
-			return SocketRecvReturnCode(eSockRecv_NoData);
+			return dataLength > 0 ? SocketRecvReturnCode(eSockRecv_OK) : SocketRecvReturnCode(eSockRecv_PeerClosed);
 		}
-		if (bytesRead < 0)
+		else if (bytesRead < 0)
 		{
+			int localErrno = errno;
+			if (localErrno == ECONNRESET || localErrno == EPIPE)
+			{
+				// we silently fail in this case
+				return dataLength > 0 ? SocketRecvReturnCode(eSockRecv_OK) : SocketRecvReturnCode(eSockRecv_PeerClosed);
+			}
+
 			m_logger.debug("Error reading from S2N connection: '%s' %d", s2n_strerror(s2n_errno, "EN"), s2n_connection_get_alert(m_pS2NConnection));
 			return SocketRecvReturnCode(eSockRecv_Error);
 		}
-		
-		buffer[bytesRead] = '\0';
-	
-		data.append(buffer);
+
+		buffer.commitWrite(bytesRead);
+		dataLength += bytesRead;
 	}
-	while (blocked);
-	
+	// carry on while s2n has more already decrypted, as polling the raw socket won't tell us about that
+	while (s2n_peek(m_pS2NConnection) > 0);
+
 	return SocketRecvReturnCode(eSockRecv_OK);
 #else
 	return SocketRecvReturnCode(eSockRecv_Error);
 #endif
 }
 
-SocketRecvReturnCode ConnectionSocketS2N::recvSmart(std::string& data, unsigned int timeoutSecs) const
+SocketRecvReturnCode ConnectionSocketS2N::recvNonBlocking(RecvBuffer& buffer) const
 {
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
+	if (!m_pRawSocket->isValid())
+		return SocketRecvReturnCode(eSockRecv_Error);
+
 	s2n_blocked_status blocked;
-	
-	int dataLength = 0;
 
-	char buffer[kMaxRecvLengthS2N + 1];
+	size_t dataLength = 0;
 
-	int bytesRead = 0;
-	
-	unsigned int loopCount = 0;
-	
-	// check if there's anything for us with a time-out...
 	struct pollfd fd;
 	fd.fd = m_pRawSocket->getSocketFD();
-	fd.events = POLLIN | POLLPRI;// | POLLOUT;
-	// Note: we don't need to specify POLLERR or POLLHUP, as these are automatic according
-	//       to the poll() man page
-	unsigned int timeoutMS = timeoutSecs * 1000; // poll() deals in ms...
-	
-	bool timedOut = false;
+	fd.events = POLLIN | POLLPRI;
 
-	do
+	while (true)
 	{
-		if (timeoutSecs > 0)
+		// if s2n doesn't have anything already decrypted and buffered, check the raw socket has something
+		// for us without waiting, as the s2n_recv() call below will block otherwise...
+		if (s2n_peek(m_pS2NConnection) == 0)
 		{
-			int pollResult = poll(&fd, 1, timeoutMS);
-			if (pollResult == -1)
+			int pollResult = poll(&fd, 1, 0);
+			if (pollResult <= 0 || !(fd.revents & (POLLIN | POLLPRI)))
 			{
-				// there's been an error...
-	//			break;
-				return eSockRecv_Error;
-			}
-			else if (pollResult == 0)
-			{
-				// timed out...
-				timedOut = true;
-				break;
-			}
-			
-			if (fd.revents & POLLERR)
-			{
-				// an error occurred, possibly the socket was closed on the other end.
-				break;
-			}
-			else if (fd.revents & POLLHUP)
-			{
-				// peer closed its end of the socket
 				break;
 			}
 		}
 
-		// otherwise we should have data to receive...
-		
-		// TODO: is this necessary given we're appending a NULL to the end of the buffer below? Possibly good practice, but
-		//       but could cost us a bit in performance... Currently this code isn't used for anything performance-critical, but...
-		memset(buffer, 0, sizeof(buffer));
-
-		// TODO: we could also receive into a larger windowed buffer, and only do the conversion to std::string once at the end (or
-		//       at least not as often).
+		char* pWritePointer = buffer.getWritePointer(kMaxRecvLengthS2N);
 
-		bytesRead = s2n_recv(m_pS2NConnection, buffer, kMaxRecvLengthS2N, &blocked);
+		// Note: this will still block if only a partial TLS record is available, but that should be rare,
+		//       and the recv timeout applies in that case.
+		int bytesRead = s2n_recv(m_pS2NConnection, pWritePointer, buffer.getWriteSpace(), &blocked);
 		if (bytesRead == 0)
 		{
-			// TODO: is this right?
-			return SocketRecvReturnCode(eSockRecv_NoData);
+			return dataLength > 0 ? SocketRecvReturnCode(eSockRecv_OK) : SocketRecvReturnCode(eSockRecv_PeerClosed);
 		}
-		if (bytesRead < 0)
+		else if (bytesRead < 0)
 		{
-			int localErrno = errno;
-			if (localErrno != ECONNRESET && localErrno != EPIPE)
+			if (s2n_error_get_type(s2n_errno) == S2N_ERR_T_BLOCKED)
 			{
-				m_logger.debug("Error reading from S2N connection: '%s' %d", s2n_strerror(s2n_errno, "EN"), s2n_connection_get_alert(m_pS2NConnection));
-				return SocketRecvReturnCode(eSockRecv_Error);
+				break;
 			}
-			else
+
+			int localErrno = errno;
+			if (localErrno == ECONNRESET || localErrno == EPIPE)
 			{
-				// otherwise, we silently fail
 				return SocketRecvReturnCode(eSockRecv_PeerClosed);
 			}
-		}
-
-		// this check is hopefully not needed given the above, but..
-		if (bytesRead > 0)
-		{
-			buffer[bytesRead] = '\0';
-
-			data.append(buffer);
-			dataLength += bytesRead;
-
-			// check it's a POST request
-			if (!StringHelpers::beginsWithStaticConst(data, "POST"))
-				continue;
-
-			// check there was no data payload
-			if (!StringHelpers::endsWithStaticConst(data, "\r\n\r\n"))
-				continue;
-
-			// otherwise, we've got a POST request with no form data, so try and find the Content-Length:
-
-			size_t contentLengthStart = data.find("Content-Length:");
-			if (contentLengthStart == std::string::npos)
-				continue;
-
-			size_t contentLengthDataStart = contentLengthStart + 15;
-
-			size_t lineEnd = data.find('\r', contentLengthDataStart);
-			if (lineEnd != std::string::npos)
-			{
-				std::string contentLengthString = data.substr(contentLengthDataStart, lineEnd - contentLengthDataStart);
-
-				unsigned int contentLengthVal = atoi(contentLengthString.c_str());
 
-				if (contentLengthVal > 0)
-				{
-					bytesRead = s2n_recv(m_pS2NConnection, buffer, kMaxRecvLengthS2N, &blocked);
-					
-					if (bytesRead > 0)
-					{
-						buffer[bytesRead] = '\0';
-	
-						data.append(buffer);
-						dataLength += bytesRead;
-					}
-				}
-			}
-		}
-		else
-		{
-			break;
+			m_logger.debug("Error reading from S2N connection: '%s' %d", s2n_strerror(s2n_errno, "EN"), s2n_connection_get_alert(m_pS2NConnection));
+			return SocketRecvReturnCode(eSockRecv_Error);
 		}
-		
-		loopCount += 1;
-	}
-	while (blocked);
-	
-	if (timedOut)
-	{
-		return dataLength > 0 ? eSockRecv_TimedOutWithData : eSockRecv_TimedOutNoData;
+
+		buffer.commitWrite(bytesRead);
+		dataLength += bytesRead;
 	}
 
-	return (dataLength > 0) ? SocketRecvReturnCode(eSockRecv_OK) : SocketRecvReturnCode(eSockRecv_NoData);
+	return dataLength > 0 ? SocketRecvReturnCode(eSockRecv_OK) : SocketRecvReturnCode(eSockRecv_NoData);
 #else
 	return SocketRecvReturnCode(eSockRecv_Error);
 #endif
 }
 
-SocketRecvReturnCode ConnectionSocketS2N::recvWithTimeout(std::string& data, unsigned int timeoutSecs) const
+bool ConnectionSocketS2N::hasBufferedRecvData() const
 {
-	unsigned int dataLength = 0;
-	SocketRecvReturnCode retCode = recvWithTimeoutPoll(data, dataLength, timeoutSecs);
-
-	return retCode;
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT
+	return m_pS2NConnection && s2n_peek(m_pS2NConnection) > 0;
+#else
+	return false;
+#endif
 }
 
 void ConnectionSocketS2N::accumulateSocketConnectionStatistics(ConnectionStatistics& connStatistics) const
@@ -385,91 +410,11 @@ bool ConnectionSocketS2N::close(bool deleteRawSocket)
 	return true;
 }
 
-SocketRecvReturnCode ConnectionSocketS2N::recvWithTimeoutPoll(std::string& data, unsigned int& dataLength, unsigned int timeoutSecs) const
-{
-	if (!m_pRawSocket->isValid())
-		return SocketRecvReturnCode(eSockRecv_Error);
-
-#if WEBSERVE_ENABLE_HTTPS_SUPPORT
-	s2n_blocked_status blocked;
-
-	char buffer[kMaxRecvLengthS2N + 1];
-
-	int ret = 0;
-
-	// check if there's anything for us with a time-out...
-	struct pollfd fd;
-	fd.fd = m_pRawSocket->getSocketFD();
-	fd.events = POLLIN | POLLPRI;// | POLLOUT;
-	// Note: we don't need to specify POLLERR or POLLHUP, as these are automatic according
-	//       to the poll() man page
-	unsigned int timeoutMS = timeoutSecs * 1000; // poll() deals in ms...
-
-	do
-	{
-		int pollResult = poll(&fd, 1, timeoutMS);
-		if (pollResult == -1)
-		{
-			// there's been an error...
-			return SocketRecvReturnCode(eSockRecv_Error);
-		}
-		else if (pollResult == 0)
-		{
-			// timed out...
-			break;
-		}
-		
-		if (fd.revents & POLLERR)
-		{
-			// an error occurred, possibly the socket was closed on the other end.
-			break;
-		}
-		else if (fd.revents & POLLHUP)
-		{
-			// peer closed its end of the socket
-			break;
-		}
-
-		// otherwise we should have data to receive...
-		
-		// TODO: is this necessary given we're appending a NULL to the end of the buffer below? Possibly good practice, but
-		//       but could cost us a bit in performance... Currently this code isn't used for anything performance-critical, but...
-		memset(buffer, 0, sizeof(buffer));
-
-		// TODO: we could also receive into a larger windowed buffer, and only do the conversion to std::string once at the end (or
-		//       at least not as often).
-
-		ret = s2n_recv(m_pS2NConnection, buffer, kMaxRecvLengthS2N, &blocked);
-
-		if (ret == 0)
-		{
-			// TODO: is this correct?
-			return SocketRecvReturnCode(eSockRecv_NoData);
-		}
-		if (ret < 0)
-		{
-			int localError = errno;
-			m_logger.debug("Error reading from S2N connection: '%s' %d", s2n_strerror(s2n_errno, "EN"), s2n_connection_get_alert(m_pS2NConnection));
-			return SocketRecvReturnCode(eSockRecv_Error);
-		}
-		
-		buffer[ret] = '\0';
-	
-		data.append(buffer);
-		
-		dataLength += ret;
-	}
-	while (ret >= kMaxRecvLengthS2N || blocked);
-
-	return (ret > 0) ? SocketRecvReturnCode(eSockRecv_OK) : SocketRecvReturnCode(eSockRecv_NoData);
-#else
-	return SocketRecvReturnCode(eSockRecv_Error);
-#endif
-}
-
 //
 
-SocketLayerS2N::SocketLayerS2N(Logger& logger) : SocketLayer(logger)
+SocketLayerS2N::SocketLayerS2N(Logger& logger) : SocketLayer(logger),
+	m_kernelTLSEnabled(false),
+	m_http2Enabled(false)
 {
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
 	m_s2nConfig = nullptr;
@@ -512,6 +457,15 @@ bool SocketLayerS2N::configure(const Configuration& configuration)
 		setenv("S2N_DONT_MLOCK", "1", 1);
 		
 		int res = s2n_init();
+
+		if (configuration.isKernelTLSEnabled())
+		{
+#if WEBSERVE_ENABLE_S2N_KTLS_SUPPORT
+			m_kernelTLSEnabled = true;
+#else
+			m_logger.warning("Kernel TLS was enabled in the config, but support for it wasn't compiled in. Ignoring.");
+#endif
+		}
 	
 		m_s2nConfig = s2n_config_new();
 	 
@@ -601,6 +555,29 @@ bool SocketLayerS2N::configure(const Configuration& configuration)
 			m_logger.error("Could not set s2n config cipher preferences: '%s'. %s", s2n_strerror(s2n_errno, "EN"), s2n_strerror_debug(s2n_errno, "EN"));
 			return false;
 		}
+
+		if (configuration.isHTTP2Enabled())
+		{
+			// the event connection engine only hands workers single HTTP/1.1 requests, so it can't handle HTTP/2
+			// connections, which need to be owned for their entire lifetime.
+			if (configuration.getConnectionEngineType() != Configuration::eConnectionEngineThreadPool)
+			{
+				m_logger.warning("HTTP/2 was enabled in the config, but it's only supported by the threadPool connection engine. Ignoring.");
+			}
+			else
+			{
+				// in order of preference, so clients which support HTTP/2 will use it
+				const char* aProtocols[] = { HTTP2Connection::kProtocolID, "http/1.1" };
+				if (s2n_config_set_protocol_preferences(m_s2nConfig, aProtocols, 2) < 0)
+				{
+					m_logger.error("Could not set s2n config protocol preferences: '%s'. HTTP/2 won't be available.", s2n_strerror(s2n_errno, "EN"));
+				}
+				else
+				{
+					m_http2Enabled = true;
+				}
+			}
+		}
 		
 		m_logger.info("Configured S2N for HTTPS use.");
 		return true;
@@ -830,6 +807,13 @@ ReturnCodeType SocketLayerS2N::allocateSpecialisedConnectionSocket(RequestConnec
 	
 	// specify that the connection is securely authenticated
 	connection.https = true;
+
+	if (m_http2Enabled)
+	{
+		// the client might not support ALPN at all, in which case this will be null
+		const char* pProtocol = s2n_get_application_protocol(conn);
+		connection.http2 = pProtocol && strcmp(pProtocol, HTTP2Connection::kProtocolID) == 0;
+	}
 	
 	if (setRecvTimeout && !connection.pRawSocket->setRecvTimeoutOption(0))
 	{
@@ -837,8 +821,11 @@ ReturnCodeType SocketLayerS2N::allocateSpecialisedConnectionSocket(RequestConnec
 	}
 	
 	m_logger.debug("Successfully negotiated s2n connection.");
+
+	// this needs to be done before any application data is sent
+	bool kernelTLSSend = m_kernelTLSEnabled && enableKernelTLSSend(conn);
 			
-	connection.pConnectionSocket = new ConnectionSocketS2N(m_logger, connection.pRawSocket, conn, ownThisConnection);
+	connection.pConnectionSocket = new ConnectionSocketS2N(m_logger, connection.pRawSocket, conn, ownThisConnection, kernelTLSSend);
 	
 	return eReturnOK;
 #else
@@ -846,6 +833,24 @@ ReturnCodeType SocketLayerS2N::allocateSpecialisedConnectionSocket(RequestConnec
 #endif	
 }
 
+bool SocketLayerS2N::enableKernelTLSSend(struct s2n_connection* pS2NConnection)
+{
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT && WEBSERVE_ENABLE_S2N_KTLS_SUPPORT
+	// Note: only sending is handed over, as receiving through s2n is cheap for us (requests are small), and means
+	//       s2n_peek() (for hasBufferedRecvData()) keeps working.
+	if (s2n_connection_ktls_enable_send(pS2NConnection) < 0)
+	{
+		// most likely the 'tls' kernel module isn't loaded, or the negotiated cipher isn't supported by it
+		m_logger.debug("Couldn't enable kernel TLS for connection: '%s'", s2n_strerror(s2n_errno, "EN"));
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
 SocketLayerS2N::S2NSocketLayerThreadContext::~S2NSocketLayerThreadContext()
 {
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
@@ -29,26 +29,35 @@ struct s2n_config;
 struct s2n_connection;
 #endif
 
+// kernel TLS (kTLS) support needs a newer version of s2n than is bundled, so it needs to be enabled explicitly
+#ifndef WEBSERVE_ENABLE_S2N_KTLS_SUPPORT
+#define WEBSERVE_ENABLE_S2N_KTLS_SUPPORT 0
+#endif
+
 class ConnectionSocketS2N : public ConnectionSocket
 {
 public:
-	ConnectionSocketS2N(Logger& logger, Socket* pRawSocket, struct s2n_connection* pS2NConnection, bool ownConnection);
+	ConnectionSocketS2N(Logger& logger, Socket* pRawSocket, struct s2n_connection* pS2NConnection, bool ownConnection,
+						bool kernelTLSSend);
 	virtual ~ConnectionSocketS2N();
 	
 	virtual bool send(const std::string& data, unsigned int flags = 0) const override;
 	virtual bool send(unsigned char* pData, size_t dataLength) const override;
+	virtual bool sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags = 0) const override;
+
+	virtual SocketRecvReturnCode recv(RecvBuffer& buffer, unsigned int timeoutSecs) const override;
+	virtual SocketRecvReturnCode recvNonBlocking(RecvBuffer& buffer) const override;
 
-	virtual SocketRecvReturnCode recv(std::string& data) const override;
-	virtual SocketRecvReturnCode recvSmart(std::string& data, unsigned int timeoutSecs) const override;
-	virtual SocketRecvReturnCode recvWithTimeout(std::string& data, unsigned int timeoutSecs) const override;
+	virtual bool hasBufferedRecvData() const override;
+
+	// only if the kernel's doing the TLS encryption of sends (kTLS), in which case file data can be sent with sendfile()
+	virtual bool supportsSendFileData() const override;
+	virtual bool sendFileData(int fileFD, size_t offset, size_t length) const override;
 	
 	virtual void accumulateSocketConnectionStatistics(ConnectionStatistics& connStatistics) const override;
 	
 	virtual bool close(bool deleteRawSocket) override;
 	
-protected:
-	SocketRecvReturnCode recvWithTimeoutPoll(std::string& data, unsigned int& dataLength, unsigned int timeoutSecs) const;
-	
 protected:
 	bool		m_active;
 	
@@ -59,6 +68,9 @@ protected:
 	// whether this connection was allocated just for this socket
 	bool				m_ownConnection;
 	struct s2n_connection*		m_pS2NConnection;
+
+	// whether kTLS has been enabled for sending on the connection
+	bool				m_kernelTLSSend;
 };
 
 class SocketLayerS2N : public SocketLayer
@@ -92,11 +104,20 @@ protected:
 		struct s2n_connection*		m_s2nConnection;
 	};
 	
+protected:
+	// tries to enable kTLS for sending on the newly-negotiated connection, returning false if the kernel (or
+	// negotiated cipher) doesn't support it, in which case s2n just carries on doing the encryption itself.
+	bool enableKernelTLSSend(struct s2n_connection* pS2NConnection);
+	
 protected:
 	
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
 	struct s2n_config*				m_s2nConfig;
 #endif
+
+	bool							m_kernelTLSEnabled;
+	// whether HTTP/2 is offered (via ALPN) to clients
+	bool							m_http2Enabled;
 };
 
 #endif // SOCKET_LAYER_S2N_H
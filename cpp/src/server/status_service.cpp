@@ -23,6 +23,69 @@
 
 #include "web_server_common.h"
 
+// upper bounds (in ms) of each of the queue wait histogram buckets, apart from the last one which
+// holds everything above the previous one.
+static const unsigned int kQueueWaitBucketLimitsMS[ServerStatistics::kNumQueueWaitBuckets - 1] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000 };
+
+ServerStatistics::ServerStatistics() :
+	connectionsQueued(0),
+	connectionsShedQueueDepth(0),
+	connectionsShedQueueWait(0)
+{
+	for (unsigned int i = 0; i < kNumQueueWaitBuckets; i++)
+	{
+		aQueueWaitBuckets[i] = 0;
+	}
+}
+
+void ServerStatistics::recordQueueWait(unsigned int waitMS)
+{
+	unsigned int bucketIndex = 0;
+	while (bucketIndex < kNumQueueWaitBuckets - 1 && waitMS > kQueueWaitBucketLimitsMS[bucketIndex])
+	{
+		bucketIndex++;
+	}
+
+	aQueueWaitBuckets[bucketIndex] += 1;
+}
+
+unsigned int ServerStatistics::getQueueWaitPercentileMS(float percentile) const
+{
+	uint64_t aCounts[kNumQueueWaitBuckets];
+	uint64_t totalCount = 0;
+	for (unsigned int i = 0; i < kNumQueueWaitBuckets; i++)
+	{
+		aCounts[i] = aQueueWaitBuckets[i].load();
+		totalCount += aCounts[i];
+	}
+
+	if (totalCount == 0)
+		return 0;
+
+	uint64_t targetCount = (uint64_t)((double)totalCount * percentile);
+	uint64_t runningCount = 0;
+	for (unsigned int i = 0; i < kNumQueueWaitBuckets - 1; i++)
+	{
+		runningCount += aCounts[i];
+		if (runningCount >= targetCount)
+			return kQueueWaitBucketLimitsMS[i];
+	}
+
+	// it's in the last open-ended bucket, so just return the last limit
+	return kQueueWaitBucketLimitsMS[kNumQueueWaitBuckets - 2];
+}
+
+static std::string formatSocketOptionValue(int value)
+{
+	// Note: TCP_NOTSENT_LOWAT defaults to UINT_MAX (i.e. disabled), which comes back as -1 as well
+	if (value < 0)
+		return "n/a";
+	
+	return StringHelpers::formatNumberThousandsSeparator(value);
+}
+
+//
+
 StatusService::StatusService() : m_pTimerThread(nullptr),
 	m_active(false),
 	m_httpConnectionsCount(0),
@@ -56,7 +119,7 @@ void StatusService::stop()
 //	m_pTimerThread->join();
 }
 
-std::string StatusService::getCurrentStatusHTML()
+std::string StatusService::getCurrentStatusHTML(const ServerStatistics* pServerStatistics)
 {
 	std::string html;
 	
@@ -90,6 +153,34 @@ std::string StatusService::getCurrentStatusHTML()
 	html += "<tr><td>Free memory:</td><td>" + StringHelpers::formatSize(freeMem) + "</td></tr>\n";
 	html += "<tr><td>WebServe RSS:</td><td>" + StringHelpers::formatSize(webServeRSS) + "</td></tr>\n";
 	
+	if (pServerStatistics)
+	{
+		// bank row
+		html += "<tr><td colspan=\"2\"></td><tr>\n";
+		
+		html += "<tr><td>Connections queued:</td><td>" + StringHelpers::formatNumberThousandsSeparator(pServerStatistics->connectionsQueued) + "</td></tr>\n";
+		html += "<tr><td>Shed (queue depth):</td><td>" + StringHelpers::formatNumberThousandsSeparator(pServerStatistics->connectionsShedQueueDepth) + "</td></tr>\n";
+		html += "<tr><td>Shed (queue wait):</td><td>" + StringHelpers::formatNumberThousandsSeparator(pServerStatistics->connectionsShedQueueWait) + "</td></tr>\n";
+		
+		char szTemp[128];
+		snprintf(szTemp, 128, "<= %u ms / <= %u ms / <= %u ms", pServerStatistics->getQueueWaitPercentileMS(0.5f),
+				 pServerStatistics->getQueueWaitPercentileMS(0.9f), pServerStatistics->getQueueWaitPercentileMS(0.99f));
+		html += "<tr><td>Queue wait p50 / p90 / p99:</td><td>" + std::string(szTemp) + "</td></tr>\n";
+		
+		for (const ServerStatistics::ListenerInfo& listenerInfo : pServerStatistics->aListeners)
+		{
+			// bank row
+			html += "<tr><td colspan=\"2\"></td><tr>\n";
+			
+			html += "<tr><td>" + listenerInfo.name + " listen backlog:</td><td>" + std::to_string(listenerInfo.backlog) + "</td></tr>\n";
+			html += "<tr><td>" + listenerInfo.name + " TCP_DEFER_ACCEPT:</td><td>" + formatSocketOptionValue(listenerInfo.deferAcceptTimeout) + "</td></tr>\n";
+			html += "<tr><td>" + listenerInfo.name + " TCP_NODELAY:</td><td>" + formatSocketOptionValue(listenerInfo.noDelay) + "</td></tr>\n";
+			html += "<tr><td>" + listenerInfo.name + " TCP_NOTSENT_LOWAT:</td><td>" + formatSocketOptionValue(listenerInfo.notSentLowat) + "</td></tr>\n";
+			html += "<tr><td>" + listenerInfo.name + " SO_SNDBUF:</td><td>" + formatSocketOptionValue(listenerInfo.sendBufferSize) + "</td></tr>\n";
+			html += "<tr><td>" + listenerInfo.name + " SO_RCVBUF:</td><td>" + formatSocketOptionValue(listenerInfo.recvBufferSize) + "</td></tr>\n";
+		}
+	}
+	
 	html += "</table>\n<br>\n";
 	
 	html += "History:<br>\n";
@@ -148,6 +239,11 @@ void StatusService::accumulateConnectionStatistics(const ConnectionStatistics& c
 
 void StatusService::timerThreadFunction()
 {
+	if (!m_aTimerThreadCPUs.empty())
+	{
+		System::setCurrentThreadCPUAffinity(m_aTimerThreadCPUs);
+	}
+	
 	while (m_active)
 	{
 		performStatusSnapshot();		
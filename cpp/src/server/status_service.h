@@ -24,19 +24,64 @@
 #include <condition_variable>
 #include <ctime>
 #include <vector>
+#include <string>
 
 struct ConnectionStatistics;
 
+// Statistics about the server as a whole (as opposed to per-connection ones), owned by WebServerService.
+struct ServerStatistics
+{
+	ServerStatistics();
+
+	void recordQueueWait(unsigned int waitMS);
+
+	// returns an approximation (the upper limit of the histogram bucket it falls in) of the
+	// queue wait time at the given percentile (0.0 - 1.0).
+	unsigned int getQueueWaitPercentileMS(float percentile) const;
+
+	static const unsigned int kNumQueueWaitBuckets = 14;
+
+	std::atomic<uint64_t>		connectionsQueued;
+	// connections which were shed because the pending queue was too deep when they were accepted
+	std::atomic<uint64_t>		connectionsShedQueueDepth;
+	// connections which were shed because they'd been waiting in the queue for too long
+	std::atomic<uint64_t>		connectionsShedQueueWait;
+
+	// histogram of how long connections waited in the pending queue for a worker thread
+	std::atomic<uint64_t>		aQueueWaitBuckets[kNumQueueWaitBuckets];
+
+	// the effective (as reported back by the kernel) tuning values of the listening sockets, set before
+	// any worker threads are started, so doesn't need locking. -1 means unknown / not supported.
+	struct ListenerInfo
+	{
+		std::string		name;
+		unsigned int	backlog				= 0;
+		int				deferAcceptTimeout	= -1;
+		int				noDelay				= -1;
+		int				notSentLowat		= -1;
+		int				sendBufferSize		= -1;
+		int				recvBufferSize		= -1;
+	};
+
+	std::vector<ListenerInfo>	aListeners;
+};
+
 class StatusService
 {
 public:
 	StatusService();
 	~StatusService();
 	
+	// optionally pin the timer thread to the given CPUs. Needs to be called before start().
+	void setTimerThreadCPUs(const std::vector<unsigned int>& aCPUs)
+	{
+		m_aTimerThreadCPUs = aCPUs;
+	}
+	
 	void start();
 	void stop();
 	
-	std::string getCurrentStatusHTML();
+	std::string getCurrentStatusHTML(const ServerStatistics* pServerStatistics = nullptr);
 	
 	void accumulateConnectionStatistics(const ConnectionStatistics& connStatistics);
 	
@@ -72,6 +117,8 @@ protected:
 	
 	bool							m_active;
 	
+	std::vector<unsigned int>		m_aTimerThreadCPUs;
+	
 	std::atomic<uint64_t>			m_httpConnectionsCount;
 	std::atomic<uint64_t>			m_httpsConnectionsCount;
 	
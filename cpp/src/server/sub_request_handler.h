@@ -24,6 +24,10 @@
 #include "request_handler_common.h"
 #include "configuration.h"
 
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+#include "coroutine_task.h"
+#endif
+
 struct RequestConnection;
 class WebRequest;
 
@@ -46,6 +50,17 @@ public:
 
 	virtual WebRequestHandlerResult handleRequest(RequestConnection& requestConnection, const WebRequest& request, const std::string& refinedURI) = 0;
 
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+	// Coroutine variant, used (with the event connection engine) when coroutine handlers are enabled, which can
+	// co_await IO via the connection's CoroutineReactor rather than blocking the worker thread.
+	// The default implementation is just an adapter for the synchronous handleRequest() above, so existing
+	// handlers work unchanged. The arguments are guaranteed to remain valid until the task completes.
+	virtual Task<WebRequestHandlerResult> handleRequestAsync(RequestConnection& requestConnection, const WebRequest& request, const std::string& refinedURI)
+	{
+		co_return handleRequest(requestConnection, request, refinedURI);
+	}
+#endif
+
 protected:
 };
 
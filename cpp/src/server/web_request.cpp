@@ -18,44 +18,76 @@
 
 #include "web_request.h"
 
-#include <sstream>
-#include <iostream>
-#include <vector>
-
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <charconv>
+#include <strings.h>
 
 #include "utils/string_helpers.h"
+#include "utils/char_scanner.h"
 
-WebRequest::WebRequest(const std::string& rawRequest) : m_rawRequest(rawRequest),
+WebRequest::WebRequest(std::string_view rawRequest) : m_rawRequest(rawRequest),
+	m_pBodyReader(nullptr),
 	m_requestType(eRequestUnknown),
     m_httpVersion(eHTTPUnknown),
 	m_connectionType(eConnectionUnknown),
 	m_fileType(eFTUnknown),
-	m_headerAuthenticationType(eAuthNone)
+	m_headerAuthenticationType(eAuthNone),
+	m_paramsDecoded(false),
+	m_cookiesDecoded(false)
 {
 
 }
 
+// returns the next line (without the line ending) from the header, and moves pos past it. separatorPos is set to the
+// position of the first ':' in the line (or npos).
+static bool getNextLine(std::string_view header, size_t& pos, std::string_view& line, size_t& separatorPos)
+{
+	if (pos >= header.size())
+		return false;
+
+	size_t lineLength = CharScanner::findLineEnd(header.data() + pos, header.size() - pos, separatorPos);
+	if (lineLength == CharScanner::npos)
+		lineLength = header.size() - pos;
+
+	line = header.substr(pos, lineLength);
+	if (!line.empty() && line.back() == '\r')
+	{
+		line.remove_suffix(1);
+	}
+
+	if (separatorPos != CharScanner::npos && separatorPos >= line.size())
+	{
+		separatorPos = CharScanner::npos;
+	}
+
+	pos += lineLength + 1;
+	return true;
+}
+
 bool WebRequest::parse(Logger& logger)
 {
-	// TODO: doing it this way is very hacky as it means we lose blank lines (end of header, etc)...
-	// TODO: also, allocating loads of separate strings for each line is fairly expensive - use some stringView type of thing?
-	std::vector<std::string> lines;
-	StringHelpers::split(m_rawRequest, lines);
+	const std::string_view rawRequest(m_rawRequest);
 
-	if (lines.empty())
-		return false;
+	// only the header is split into lines, as any body which was received with it follows the empty line at the end
+	size_t headerEnd = CharScanner::findHeaderEnd(rawRequest.data(), rawRequest.size());
+	size_t bodyStart = (headerEnd != CharScanner::npos) ? headerEnd + 4 : rawRequest.size();
+	const std::string_view header = rawRequest.substr(0, headerEnd);
+
+	size_t linePos = 0;
+	std::string_view line;
+	size_t separatorPos = CharScanner::npos;
 
 	// first line should contain main request
-	const std::string &line = lines[0];
+	if (!getNextLine(header, linePos, line, separatorPos) || line.empty())
+		return false;
 
 	size_t httpVersionItemStart = line.find("HTTP/");
-	if (httpVersionItemStart == std::string::npos)
+	if (httpVersionItemStart == std::string_view::npos)
 		return false;
 
-	std::string httpVersionString = line.substr(httpVersionItemStart + 5, 3);
+	std::string_view httpVersionString = line.substr(httpVersionItemStart + 5, 3);
 	if (httpVersionString == "1.1")
 	{
 		m_httpVersion = eHTTP11;
@@ -69,34 +101,35 @@ bool WebRequest::parse(Logger& logger)
 		m_httpVersion = eHTTP09;
 	}
 
-	if (!StringHelpers::beginsWithStaticConst(line, "GET"))
+	if (line.compare(0, 3, "GET") != 0)
 	{
-		if (!StringHelpers::beginsWithStaticConst(line, "POST"))
+		if (line.compare(0, 4, "POST") != 0)
 		{
-			if (!StringHelpers::beginsWithStaticConst(line, "HEAD"))
+			if (line.compare(0, 4, "HEAD") != 0)
 			{
-				std::string command;
+				std::string_view command;
 				size_t commandSep = line.find(' ');
-				if (commandSep != std::string::npos)
+				if (commandSep != std::string_view::npos)
 				{
 					command = line.substr(0, commandSep);
 				}
 				
 				m_requestType = eRequestUnknown;
 	
-				logger.error("Unsupported HTTP command in request from client: %s", command.c_str());
+				logger.error("Unsupported HTTP command in request from client: %s", std::string(command).c_str());
+
+				return false;
 			}
 			else
 			{
+				// handled the same as GET, other than the responses being header-only
 				m_requestType = eRequestHEAD;
-				
-				// we recognise this, but don't handle it (for the moment)
 			}
-			
-			return false;
 		}
-
-		m_requestType = eRequestPOST;
+		else
+		{
+			m_requestType = eRequestPOST;
+		}
 	}
 	else
 	{
@@ -108,13 +141,13 @@ bool WebRequest::parse(Logger& logger)
 
 	size_t pathEnd = line.rfind(' '); // should be the space before the HTTP version
 
-	if (pathEnd == std::string::npos)
+	if (pathEnd == std::string_view::npos || pathEnd < pathStart)
 		return false;
 
-	const std::string path = line.substr(pathStart, pathEnd - pathStart);
+	const std::string_view path = line.substr(pathStart, pathEnd - pathStart);
 
 	size_t nQuestionMark = path.find('?');
-	if (nQuestionMark == std::string::npos)
+	if (nQuestionMark == std::string_view::npos)
 	{
 		m_path = path;
 	}
@@ -125,9 +158,7 @@ bool WebRequest::parse(Logger& logger)
 		// if POST has this on the end, ignore the URL params
 		if (m_requestType != eRequestPOST)
 		{
-			std::string params = path.substr(nQuestionMark + 1);
-
-			addParams(params);
+			m_queryString = path.substr(nQuestionMark + 1);
 		}
 	}
 
@@ -135,9 +166,9 @@ bool WebRequest::parse(Logger& logger)
 	if (m_requestType != eRequestPOST)
 	{
 		size_t extensionSep = m_path.find_last_of('.');
-		if (extensionSep != std::string::npos)
+		if (extensionSep != std::string_view::npos)
 		{
-			std::string extensionString = m_path.substr(extensionSep + 1);
+			std::string_view extensionString = m_path.substr(extensionSep + 1);
 			if (extensionString == "css")
 			{
 				m_fileType = eFTCSS;
@@ -145,55 +176,37 @@ bool WebRequest::parse(Logger& logger)
 		}
 	}
 
-	std::vector<std::string>::const_iterator itLine = lines.begin();
-	++ itLine; // skip the first line which we've processed already
-
-	bool lookForAuthentication = false;
-	bool foundCookie = false;
-	bool foundUserAgent = false;
-	bool foundHost = false;
-	bool foundConnection = false;
-
-	// TODO: this needs to cope with case-insensitive comparisons...
-	//       We can't just make the entire line lower-case though, it needs to be itemised
-
-	for (; itLine != lines.end(); ++itLine)
+	// the first line's been processed already
+	while (getNextLine(header, linePos, line, separatorPos))
 	{
-		const std::string& otherLine = *itLine;
+		if (separatorPos == CharScanner::npos)
+			continue;
 
-		// now try and find an authentication line...
-		if (lookForAuthentication && (otherLine.compare(0, 14, "Authorization:") == 0))
-		{
-			std::string authorizationString = otherLine.substr(15);
-			processAuthenticationHeader(authorizationString);
-			lookForAuthentication = false;
-		}
-		else if (!foundCookie && (otherLine.compare(0, 7, "Cookie:") == 0))
-		{
-			std::string cookieString = extractFieldItem(otherLine, 7 + 1);
-			processCookieHeader(cookieString);
-			foundCookie = true;
-		}
-		else if (!foundUserAgent && (otherLine.compare(0, 11, "User-Agent:") == 0))
-		{
-			m_userAgentField = extractFieldItem(otherLine, 11 + 1);
+		const std::string_view fieldName = line.substr(0, separatorPos);
+		const std::string_view fieldValue = extractFieldItem(line, separatorPos + 1);
 
-			foundUserAgent = true;
-		}
-		else if (!foundHost && (otherLine.compare(0, 5, "Host:") == 0))
+		HTTPHeaderField field = HTTPHeaderFields::lookupField(fieldName);
+		if (field != eHeaderUnknown)
 		{
-			m_hostValue = extractFieldItem(otherLine, 5 + 1);
-
-			foundHost = true;
+			// only the first one counts
+			if (!hasHeader(field))
+			{
+				m_aKnownHeaders[field] = fieldValue;
+			}
 		}
-		else if (!foundConnection && (otherLine.compare(0, 11, "Connection:") == 0))
+		else
 		{
-			m_connectionValue = extractFieldItem(otherLine, 11 + 1);
-
-			foundConnection = true;
+			m_aOtherHeaders.emplace_back(OtherHeaderField{ fieldName, fieldValue });
 		}
 	}
 
+	// TODO: authentication isn't supported at the moment
+	const bool lookForAuthentication = false;
+	if (lookForAuthentication && hasHeader(eHeaderAuthorization))
+	{
+		processAuthenticationHeader(getHeader(eHeaderAuthorization));
+	}
+
 	// apply defaults
 	if (m_httpVersion == eHTTP11)
 	{
@@ -204,97 +217,107 @@ bool WebRequest::parse(Logger& logger)
 		m_connectionType = eConnectionClose;
 	}
 
-	if (!m_connectionValue.empty() && (m_httpVersion == eHTTP10 || m_httpVersion == eHTTP11))
+	const std::string_view connectionValue = getHeader(eHeaderConnection);
+	if (!connectionValue.empty() && (m_httpVersion == eHTTP10 || m_httpVersion == eHTTP11))
 	{
-		std::string lowerCaseConnectionValue = StringHelpers::toLower(m_connectionValue);
-		if (lowerCaseConnectionValue == "close")
+		if (HTTPHeaderFields::equalsIgnoreCase(connectionValue, "close"))
 		{
 			m_connectionType = eConnectionClose;
 		}
-		else if (lowerCaseConnectionValue == "keep-alive")
+		else if (HTTPHeaderFields::equalsIgnoreCase(connectionValue, "keep-alive"))
 		{
 			m_connectionType = eConnectionKeepAlive;
 		}
 		else
 		{
-			logger.warning("Unknown connection type specified: %s", m_connectionValue.c_str());
+			logger.warning("Unknown connection type specified: %s", std::string(connectionValue).c_str());
 		}
 	}
 
-	// TODO: this is crap - we should check for the double CR and use that to detect the end of the header...
-	//       or as a hacky stop-gap to be more robust (and detect missing POST data), match the line
-	//       by the Content-Length....
-	if (m_requestType == eRequestPOST && lines.size() > 1)
+	// the body is only here if it was small enough to be received with the header (as a webform's would be),
+	// otherwise it's up to the request handler to stream it with the body reader.
+	if (m_requestType == eRequestPOST && bodyStart < rawRequest.size())
 	{
-		// hopefully, last line of HTTP request should be the POST params
+		m_bodyParamsString = rawRequest.substr(bodyStart);
+	}
 
-		const std::string& params = lines.back();
+	return true;
+}
 
-		// Note: Sometimes we don't seem to have any POST data, as WebKit always seems to send POST webform
-		//       data after the data start in a second packet and our single receive doesn't cope with this...
+const WebRequest::ValueList& WebRequest::getParams() const
+{
+	if (!m_paramsDecoded)
+	{
+		// decoding can only make values shorter, so this is enough space for all of them
+		size_t maxDecodedLength = 0;
+		if (m_queryString.find_first_of("%+") != std::string_view::npos)
+			maxDecodedLength += m_queryString.size();
+		if (m_bodyParamsString.find_first_of("%+") != std::string_view::npos)
+			maxDecodedLength += m_bodyParamsString.size();
+
+		m_decodedParamValues.reserve(maxDecodedLength);
+
+		addParams(m_queryString);
+		addParams(m_bodyParamsString);
+		m_paramsDecoded = true;
+	}
 
-		addParams(params);
+	return m_aParams;
+}
+
+const WebRequest::ValueList& WebRequest::getCookies() const
+{
+	if (!m_cookiesDecoded)
+	{
+		processCookieHeader(getHeader(eHeaderCookie), m_aCookies);
+		m_cookiesDecoded = true;
 	}
 
-	return true;
+	return m_aCookies;
 }
 
 bool WebRequest::hasParam(const std::string &name) const
 {
-	std::map<std::string, std::string>::const_iterator itFind = m_aParams.find(name);
-
-	return itFind != m_aParams.end();
+	return findItem(getParams(), name) != nullptr;
 }
 
 std::string WebRequest::getParam(const std::string& name) const
 {
-	std::map<std::string, std::string>::const_iterator itFind = m_aParams.find(name);
-	
-	if (itFind == m_aParams.end())
+	const ValueItem* pItem = findItem(getParams(), name);
+	if (!pItem)
 		return "";
 
-	return itFind->second;
+	return std::string(pItem->value);
 }
 
 int WebRequest::getParamAsInt(const std::string& name, int defaultVal) const
 {
-	std::map<std::string, std::string>::const_iterator itFind = m_aParams.find(name);
-	
-	if (itFind == m_aParams.end())
-		return defaultVal;
-	
-	std::string paramValue = itFind->second;
-
-	if (paramValue.empty())
-	{
+	const ValueItem* pItem = findItem(getParams(), name);
+	if (!pItem || pItem->value.empty())
 		return defaultVal;
-	}
 
-	return atoi(paramValue.c_str());
+	return getItemValueAsInt(*pItem);
 }
 
-// Note: this rebuilds the params in alphabetical order, instead of the original
-//       order they were in from the original request.
+// Note: this rebuilds the params in the order they were first in the request, without any duplicates.
 std::string WebRequest::getParamsAsGETString(bool ignorePaginationParams) const
 {
 	std::string paramString;
 	
-	for (const auto& itParam : m_aParams)
+	for (const ValueItem& param : getParams())
 	{
-		const std::string& paramName = itParam.first;
-		const std::string& paramValue = itParam.second;
-		
 		if (ignorePaginationParams)
 		{
-			if (paramName == "perPage" || paramName == "startIndex")
+			if (param.name == "perPage" || param.name == "startIndex")
 				continue;
 		}
 		
 		if (!paramString.empty())
 			paramString += "&";
 		
-		paramString += paramName + "=";
-		paramString += StringHelpers::simpleEncodeString(paramValue);
+		paramString.append(param.name);
+		paramString += "=";
+		paramString += StringHelpers::simpleEncodeString(std::string(param.value));
 	}
 	
 	return paramString;
@@ -302,109 +325,193 @@ std::string WebRequest::getParamsAsGETString(bool ignorePaginationParams) const
 
 bool WebRequest::hasCookie(const std::string& name) const
 {
-	std::map<std::string, std::string>::const_iterator itFind = m_aCookies.find(name);
-
-	return itFind != m_aCookies.end();
+	return findItem(getCookies(), name) != nullptr;
 }
 
 std::string WebRequest::getCookie(const std::string& name) const
 {
-	std::map<std::string, std::string>::const_iterator itFind = m_aCookies.find(name);
-
-	if (itFind == m_aCookies.end())
+	const ValueItem* pItem = findItem(getCookies(), name);
+	if (!pItem)
 		return "";
 
-	return itFind->second;
+	return std::string(pItem->value);
 }
 
 int WebRequest::getCookieAsInt(const std::string& name, int defaultVal) const
 {
-	std::string cookieValue = getCookie(name);
-
-	if (cookieValue.empty())
-	{
+	const ValueItem* pItem = findItem(getCookies(), name);
+	if (!pItem || pItem->value.empty())
 		return defaultVal;
-	}
 
-	return atoi(cookieValue.c_str());
+	return getItemValueAsInt(*pItem);
 }
 
 int WebRequest::getParamOrCookieAsInt(const std::string& paramName, const std::string& cookieName, int defaultValue) const
 {
-	std::map<std::string, std::string>::const_iterator itFind = m_aParams.find(paramName);
+	const ValueItem* pItem = findItem(getParams(), paramName);
+	if (pItem && !pItem->value.empty())
+		return getItemValueAsInt(*pItem);
+
+	// otherwise, look for the cookie...
+	return getCookieAsInt(cookieName, defaultValue);
+}
+
+const WebRequest::ValueItem* WebRequest::findItem(const ValueList& aItems, std::string_view name)
+{
+	for (const ValueItem& item : aItems)
+	{
+		if (item.name == name)
+			return &item;
+	}
 
-	if (itFind != m_aParams.end())
+	return nullptr;
+}
+
+void WebRequest::addOrReplaceItem(ValueList& aItems, std::string_view name, std::string_view value)
+{
+	for (ValueItem& item : aItems)
 	{
-		std::string paramValue = itFind->second;
-		if (!paramValue.empty())
+		if (item.name == name)
 		{
-			return atoi(paramValue.c_str());
+			item.value = value;
+			return;
 		}
 	}
 
-	// otherwise, look for the cookie...
-	std::string cookieValue = getCookie(cookieName);
+	aItems.emplace_back(name, value);
+}
 
-	if (cookieValue.empty())
+int WebRequest::getItemValueAsInt(const ValueItem& item)
+{
+	if (!item.intValueParsed)
 	{
-		return defaultValue;
+		// like atoi(), leading whitespace and anything after the number is ignored, and values which aren't numbers are 0
+		const char* pStart = item.value.data();
+		const char* pEnd = pStart + item.value.size();
+		while (pStart != pEnd && (*pStart == ' ' || *pStart == '\t'))
+		{
+			pStart++;
+		}
+		if (pStart != pEnd && *pStart == '+')
+		{
+			pStart++;
+		}
+
+		int value = 0;
+		if (std::from_chars(pStart, pEnd, value).ec != std::errc())
+		{
+			value = 0;
+		}
+
+		item.intValue = value;
+		item.intValueParsed = true;
 	}
 
-	return atoi(cookieValue.c_str());
+	return item.intValue;
 }
 
-std::string WebRequest::extractFieldItem(const std::string& fieldString, unsigned int valueStartPos)
+std::string_view WebRequest::getHeader(std::string_view name) const
 {
-	std::string fieldValue;
-	if (fieldString.substr(fieldString.size() - 1, 1) == "\r")
+	HTTPHeaderField field = HTTPHeaderFields::lookupField(name);
+	if (field != eHeaderUnknown)
+		return m_aKnownHeaders[field];
+
+	for (const OtherHeaderField& otherField : m_aOtherHeaders)
 	{
-		fieldValue = fieldString.substr(valueStartPos, fieldString.size() - 1 - valueStartPos);
+		if (otherField.name.size() == name.size() && strncasecmp(otherField.name.data(), name.data(), name.size()) == 0)
+			return otherField.value;
 	}
-	else
+
+	return std::string_view();
+}
+
+std::string_view WebRequest::extractFieldItem(std::string_view fieldLine, size_t valueStartPos)
+{
+	// Note: the line ending has already been removed
+	size_t valueStart = fieldLine.find_first_not_of(" \t", valueStartPos);
+	if (valueStart == std::string_view::npos)
 	{
-		fieldValue = fieldString.substr(valueStartPos);
+		// it's empty, but still return a view into the line so it's distinguishable from a missing field
+		return fieldLine.substr(fieldLine.size());
 	}
 
-	return fieldValue;
+	size_t valueEnd = fieldLine.find_last_not_of(" \t");
+	return fieldLine.substr(valueStart, valueEnd + 1 - valueStart);
 }
 
-void WebRequest::addParams(const std::string& params)
+static int getHexDigitValue(char c)
 {
-	std::vector<std::string> items;
-	StringHelpers::split(params, items, "&");
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
 
-	std::vector<std::string>::iterator it = items.begin();
-	std::vector<std::string>::iterator itEnd = items.end();
-	for (; it != itEnd; ++it)
+void WebRequest::addParams(std::string_view params) const
+{
+	size_t itemStart = 0;
+	while (itemStart < params.size())
 	{
-		const std::string& item = *it;
+		size_t itemEnd = params.find('&', itemStart);
+		if (itemEnd == std::string_view::npos)
+			itemEnd = params.size();
+
+		std::string_view item = params.substr(itemStart, itemEnd - itemStart);
+		itemStart = itemEnd + 1;
 
 		size_t sep = item.find('=');
-		if (sep == std::string::npos)
+		if (sep == std::string_view::npos)
 			continue;
 
-		std::string name = item.substr(0, sep);
-		std::string value = item.substr(sep + 1);
+		std::string_view name = item.substr(0, sep);
+		std::string_view value = item.substr(sep + 1);
 
-		value = StringHelpers::simpleDecodeString(value);
+		if (name.empty() || value.empty())
+			continue;
 
-		if (!name.empty() && !value.empty())
+		if (value.find_first_of("%+") != std::string_view::npos)
 		{
-			m_aParams[name] = value;
+			// decode it (%-encoding, and + to spaces) into the space reserved for it
+			size_t decodedStart = m_decodedParamValues.size();
+			for (size_t i = 0; i < value.size(); i++)
+			{
+				char c = value[i];
+				if (c == '+')
+				{
+					c = ' ';
+				}
+				else if (c == '%' && i + 2 < value.size() && getHexDigitValue(value[i + 1]) >= 0 && getHexDigitValue(value[i + 2]) >= 0)
+				{
+					c = (char)((getHexDigitValue(value[i + 1]) << 4) | getHexDigitValue(value[i + 2]));
+					i += 2;
+				}
+
+				m_decodedParamValues.push_back(c);
+			}
+
+			value = std::string_view(m_decodedParamValues.data() + decodedStart, m_decodedParamValues.size() - decodedStart);
+			if (value.empty())
+				continue;
 		}
+
+		addOrReplaceItem(m_aParams, name, value);
 	}
 }
 
-void WebRequest::processAuthenticationHeader(const std::string& authorizationString)
+void WebRequest::processAuthenticationHeader(std::string_view authorizationString)
 {
 	size_t sepPos = authorizationString.find(' ');
-	if (sepPos == std::string::npos)
+	if (sepPos == std::string_view::npos)
 	{
 		m_headerAuthenticationType = eAuthMalformed;
 		return;
 	}
 
-	std::string authenticationType = authorizationString.substr(0, sepPos);
+	std::string_view authenticationType = authorizationString.substr(0, sepPos);
 
 	if (authenticationType != "Basic")
 	{
@@ -414,15 +521,7 @@ void WebRequest::processAuthenticationHeader(const std::string& authorizationStr
 
 	m_headerAuthenticationType = eAuthBasic;
 
-	std::string authorizationToken = authorizationString.substr(sepPos + 1);
-
-	// remove any trailing "\r" char
-	if (authorizationToken[authorizationToken.size() - 1] == '\r')
-	{
-		authorizationToken = authorizationToken.substr(0, authorizationToken.size() - 1);
-	}
-
-	authorizationToken = StringHelpers::base64Decode(authorizationToken);
+	std::string authorizationToken = StringHelpers::base64Decode(std::string(authorizationString.substr(sepPos + 1)));
 
 	if (m_headerAuthenticationType == eAuthBasic)
 	{
@@ -433,32 +532,34 @@ void WebRequest::processAuthenticationHeader(const std::string& authorizationStr
 			return;
 		}
 
-		std::string authUser = authorizationToken.substr(0, passSep);
-		std::string authPass = authorizationToken.substr(passSep + 1);
-
-		m_authUsername = authUser;
-		m_authPassword = authPass;
+		m_authUsername = authorizationToken.substr(0, passSep);
+		m_authPassword = authorizationToken.substr(passSep + 1);
 	}
 }
 
-void WebRequest::processCookieHeader(const std::string& cookieString)
+void WebRequest::processCookieHeader(std::string_view cookieString, ValueList& aCookies)
 {
-	std::vector<std::string> items;
 	// TODO: this probably isn't completely robust to all types of strings, even if they are hex-encoded...
-	StringHelpers::split(cookieString, items, "; ");
-
-	for (const std::string& item : items)
+	size_t itemStart = 0;
+	while (itemStart < cookieString.size())
 	{
+		size_t itemEnd = cookieString.find("; ", itemStart);
+		if (itemEnd == std::string_view::npos)
+			itemEnd = cookieString.size();
+
+		std::string_view item = cookieString.substr(itemStart, itemEnd - itemStart);
+		itemStart = itemEnd + 2;
+
 		size_t sep = item.find('=');
-		if (sep == std::string::npos)
+		if (sep == std::string_view::npos)
 			continue;
 
-		std::string name = item.substr(0, sep);
-		std::string value = item.substr(sep + 1);
+		std::string_view name = item.substr(0, sep);
+		std::string_view value = item.substr(sep + 1);
 
 		if (!name.empty() && !value.empty())
 		{
-			m_aCookies[name] = value;
+			addOrReplaceItem(aCookies, name, value);
 		}
 	}
 }
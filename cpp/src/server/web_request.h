@@ -20,14 +20,25 @@
 #define WEB_REQUEST_H
 
 #include <string>
-#include <map>
+#include <string_view>
 
 #include "utils/logger.h"
+#include "utils/small_vector.h"
 
+#include "http_header_fields.h"
+
+class RequestBodyReader;
+
+// Parses the request header in-place: the raw request is the only buffer owned, and the fields extracted from it
+// are views into it, so the WebRequest can't be copied. Params and cookies are only decoded (into small vectors,
+// which are inline until they have more than 16 items) the first time they're looked up.
 class WebRequest
 {
 public:
-	WebRequest(const std::string& rawRequest);
+	WebRequest(std::string_view rawRequest);
+
+	WebRequest(const WebRequest&) = delete;
+	WebRequest& operator=(const WebRequest&) = delete;
 
 	enum HTTPVersion
 	{
@@ -72,13 +83,26 @@ public:
 
 	// not great passing in logger like this, but least bad option...
 	bool parse(Logger& logger);
-	
+
 	const std::string& getRawRequest() const
 	{
 		return m_rawRequest;
 	}
 
-	const std::string& getPath() const
+	// Note: we don't own this, it's only valid while the request is being handled.
+	void setBodyReader(RequestBodyReader* pBodyReader)
+	{
+		m_pBodyReader = pBodyReader;
+	}
+
+	// for reading the request body, which is only in the raw request if it was small enough to be received with the header.
+	RequestBodyReader* getBodyReader() const
+	{
+		return m_pBodyReader;
+	}
+
+	// Note: these views are only valid while the WebRequest exists.
+	std::string_view getPath() const
 	{
 		return m_path;
 	}
@@ -88,9 +112,15 @@ public:
 		return m_requestType;
 	}
 
-	const std::string& getHost() const
+	// HEAD requests are handled as GET ones, but the response to them mustn't have a body
+	bool isHeadRequest() const
 	{
-		return m_hostValue;
+		return m_requestType == eRequestHEAD;
+	}
+
+	std::string_view getHost() const
+	{
+		return m_aKnownHeaders[eHeaderHost];
 	}
 
 	HTTPVersion getHTTPVersion() const
@@ -128,14 +158,36 @@ public:
 		return m_authPassword;
 	}
 	
-	const std::string& getUserAgent() const
+	std::string_view getUserAgent() const
+	{
+		return m_aKnownHeaders[eHeaderUserAgent];
+	}
+
+	// whether the header field was in the request (even if it had an empty value)
+	bool hasHeader(HTTPHeaderField field) const
+	{
+		return m_aKnownHeaders[field].data() != nullptr;
+	}
+
+	// returns the value (without surrounding whitespace) of the header field, or an empty view if it wasn't in the
+	// request. If the field was in the request more than once, this is the first one.
+	std::string_view getHeader(HTTPHeaderField field) const
+	{
+		return m_aKnownHeaders[field];
+	}
+
+	// as above, but for any field name (case-insensitive), including ones which aren't known HTTPHeaderFields
+	std::string_view getHeader(std::string_view name) const;
+
+	// whether the client's waiting for an interim "100 Continue" response before sending the body
+	bool expectsContinue() const
 	{
-		return m_userAgentField;
+		return m_httpVersion == eHTTP11 && HTTPHeaderFields::equalsIgnoreCase(m_aKnownHeaders[eHeaderExpect], "100-continue");
 	}
 
 	bool hasParams() const
 	{
-		return !m_aParams.empty();
+		return !getParams().empty();
 	}
 
 	bool hasParam(const std::string& name) const;
@@ -146,7 +198,7 @@ public:
 
 	bool hasCookies() const
 	{
-		return !m_aCookies.empty();
+		return !getCookies().empty();
 	}
 
 	bool hasCookie(const std::string& name) const;
@@ -157,26 +209,66 @@ public:
 	int getParamOrCookieAsInt(const std::string& paramName, const std::string& cookieName, int defaultValue) const;
 
 protected:
-	static std::string extractFieldItem(const std::string& fieldString, unsigned int valueStartPos);
-	void addParams(const std::string& params);
+	// a param or cookie
+	struct ValueItem
+	{
+		ValueItem(std::string_view itemName, std::string_view itemValue) : name(itemName), value(itemValue)
+		{
+		}
+
+		std::string_view	name;
+		std::string_view	value;
+
+		// the value is only parsed as an int the first time it's asked for as one
+		mutable int			intValue = 0;
+		mutable bool		intValueParsed = false;
+	};
+
+	typedef SmallVector<ValueItem, 16> ValueList;
 
-	void processAuthenticationHeader(const std::string& authorizationString);
-	void processCookieHeader(const std::string& cookieString);
+	// these decode the params / cookies the first time they're called
+	const ValueList& getParams() const;
+	const ValueList& getCookies() const;
+
+	static const ValueItem* findItem(const ValueList& aItems, std::string_view name);
+	// later items with the same name replace earlier ones
+	static void addOrReplaceItem(ValueList& aItems, std::string_view name, std::string_view value);
+	static int getItemValueAsInt(const ValueItem& item);
+
+	// returns the value of the header field line after the name, without any surrounding whitespace
+	static std::string_view extractFieldItem(std::string_view fieldLine, size_t valueStartPos);
+	void addParams(std::string_view params) const;
+
+	void processAuthenticationHeader(std::string_view authorizationString);
+	static void processCookieHeader(std::string_view cookieString, ValueList& aCookies);
 
 protected:
+	// the only copy of the request, which all the string_views below point into
 	std::string				m_rawRequest;
 
-	// extracted field strings
-	std::string				m_userAgentField;
+	RequestBodyReader*		m_pBodyReader;
+
+	// the values of the header fields, indexed by HTTPHeaderField
+	std::string_view		m_aKnownHeaders[eNumKnownHeaderFields];
+
+	struct OtherHeaderField
+	{
+		std::string_view	name;
+		std::string_view	value;
+	};
+
+	// any fields which aren't known HTTPHeaderFields, in the order they were in the request
+	SmallVector<OtherHeaderField, 16>	m_aOtherHeaders;
 
 	// decoded / processed items
 	HTTPRequestType			m_requestType;
 	HTTPVersion				m_httpVersion;
 
-	std::string				m_path;
+	std::string_view		m_path;
 
-	std::string				m_hostValue;
-	std::string				m_connectionValue;
+	// not yet decoded
+	std::string_view		m_queryString;
+	std::string_view		m_bodyParamsString;
 
 	// Note: this might be set based on HTTP version default and modified by Connection header field...
 	ConnectionType			m_connectionType;
@@ -187,8 +279,14 @@ protected:
 	std::string				m_authUsername;
 	std::string				m_authPassword;
 
-	std::map<std::string, std::string>	m_aParams;
-	std::map<std::string, std::string>	m_aCookies;
+	mutable bool			m_paramsDecoded;
+	mutable ValueList		m_aParams;
+	mutable bool			m_cookiesDecoded;
+	mutable ValueList		m_aCookies;
+
+	// param values which need %-decoding are decoded into this, and the rest are views into the raw request.
+	// It's reserved up-front for all of them, so never reallocates (which would invalidate the views into it).
+	mutable std::string		m_decodedParamValues;
 };
 
 #endif // WEB_REQUEST_H
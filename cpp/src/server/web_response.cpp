@@ -19,8 +19,12 @@
 #include "web_response.h"
 
 #include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
 
 #include "configuration.h"
+#include "web_request.h"
 
 void WebResponseParams::extractParamsFromConfiguration(bool secureConnection)
 {
@@ -35,14 +39,7 @@ void WebResponseCommon::addCommonResponseHeaderItems(std::string& headerResponse
 {
 	if (responseParams.configuration.getSendDateHeaderField())
 	{
-		char szTime[64];
-
-		time_t timeNow;
-		struct tm timeInfo;
-		time(&timeNow);
-		gmtime_r(&timeNow, &timeInfo);
-		strftime (szTime, 64, "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &timeInfo);
-		headerResponse += szTime;
+		headerResponse += "Date: " + formatHTTPDate(time(nullptr)) + "\r\n";
 	}
 
 	if (responseParams.keepAliveEnabled)
@@ -107,3 +104,108 @@ void WebResponseCommon::addCommonResponseHeaderItems(std::string& headerResponse
 	
 //	headerResponse += "Server: WebServe\r\n";
 }
+
+std::string WebResponseCommon::formatHTTPDate(time_t time)
+{
+	char szTime[64];
+
+	struct tm timeInfo;
+	gmtime_r(&time, &timeInfo);
+	// Note: %a and %b are locale-dependent, but we never change the locale from "C"
+	strftime(szTime, 64, "%a, %d %b %Y %H:%M:%S GMT", &timeInfo);
+
+	return szTime;
+}
+
+bool WebResponseCommon::parseHTTPDate(std::string_view dateString, time_t& time)
+{
+	// Note: strptime() needs a null-terminated string, and IMF-fixdate is always 29 chars
+	if (dateString.size() != 29)
+		return false;
+
+	char szDate[32];
+	memcpy(szDate, dateString.data(), dateString.size());
+	szDate[dateString.size()] = 0;
+
+	struct tm timeInfo;
+	memset(&timeInfo, 0, sizeof(timeInfo));
+	const char* pEnd = strptime(szDate, "%a, %d %b %Y %H:%M:%S GMT", &timeInfo);
+	if (!pEnd || *pEnd != 0)
+		return false;
+
+	time = timegm(&timeInfo);
+	return time != (time_t)-1;
+}
+
+std::string WebResponseCommon::generateFileETag(const struct stat& fileStat)
+{
+	char szETag[64];
+	snprintf(szETag, 64, "\"%llx-%llx-%llx\"", (unsigned long long)fileStat.st_ino, (unsigned long long)fileStat.st_size,
+			 (unsigned long long)fileStat.st_mtime);
+
+	return szETag;
+}
+
+bool WebResponseCommon::isNotModified(const WebRequest& request, const std::string& eTag, time_t lastModified)
+{
+	if (request.getRequestType() != WebRequest::eRequestGET && request.getRequestType() != WebRequest::eRequestHEAD)
+		return false;
+
+	if (request.hasHeader(eHeaderIfNoneMatch))
+	{
+		// if it's present, If-Modified-Since has to be ignored, whether or not this matches.
+		std::string_view ifNoneMatch = request.getHeader(eHeaderIfNoneMatch);
+		if (ifNoneMatch == "*")
+			return true;
+
+		// a list of entity tags, which are compared using the weak comparison, so any "W/" prefix is ignored
+		// Note: entity tags can't contain commas, so we can just split on them
+		while (!ifNoneMatch.empty())
+		{
+			size_t commaPos = ifNoneMatch.find(',');
+			std::string_view tag = ifNoneMatch.substr(0, commaPos);
+			ifNoneMatch = (commaPos == std::string_view::npos) ? std::string_view() : ifNoneMatch.substr(commaPos + 1);
+
+			while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+				tag.remove_prefix(1);
+			while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+				tag.remove_suffix(1);
+
+			if (tag.substr(0, 2) == "W/")
+				tag.remove_prefix(2);
+
+			if (tag == eTag)
+				return true;
+		}
+
+		return false;
+	}
+
+	if (request.hasHeader(eHeaderIfModifiedSince))
+	{
+		time_t ifModifiedSince;
+		if (!parseHTTPDate(request.getHeader(eHeaderIfModifiedSince), ifModifiedSince))
+			return false;
+
+		return lastModified <= ifModifiedSince;
+	}
+
+	return false;
+}
+
+void WebResponseCommon::addValidatorHeaderItems(std::string& headerResponse, const std::string& eTag, time_t lastModified)
+{
+	headerResponse += "ETag: " + eTag + "\r\n";
+	headerResponse += "Last-Modified: " + formatHTTPDate(lastModified) + "\r\n";
+}
+
+std::string WebResponseCommon::getNotModifiedResponseHeader(const WebResponseParams& responseParams, const std::string& eTag, time_t lastModified)
+{
+	std::string responseString = "HTTP/1.1 304\r\n";
+
+	WebResponseCommon::addCommonResponseHeaderItems(responseString, responseParams);
+	addValidatorHeaderItems(responseString, eTag, lastModified);
+	responseString += "\r\n";
+
+	return responseString;
+}
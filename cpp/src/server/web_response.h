@@ -20,20 +20,26 @@
 #define WEB_RESPONSE_H
 
 #include <string>
+#include <string_view>
+#include <ctime>
 
 class WebResponseAdvanced;
+class WebRequest;
+
+struct stat;
 
 class Configuration;
 
 struct WebResponseParams
 {
-	WebResponseParams(const Configuration& conf, bool secureConnection) :
+	WebResponseParams(const Configuration& conf, bool secureConnection, bool headerOnlyResponse = false) :
 		configuration(conf),
 		keepAliveEnabled(true),
 		useChunkedLargeFiles(false),
 		cacheControlFlags(0),
 		cacheControlMaxAgeValue(0),
-		sendHSTSHeader(false)
+		sendHSTSHeader(false),
+		headerOnly(headerOnlyResponse)
 	{
 		extractParamsFromConfiguration(secureConnection);
 	}
@@ -73,6 +79,10 @@ struct WebResponseParams
 	unsigned int			cacheControlMaxAgeValue;
 	
 	bool					sendHSTSHeader;
+
+	// for HEAD requests: the response is just the header (with the Content-Length the body would have, where it can
+	// be worked out cheaply), and the body isn't generated at all.
+	bool					headerOnly;
 };
 
 class WebResponseCommon
@@ -84,6 +94,25 @@ public:
 	}
 
 	static void addCommonResponseHeaderItems(std::string& headerResponse, const WebResponseParams& responseParams);
+
+	// in the IMF-fixdate format, i.e. "Sun, 06 Nov 1994 08:49:37 GMT"
+	static std::string formatHTTPDate(time_t time);
+	// only the IMF-fixdate format is supported, not the obsolete RFC 850 or asctime() ones.
+	static bool parseHTTPDate(std::string_view dateString, time_t& time);
+
+	// a strong entity tag (including the quotes) for the current version of the file, based on its inode, size and
+	// modification time, so it doesn't need the file content to be read.
+	static std::string generateFileETag(const struct stat& fileStat);
+
+	// whether the request's If-None-Match (or If-Modified-Since if it doesn't have one) header field means the client
+	// already has this version of the resource, so a 304 response can be sent instead.
+	static bool isNotModified(const WebRequest& request, const std::string& eTag, time_t lastModified);
+
+	// adds the ETag and Last-Modified header fields
+	static void addValidatorHeaderItems(std::string& headerResponse, const std::string& eTag, time_t lastModified);
+
+	// the complete header for a 304 (Not Modified) response, which has no body
+	static std::string getNotModifiedResponseHeader(const WebResponseParams& responseParams, const std::string& eTag, time_t lastModified);
 };
 
 #endif // WEB_RESPONSE_H
@@ -19,17 +19,28 @@
 #include "web_response_advanced_binary_file.h"
 
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <charconv>
+#include <random>
+#include <algorithm>
 
 #include "utils/socket.h"
 #include "utils/file_helpers.h"
 
 #include "web_response.h"
+#include "web_request.h"
 
 static const unsigned int kMaxSendChunkSize = 1024 * 64; // TODO: decouple read and send?
 
+// more ranges than this in a request are likely to be an attempt at abuse, so we just send the whole file instead
+static const size_t kMaxRanges = 16;
+
 WebResponseAdvancedBinaryFile::WebResponseAdvancedBinaryFile(const std::string& filePath) :
 	WebResponseAdvanced(),
-	m_filePath(filePath)
+	m_filePath(filePath),
+	m_pRequest(nullptr)
 {
 	// check the file extension to content type mapping to ensure we support it...
 	std::string fileExtension = FileHelpers::getFileExtension(m_filePath);
@@ -83,6 +94,22 @@ WebResponseAdvancedBinaryFile::WebResponseAdvancedBinaryFile(const std::string&
 	{
 		m_contentTypeString = "audio/mpeg3";
 	}
+	else if (fileExtension == "mp4")
+	{
+		m_contentTypeString = "video/mp4";
+	}
+	else if (fileExtension == "m4v")
+	{
+		m_contentTypeString = "video/x-m4v";
+	}
+	else if (fileExtension == "mov")
+	{
+		m_contentTypeString = "video/quicktime";
+	}
+	else if (fileExtension == "webm")
+	{
+		m_contentTypeString = "video/webm";
+	}
 	else if (fileExtension == "pdf")
 	{
 		m_contentTypeString = "application/pdf";
@@ -101,6 +128,26 @@ WebResponseAdvancedBinaryFile::WebResponseAdvancedBinaryFile(const std::string&
 	}
 }
 
+// sends the data, along with the response header in the same send if it hasn't been sent yet, which is then cleared
+static bool sendWithPendingHeader(ConnectionSocket* pConnectionSocket, std::string& header, unsigned char* pData, size_t dataLength)
+{
+	if (header.empty())
+	{
+		return pConnectionSocket->send(pData, dataLength);
+	}
+
+	struct iovec aIOVecs[2];
+	aIOVecs[0].iov_base = (void*)header.data();
+	aIOVecs[0].iov_len = header.size();
+	aIOVecs[1].iov_base = pData;
+	aIOVecs[1].iov_len = dataLength;
+
+	bool wasSuccessful = pConnectionSocket->sendv(aIOVecs, 2);
+	header.clear();
+
+	return wasSuccessful;
+}
+
 bool WebResponseAdvancedBinaryFile::sendResponse(ConnectionSocket* pConnectionSocket, const WebResponseParams& responseParams) const
 {
 	// TODO: don't print full path in any error
@@ -110,6 +157,44 @@ bool WebResponseAdvancedBinaryFile::sendResponse(ConnectionSocket* pConnectionSo
 		return false;
 	}
 
+	int fileFD = open(m_filePath.c_str(), O_RDONLY);
+	if (fileFD == -1)
+	{
+		return false;
+	}
+
+	// work out the data length from the file we've actually opened
+	struct stat statBuff;
+	if (fstat(fileFD, &statBuff) == -1)
+	{
+		close(fileFD);
+		return false;
+	}
+
+	size_t fileSizeInBytes = statBuff.st_size;
+
+	std::string eTag = WebResponseCommon::generateFileETag(statBuff);
+
+	if (m_pRequest && WebResponseCommon::isNotModified(*m_pRequest, eTag, statBuff.st_mtime))
+	{
+		close(fileFD);
+
+		return pConnectionSocket->send(WebResponseCommon::getNotModifiedResponseHeader(responseParams, eTag, statBuff.st_mtime), 0);
+	}
+
+	if (m_pRequest && m_pRequest->getRequestType() == WebRequest::eRequestGET && m_pRequest->hasHeader(eHeaderRange) &&
+		ifRangeMatches(statBuff, eTag))
+	{
+		std::vector<ByteRange> aRanges;
+		if (parseRangeHeader(m_pRequest->getHeader(eHeaderRange), fileSizeInBytes, aRanges))
+		{
+			bool wasSuccessful = sendRangesResponse(pConnectionSocket, responseParams, fileFD, statBuff, eTag, aRanges);
+			close(fileFD);
+			return wasSuccessful;
+		}
+		// otherwise, we ignore the Range header field and send the whole file as normal
+	}
+
 	std::string responseString;
 	char szTemp[64];
 	memset(szTemp, 0, 64);
@@ -121,8 +206,11 @@ bool WebResponseAdvancedBinaryFile::sendResponse(ConnectionSocket* pConnectionSo
 	WebResponseCommon::addCommonResponseHeaderItems(responseString, responseParams);
 
 	responseString += "Content-Type: " + m_contentTypeString + "\r\n";
+	responseString += "Accept-Ranges: bytes\r\n";
+	WebResponseCommon::addValidatorHeaderItems(responseString, eTag, statBuff.st_mtime);
 
-	if (responseParams.useChunkedLargeFiles)
+	// Note: header-only responses always have the Content-Length, as there's no body to be chunked
+	if (responseParams.useChunkedLargeFiles && !responseParams.headerOnly)
 	{
 		// this is the last header string, so we need to end the header...
 		responseString += "Transfer-Encoding: chunked\r\n\r\n";
@@ -135,143 +223,384 @@ bool WebResponseAdvancedBinaryFile::sendResponse(ConnectionSocket* pConnectionSo
 		// It's not 100% clear from RFC 2616 if this is part of the spec or not... 14.41 doesn't mention it, but
 		// section 4.4 does mention it with regards to message length...
 //		responseString += "Transfer-Encoding: identity\r\n";
+
+		// only need to the content-length if we're not chunked...
+		memset(szTemp, 0, 64);
+		sprintf(szTemp, "Content-Length: %zu\r\n\r\n", fileSizeInBytes);
+		responseString += szTemp;
+
+		if (responseParams.headerOnly)
+		{
+			close(fileFD);
+
+			return pConnectionSocket->send(responseString, 0);
+		}
+
+		bool wasSuccessful = sendFileRange(pConnectionSocket, fileFD, 0, fileSizeInBytes, responseString);
+
+		close(fileFD);
+
+		// caller will handle (possibly) closing socket
+		return wasSuccessful;
 	}
 
-	// work out the data length
-	// TODO: move this somewhere more re-usable
-	struct stat statBuff;
-	if (stat(m_filePath.c_str(), &statBuff) == -1)
+	size_t bytesToRead = fileSizeInBytes;
+
+	bool wasSuccessful = true;
+
+	// if we're using chunked, we need extra memory allocated for the chunk size + \r\n at the beginning and the \r\n at the end of the
+	// chunk data block.
+
+	// work out the size of the initial chunk size part...
+	sprintf(szTemp, "%02X\r\n", kMaxSendChunkSize);
+
+	unsigned int maxChunkHeaderLength = strlen(szTemp);
+
+	unsigned int bufferSize = maxChunkHeaderLength + kMaxSendChunkSize + 2;
+
+	unsigned char* pDataBuffer = new unsigned char[bufferSize];
+
+	size_t fileOffset = 0;
+
+	while (bytesToRead > 0)
 	{
-		return false;
+		unsigned char* pDataBufferNextPos = pDataBuffer;
+		size_t thisChunkDataSize = (bytesToRead >= kMaxSendChunkSize) ? kMaxSendChunkSize : bytesToRead;
+
+		// write chunk size header to start of data buffer
+		sprintf(szTemp, "%02X\r\n", (unsigned int)thisChunkDataSize);
+		unsigned int chunkHeaderLength = strlen(szTemp);
+		memcpy(pDataBufferNextPos, szTemp, chunkHeaderLength);
+
+		unsigned int totalChunkMessageSize = chunkHeaderLength + thisChunkDataSize + 2;
+
+		pDataBufferNextPos += chunkHeaderLength;
+
+		ssize_t dataRead = pread(fileFD, pDataBufferNextPos, thisChunkDataSize, fileOffset);
+		if (dataRead != (ssize_t)thisChunkDataSize)
+		{
+			wasSuccessful = false;
+			break;
+		}
+
+		pDataBufferNextPos += dataRead;
+
+		memcpy(pDataBufferNextPos, "\r\n", 2);
+
+		if (!sendWithPendingHeader(pConnectionSocket, responseString, pDataBuffer, totalChunkMessageSize))
+		{
+			wasSuccessful = false;
+			break;
+		}
+
+		bytesToRead -= thisChunkDataSize;
+		fileOffset += thisChunkDataSize;
 	}
 
-	size_t fileSizeInBytes = statBuff.st_size;
+	delete [] pDataBuffer;
 
-	if (!responseParams.useChunkedLargeFiles)
+	close(fileFD);
+
+	if (wasSuccessful)
 	{
-		// only need to the content-length if we're not chunked...
+		// now send a final 0\r\n as the last chunk...
+		std::string lastChunk = "0\r\n";
+		wasSuccessful = sendWithPendingHeader(pConnectionSocket, responseString, (unsigned char*)lastChunk.data(), lastChunk.size());
+	}
 
-		memset(szTemp, 0, 64);
-		sprintf(szTemp, "Content-Length: %zu\r\n\r\n", fileSizeInBytes);
-		responseString += szTemp;
+	if (!wasSuccessful)
+	{
+		// on the assumption that the socket was closed by the other side...
+		// TODO: this needs to be made more robust to correctly check that that was the case...
+		return false;
 	}
 
-	// send this header info
-	pConnectionSocket->send(responseString, 0);
+	// now send final "\r\n"
+	pConnectionSocket->send("\r\n");
 
-	// now send the raw content
-	// TODO: this should really be above, and it's unlikely to fail if stat worked...
-	FILE* pDataFile = fopen(m_filePath.c_str(), "rb");
-	if (!pDataFile)
+	// caller will handle (possibly) closing socket
+
+	return true;
+}
+
+bool WebResponseAdvancedBinaryFile::parseRangeHeader(std::string_view rangeValue, size_t fileSize, std::vector<ByteRange>& aRanges)
+{
+	// Note: "bytes" is the only range unit we support, and it's case-insensitive
+	if (rangeValue.size() < 6 || !HTTPHeaderFields::equalsIgnoreCase(rangeValue.substr(0, 6), "bytes="))
 	{
 		return false;
 	}
 
-	size_t bytesToRead = fileSizeInBytes;
+	rangeValue.remove_prefix(6);
 
-	bool wasSuccessful = true;
+	bool haveAnyRangeSpecs = false;
 
-	if (responseParams.useChunkedLargeFiles)
+	while (!rangeValue.empty())
 	{
-		// if we're using chunked, we need extra memory allocated for the chunk size + \r\n at the beginning and the \r\n at the end of the
-		// chunk data block.
+		size_t commaPos = rangeValue.find(',');
+		std::string_view rangeSpec = rangeValue.substr(0, commaPos);
+		rangeValue = (commaPos == std::string_view::npos) ? std::string_view() : rangeValue.substr(commaPos + 1);
 
-		// work out the size of the initial chunk size part...
-		sprintf(szTemp, "%02X\r\n", kMaxSendChunkSize);
+		while (!rangeSpec.empty() && (rangeSpec.front() == ' ' || rangeSpec.front() == '\t'))
+			rangeSpec.remove_prefix(1);
+		while (!rangeSpec.empty() && (rangeSpec.back() == ' ' || rangeSpec.back() == '\t'))
+			rangeSpec.remove_suffix(1);
 
-		unsigned int maxChunkHeaderLength = strlen(szTemp);
+		// empty list elements are allowed
+		if (rangeSpec.empty())
+			continue;
 
-		unsigned int bufferSize = maxChunkHeaderLength + kMaxSendChunkSize + 2;
+		size_t dashPos = rangeSpec.find('-');
+		if (dashPos == std::string_view::npos)
+			return false;
 
-		unsigned char* pDataBuffer = new unsigned char[bufferSize];
+		std::string_view firstString = rangeSpec.substr(0, dashPos);
+		std::string_view lastString = rangeSpec.substr(dashPos + 1);
 
-		while (bytesToRead > 0)
+		// parses the whole of the string as an unsigned number
+		auto parseNumber = [](std::string_view numberString, size_t& value)
 		{
-			unsigned char* pDataBufferNextPos = pDataBuffer;
-			size_t thisChunkDataSize = (bytesToRead >= kMaxSendChunkSize) ? kMaxSendChunkSize : bytesToRead;
-
-			// write chunk size header to start of data buffer
-			sprintf(szTemp, "%02X\r\n", (unsigned int)thisChunkDataSize);
-			unsigned int chunkHeaderLength = strlen(szTemp);
-			memcpy(pDataBufferNextPos, szTemp, chunkHeaderLength);
+			if (numberString.empty())
+				return false;
+			auto result = std::from_chars(numberString.data(), numberString.data() + numberString.size(), value);
+			return result.ec == std::errc() && result.ptr == numberString.data() + numberString.size();
+		};
 
-			unsigned int totalChunkMessageSize = chunkHeaderLength + thisChunkDataSize + 2;
+		size_t first = 0;
+		size_t last = 0;
 
-			pDataBufferNextPos += chunkHeaderLength;
+		if (firstString.empty())
+		{
+			// a suffix range ("-500"), for the last bytes of the file
+			if (!parseNumber(lastString, last))
+				return false;
 
-			size_t dataRead = fread(pDataBufferNextPos, 1, thisChunkDataSize, pDataFile);
-			if (dataRead != thisChunkDataSize)
-			{
-				wasSuccessful = false;
-				break;
-			}
+			haveAnyRangeSpecs = true;
 
-			pDataBufferNextPos += dataRead;
+			if (last == 0 || fileSize == 0)
+				continue; // not satisfiable
 
-			memcpy(pDataBufferNextPos, "\r\n", 2);
+			size_t suffixLength = std::min(last, fileSize);
+			aRanges.push_back({fileSize - suffixLength, suffixLength});
+		}
+		else
+		{
+			if (!parseNumber(firstString, first))
+				return false;
 
-			if (!pConnectionSocket->send(pDataBuffer, totalChunkMessageSize))
+			if (lastString.empty())
+			{
+				last = fileSize - 1;
+			}
+			else if (!parseNumber(lastString, last) || last < first)
 			{
-				wasSuccessful = false;
-				break;
+				return false;
 			}
 
-			bytesToRead -= thisChunkDataSize;
-		}
+			haveAnyRangeSpecs = true;
 
-		delete [] pDataBuffer;
+			if (first >= fileSize)
+				continue; // not satisfiable
 
-		if (wasSuccessful)
-		{
-			// now send a final 0\r\n as the last chunk...
-			pConnectionSocket->send("0\r\n");
+			last = std::min(last, fileSize - 1);
+			aRanges.push_back({first, last - first + 1});
 		}
+
+		if (aRanges.size() > kMaxRanges)
+			return false;
 	}
-	else
+
+	// overlapping (or adjacent) ranges are merged, so that they can't be used to make us send far more than the
+	// size of the file (RFC 7233 6.1), which means they're also sent in order of their position in the file.
+	if (aRanges.size() > 1)
 	{
-		unsigned char* pDataBuffer = new unsigned char[kMaxSendChunkSize];
+		std::sort(aRanges.begin(), aRanges.end(), [](const ByteRange& a, const ByteRange& b) { return a.start < b.start; });
 
-		while (bytesToRead > 0)
+		size_t lastMergedIndex = 0;
+		for (size_t i = 1; i < aRanges.size(); i++)
 		{
-			size_t thisChunkSize = (bytesToRead >= kMaxSendChunkSize) ? kMaxSendChunkSize : bytesToRead;
-
-			size_t dataRead = fread(pDataBuffer, 1, thisChunkSize, pDataFile);
-			if (dataRead != thisChunkSize)
+			ByteRange& lastMergedRange = aRanges[lastMergedIndex];
+			size_t lastMergedEnd = lastMergedRange.start + lastMergedRange.length;
+			if (aRanges[i].start <= lastMergedEnd)
 			{
-				wasSuccessful = false;
-				break;
+				lastMergedRange.length = std::max(lastMergedEnd, aRanges[i].start + aRanges[i].length) - lastMergedRange.start;
 			}
-
-			if (!pConnectionSocket->send(pDataBuffer, thisChunkSize))
+			else
 			{
-				wasSuccessful = false;
-				break;
+				aRanges[++lastMergedIndex] = aRanges[i];
 			}
-
-			bytesToRead -= thisChunkSize;
 		}
 
-		delete [] pDataBuffer;
+		aRanges.resize(lastMergedIndex + 1);
 	}
 
-	fclose(pDataFile);
+	return haveAnyRangeSpecs;
+}
 
-	if (!wasSuccessful)
+bool WebResponseAdvancedBinaryFile::ifRangeMatches(const struct stat& fileStat, const std::string& eTag) const
+{
+	if (!m_pRequest->hasHeader(eHeaderIfRange))
+		return true;
+
+	std::string_view ifRangeValue = m_pRequest->getHeader(eHeaderIfRange);
+
+	// entity tags use the strong comparison, so weak ones never match
+	if (!ifRangeValue.empty() && (ifRangeValue.front() == '"' || ifRangeValue.substr(0, 2) == "W/"))
+		return ifRangeValue == eTag;
+
+	// otherwise it's a date, which has to be an exact match of the file's modification time, formatted the same way
+	// as we would have sent it.
+	return ifRangeValue == WebResponseCommon::formatHTTPDate(fileStat.st_mtime);
+}
+
+bool WebResponseAdvancedBinaryFile::sendRangesResponse(ConnectionSocket* pConnectionSocket, const WebResponseParams& responseParams, int fileFD,
+													   const struct stat& fileStat, const std::string& eTag, const std::vector<ByteRange>& aRanges) const
+{
+	size_t fileSize = fileStat.st_size;
+
+	std::string responseString;
+	char szTemp[128];
+	memset(szTemp, 0, 128);
+
+	if (aRanges.empty())
 	{
-		// on the assumption that the socket was closed by the other side...
-		// TODO: this needs to be made more robust to correctly check that that was the case...
-		return false;
+		// none of the ranges were satisfiable
+		sprintf(szTemp, "HTTP/1.1 %i\r\n", 416);
+		responseString += szTemp;
+
+		WebResponseCommon::addCommonResponseHeaderItems(responseString, responseParams);
+
+		sprintf(szTemp, "Content-Range: bytes */%zu\r\n", fileSize);
+		responseString += szTemp;
+		responseString += "Content-Length: 0\r\n\r\n";
+
+		return pConnectionSocket->send(responseString, 0);
+	}
+
+	sprintf(szTemp, "HTTP/1.1 %i\r\n", 206);
+	responseString += szTemp;
+
+	WebResponseCommon::addCommonResponseHeaderItems(responseString, responseParams);
+
+	responseString += "Accept-Ranges: bytes\r\n";
+	WebResponseCommon::addValidatorHeaderItems(responseString, eTag, fileStat.st_mtime);
+
+	if (aRanges.size() == 1)
+	{
+		const ByteRange& range = aRanges[0];
+
+		responseString += "Content-Type: " + m_contentTypeString + "\r\n";
+		sprintf(szTemp, "Content-Range: bytes %zu-%zu/%zu\r\n", range.start, range.start + range.length - 1, fileSize);
+		responseString += szTemp;
+		sprintf(szTemp, "Content-Length: %zu\r\n\r\n", range.length);
+		responseString += szTemp;
+
+		return sendFileRange(pConnectionSocket, fileFD, range.start, range.length, responseString);
 	}
 
-	if (responseParams.useChunkedLargeFiles)
+	// multiple ranges, so it's a multipart/byteranges response, with each range as a part with its own header.
+	// The boundary only needs to not occur in the file data, so a random one is used.
+	std::random_device randomDevice;
+	sprintf(szTemp, "%08x%08x", randomDevice(), randomDevice());
+	std::string boundary = szTemp;
+
+	std::vector<std::string> aPartHeaders;
+	aPartHeaders.reserve(aRanges.size());
+
+	std::string finalBoundary = "\r\n--" + boundary + "--\r\n";
+
+	// work out the length of it all up-front, so we can send a Content-Length
+	size_t contentLength = finalBoundary.size();
+	for (const ByteRange& range : aRanges)
 	{
-		// now send final "\r\n"
-		pConnectionSocket->send("\r\n");
+		std::string partHeader = "\r\n--" + boundary + "\r\nContent-Type: " + m_contentTypeString + "\r\n";
+		sprintf(szTemp, "Content-Range: bytes %zu-%zu/%zu\r\n\r\n", range.start, range.start + range.length - 1, fileSize);
+		partHeader += szTemp;
+
+		contentLength += partHeader.size() + range.length;
+		aPartHeaders.emplace_back(std::move(partHeader));
 	}
 
-	// caller will handle (possibly) closing socket
+	responseString += "Content-Type: multipart/byteranges; boundary=" + boundary + "\r\n";
+	sprintf(szTemp, "Content-Length: %zu\r\n\r\n", contentLength);
+	responseString += szTemp;
 
-	return true;
+	for (size_t i = 0; i < aRanges.size(); i++)
+	{
+		// the part header gets sent along with the response header (if it's still pending) and the range data
+		responseString += aPartHeaders[i];
+
+		if (!sendFileRange(pConnectionSocket, fileFD, aRanges[i].start, aRanges[i].length, responseString))
+		{
+			return false;
+		}
+	}
+
+	return pConnectionSocket->send(finalBoundary, 0);
+}
+
+bool WebResponseAdvancedBinaryFile::sendFileRange(ConnectionSocket* pConnectionSocket, int fileFD, size_t offset, size_t length, std::string& pendingHeader)
+{
+	if (length == 0)
+	{
+		if (pendingHeader.empty())
+			return true;
+
+		bool wasSuccessful = pConnectionSocket->send(pendingHeader, 0);
+		pendingHeader.clear();
+		return wasSuccessful;
+	}
+
+	if (pConnectionSocket->supportsSendFileData())
+	{
+		// the connection socket can send the file content itself more efficiently
+		if (!pendingHeader.empty())
+		{
+			// send the header info, letting the socket know the file content is about to follow, so the end of the
+			// header doesn't go out in a packet on its own
+			struct iovec headerIOVec;
+			headerIOVec.iov_base = (void*)pendingHeader.data();
+			headerIOVec.iov_len = pendingHeader.size();
+			bool wasSuccessful = pConnectionSocket->sendv(&headerIOVec, 1, ConnectionSocket::SEND_MORE_TO_FOLLOW);
+			pendingHeader.clear();
+			if (!wasSuccessful)
+			{
+				return false;
+			}
+		}
+
+		return pConnectionSocket->sendFileData(fileFD, offset, length);
+	}
+
+	// otherwise, read it with positioned reads (so the file offset doesn't matter) and send it in chunks
+	unsigned char* pDataBuffer = new unsigned char[kMaxSendChunkSize];
+
+	bool wasSuccessful = true;
+
+	while (length > 0)
+	{
+		size_t thisChunkSize = (length >= kMaxSendChunkSize) ? kMaxSendChunkSize : length;
+
+		ssize_t dataRead = pread(fileFD, pDataBuffer, thisChunkSize, offset);
+		if (dataRead != (ssize_t)thisChunkSize)
+		{
+			wasSuccessful = false;
+			break;
+		}
+
+		if (!sendWithPendingHeader(pConnectionSocket, pendingHeader, pDataBuffer, thisChunkSize))
+		{
+			wasSuccessful = false;
+			break;
+		}
+
+		offset += thisChunkSize;
+		length -= thisChunkSize;
+	}
+
+	delete [] pDataBuffer;
+
+	return wasSuccessful;
 }
 
 WebResponseAdvancedBinaryFile::ValidationResult WebResponseAdvancedBinaryFile::validateResponse() const
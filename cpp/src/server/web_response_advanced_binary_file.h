@@ -22,12 +22,26 @@
 #include "web_response_advanced.h"
 
 #include <string>
+#include <string_view>
+#include <vector>
 
+class WebRequest;
+struct stat;
+
+// Sends a file as the response, without reading it all into memory first. If setRequest() has been called, conditional
+// requests (304 Not Modified) and single and multiple byte ranges of the file (206 Partial Content) are supported.
 class WebResponseAdvancedBinaryFile : public WebResponseAdvanced
 {
 public:
 	WebResponseAdvancedBinaryFile(const std::string& filePath);
 
+	// the request the response is for, which is used for its conditional (If-None-Match etc) and Range header fields.
+	// Note: we don't own this, and it needs to exist until sendResponse() has been called.
+	void setRequest(const WebRequest* pRequest)
+	{
+		m_pRequest = pRequest;
+	}
+
 	virtual bool sendResponse(ConnectionSocket* pConnectionSocket, const WebResponseParams& responseParams) const override;
 	
 	enum ValidationResult
@@ -40,10 +54,35 @@ public:
 	ValidationResult validateResponse() const;
 
 protected:
-	std::string		m_filePath;
+	struct ByteRange
+	{
+		size_t		start;
+		size_t		length;
+	};
+
+	// parses a Range header field value (i.e. "bytes=0-499, -500") into the ranges of the file which are satisfiable.
+	// Returns false if it's not a valid bytes range (or has too many ranges), in which case it should be ignored and
+	// the whole file sent. Overlapping and adjacent ranges are merged, so the ranges are in order and don't overlap.
+	static bool parseRangeHeader(std::string_view rangeValue, size_t fileSize, std::vector<ByteRange>& aRanges);
+
+	// whether any If-Range header field in the request matches the current version of the file, so the ranges requested
+	// can be sent, rather than the whole file.
+	bool ifRangeMatches(const struct stat& fileStat, const std::string& eTag) const;
+
+	bool sendRangesResponse(ConnectionSocket* pConnectionSocket, const WebResponseParams& responseParams, int fileFD,
+							const struct stat& fileStat, const std::string& eTag, const std::vector<ByteRange>& aRanges) const;
+
+	// sends part of the file, after any pending header (which is cleared once it's been sent), using sendFileData()
+	// if the connection socket supports it, or positioned reads otherwise.
+	static bool sendFileRange(ConnectionSocket* pConnectionSocket, int fileFD, size_t offset, size_t length, std::string& pendingHeader);
+
+protected:
+	std::string			m_filePath;
+
+	const WebRequest*	m_pRequest;
 	
 	// cached stuff
-	std::string		m_contentTypeString;
+	std::string			m_contentTypeString;
 };
 
 #endif // WEB_RESPONSE_ADVANCED_BINARY_FILE_H
@@ -23,6 +23,8 @@
 
 #include <cstring> // for memset()
 
+#include <sys/stat.h>
+
 #include "web_response.h"
 
 #include "utils/string_helpers.h"
@@ -36,7 +38,12 @@ WebResponseGeneratorBasicText::WebResponseGeneratorBasicText(int returnCode, con
 
 std::string WebResponseGeneratorBasicText::getResponseString(const WebResponseParams& responseParams) const
 {
-	std::string response;
+	return getCombinedResponseString(responseParams);
+}
+
+void WebResponseGeneratorBasicText::getResponse(const WebResponseParams& responseParams, std::string& header, std::string& body) const
+{
+	std::string& response = header;
 
 	char szTemp[64];
 	memset(szTemp, 0, 64);
@@ -52,7 +59,34 @@ std::string WebResponseGeneratorBasicText::getResponseString(const WebResponsePa
 	sprintf(szTemp, "Content-Length: %ld\r\n\r\n", m_text.size());
 	response += szTemp;
 
-	response += m_text;
+	if (!responseParams.headerOnly)
+	{
+		body = m_text;
+	}
+}
+
+//
+
+WebResponseGeneratorServiceUnavailable::WebResponseGeneratorServiceUnavailable(unsigned int retryAfterSeconds) :
+	m_retryAfterSeconds(retryAfterSeconds)
+{
+
+}
+
+std::string WebResponseGeneratorServiceUnavailable::getResponseString(const WebResponseParams& responseParams) const
+{
+	std::string response = "HTTP/1.1 503\r\n";
+
+	WebResponseCommon::addCommonResponseHeaderItems(response, responseParams);
+
+	if (m_retryAfterSeconds > 0)
+	{
+		char szTemp[64];
+		sprintf(szTemp, "Retry-After: %u\r\n", m_retryAfterSeconds);
+		response += szTemp;
+	}
+
+	response += "Content-Length: 0\r\n\r\n";
 
 	return response;
 }
@@ -183,7 +217,8 @@ std::string WebResponseGeneratorAuthentication::getResponseString(const WebRespo
 //
 
 WebResponseGeneratorFile::WebResponseGeneratorFile(const std::string& path) :
-	m_path(path)
+	m_path(path),
+	m_pRequest(nullptr)
 {
 
 }
@@ -192,9 +227,30 @@ WebResponseGeneratorFile::WebResponseGeneratorFile(const std::string& path) :
 
 std::string WebResponseGeneratorFile::getResponseString(const WebResponseParams& responseParams) const
 {
-	std::string response;
+	return getCombinedResponseString(responseParams);
+}
+
+static const std::string kFileNotFoundContent = "File not found.\n";
+
+void WebResponseGeneratorFile::getResponse(const WebResponseParams& responseParams, std::string& header, std::string& body) const
+{
+	std::string& response = header;
+
+	// work out the validators first, so we don't need to read the file at all if the client already has this version of it
+	struct stat statBuff;
+	bool haveFileStat = stat(m_path.c_str(), &statBuff) == 0;
+	std::string eTag;
+	if (haveFileStat)
+	{
+		eTag = WebResponseCommon::generateFileETag(statBuff);
+
+		if (m_pRequest && WebResponseCommon::isNotModified(*m_pRequest, eTag, statBuff.st_mtime))
+		{
+			response = WebResponseCommon::getNotModifiedResponseHeader(responseParams, eTag, statBuff.st_mtime);
+			return;
+		}
+	}
 
-	bool binary = false;
 	FileContentType contentType = eContentTextHTML;
 	// work out if it's an image
 	int extensionPos = m_path.rfind('.');
@@ -202,66 +258,56 @@ std::string WebResponseGeneratorFile::getResponseString(const WebResponseParams&
 	{
 		std::string extension = m_path.substr(extensionPos + 1);
 
-		// Note: this is likely no longer a good idea, and everything's set to binary anyway
-		//       due to CSS/JS minification causing extremely long lines, so...
 		if (extension == "png")
 		{
-			binary = true;
 			contentType = eContentImagePNG;
 		}
 		else if (extension == "jpg")
 		{
-			binary = true;
 			contentType = eContentImageJPEG;
 		}
 		else if (extension == "svg")
 		{
-			binary = true;
 			contentType = eContentImageSVG;
 		}
 		else if (extension == "css")
 		{
-			binary = true;
 			contentType = eContentTextCSS;
 		}
 		else if (extension == "js")
 		{
-			binary = true;
 			contentType = eContentTextJS;
 		}
 	}
 
-	std::ios::openmode mode = std::ios::in;
-
-	if (binary)
-	{
-		mode = std::ios::in | std::ios::binary;
-	}
-
-	std::fstream fileStream(m_path.c_str(), mode);
-
-	std::string content;
+	std::string& content = body;
 	int returnCode = 200;
 
-	if (fileStream.fail())
+	// Note: everything is read as binary (unmodified), so that the size of the content is always the size of the file,
+	//       which is all we need for header-only responses.
+	size_t contentLength = 0;
+
+	if (responseParams.headerOnly)
 	{
-		// TODO: for security, don't show the full path...
-		content = "File not found.\n";
-		returnCode = 404;
+		if (haveFileStat)
+		{
+			contentLength = statBuff.st_size;
+		}
+		else
+		{
+			contentLength = kFileNotFoundContent.size();
+			returnCode = 404;
+		}
 	}
 	else
 	{
-		if (!binary)
-		{
-			std::string line;
-			char buf[1024];
+		std::fstream fileStream(m_path.c_str(), std::ios::in | std::ios::binary);
 
-			// Note: this can be a serious limitation with minified JS/CSS...
-			while (fileStream.getline(buf, 1024))
-			{
-				line.assign(buf);
-				content += line + "\n";
-			}
+		if (fileStream.fail())
+		{
+			// TODO: for security, don't show the full path...
+			content = kFileNotFoundContent;
+			returnCode = 404;
 		}
 		else
 		{
@@ -270,8 +316,10 @@ std::string WebResponseGeneratorFile::getResponseString(const WebResponseParams&
 
 			content = ssOut.str();
 		}
+		fileStream.close();
+
+		contentLength = content.size();
 	}
-	fileStream.close();
 
 	char szTemp[64];
 	memset(szTemp, 0, 64);
@@ -312,13 +360,14 @@ std::string WebResponseGeneratorFile::getResponseString(const WebResponseParams&
 		response += "Content-Type: " + contentTypeString + "\r\n";
 	}
 
+	if (returnCode == 200 && haveFileStat)
+	{
+		WebResponseCommon::addValidatorHeaderItems(response, eTag, statBuff.st_mtime);
+	}
+
 	memset(szTemp, 0, 64);
-	sprintf(szTemp, "Content-Length: %zu\r\n\r\n", content.size());
+	sprintf(szTemp, "Content-Length: %zu\r\n\r\n", contentLength);
 	response += szTemp;
-
-	response += content;
-
-	return response;
 }
 
 //
@@ -364,11 +413,36 @@ static const std::string templatePlaceholders[] = {"<%1%>", "<%2%>", "<%3%>", "<
 
 std::string WebResponseGeneratorTemplateFile::getResponseString(const WebResponseParams& responseParams) const
 {
-	std::string response;
+	return getCombinedResponseString(responseParams);
+}
+
+void WebResponseGeneratorTemplateFile::getResponse(const WebResponseParams& responseParams, std::string& header, std::string& body) const
+{
+	std::string& response = header;
+
+	if (responseParams.headerOnly)
+	{
+		// the length of the content isn't known without rendering the template, which we don't want to do just for
+		// the header, so there's no Content-Length (which is allowed for HEAD responses), only whether it exists.
+		struct stat statBuff;
+		if (stat(m_path.c_str(), &statBuff) == -1)
+		{
+			WebResponseGeneratorBasicText notFoundResponse(404, "Template file not found.\n");
+			notFoundResponse.getResponse(responseParams, header, body);
+			return;
+		}
+
+		response += "HTTP/1.1 200\r\n";
+
+		WebResponseCommon::addCommonResponseHeaderItems(response, responseParams);
+
+		response += "Content-Type: text/html; charset=UTF-8\r\n\r\n";
+		return;
+	}
 
 	std::fstream fileStream(m_path.c_str(), std::ios::in);
 
-	std::string content;
+	std::string& content = body;
 	int returnCode = 200;
 
 	if (fileStream.fail())
@@ -445,8 +519,4 @@ std::string WebResponseGeneratorTemplateFile::getResponseString(const WebRespons
 	memset(szTemp, 0, 64);
 	sprintf(szTemp, "Content-Length: %ld\r\n\r\n", content.size());
 	response += szTemp;
-
-	response += content;
-
-	return response;
 }
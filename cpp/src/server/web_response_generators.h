@@ -24,6 +24,8 @@
 
 #include "web_response.h"
 
+class WebRequest;
+
 class WebResponseGenerator
 {
 public:
@@ -33,6 +35,26 @@ public:
 	}
 
 	virtual std::string getResponseString(const WebResponseParams& responseParams) const = 0;
+
+	// generates the header and body separately, so that they can be sent together with a vectored send
+	// (i.e. ConnectionSocket::send(header, body)) without the body needing to be copied onto the end of the header.
+	// By default, everything is in the header.
+	virtual void getResponse(const WebResponseParams& responseParams, std::string& header, std::string& body) const
+	{
+		header = getResponseString(responseParams);
+	}
+
+protected:
+	// for generators which override getResponse(), to implement getResponseString() with
+	std::string getCombinedResponseString(const WebResponseParams& responseParams) const
+	{
+		std::string header;
+		std::string body;
+		getResponse(responseParams, header, body);
+
+		header += body;
+		return header;
+	}
 };
 
 class WebResponseGeneratorBasicText : public WebResponseGenerator
@@ -41,12 +63,25 @@ public:
 	WebResponseGeneratorBasicText(int returnCode, const std::string& text);
 
 	virtual std::string getResponseString(const WebResponseParams& responseParams) const override;
+	virtual void getResponse(const WebResponseParams& responseParams, std::string& header, std::string& body) const override;
 
 protected:
 	int				m_returnCode;
 	std::string		m_text;
 };
 
+// minimal response to send when shedding load, without doing any request handling
+class WebResponseGeneratorServiceUnavailable : public WebResponseGenerator
+{
+public:
+	WebResponseGeneratorServiceUnavailable(unsigned int retryAfterSeconds);
+
+	virtual std::string getResponseString(const WebResponseParams& responseParams) const override;
+
+protected:
+	unsigned int	m_retryAfterSeconds;
+};
+
 class WebResponseGeneratorRedirect : public WebResponseGenerator
 {
 public:
@@ -114,7 +149,16 @@ class WebResponseGeneratorFile : public WebResponseGenerator
 public:
 	WebResponseGeneratorFile(const std::string& path);
 
+	// the request the response is for, which is used for its conditional (If-None-Match etc) header fields, so that
+	// a 304 response can be sent instead if the client already has the file.
+	// Note: we don't own this, and it needs to exist until the response has been generated.
+	void setRequest(const WebRequest* pRequest)
+	{
+		m_pRequest = pRequest;
+	}
+
 	virtual std::string getResponseString(const WebResponseParams& responseParams) const override;
+	virtual void getResponse(const WebResponseParams& responseParams, std::string& header, std::string& body) const override;
 
 	enum FileContentType
 	{
@@ -128,7 +172,9 @@ public:
 	};
 
 protected:
-	std::string		m_path;
+	std::string			m_path;
+
+	const WebRequest*	m_pRequest;
 };
 
 class WebResponseGeneratorTemplateFile : public WebResponseGenerator
@@ -142,6 +188,7 @@ public:
 	// TODO: if the above gets any more silly, use a function to add more instead!!
 
 	virtual std::string getResponseString(const WebResponseParams& responseParams) const override;
+	virtual void getResponse(const WebResponseParams& responseParams, std::string& header, std::string& body) const override;
 
 protected:
 	int							m_templateArgs;
@@ -19,7 +19,11 @@
 #ifndef WEB_SERVER_COMMON_H
 #define WEB_SERVER_COMMON_H
 
+#include <chrono>
+#include <vector>
+
 #include "utils/socket.h"
+#include "utils/recv_buffer.h"
 // arguably is better to forward-declare it, but that means we need the include everywhere else, so...
 #include "utils/logger.h"
 
@@ -37,6 +41,8 @@ enum ReturnCodeType
 	eReturnFail
 };
 
+class CoroutineReactor;
+
 class SocketLayerThreadContext
 {
 public:
@@ -58,7 +64,12 @@ struct WebServerThreadConfig
 		threadID(-1),
 		pConfiguration(nullptr),
 		pLogger(nullptr),
-	    pSLThreadContext(nullptr)
+	    pSLThreadContext(nullptr),
+		pNonSecureSLThreadContext(nullptr),
+		pServerStatistics(nullptr),
+		pCoroutineReactor(nullptr),
+		primaryCPU(-1),
+		placementGroup(0)
 	{
 
 	}
@@ -69,7 +80,12 @@ struct WebServerThreadConfig
 		threadID(thdID),
 		pConfiguration(pConfig),
 		pLogger(pLog),
-	    pSLThreadContext(nullptr)
+	    pSLThreadContext(nullptr),
+		pNonSecureSLThreadContext(nullptr),
+		pServerStatistics(nullptr),
+		pCoroutineReactor(nullptr),
+		primaryCPU(-1),
+		placementGroup(0)
 	{
 
 	}
@@ -85,6 +101,21 @@ struct WebServerThreadConfig
 	Logger*					pLogger;
 	
 	SocketLayerThreadContext*	pSLThreadContext;
+	// separate one for the non-secure socket layer (only used by the io_uring one currently)
+	SocketLayerThreadContext*	pNonSecureSLThreadContext;
+
+	// we don't own this - it's WebServerService's
+	ServerStatistics*		pServerStatistics;
+
+	// only set if coroutine handlers are enabled. We don't own this either.
+	CoroutineReactor*		pCoroutineReactor;
+
+	// CPUs the thread should be pinned to - if empty, it's not pinned
+	std::vector<unsigned int>	aCPUAffinity;
+	// the main CPU the thread was assigned, or -1 if not pinned
+	int						primaryCPU;
+	// index of the pending connections queue group (NUMA node) this thread prefers to take connections from
+	unsigned int			placementGroup;
 };
 
 struct ConnectionStatistics
@@ -165,6 +196,8 @@ struct RequestConnection
 	}
 	
 	bool					https = false;
+	// whether HTTP/2 was negotiated (via ALPN) by the socket layer, rather than HTTP/1.1
+	bool					http2 = false;
 
 	// this should not be used for communication...
 	Socket*					pRawSocket = nullptr;
@@ -178,6 +211,21 @@ struct RequestConnection
 	
 	StatusService*			pStatusService = nullptr;
 
+	// when the connection was added to the pending connection queue
+	std::chrono::steady_clock::time_point	enqueueTime;
+
+	// number of keep-alive requests which have been handled on this connection so far
+	unsigned int			keepAliveRequestCount = 0;
+
+	// data received from the connection socket which hasn't been handled yet. Complete requests are handled
+	// as views into this, so it must not be modified until the request has been handled.
+	RecvBuffer				recvBuffer;
+
+	// this is only used by the event (epoll) connection engine, where connections aren't owned
+	// by a single worker thread for their lifetime, so state needs to be kept between requests:
+	// it's set by the poller when the connection was waiting for data for longer than its timeout
+	bool					idleTimedOut = false;
+
 	// hacky convenience function...
 	Logger& logger()
 	{
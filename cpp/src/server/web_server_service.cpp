@@ -19,24 +19,58 @@
 #include "web_server_service.h"
 
 #include <functional> // for bind()
+#include <algorithm>
+
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "socket_layer_interface.h"
 #include "socket_layer_plain.h"
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+#include "socket_layer_io_uring.h"
+#endif
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
 #include "socket_layer_s2n.h"
 #endif
 
+#include "connection_event_poller.h"
+#include "listener_handoff.h"
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+#include "coroutine_reactor.h"
+#endif
+
 #include "web_request.h"
+#include "web_response_generators.h"
 #include "configuration.h"
 #include "utils/system.h"
 
-#define USE_ADDITIONAL_ATOMIC_CONDITION_VARIABLE 1
+// how long idle workers park for before re-checking the pending queue anyway, as a safety net
+// against any missed wake-ups, and so they notice being stopped.
+static const unsigned int kWorkerParkTimeoutMS = 1000;
+
+// how often the elastic worker pool is checked for growing / cleaning up retired threads
+static const unsigned int kElasticPoolManageIntervalMS = 100;
 
 WebServerService::WebServerService() :
 	m_pNonSecureSocketLayer(nullptr),
 	m_pSecureSocketLayer(nullptr),
     m_active(false),
-	m_haveNewConnection(false),
+	m_numPlacementGroups(1),
+	m_elasticWorkerPool(false),
+	m_numActiveWorkers(0),
+	m_numBusyWorkers(0),
+	m_numAsyncRequestsInFlight(0),
+	m_lastDequeueTimeMS(0),
+	m_workerPoolGrowthRequested(false),
+	m_pEventPoller(nullptr),
+	m_pCoroutineReactor(nullptr),
+	m_usePerWorkerListeners(false),
+	m_pListenerHandoff(nullptr),
+	m_acceptingConnections(true),
+	m_listenersHandedOver(false),
 	m_pRequestHandler(nullptr),
 	m_freeHandler(false)
 {
@@ -45,6 +79,61 @@ WebServerService::WebServerService() :
 
 WebServerService::~WebServerService()
 {
+	if (m_pListenerHandoff)
+	{
+		delete m_pListenerHandoff;
+		m_pListenerHandoff = nullptr;
+	}
+	
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+	if (m_pCoroutineReactor)
+	{
+		delete m_pCoroutineReactor;
+		m_pCoroutineReactor = nullptr;
+	}
+#endif
+	
+	if (m_pEventPoller)
+	{
+		delete m_pEventPoller;
+		m_pEventPoller = nullptr;
+	}
+	
+	for (std::vector<ListenerSocket>& aListeners : m_aWorkerListenerSockets)
+	{
+		for (ListenerSocket& listener : aListeners)
+		{
+			delete listener.pSocket;
+		}
+	}
+	m_aWorkerListenerSockets.clear();
+	
+	for (BoundedMPMCQueue<RequestConnection*>* pPendingConnections : m_aPendingConnectionQueues)
+	{
+		// free any connections which never got handled
+		RequestConnection* pConnection = nullptr;
+		while (pPendingConnections->tryPop(pConnection))
+		{
+			pConnection->closeConnectionAndFreeSockets();
+			delete pConnection;
+		}
+		
+		delete pPendingConnections;
+	}
+	m_aPendingConnectionQueues.clear();
+	
+	for (BoundedMPMCQueue<unsigned int>* pIdleWorkers : m_aIdleWorkerQueues)
+	{
+		delete pIdleWorkers;
+	}
+	m_aIdleWorkerQueues.clear();
+	
+	for (ThreadParker* pParker : m_aWorkerParkers)
+	{
+		delete pParker;
+	}
+	m_aWorkerParkers.clear();
+	
 	if (m_pNonSecureSocketLayer)
 	{
 		delete m_pNonSecureSocketLayer;
@@ -59,10 +148,7 @@ WebServerService::~WebServerService()
 	
 	for (WebServerThreadConfig& threadConfig : m_aThreadConfigs)
 	{
-		if (threadConfig.pSLThreadContext)
-		{
-			delete threadConfig.pSLThreadContext;
-		}
+		freeWorkerThreadContexts(&threadConfig);
 	}
 	
 	if (m_freeHandler && m_pRequestHandler)
@@ -96,7 +182,19 @@ bool WebServerService::configure(const Configuration& configuration)
 		}
 	}
 	
-	m_pNonSecureSocketLayer = new SocketLayerPlain(m_logger);
+	if (m_configuration.getIOBackendType() == Configuration::eIOBackendIOUring)
+	{
+#if WEBSERVE_ENABLE_IO_URING_SUPPORT
+		m_pNonSecureSocketLayer = new SocketLayerIOUring(m_logger);
+#else
+		m_logger.warning("io_uring support is not compiled in. Falling back to standard socket IO.");
+#endif
+	}
+	
+	if (!m_pNonSecureSocketLayer)
+	{
+		m_pNonSecureSocketLayer = new SocketLayerPlain(m_logger);
+	}
 	if (!m_pNonSecureSocketLayer->configure(configuration))
 	{
 		// if there was an error, bail out...
@@ -125,10 +223,51 @@ bool WebServerService::bindSocketsAndPrepare()
 		socketCreationFlags |= Socket::SOCKOPT_FASTOPEN;
 	}
 	
-	if (m_configuration.isHTTPv4Enabled())
+	if (m_configuration.getPerWorkerListeners())
+	{
+		if (m_configuration.getConnectionEngineType() == Configuration::eConnectionEngineThreadPool)
+		{
+			m_usePerWorkerListeners = true;
+		}
+		else
+		{
+			m_logger.warning("perWorkerListeners is only supported with the threadPool connection engine. Option will be ignored.");
+		}
+	}
+	
+	if (m_usePerWorkerListeners)
+	{
+		if (!bindPerWorkerListenerSockets(socketCreationFlags))
+			return false;
+	}
+	
+	if (!m_configuration.getUpgradeSocketPath().empty())
+	{
+		if (m_usePerWorkerListeners)
+		{
+			m_logger.warning("upgradeSocketPath is not supported with perWorkerListeners. Option will be ignored.");
+		}
+		else
+		{
+			m_pListenerHandoff = new ListenerHandoff(m_logger, m_configuration.getUpgradeSocketPath());
+			
+			// if there's an existing process running, take over its listening sockets rather than binding new ones,
+			// so that it can carry on serving with them while we start up.
+			std::vector<ListenerHandoff::Listener> aListeners;
+			if (m_pListenerHandoff->receiveListeners(aListeners))
+			{
+				adoptHandedOverListeners(aListeners);
+			}
+		}
+	}
+	
+	// Note: the isValid() checks are for sockets which have been taken over from an existing process above
+	
+	if (m_configuration.isHTTPv4Enabled() && !m_usePerWorkerListeners && !m_mainSocketV4HTTP.isValid())
 	{
 		unsigned int portNumber = m_configuration.getHTTPv4PortNumber();
 		m_mainSocketV4HTTP.create(&m_logger, socketCreationFlags, false);
+		applyListenerTuning(m_mainSocketV4HTTP, false);
 	
 		if (!m_mainSocketV4HTTP.bind(portNumber, false))
 		{
@@ -138,10 +277,11 @@ bool WebServerService::bindSocketsAndPrepare()
 	}
 	
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
-	if (m_configuration.isHTTPSv4Enabled())
+	if (m_configuration.isHTTPSv4Enabled() && !m_usePerWorkerListeners && !m_mainSocketV4HTTPS.isValid())
 	{
 		unsigned int portNumber = m_configuration.getHTTPSv4PortNumber();
 		m_mainSocketV4HTTPS.create(&m_logger, socketCreationFlags, false);
+		applyListenerTuning(m_mainSocketV4HTTPS, true);
 	
 		if (!m_mainSocketV4HTTPS.bind(portNumber, false))
 		{
@@ -152,10 +292,11 @@ bool WebServerService::bindSocketsAndPrepare()
 #endif
 
 #if WEBSERVE_ENABLE_IPV6_SUPPORT
-	if (m_configuration.isHTTPv6Enabled())
+	if (m_configuration.isHTTPv6Enabled() && !m_usePerWorkerListeners && !m_mainSocketV6HTTP.isValid())
 	{
 		unsigned int portNumber = m_configuration.getHTTPv6PortNumber();
 		m_mainSocketV6HTTP.create(&m_logger, socketCreationFlags, true);
+		applyListenerTuning(m_mainSocketV6HTTP, false);
 
 		if (!m_mainSocketV6HTTP.bind(portNumber, true))
 		{
@@ -164,10 +305,11 @@ bool WebServerService::bindSocketsAndPrepare()
 		}
 	}
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
-	if (m_configuration.isHTTPSv6Enabled())
+	if (m_configuration.isHTTPSv6Enabled() && !m_usePerWorkerListeners && !m_mainSocketV6HTTPS.isValid())
 	{
 		unsigned int portNumber = m_configuration.getHTTPSv6PortNumber();
 		m_mainSocketV6HTTPS.create(&m_logger, socketCreationFlags, true);
+		applyListenerTuning(m_mainSocketV6HTTPS, true);
 	
 		if (!m_mainSocketV6HTTPS.bind(portNumber, true))
 		{
@@ -201,6 +343,220 @@ bool WebServerService::bindSocketsAndPrepare()
 	return true;
 }
 
+Socket* WebServerService::getMainSocketForListenerType(unsigned int listenerType)
+{
+	switch (listenerType)
+	{
+		case ListenerHandoff::eListenerHTTPv4:
+			return &m_mainSocketV4HTTP;
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT
+		case ListenerHandoff::eListenerHTTPSv4:
+			return &m_mainSocketV4HTTPS;
+#endif
+#if WEBSERVE_ENABLE_IPV6_SUPPORT
+		case ListenerHandoff::eListenerHTTPv6:
+			return &m_mainSocketV6HTTP;
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT
+		case ListenerHandoff::eListenerHTTPSv6:
+			return &m_mainSocketV6HTTPS;
+#endif
+#endif
+		default:
+			return nullptr;
+	}
+}
+
+void WebServerService::adoptHandedOverListeners(const std::vector<ListenerHandoff::Listener>& aListeners)
+{
+	unsigned int numAdopted = 0;
+	
+	for (const ListenerHandoff::Listener& listener : aListeners)
+	{
+		Socket* pMainSocket = getMainSocketForListenerType(listener.type);
+		
+		bool enabled = false;
+		switch (listener.type)
+		{
+			case ListenerHandoff::eListenerHTTPv4:
+				enabled = m_configuration.isHTTPv4Enabled();
+				break;
+			case ListenerHandoff::eListenerHTTPSv4:
+				enabled = m_configuration.isHTTPSv4Enabled();
+				break;
+			case ListenerHandoff::eListenerHTTPv6:
+				enabled = m_configuration.isHTTPv6Enabled();
+				break;
+			case ListenerHandoff::eListenerHTTPSv6:
+				enabled = m_configuration.isHTTPSv6Enabled();
+				break;
+		}
+		
+		if (!pMainSocket || !enabled || !pMainSocket->adoptListeningSocket(&m_logger, listener.fd))
+		{
+			// we don't want this one (the configuration's changed), but the old process still has it open
+			// until it exits, so we just need to close our copy of it.
+			::close(listener.fd);
+			continue;
+		}
+		
+		// in case the tuning's changed in the configuration.
+		// Note: buffer size changes won't affect the window scaling of connections on already-listening sockets.
+		bool secure = listener.type == ListenerHandoff::eListenerHTTPSv4 || listener.type == ListenerHandoff::eListenerHTTPSv6;
+		applyListenerTuning(*pMainSocket, secure);
+		
+		numAdopted++;
+	}
+	
+	m_logger.notice("Took over %u listening sockets from existing process.", numAdopted);
+}
+
+std::vector<ListenerHandoff::Listener> WebServerService::getHandoffListeners()
+{
+	std::vector<ListenerHandoff::Listener> aListeners;
+	
+	const ListenerHandoff::ListenerType aTypes[] = { ListenerHandoff::eListenerHTTPv4, ListenerHandoff::eListenerHTTPSv4,
+													 ListenerHandoff::eListenerHTTPv6, ListenerHandoff::eListenerHTTPSv6 };
+	for (ListenerHandoff::ListenerType type : aTypes)
+	{
+		Socket* pMainSocket = getMainSocketForListenerType(type);
+		if (!pMainSocket || !pMainSocket->isValid())
+			continue;
+		
+		ListenerHandoff::Listener listener;
+		listener.type = type;
+		listener.fd = pMainSocket->getSocketFD();
+		aListeners.emplace_back(listener);
+	}
+	
+	return aListeners;
+}
+
+bool WebServerService::bindPerWorkerListenerSockets(unsigned int socketCreationFlags)
+{
+	socketCreationFlags |= Socket::SOCKOPT_REUSEPORT;
+	
+	unsigned int numWorkers = m_configuration.getNumWorkerThreads();
+	m_aWorkerListenerSockets.resize(numWorkers);
+	
+	for (unsigned int i = 0; i < numWorkers; i++)
+	{
+		std::vector<ListenerSocket>& aListeners = m_aWorkerListenerSockets[i];
+		
+		if (m_configuration.isHTTPv4Enabled())
+		{
+			if (!addPerWorkerListenerSocket(aListeners, m_configuration.getHTTPv4PortNumber(), socketCreationFlags, false, false))
+				return false;
+		}
+
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT
+		if (m_configuration.isHTTPSv4Enabled())
+		{
+			if (!addPerWorkerListenerSocket(aListeners, m_configuration.getHTTPSv4PortNumber(), socketCreationFlags, false, true))
+				return false;
+		}
+#endif
+
+#if WEBSERVE_ENABLE_IPV6_SUPPORT
+		if (m_configuration.isHTTPv6Enabled())
+		{
+			if (!addPerWorkerListenerSocket(aListeners, m_configuration.getHTTPv6PortNumber(), socketCreationFlags, true, false))
+				return false;
+		}
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT
+		if (m_configuration.isHTTPSv6Enabled())
+		{
+			if (!addPerWorkerListenerSocket(aListeners, m_configuration.getHTTPSv6PortNumber(), socketCreationFlags, true, true))
+				return false;
+		}
+#endif
+#endif
+	}
+	
+	return true;
+}
+
+bool WebServerService::addPerWorkerListenerSocket(std::vector<ListenerSocket>& aListeners, unsigned int portNumber, unsigned int socketCreationFlags,
+												  bool v6, bool secure)
+{
+	Socket* pNewSocket = new Socket();
+	if (!pNewSocket->create(&m_logger, socketCreationFlags, v6))
+	{
+		m_logger.critical("Can't create SO_REUSEPORT socket for port: %u", portNumber);
+		delete pNewSocket;
+		return false;
+	}
+	
+	applyListenerTuning(*pNewSocket, secure);
+	
+	if (!pNewSocket->bind(portNumber, v6))
+	{
+		m_logger.critical("Can't bind to port: %u for per-worker listener", portNumber);
+		delete pNewSocket;
+		return false;
+	}
+	
+	ListenerSocket newListener;
+	newListener.pSocket = pNewSocket;
+	newListener.secure = secure;
+	aListeners.emplace_back(newListener);
+	
+	return true;
+}
+
+void WebServerService::applyListenerTuning(Socket& listenerSocket, bool secure)
+{
+	const Configuration::ListenerTuning& tuning = m_configuration.getListenerTuning(secure);
+	
+	if (tuning.deferAcceptTimeout > 0 && !listenerSocket.setTCPDeferAccept(tuning.deferAcceptTimeout))
+	{
+		m_logger.warning("Couldn't set TCP_DEFER_ACCEPT on listener socket.");
+	}
+	
+	if (tuning.noDelay && !listenerSocket.setTCPNoDelay(true))
+	{
+		m_logger.warning("Couldn't set TCP_NODELAY on listener socket.");
+	}
+	
+	if (tuning.notSentLowat > 0 && !listenerSocket.setTCPNotSentLowat(tuning.notSentLowat * 1024))
+	{
+		m_logger.warning("Couldn't set TCP_NOTSENT_LOWAT on listener socket.");
+	}
+	
+	if (tuning.sendBufferSize > 0 && !listenerSocket.setSendBufferSize(tuning.sendBufferSize * 1024))
+	{
+		m_logger.warning("Couldn't set SO_SNDBUF on listener socket.");
+	}
+	
+	if (tuning.recvBufferSize > 0 && !listenerSocket.setRecvBufferSize(tuning.recvBufferSize * 1024))
+	{
+		m_logger.warning("Couldn't set SO_RCVBUF on listener socket.");
+	}
+}
+
+bool WebServerService::listenWithTuning(Socket& listenerSocket, bool secure)
+{
+	return listenerSocket.listen(m_configuration.getListenerTuning(secure).backlog);
+}
+
+void WebServerService::recordListenerTuning(const Socket& listenerSocket, const char* name, bool secure)
+{
+	ServerStatistics::ListenerInfo info;
+	info.name = name;
+	// Note: the kernel silently caps this to net.core.somaxconn
+	info.backlog = m_configuration.getListenerTuning(secure).backlog;
+#ifdef TCP_DEFER_ACCEPT
+	info.deferAcceptTimeout = listenerSocket.getIntOption(IPPROTO_TCP, TCP_DEFER_ACCEPT);
+#endif
+	info.noDelay = listenerSocket.getIntOption(IPPROTO_TCP, TCP_NODELAY);
+#ifdef TCP_NOTSENT_LOWAT
+	info.notSentLowat = listenerSocket.getIntOption(IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+#endif
+	info.sendBufferSize = listenerSocket.getIntOption(SOL_SOCKET, SO_SNDBUF);
+	info.recvBufferSize = listenerSocket.getIntOption(SOL_SOCKET, SO_RCVBUF);
+	
+	m_serverStatistics.aListeners.emplace_back(info);
+}
+
 void WebServerService::start()
 {
 	if (!m_pRequestHandler)
@@ -217,27 +573,31 @@ void WebServerService::start()
 	// TODO: also, the returns here for the #else for not compiled in support should really be done in
 	//       bindSocketsAndPrepare() with return falses...
 
-	if (m_configuration.isHTTPv4Enabled())
+	if (m_configuration.isHTTPv4Enabled() && !m_usePerWorkerListeners)
 	{
-		if (!m_mainSocketV4HTTP.listen(50))
+		if (!listenWithTuning(m_mainSocketV4HTTP, false))
 		{
 			m_logger.critical("Could not listen on HTTP socket.");
 			return;
 		}
 		
+		recordListenerTuning(m_mainSocketV4HTTP, "HTTP", false);
+		
 		unsigned int portNumberHTTP = m_configuration.getHTTPv4PortNumber();
 		m_logger.notice("Server listening on port: %u for HTTP", portNumberHTTP);
 	}
 	
-	if (m_configuration.isHTTPSv4Enabled())
+	if (m_configuration.isHTTPSv4Enabled() && !m_usePerWorkerListeners)
 	{
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
-		if (!m_mainSocketV4HTTPS.listen(50))
+		if (!listenWithTuning(m_mainSocketV4HTTPS, true))
 		{
 			m_logger.critical("Could not listen on HTTPS socket.");
 			return;
 		}
 		
+		recordListenerTuning(m_mainSocketV4HTTPS, "HTTPS", true);
+		
 		unsigned int portNumberHTTPS = m_configuration.getHTTPSv4PortNumber();
 		m_logger.notice("Server listening on port: %u for HTTPS", portNumberHTTPS);
 #else
@@ -245,14 +605,16 @@ void WebServerService::start()
 #endif
 	}
 
-	if (m_configuration.isHTTPv6Enabled())
+	if (m_configuration.isHTTPv6Enabled() && !m_usePerWorkerListeners)
 	{
 #if WEBSERVE_ENABLE_IPV6_SUPPORT
-		if (!m_mainSocketV6HTTP.listen(50))
+		if (!listenWithTuning(m_mainSocketV6HTTP, false))
 		{
 			m_logger.critical("Could not listen on HTTPv6 socket.");
 			return;
 		}
+		
+		recordListenerTuning(m_mainSocketV6HTTP, "HTTPv6", false);
 
 		unsigned int portNumberHTTP = m_configuration.getHTTPv6PortNumber();
 		m_logger.notice("Server listening on port: %u for HTTPv6", portNumberHTTP);
@@ -262,16 +624,18 @@ void WebServerService::start()
 #endif
 	}
 	
-	if (m_configuration.isHTTPSv6Enabled())
+	if (m_configuration.isHTTPSv6Enabled() && !m_usePerWorkerListeners)
 	{
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
 #if WEBSERVE_ENABLE_IPV6_SUPPORT
-		if (!m_mainSocketV6HTTPS.listen(50))
+		if (!listenWithTuning(m_mainSocketV6HTTPS, true))
 		{
 			m_logger.critical("Could not listen on HTTPSv6 socket.");
 			return;
 		}
 		
+		recordListenerTuning(m_mainSocketV6HTTPS, "HTTPSv6", true);
+		
 		unsigned int portNumberHTTPS = m_configuration.getHTTPSv6PortNumber();
 		m_logger.notice("Server listening on port: %u for HTTPSv6", portNumberHTTPS);
 #else
@@ -284,292 +648,1365 @@ void WebServerService::start()
 #endif
 	}
 
-	m_active = true;
-
-	if (m_configuration.isHTTPv4Enabled())
+	if (m_usePerWorkerListeners)
 	{
-		m_acceptHTTPV4ConnectionThread = std::thread(&WebServerService::acceptConnectionThreadFunction, this, &m_mainSocketV4HTTP, false);
+		for (std::vector<ListenerSocket>& aListeners : m_aWorkerListenerSockets)
+		{
+			for (ListenerSocket& listener : aListeners)
+			{
+				if (!listenWithTuning(*listener.pSocket, listener.secure))
+				{
+					m_logger.critical("Could not listen on per-worker listener socket.");
+					return;
+				}
+			}
+		}
+		
+		// they're all tuned the same way, so just record the first worker's ones
+		if (!m_aWorkerListenerSockets.empty())
+		{
+			for (ListenerSocket& listener : m_aWorkerListenerSockets[0])
+			{
+				recordListenerTuning(*listener.pSocket, listener.secure ? "HTTPS (per-worker)" : "HTTP (per-worker)", listener.secure);
+			}
+		}
+		
+		m_logger.notice("Server listening with per-worker SO_REUSEPORT listeners.");
 	}
 	
-#if WEBSERVE_ENABLE_HTTPS_SUPPORT
-	if (m_configuration.isHTTPSv4Enabled())
+	if (m_pListenerHandoff)
 	{
-		m_acceptHTTPSV4ConnectionThread = std::thread(&WebServerService::acceptConnectionThreadFunction, this, &m_mainSocketV4HTTPS, true);
+		// the listening sockets can be shared with another process during upgrades, so the accept threads
+		// poll() them, and can't rely on them still having a connection to accept afterwards, as the other
+		// process may have taken it.
+		for (ListenerHandoff::Listener& listener : getHandoffListeners())
+		{
+			getMainSocketForListenerType(listener.type)->setNonBlocking(true);
+		}
 	}
-#endif
 
-#if WEBSERVE_ENABLE_IPV6_SUPPORT
-	if (m_configuration.isHTTPv6Enabled())
+	if (m_configuration.getConnectionEngineType() == Configuration::eConnectionEngineEPoll)
 	{
-		m_acceptHTTPV6ConnectionThread = std::thread(&WebServerService::acceptConnectionThreadFunction, this, &m_mainSocketV6HTTP, false);
+		m_pEventPoller = new ConnectionEventPoller(m_logger);
+		if (!m_pEventPoller->initialise())
+		{
+			m_logger.warning("Could not initialise event connection engine, falling back to thread pool engine.");
+			delete m_pEventPoller;
+			m_pEventPoller = nullptr;
+		}
+		else
+		{
+			m_pEventPoller->start();
+			m_logger.notice("Using event connection engine.");
+		}
 	}
+	
+	if (m_configuration.getCoroutineHandlers())
+	{
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+		if (m_pEventPoller)
+		{
+			m_pCoroutineReactor = new CoroutineReactor(m_logger);
+			if (!m_pCoroutineReactor->initialise())
+			{
+				m_logger.warning("Could not initialise coroutine reactor. Request handlers will be run synchronously.");
+				delete m_pCoroutineReactor;
+				m_pCoroutineReactor = nullptr;
+			}
+			else
+			{
+				// resume coroutines on the worker threads, rather than the reactor's threads
+				ConnectionEventPoller* pEventPoller = m_pEventPoller;
+				m_pCoroutineReactor->setResumeHandler([pEventPoller](std::coroutine_handle<> handle)
+				{
+					pEventPoller->addReadyTask(resumeCoroutineTask, handle.address());
+				});
+				
+				m_pCoroutineReactor->start(m_configuration.getCoroutineBlockingThreads());
+				m_logger.notice("Using coroutine request handlers.");
+			}
+		}
+		else
+		{
+			m_logger.warning("coroutineHandlers is only supported with the epoll connection engine. Option will be ignored.");
+		}
+#else
+		m_logger.warning("Coroutine handler support is not compiled in. Option will be ignored.");
 #endif
+	}
+
+	// the elastic worker pool is only supported with the accept thread / pending connection queue approach currently,
+	// as the other approaches have state tied to each worker thread which needs to exist for the lifetime of the service.
+	m_elasticWorkerPool = !m_pEventPoller && !m_usePerWorkerListeners &&
+							m_configuration.getMaxWorkerThreads() > m_configuration.getMinWorkerThreads();
 	
-#if WEBSERVE_ENABLE_HTTPS_SUPPORT
-#if WEBSERVE_ENABLE_IPV6_SUPPORT
-	if (m_configuration.isHTTPSv6Enabled())
+	if (m_usePerWorkerListeners && m_configuration.getMaxWorkerThreads() > m_configuration.getMinWorkerThreads())
 	{
-		m_acceptHTTPSV6ConnectionThread = std::thread(&WebServerService::acceptConnectionThreadFunction, this, &m_mainSocketV6HTTPS, true);
+		m_logger.warning("The elastic worker pool is not supported with perWorkerListeners. workerThreads will be used instead.");
 	}
-#endif
-#endif
+	
+	unsigned int numWorkerSlots = m_elasticWorkerPool ? m_configuration.getMaxWorkerThreads() : m_configuration.getNumWorkerThreads();
+	unsigned int numInitialWorkers = m_elasticWorkerPool ? m_configuration.getMinWorkerThreads() : m_configuration.getNumWorkerThreads();
 
-	for (unsigned int i = 0; i < m_configuration.getNumWorkerThreads(); i++)
+	// allocate all the slots up-front, so that pointers to them remain valid as threads come and go
+	for (unsigned int i = 0; i < numWorkerSlots; i++)
 	{
 		m_aThreadConfigs.emplace_back(WebServerThreadConfig(i, &m_configuration, &m_logger));
+		m_aThreadConfigs.back().pServerStatistics = &m_serverStatistics;
+		m_aThreadConfigs.back().pCoroutineReactor = m_pCoroutineReactor;
 	}
 	
-#if WEBSERVE_ENABLE_HTTPS_SUPPORT
-	// assumption here is only the secure socket layer will need this, which might need to be revisited...
-	bool createSocketLayerPerThreadContexts = m_pSecureSocketLayer && m_pSecureSocketLayer->supportsPerThreadContext();
-#else
-	bool createSocketLayerPerThreadContext = false;
-#endif
-
-	for (unsigned int i = 0; i < m_configuration.getNumWorkerThreads(); i++)
+	configureThreadPlacement();
+	
+	if (m_usePerWorkerListeners)
 	{
-		WebServerThreadConfig* pThreadConfig = &m_aThreadConfigs[i];
-		
-#if WEBSERVE_ENABLE_HTTPS_SUPPORT
-		if (createSocketLayerPerThreadContexts)
+		// so the kernel prefers giving each worker's listeners connections which arrived on that worker's CPU
+		for (const WebServerThreadConfig& threadConfig : m_aThreadConfigs)
 		{
-			// TODO: these leak...
-			SocketLayerThreadContext* pNewThreadContext = m_pSecureSocketLayer->allocatePerThreadContext();
-			if (pNewThreadContext)
+			if (threadConfig.primaryCPU == -1 || threadConfig.threadID >= m_aWorkerListenerSockets.size())
+				continue;
+			
+			for (ListenerSocket& listener : m_aWorkerListenerSockets[threadConfig.threadID])
 			{
-				pThreadConfig->pSLThreadContext = pNewThreadContext;
+				listener.pSocket->setIncomingCPU(threadConfig.primaryCPU);
 			}
 		}
-#endif
-		
-		std::thread newThread = std::thread(&WebServerService::workerThreadFunction, this, pThreadConfig);
-		m_aWorkerThreads.emplace_back(std::move(newThread));
 	}
-	
-	m_logger.notice("%zu worker threads started.", m_aWorkerThreads.size());
 
-	for (std::thread& workerThread : m_aWorkerThreads)
+	if (!m_pEventPoller && !m_usePerWorkerListeners)
 	{
-		workerThread.join();
+		// the shared pending connection queues and worker parking slots used by the accept threads,
+		// with a queue per placement (NUMA node) group
+		for (unsigned int i = 0; i < m_numPlacementGroups; i++)
+		{
+			m_aPendingConnectionQueues.emplace_back(new BoundedMPMCQueue<RequestConnection*>(m_configuration.getPendingConnectionQueueSize()));
+			// this only ever needs to hold each worker once, as workers only add themselves if they're not already in it
+			m_aIdleWorkerQueues.emplace_back(new BoundedMPMCQueue<unsigned int>(numWorkerSlots));
+		}
+		
+		for (unsigned int i = 0; i < numWorkerSlots; i++)
+		{
+			m_aWorkerParkers.emplace_back(new ThreadParker());
+		}
 	}
 
-	if (m_configuration.isHTTPv4Enabled())
+	m_active = true;
+
+	if (m_configuration.isHTTPv4Enabled() && !m_usePerWorkerListeners)
 	{
-		m_acceptHTTPV4ConnectionThread.join();
+		m_acceptHTTPV4ConnectionThread = std::thread(&WebServerService::acceptConnectionThreadFunction, this, &m_mainSocketV4HTTP, false);
 	}
-
+	
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
-	if (m_configuration.isHTTPSv4Enabled())
+	if (m_configuration.isHTTPSv4Enabled() && !m_usePerWorkerListeners)
 	{
-		m_acceptHTTPSV4ConnectionThread.join();
+		m_acceptHTTPSV4ConnectionThread = std::thread(&WebServerService::acceptConnectionThreadFunction, this, &m_mainSocketV4HTTPS, true);
 	}
 #endif
 
 #if WEBSERVE_ENABLE_IPV6_SUPPORT
-	if (m_configuration.isHTTPv6Enabled())
+	if (m_configuration.isHTTPv6Enabled() && !m_usePerWorkerListeners)
 	{
-		m_acceptHTTPV6ConnectionThread.join();
+		m_acceptHTTPV6ConnectionThread = std::thread(&WebServerService::acceptConnectionThreadFunction, this, &m_mainSocketV6HTTP, false);
 	}
 #endif
 	
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
 #if WEBSERVE_ENABLE_IPV6_SUPPORT
-	if (m_configuration.isHTTPSv6Enabled())
+	if (m_configuration.isHTTPSv6Enabled() && !m_usePerWorkerListeners)
 	{
-		m_acceptHTTPSV6ConnectionThread.join();
+		m_acceptHTTPSV6ConnectionThread = std::thread(&WebServerService::acceptConnectionThreadFunction, this, &m_mainSocketV6HTTPS, true);
 	}
-#endif	
 #endif
-}
+#endif
 
-void WebServerService::stop()
-{
-	m_active = false;
+	m_aWorkerThreads.resize(numWorkerSlots);
+	m_aWorkerSlotStates = std::vector<std::atomic<int> >(numWorkerSlots);
+	for (std::atomic<int>& slotState : m_aWorkerSlotStates)
+	{
+		slotState = eWorkerSlotUnused;
+	}
 	
-	m_logger.notice("Stopping web service.");
+	m_numActiveWorkers = numInitialWorkers;
+	for (unsigned int i = 0; i < numInitialWorkers; i++)
+	{
+		startWorkerThread(i);
+	}
 	
-	if (m_configuration.isHTTPv4Enabled())
+	m_logger.notice("%u worker threads started.", numInitialWorkers);
+	
+	if (m_pListenerHandoff)
 	{
-		m_mainSocketV4HTTP.close();
+		// we're now ready to serve requests, so if we took over from an existing process, let it know so it can drain
+		// and exit, and then take over listening for the next upgrade ourselves.
+		m_pListenerHandoff->notifyReady();
+		if (!m_pListenerHandoff->startListening(getHandoffListeners(), std::bind(&WebServerService::drainForUpgrade, this)))
+		{
+			m_logger.error("Could not listen on upgrade socket. Upgrade handoff will not be possible.");
+		}
 	}
 	
+	if (m_elasticWorkerPool)
+	{
+		m_logger.notice("Elastic worker pool enabled, with between %u and %u worker threads.", m_configuration.getMinWorkerThreads(),
+						m_configuration.getMaxWorkerThreads());
+		
+		// this blocks until we're stopped
+		manageElasticWorkerPool();
+	}
+
+	for (unsigned int i = 0; i < numWorkerSlots; i++)
+	{
+		if (m_aWorkerThreads[i].joinable())
+		{
+			m_aWorkerThreads[i].join();
+		}
+		
+		freeWorkerThreadContexts(&m_aThreadConfigs[i]);
+	}
+
+	if (m_configuration.isHTTPv4Enabled() && !m_usePerWorkerListeners)
+	{
+		m_acceptHTTPV4ConnectionThread.join();
+	}
+
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
-	if (m_configuration.isHTTPSv4Enabled())
+	if (m_configuration.isHTTPSv4Enabled() && !m_usePerWorkerListeners)
 	{
-		m_mainSocketV4HTTPS.close();
+		m_acceptHTTPSV4ConnectionThread.join();
 	}
 #endif
 
 #if WEBSERVE_ENABLE_IPV6_SUPPORT
-	if (m_configuration.isHTTPv6Enabled())
+	if (m_configuration.isHTTPv6Enabled() && !m_usePerWorkerListeners)
 	{
-		m_mainSocketV6HTTP.close();
+		m_acceptHTTPV6ConnectionThread.join();
 	}
 #endif
 	
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
 #if WEBSERVE_ENABLE_IPV6_SUPPORT
-	if (m_configuration.isHTTPSv6Enabled())
+	if (m_configuration.isHTTPSv6Enabled() && !m_usePerWorkerListeners)
 	{
-		m_mainSocketV6HTTPS.close();
+		m_acceptHTTPSV6ConnectionThread.join();
 	}
+#endif	
 #endif
-#endif
+	
+	if (m_pListenerHandoff)
 	{
-		
-#if USE_ADDITIONAL_ATOMIC_CONDITION_VARIABLE
-		m_haveNewConnection = true;
-#endif
-		std::unique_lock<std::mutex> lock(m_lock);
-
-		m_newConnectionEvent.notify_all();
+		m_pListenerHandoff->stop();
 	}
 }
 
-void WebServerService::workerThreadFunction(WebServerThreadConfig* pThreadConfig)
+void WebServerService::startWorkerThread(unsigned int slotIndex)
 {
-	while (m_active)
-	{
-		RequestConnection connection;
+	WebServerThreadConfig* pThreadConfig = &m_aThreadConfigs[slotIndex];
+	
+	m_aWorkerSlotStates[slotIndex] = eWorkerSlotRunning;
+	
+	m_aWorkerThreads[slotIndex] = std::thread(&WebServerService::workerThreadEntryFunction, this, pThreadConfig);
+}
 
+void WebServerService::workerThreadEntryFunction(WebServerThreadConfig* pThreadConfig)
+{
+	// pin the thread first (if configured), so that the per-thread state allocated below ends up
+	// on the thread's local NUMA node due to first-touch allocation.
+	if (!pThreadConfig->aCPUAffinity.empty())
+	{
+		if (!System::setCurrentThreadCPUAffinity(pThreadConfig->aCPUAffinity))
 		{
-			std::unique_lock<std::mutex> lock(m_lock);
-
-			if (!m_active)
-				break;
+			m_logger.warning("Could not set CPU affinity for worker thread %u.", pThreadConfig->threadID);
+		}
+	}
+	
+	allocateWorkerThreadContexts(pThreadConfig);
+	
+	if (m_pEventPoller)
+	{
+		eventWorkerThreadFunction(pThreadConfig);
+	}
+	else if (m_usePerWorkerListeners)
+	{
+		listenerWorkerThreadFunction(pThreadConfig);
+	}
+	else
+	{
+		workerThreadFunction(pThreadConfig);
+	}
+}
 
-			if (m_aPendingConnections.empty())
+void WebServerService::configureThreadPlacement()
+{
+	std::vector<unsigned int> aWorkerCPUs;
+	if (!m_configuration.getWorkerThreadCPUs().empty())
+	{
+		if (!System::parseCPUList(m_configuration.getWorkerThreadCPUs(), aWorkerCPUs))
+		{
+			m_logger.warning("Invalid workerThreadCPUs value: '%s'. Worker threads will not be pinned.", m_configuration.getWorkerThreadCPUs().c_str());
+		}
+	}
+	
+	if (!m_configuration.getAcceptThreadCPUs().empty())
+	{
+		if (!System::parseCPUList(m_configuration.getAcceptThreadCPUs(), m_aAcceptThreadCPUs))
+		{
+			m_logger.warning("Invalid acceptThreadCPUs value: '%s'. Accept threads will not be pinned.", m_configuration.getAcceptThreadCPUs().c_str());
+		}
+	}
+	
+	unsigned int numNodeGroups = 0;
+	
+	if (m_configuration.getNUMAAwarePlacement())
+	{
+		if (System::getCPUNUMANodes(m_aCPUNUMANodes))
+		{
+			if (aWorkerCPUs.empty())
 			{
-#if USE_ADDITIONAL_ATOMIC_CONDITION_VARIABLE
-				m_haveNewConnection = false;
-#endif
-				// there's nothing currently in the queue for us to take, so wait for an event...
-
-//				fprintf(stderr, "Waiting for event...\n");
-
-#if USE_ADDITIONAL_ATOMIC_CONDITION_VARIABLE
-				m_newConnectionEvent.wait(lock, [this]{ return m_haveNewConnection.load(); });
-#else
-				m_newConnectionEvent.wait(lock);
-#endif
-
-//				fprintf(stderr, "Event received...\n");
+				// use all the CPUs we know about
+				for (unsigned int cpu = 0; cpu < m_aCPUNUMANodes.size(); cpu++)
+				{
+					if (m_aCPUNUMANodes[cpu] != -1)
+					{
+						aWorkerCPUs.emplace_back(cpu);
+					}
+				}
 			}
-
-			if (!m_active)
-				break;
-
-			if (m_aPendingConnections.empty())
+			
+			// map the nodes the worker CPUs are on to contiguous group indices
+			for (unsigned int cpu : aWorkerCPUs)
 			{
-				// we shouldn't get here, but we do, a spurious wake-up??...
-//				fprintf(stderr, "Error...\n");
-				continue;
+				int node = (cpu < m_aCPUNUMANodes.size()) ? m_aCPUNUMANodes[cpu] : -1;
+				if (node == -1)
+					continue;
+				
+				if ((size_t)node >= m_aNUMANodePlacementGroups.size())
+				{
+					m_aNUMANodePlacementGroups.resize(node + 1, -1);
+				}
+				
+				if (m_aNUMANodePlacementGroups[node] == -1)
+				{
+					m_aNUMANodePlacementGroups[node] = (int)numNodeGroups++;
+				}
 			}
-
-			connection = std::move(m_aPendingConnections.front());
-			m_aPendingConnections.pop();
+			
+			m_logger.notice("NUMA-aware placement enabled, with %u NUMA node groups.", numNodeGroups);
+		}
+		else
+		{
+			m_logger.warning("NUMA topology information is not available. NUMA-aware placement will be disabled.");
+		}
+	}
+	
+	m_numPlacementGroups = (numNodeGroups > 1) ? numNodeGroups : 1;
+	
+	if (aWorkerCPUs.empty())
+		return;
+	
+	for (WebServerThreadConfig& threadConfig : m_aThreadConfigs)
+	{
+		unsigned int primaryCPU = aWorkerCPUs[threadConfig.threadID % aWorkerCPUs.size()];
+		threadConfig.primaryCPU = (int)primaryCPU;
+		
+		int node = getNUMANodeForCPU(primaryCPU);
+		if (m_numPlacementGroups > 1 && node != -1)
+		{
+			// pin to all the worker CPUs on the same node, so the scheduler can still balance within the node
+			threadConfig.placementGroup = m_aNUMANodePlacementGroups[node];
+			for (unsigned int cpu : aWorkerCPUs)
+			{
+				if (getNUMANodeForCPU(cpu) == node)
+				{
+					threadConfig.aCPUAffinity.emplace_back(cpu);
+				}
+			}
+		}
+		else
+		{
+			threadConfig.aCPUAffinity = aWorkerCPUs;
 		}
+	}
+}
 
-		m_logger.debug("Handling new connection.");
+int WebServerService::getNUMANodeForCPU(int cpu) const
+{
+	if (cpu < 0 || (size_t)cpu >= m_aCPUNUMANodes.size())
+		return -1;
+	
+	return m_aCPUNUMANodes[cpu];
+}
 
-		connection.pThreadConfig = pThreadConfig;
+unsigned int WebServerService::getPlacementGroupForConnection(const RequestConnection& connection) const
+{
+	if (m_numPlacementGroups <= 1)
+		return 0;
+	
+	// the CPU which handled the NIC queue for the connection
+	int node = getNUMANodeForCPU(connection.pRawSocket->getIncomingCPU());
+	if (node == -1 || (size_t)node >= m_aNUMANodePlacementGroups.size() || m_aNUMANodePlacementGroups[node] == -1)
+		return 0;
+	
+	return m_aNUMANodePlacementGroups[node];
+}
 
-		handleConnection(connection);
+bool WebServerService::popPendingConnection(unsigned int preferredGroup, RequestConnection*& pConnection)
+{
+	if (m_aPendingConnectionQueues[preferredGroup]->tryPop(pConnection))
+		return true;
+	
+	// otherwise, steal from any other groups
+	for (unsigned int i = 1; i < m_numPlacementGroups; i++)
+	{
+		unsigned int groupIndex = (preferredGroup + i) % m_numPlacementGroups;
+		if (m_aPendingConnectionQueues[groupIndex]->tryPop(pConnection))
+			return true;
 	}
+	
+	return false;
 }
 
-void WebServerService::acceptConnectionThreadFunction(Socket* bindSocket, bool secureType)
+size_t WebServerService::getNumPendingConnections() const
 {
-	while (m_active)
+	size_t total = 0;
+	for (const BoundedMPMCQueue<RequestConnection*>* pPendingConnections : m_aPendingConnectionQueues)
 	{
-		RequestConnection newConnection(new Socket(), nullptr);
-		newConnection.https = secureType;
-
-		if (bindSocket->accept(newConnection.pRawSocket))
-		{
-			newConnection.pRawSocket->setLogger(&m_logger);
-
-			{
-				std::unique_lock<std::mutex> lock(m_lock);
-
-				bool wasEmpty = m_aPendingConnections.empty();
-
-				m_aPendingConnections.emplace(newConnection);
-//			}
+		total += pPendingConnections->getApproxSize();
+	}
+	
+	return total;
+}
 
-				// TODO: is this a good idea?
-				if (wasEmpty)
-				{
-#if USE_ADDITIONAL_ATOMIC_CONDITION_VARIABLE
-					m_haveNewConnection = true;
+void WebServerService::allocateWorkerThreadContexts(WebServerThreadConfig* pThreadConfig)
+{
+	// Note: with the event engine, connections can be handled by different threads for each request,
+	//       so we can't use cached per-thread state for them.
+	if (m_pEventPoller)
+		return;
+	
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT
+	if (m_pSecureSocketLayer && m_pSecureSocketLayer->supportsPerThreadContext())
+	{
+		pThreadConfig->pSLThreadContext = m_pSecureSocketLayer->allocatePerThreadContext();
+	}
 #endif
+	
+	if (m_pNonSecureSocketLayer->supportsPerThreadContext())
+	{
+		// if this fails, that thread will just fall back to using plain sockets
+		pThreadConfig->pNonSecureSLThreadContext = m_pNonSecureSocketLayer->allocatePerThreadContext();
+	}
+}
 
-//					fprintf(stderr, "Notifying pool...\n");
-
-					// Note: ideally, we should be able to use notify_one() here...
-//					m_newConnectionEvent.notify_one();
+void WebServerService::freeWorkerThreadContexts(WebServerThreadConfig* pThreadConfig)
+{
+	if (pThreadConfig->pSLThreadContext)
+	{
+		delete pThreadConfig->pSLThreadContext;
+		pThreadConfig->pSLThreadContext = nullptr;
+	}
+	
+	if (pThreadConfig->pNonSecureSLThreadContext)
+	{
+		delete pThreadConfig->pNonSecureSLThreadContext;
+		pThreadConfig->pNonSecureSLThreadContext = nullptr;
+	}
+}
 
-					// however, in practice, with keep-alive (pipelined requests) enabled,
-					// we seem to end up with threads waiting on the condition, but with m_aPendingConnections
-					// having multiple items in it ready to be consumed. using notify_all() appears to stop this
-					// happening. It's possible this is due to the if (wasEmpty) condition above or some other
-					// issue with the logic / condition_variable...
-					m_newConnectionEvent.notify_all();
-				}
+void WebServerService::manageElasticWorkerPool()
+{
+	const unsigned int maxWorkers = m_configuration.getMaxWorkerThreads();
+	const int64_t growQueueWaitMS = m_configuration.getWorkerThreadGrowQueueWaitMS();
+	
+	while (m_active)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(kElasticPoolManageIntervalMS));
+		
+		if (!m_active)
+			break;
+		
+		// clean up any threads which have retired themselves
+		for (unsigned int i = 0; i < m_aWorkerSlotStates.size(); i++)
+		{
+			if (m_aWorkerSlotStates[i] == eWorkerSlotRetired)
+			{
+				m_aWorkerThreads[i].join();
+				freeWorkerThreadContexts(&m_aThreadConfigs[i]);
+				m_aWorkerSlotStates[i] = eWorkerSlotUnused;
+				
+				m_logger.info("Worker thread %u retired due to being idle. %u worker threads active.", i, m_numActiveWorkers.load());
 			}
 		}
-		else
+		
+		// see if we need to grow the pool: either a worker saw a connection which waited too long, or we can
+		// see connections are waiting with all workers busy, and none have been taken from the queue for a while
+		// (i.e. they're all tied up with slow requests).
+		bool shouldGrow = m_workerPoolGrowthRequested.exchange(false);
+		if (!shouldGrow && getNumPendingConnections() > 0 && m_numBusyWorkers >= m_numActiveWorkers)
+		{
+			int64_t timeSinceLastDequeueMS = getSteadyTimeMS() - m_lastDequeueTimeMS;
+			shouldGrow = timeSinceLastDequeueMS > growQueueWaitMS;
+		}
+		
+		if (!shouldGrow || m_numActiveWorkers >= maxWorkers)
+			continue;
+		
+		for (unsigned int i = 0; i < m_aWorkerSlotStates.size(); i++)
 		{
-			if (m_active)
+			if (m_aWorkerSlotStates[i] == eWorkerSlotUnused)
 			{
-				// only log this if we're still active, otherwise we print this when stopping the service...
-				m_logger.error("Can't accept connection.");
+				m_numActiveWorkers += 1;
+				startWorkerThread(i);
+				
+				m_logger.info("Added worker thread %u due to demand. %u worker threads active.", i, m_numActiveWorkers.load());
+				break;
 			}
 		}
 	}
 }
 
-void WebServerService::handleConnection(RequestConnection& connection)
+bool WebServerService::tryRetireWorkerThread()
 {
-	connection.ipInfo.initInfo(connection.pRawSocket);
+	unsigned int currentCount = m_numActiveWorkers.load();
+	const unsigned int minWorkers = m_configuration.getMinWorkerThreads();
 	
-	if (connection.https && m_pSecureSocketLayer)
+	while (currentCount > minWorkers)
 	{
-		m_logger.debug("Client HTTPS connection accept()ed from IP: %s", connection.ipInfo.getIPAddress().c_str());
-		
-		connection.connStatistics.httpsConnections += 1;
-		
-		ReturnCodeType retCode = m_pSecureSocketLayer->allocateSpecialisedConnectionSocket(connection);
-		if (retCode == eReturnFail)
-		{
-			connection.closeConnectionAndFreeSockets();
-			m_logger.error("Error allocating specialised connection socket for HTTPS connection.");
-			return;
-		}
-		else if (retCode == eReturnFailSilent)
+		if (m_numActiveWorkers.compare_exchange_weak(currentCount, currentCount - 1))
+			return true;
+	}
+	
+	return false;
+}
+
+int64_t WebServerService::getSteadyTimeMS()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void WebServerService::stop()
+{
+	m_active = false;
+	
+	m_logger.notice("Stopping web service.");
+	
+	if (m_listenersHandedOver)
+	{
+		// the new process is still using the listening sockets, so we can't shut them down
+		for (ListenerHandoff::Listener& listener : getHandoffListeners())
 		{
-			// return, but don't log anything
-			connection.closeConnectionAndFreeSockets();
-			m_logger.debug("Fail silent when allocating S2N connection for IP: %s", connection.ipInfo.getIPAddress().c_str());
-			return;
+			getMainSocketForListenerType(listener.type)->closeWithoutShutdown();
 		}
 	}
-	else
+	
+	if (m_configuration.isHTTPv4Enabled())
 	{
-		m_logger.debug("Client HTTP connection accept()ed from IP: %s", connection.ipInfo.getIPAddress().c_str());
-		
-		connection.connStatistics.httpConnections += 1;
-		
-		// this can't really fail (although the allocation of the socket could in theory, but...)
-		m_pNonSecureSocketLayer->allocateSpecialisedConnectionSocket(connection);
+		m_mainSocketV4HTTP.close();
 	}
 	
-	// check we've allocated a valid connection socket - if not, error and ignore connection.
-	if (!connection.pConnectionSocket)
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT
+	if (m_configuration.isHTTPSv4Enabled())
 	{
-		m_logger.error("Could not allocate connection socket for connection. Ignoring request.");
-		return;
+		m_mainSocketV4HTTPS.close();
+	}
+#endif
+
+#if WEBSERVE_ENABLE_IPV6_SUPPORT
+	if (m_configuration.isHTTPv6Enabled())
+	{
+		m_mainSocketV6HTTP.close();
 	}
+#endif
 	
-	m_pRequestHandler->handleRequest(connection);
+#if WEBSERVE_ENABLE_HTTPS_SUPPORT
+#if WEBSERVE_ENABLE_IPV6_SUPPORT
+	if (m_configuration.isHTTPSv6Enabled())
+	{
+		m_mainSocketV6HTTPS.close();
+	}
+#endif
+#endif
+	
+	// wake up any parked worker threads so they notice we've stopped
+	for (ThreadParker* pParker : m_aWorkerParkers)
+	{
+		pParker->unpark();
+	}
+	
+	for (std::vector<ListenerSocket>& aListeners : m_aWorkerListenerSockets)
+	{
+		for (ListenerSocket& listener : aListeners)
+		{
+			listener.pSocket->close();
+		}
+	}
+	
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+	if (m_pCoroutineReactor)
+	{
+		// this resumes any request coroutines still waiting on IO with failures, so they finish (and give their
+		// connections back to the event poller, which then closes them below).
+		m_pCoroutineReactor->stop();
+	}
+#endif
+	
+	if (m_pEventPoller)
+	{
+		// this will wake up any worker threads waiting on it, and close any connections it still has
+		m_pEventPoller->stop();
+	}
+}
+
+void WebServerService::drainForUpgrade()
+{
+	m_logger.notice("New process has taken over the listening sockets. Draining connections before exiting.");
+	
+	m_acceptingConnections = false;
+	m_pRequestHandler->setDraining(true);
+	
+	const int64_t drainEndTimeMS = getSteadyTimeMS() + (int64_t)m_configuration.getUpgradeDrainTimeout() * 1000;
+	
+	while (getSteadyTimeMS() < drainEndTimeMS)
+	{
+		bool haveConnections = false;
+		if (m_pEventPoller)
+		{
+			// connections can be waiting for data, waiting for a worker, being handled by a worker, or
+			// in a coroutine request handler waiting on IO.
+			haveConnections = m_pEventPoller->getNumWatchedConnections() > 0 || m_pEventPoller->getNumReadyConnections() > 0 ||
+								m_numBusyWorkers > 0 || m_numAsyncRequestsInFlight > 0;
+		}
+		else
+		{
+			haveConnections = getNumPendingConnections() > 0 || m_numBusyWorkers > 0;
+		}
+		
+		if (!haveConnections)
+			break;
+		
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	
+	m_listenersHandedOver = true;
+	
+	stop();
+}
+
+void WebServerService::workerThreadFunction(WebServerThreadConfig* pThreadConfig)
+{
+	ThreadParker* pParker = m_aWorkerParkers[pThreadConfig->threadID];
+	const unsigned int placementGroup = pThreadConfig->placementGroup;
+	
+	const int64_t idleRetireTimeMS = (int64_t)m_configuration.getWorkerThreadIdleRetireTime() * 1000;
+	const unsigned int growQueueWaitMS = m_configuration.getWorkerThreadGrowQueueWaitMS();
+	
+	int64_t lastBusyTimeMS = getSteadyTimeMS();
+	
+	while (m_active)
+	{
+		RequestConnection* pConnection = nullptr;
+		
+		if (!popPendingConnection(placementGroup, pConnection))
+		{
+			// there's nothing currently in the queue for us to take, so announce we're idle, and park
+			// until an accept thread wakes us specifically.
+			pParker->setParked(true);
+			
+			// if we've still got an entry in the idle queue from a previous time we parked (i.e. we timed out
+			// without being woken), that one will do, otherwise we'd just keep filling the queue up.
+			bool addedToIdleQueue = true;
+			if (pParker->markInIdleQueue())
+			{
+				addedToIdleQueue = m_aIdleWorkerQueues[placementGroup]->tryPush(pThreadConfig->threadID);
+				if (!addedToIdleQueue)
+				{
+					pParker->clearInIdleQueue();
+				}
+			}
+			
+			// re-check after announcing ourselves, as a connection could have been added just before
+			// we did, in which case the accept thread wouldn't have found us to wake...
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!popPendingConnection(placementGroup, pConnection))
+			{
+				// if we couldn't add ourselves to the idle queue, we'll just have to rely on the timeout
+				bool wasWoken = pParker->park(addedToIdleQueue ? kWorkerParkTimeoutMS : kWorkerParkTimeoutMS / 10);
+				
+				// any index of ours left in the idle queue is now stale until we park again, which the accept
+				// threads will skip over as we're no longer marked as parked.
+				pParker->setParked(false);
+				
+				if (!wasWoken && m_elasticWorkerPool && m_active && (getSteadyTimeMS() - lastBusyTimeMS) > idleRetireTimeMS)
+				{
+					// we've been idle for long enough that we can exit if there are more than the minimum
+					// number of workers. Checking the queue is still empty after clearing our parked state
+					// means we can't have been given a wake-up for a connection we'd then not handle.
+					if (getNumPendingConnections() == 0 && tryRetireWorkerThread())
+					{
+						m_aWorkerSlotStates[pThreadConfig->threadID] = eWorkerSlotRetired;
+						return;
+					}
+				}
+				continue;
+			}
+			
+			pParker->setParked(false);
+		}
+		
+		m_numBusyWorkers += 1;
+
+		pConnection->pThreadConfig = pThreadConfig;
+		
+		lastBusyTimeMS = getSteadyTimeMS();
+		m_lastDequeueTimeMS = lastBusyTimeMS;
+		
+		unsigned int queueWaitMS = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - pConnection->enqueueTime).count();
+		m_serverStatistics.recordQueueWait(queueWaitMS);
+		
+		if (m_elasticWorkerPool && queueWaitMS > growQueueWaitMS)
+		{
+			m_workerPoolGrowthRequested = true;
+		}
+		
+		unsigned int maxQueueWaitMS = m_configuration.getOverloadMaxQueueWaitMS();
+		if (maxQueueWaitMS > 0 && queueWaitMS > maxQueueWaitMS)
+		{
+			// it's been waiting too long, so the client's probably not going to be happy anyway,
+			// and we need to catch up, so don't do the full request handling...
+			m_serverStatistics.connectionsShedQueueWait += 1;
+			shedConnection(*pConnection);
+			delete pConnection;
+			m_numBusyWorkers -= 1;
+			continue;
+		}
+
+		m_logger.debug("Handling new connection.");
+
+		handleConnection(*pConnection);
+		
+		delete pConnection;
+		
+		m_numBusyWorkers -= 1;
+		lastBusyTimeMS = getSteadyTimeMS();
+	}
+}
+
+void WebServerService::wakeIdleWorker(unsigned int preferredGroup)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	
+	// try workers in the preferred group first, then any others
+	for (unsigned int i = 0; i < m_numPlacementGroups; i++)
+	{
+		BoundedMPMCQueue<unsigned int>* pIdleWorkers = m_aIdleWorkerQueues[(preferredGroup + i) % m_numPlacementGroups];
+		
+		unsigned int workerIndex = 0;
+		while (pIdleWorkers->tryPop(workerIndex))
+		{
+			// this needs to be cleared before the parked state is checked, so that if the worker has re-parked
+			// relying on the entry we've just taken, we're guaranteed to see that and wake it.
+			m_aWorkerParkers[workerIndex]->clearInIdleQueue();
+			
+			// only wake it if it's actually still parked - otherwise it's a stale entry, so try the next one
+			if (m_aWorkerParkers[workerIndex]->claimUnpark())
+			{
+				m_aWorkerParkers[workerIndex]->unpark();
+				return;
+			}
+		}
+	}
+	
+	// otherwise, all workers are currently busy, and will pick the connection up from the queue
+	// before they next park.
+}
+
+void WebServerService::eventWorkerThreadFunction(WebServerThreadConfig* pThreadConfig)
+{
+	while (m_active)
+	{
+		ConnectionEventPoller::ReadyItem readyItem;
+		if (!m_pEventPoller->getNextReadyItem(readyItem))
+		{
+			// we've been stopped
+			break;
+		}
+		
+		m_numBusyWorkers += 1;
+		
+		if (readyItem.pTaskFunction)
+		{
+			// i.e. a coroutine request handler which can now continue
+			readyItem.pTaskFunction(readyItem.pTaskData);
+		}
+		else
+		{
+			readyItem.pConnection->pThreadConfig = pThreadConfig;
+			
+			if (!readyItem.pConnection->idleTimedOut && shouldShedReadyConnection(*readyItem.pConnection))
+			{
+				m_serverStatistics.connectionsShedQueueWait += 1;
+				shedConnection(*readyItem.pConnection);
+				delete readyItem.pConnection;
+			}
+			else
+			{
+				handleEventConnection(readyItem.pConnection);
+			}
+		}
+		
+		m_numBusyWorkers -= 1;
+	}
+}
+
+bool WebServerService::shouldShedReadyConnection(const RequestConnection& connection)
+{
+	unsigned int queueWaitMS = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - connection.enqueueTime).count();
+	m_serverStatistics.recordQueueWait(queueWaitMS);
+	
+	// as with the thread pool engine, if it's been waiting too long, the client's probably not going to be happy anyway,
+	// and we need to catch up.
+	unsigned int maxQueueWaitMS = m_configuration.getOverloadMaxQueueWaitMS();
+	return maxQueueWaitMS > 0 && queueWaitMS > maxQueueWaitMS;
+}
+
+void WebServerService::listenerWorkerThreadFunction(WebServerThreadConfig* pThreadConfig)
+{
+	const std::vector<ListenerSocket>& aListeners = m_aWorkerListenerSockets[pThreadConfig->threadID];
+	const unsigned int maxConnections = m_configuration.getPerWorkerMaxConnections();
+	
+	// Note: the kernel load-balances new connections between all the SO_REUSEPORT sockets for a port,
+	//       so connections queued on this thread's sockets will only be handled by this thread. To stop
+	//       connections waiting for their next request from delaying the others, we only handle requests
+	//       once they've been completely received, so it's only requests which are slow to handle which
+	//       can hold up the others.
+	// Note: HTTP/2 connections are handled for their whole lifetime once they've been negotiated, as their
+	//       streams are multiplexed, so they do hold up the worker's other connections.
+	std::vector<WorkerConnection> aConnections;
+	std::vector<WorkerConnection> aStillWaitingConnections;
+	std::vector<struct pollfd> aPollFDs;
+	
+	while (m_active)
+	{
+		// once we've got as many connections as we're allowed, any new ones are left in the listening sockets'
+		// backlogs until some of them have been closed.
+		bool acceptingConnections = maxConnections == 0 || aConnections.size() < maxConnections;
+		
+		aPollFDs.resize(aListeners.size() + aConnections.size());
+		for (size_t i = 0; i < aListeners.size(); i++)
+		{
+			// negative fds are ignored by poll()
+			aPollFDs[i].fd = acceptingConnections ? aListeners[i].pSocket->getSocketFD() : -1;
+			aPollFDs[i].events = POLLIN;
+			aPollFDs[i].revents = 0;
+		}
+		
+		std::chrono::steady_clock::time_point timeNow = std::chrono::steady_clock::now();
+		
+		// have a timeout so that we notice m_active being unset, or the next connection to time out
+		int64_t pollTimeoutMS = 1000;
+		for (size_t i = 0; i < aConnections.size(); i++)
+		{
+			struct pollfd& pollFD = aPollFDs[aListeners.size() + i];
+			pollFD.fd = aConnections[i].pConnection->pRawSocket->getSocketFD();
+			pollFD.events = POLLIN;
+			pollFD.revents = 0;
+			
+			int64_t timeoutMS = std::chrono::duration_cast<std::chrono::milliseconds>(aConnections[i].timeoutTime - timeNow).count();
+			pollTimeoutMS = std::max(std::min(pollTimeoutMS, timeoutMS), (int64_t)0);
+		}
+		
+		int pollRet = poll(aPollFDs.data(), aPollFDs.size(), (int)pollTimeoutMS);
+		if (pollRet < 0)
+			continue;
+		
+		timeNow = std::chrono::steady_clock::now();
+		
+		aStillWaitingConnections.clear();
+		
+		for (size_t i = 0; i < aConnections.size(); i++)
+		{
+			WorkerConnection& workerConnection = aConnections[i];
+			RequestConnection& connection = *workerConnection.pConnection;
+			
+			if (aPollFDs[aListeners.size() + i].revents != 0)
+			{
+				unsigned int waitTimeoutSecs = 0;
+				if (handleWorkerConnection(workerConnection.pConnection, waitTimeoutSecs))
+				{
+					workerConnection.timeoutTime = std::chrono::steady_clock::now() + std::chrono::seconds(waitTimeoutSecs);
+					aStillWaitingConnections.emplace_back(workerConnection);
+				}
+			}
+			else if (timeNow >= workerConnection.timeoutTime)
+			{
+				// only bother sending a response if we've already handled a request on this connection,
+				// otherwise it's just a connection which never sent anything...
+				if (connection.keepAliveRequestCount > 0)
+				{
+					m_pRequestHandler->sendKeepAliveTimeoutResponse(connection);
+				}
+				
+				connection.closeConnectionAndFreeSockets();
+				delete workerConnection.pConnection;
+			}
+			else
+			{
+				aStillWaitingConnections.emplace_back(workerConnection);
+			}
+		}
+		
+		aConnections.swap(aStillWaitingConnections);
+		
+		for (size_t i = 0; i < aListeners.size(); i++)
+		{
+			if (!m_active)
+				break;
+			
+			if (!(aPollFDs[i].revents & POLLIN))
+				continue;
+			
+			RequestConnection* pNewConnection = new RequestConnection(new Socket(), pThreadConfig);
+			pNewConnection->https = aListeners[i].secure;
+			
+			if (!aListeners[i].pSocket->accept(pNewConnection->pRawSocket))
+			{
+				if (m_active)
+				{
+					m_logger.error("Can't accept connection.");
+				}
+				
+				delete pNewConnection->pRawSocket;
+				delete pNewConnection;
+				continue;
+			}
+			
+			pNewConnection->pRawSocket->setLogger(&m_logger);
+			
+			m_logger.debug("Handling new connection.");
+			
+			if (!setupConnectionSocket(*pNewConnection))
+			{
+				delete pNewConnection;
+				continue;
+			}
+			
+			if (pNewConnection->http2)
+			{
+				m_numBusyWorkers += 1;
+				m_pRequestHandler->handleRequest(*pNewConnection);
+				m_numBusyWorkers -= 1;
+				
+				delete pNewConnection;
+				continue;
+			}
+			
+			if (!m_pRequestHandler->acceptConnection(*pNewConnection))
+			{
+				delete pNewConnection;
+				continue;
+			}
+			
+			// the request might well have been received already (i.e. with TCP_DEFER_ACCEPT)
+			unsigned int waitTimeoutSecs = 0;
+			if (handleWorkerConnection(pNewConnection, waitTimeoutSecs))
+			{
+				WorkerConnection newWorkerConnection;
+				newWorkerConnection.pConnection = pNewConnection;
+				newWorkerConnection.timeoutTime = std::chrono::steady_clock::now() + std::chrono::seconds(waitTimeoutSecs);
+				aConnections.emplace_back(newWorkerConnection);
+			}
+		}
+	}
+	
+	for (WorkerConnection& workerConnection : aConnections)
+	{
+		workerConnection.pConnection->closeConnectionAndFreeSockets();
+		delete workerConnection.pConnection;
+	}
+}
+
+bool WebServerService::handleWorkerConnection(RequestConnection* pConnection, unsigned int& waitTimeoutSecs)
+{
+	RequestConnection& connection = *pConnection;
+	
+	while (true)
+	{
+		size_t requestLength = 0;
+		
+		// if there's already a complete (pipelined) request buffered from a previous receive, handle that first
+		if (!connection.recvBuffer.findCompleteRequest(requestLength))
+		{
+			SocketRecvReturnCode recvRetCode = connection.pConnectionSocket->recvNonBlocking(connection.recvBuffer);
+			if (recvRetCode.type == eSockRecv_PeerClosed || recvRetCode.type == eSockRecv_Error)
+			{
+				connection.closeConnectionAndFreeSockets();
+				delete pConnection;
+				return false;
+			}
+			
+			if (!connection.recvBuffer.findCompleteRequest(requestLength))
+			{
+				// we haven't got the full request yet, so wait for more
+				waitTimeoutSecs = connection.keepAliveRequestCount == 0 ? 5 : m_configuration.getKeepAliveTimeout();
+				return true;
+			}
+		}
+		
+		m_numBusyWorkers += 1;
+		
+		// Note: this removes the request from the connection's receive buffer once it's been handled.
+		MainRequestHandler::RequestResult result = m_pRequestHandler->handleSingleRequest(connection, requestLength);
+		
+		m_numBusyWorkers -= 1;
+		
+		if (result != MainRequestHandler::eRequestKeepAlive)
+		{
+			connection.closeConnectionAndFreeSockets();
+			delete pConnection;
+			return false;
+		}
+		
+		// poll() won't tell us about a further pipelined request which has already been received, or data the
+		// TLS layer has already read off the socket, so those need handling straight away.
+		if (!connection.recvBuffer.findCompleteRequest(requestLength) && !connection.pConnectionSocket->hasBufferedRecvData())
+		{
+			waitTimeoutSecs = m_configuration.getKeepAliveTimeout();
+			return true;
+		}
+	}
+}
+
+void WebServerService::acceptConnectionThreadFunction(Socket* bindSocket, bool secureType)
+{
+	if (!m_aAcceptThreadCPUs.empty())
+	{
+		if (!System::setCurrentThreadCPUAffinity(m_aAcceptThreadCPUs))
+		{
+			m_logger.warning("Could not set CPU affinity for accept thread.");
+		}
+	}
+	
+	while (m_active && m_acceptingConnections)
+	{
+		if (m_pListenerHandoff && !waitForIncomingConnection(bindSocket))
+		{
+			// nothing to accept yet (or we've been stopped)
+			continue;
+		}
+		
+		RequestConnection* pNewConnection = new RequestConnection(new Socket(), nullptr);
+		pNewConnection->https = secureType;
+
+		if (bindSocket->accept(pNewConnection->pRawSocket))
+		{
+			pNewConnection->pRawSocket->setLogger(&m_logger);
+			
+			dispatchAcceptedConnection(pNewConnection);
+		}
+		else
+		{
+			if (m_active && !acceptWouldHaveBlocked())
+			{
+				// only log this if we're still active, otherwise we print this when stopping the service...
+				m_logger.error("Can't accept connection.");
+			}
+			
+			delete pNewConnection->pRawSocket;
+			delete pNewConnection;
+		}
+	}
+}
+
+void WebServerService::dispatchAcceptedConnection(RequestConnection* pNewConnection)
+{
+	unsigned int maxQueueDepth = m_configuration.getOverloadMaxQueueDepth();
+	
+	if (m_pEventPoller)
+	{
+		// new connections don't wait for a worker until they've received something, so use the number of connections
+		// which have, and are waiting for a worker thread, as the queue depth.
+		if (maxQueueDepth > 0 && m_pEventPoller->getNumReadyConnections() >= maxQueueDepth)
+		{
+			m_serverStatistics.connectionsShedQueueDepth += 1;
+			shedConnection(*pNewConnection);
+			delete pNewConnection;
+			return;
+		}
+		
+		// initial timeout for the first request, matching the thread pool engine's recvSmart() one.
+		if (!m_pEventPoller->addConnection(pNewConnection, 5))
+		{
+			pNewConnection->closeConnectionAndFreeSockets();
+			delete pNewConnection;
+		}
+		return;
+	}
+	
+	if (maxQueueDepth > 0 && getNumPendingConnections() >= maxQueueDepth)
+	{
+		m_serverStatistics.connectionsShedQueueDepth += 1;
+		shedConnection(*pNewConnection);
+		delete pNewConnection;
+		return;
+	}
+	
+	pNewConnection->enqueueTime = std::chrono::steady_clock::now();
+	
+	unsigned int placementGroup = getPlacementGroupForConnection(*pNewConnection);
+
+	if (!m_aPendingConnectionQueues[placementGroup]->tryPush(pNewConnection))
+	{
+		// the queue is full, so we've no choice but to drop it.
+		m_logger.warning("Pending connection queue is full. Dropping connection.");
+		pNewConnection->closeConnectionAndFreeSockets();
+		delete pNewConnection;
+		return;
+	}
+	
+	m_serverStatistics.connectionsQueued += 1;
+	
+	wakeIdleWorker(placementGroup);
+}
+
+bool WebServerService::waitForIncomingConnection(const Socket* pBindSocket)
+{
+	struct pollfd fd;
+	fd.fd = pBindSocket->getSocketFD();
+	fd.events = POLLIN;
+	fd.revents = 0;
+	
+	// have a timeout so that we notice m_active or m_acceptingConnections being unset...
+	int pollRet = poll(&fd, 1, 1000);
+	return pollRet > 0 && (fd.revents & POLLIN);
+}
+
+bool WebServerService::acceptWouldHaveBlocked()
+{
+	// with non-blocking listening sockets shared between processes, another process can take the connection
+	// between us polling and accepting, which isn't an error.
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void WebServerService::shedConnection(RequestConnection& connection)
+{
+	// Note: this is generally done before any connection socket has been allocated (so for HTTPS, before negotiation),
+	//       so we can only send a response on non-secure connections, and doing a full TLS handshake just
+	//       to tell the client we're too busy would be counter-productive anyway...
+	//       With the event engine, it can also be a kept-alive connection which has received its next request, in
+	//       which case we still send the response directly on the raw socket, which for HTTP is the same thing.
+	if (!connection.https && m_configuration.getOverloadShedAction() == Configuration::eOverloadShed503)
+	{
+		WebResponseParams responseParams(m_configuration, false);
+		responseParams.keepAliveEnabled = false;
+		
+		WebResponseGeneratorServiceUnavailable responseGenerator(m_configuration.getOverloadRetryAfter());
+		std::string response = responseGenerator.getResponseString(responseParams);
+		
+		// this can be called on the accept threads, so we can't wait for the client: if it doesn't all fit in the
+		// socket's send buffer straight away, just reset the connection.
+		if (!connection.pRawSocket->sendNonBlocking(response))
+		{
+			connection.pRawSocket->setAbortiveClose();
+		}
+	}
+	else
+	{
+		// don't leave the connection lingering in the kernel (with the client's request unread) after we close it
+		connection.pRawSocket->setAbortiveClose();
+	}
+	
+	connection.closeConnectionAndFreeSockets();
+}
+
+void WebServerService::handleConnection(RequestConnection& connection)
+{
+	if (!setupConnectionSocket(connection))
+		return;
+	
+	m_pRequestHandler->handleRequest(connection);
+}
+
+bool WebServerService::setupConnectionSocket(RequestConnection& connection)
+{
+	connection.ipInfo.initInfo(connection.pRawSocket);
+	
+	connection.recvBuffer.setMaxHeaderSize(m_configuration.getMaxRequestHeaderSize());
+	
+	// so slow clients can't tie up a worker thread indefinitely with a large response
+	connection.pRawSocket->setSendTimeout(m_configuration.getSendTimeout());
+	
+	if (connection.https && m_pSecureSocketLayer)
+	{
+		m_logger.debug("Client HTTPS connection accept()ed from IP: %s", connection.ipInfo.getIPAddress().c_str());
+		
+		connection.connStatistics.httpsConnections += 1;
+		
+		ReturnCodeType retCode = m_pSecureSocketLayer->allocateSpecialisedConnectionSocket(connection);
+		if (retCode == eReturnFail)
+		{
+			connection.closeConnectionAndFreeSockets();
+			m_logger.error("Error allocating specialised connection socket for HTTPS connection.");
+			return false;
+		}
+		else if (retCode == eReturnFailSilent)
+		{
+			// return, but don't log anything
+			connection.closeConnectionAndFreeSockets();
+			m_logger.debug("Fail silent when allocating S2N connection for IP: %s", connection.ipInfo.getIPAddress().c_str());
+			return false;
+		}
+	}
+	else
+	{
+		m_logger.debug("Client HTTP connection accept()ed from IP: %s", connection.ipInfo.getIPAddress().c_str());
+		
+		connection.connStatistics.httpConnections += 1;
+		
+		// this can't really fail (although the allocation of the socket could in theory, but...)
+		m_pNonSecureSocketLayer->allocateSpecialisedConnectionSocket(connection);
+	}
+	
+	// check we've allocated a valid connection socket - if not, error and ignore connection.
+	if (!connection.pConnectionSocket)
+	{
+		m_logger.error("Could not allocate connection socket for connection. Ignoring request.");
+		connection.closeConnectionAndFreeSockets();
+		return false;
+	}
+	
+	return true;
+}
+
+void WebServerService::handleEventConnection(RequestConnection* pConnection)
+{
+	RequestConnection& connection = *pConnection;
+	
+	if (connection.idleTimedOut)
+	{
+		// only bother sending a response if we've already handled a request on this connection,
+		// otherwise it's just a connection which never sent anything...
+		if (connection.pConnectionSocket && connection.keepAliveRequestCount > 0)
+		{
+			m_pRequestHandler->sendKeepAliveTimeoutResponse(connection);
+		}
+		
+		connection.closeConnectionAndFreeSockets();
+		delete pConnection;
+		return;
+	}
+	
+	if (!connection.pConnectionSocket)
+	{
+		// it's a new connection we haven't seen before, so we need to set it up
+		// Note: for HTTPS, this does the TLS negotiation, which blocks.
+		// TODO: it'd be good to make negotiation event-driven as well at some point...
+		if (!setupConnectionSocket(connection))
+		{
+			delete pConnection;
+			return;
+		}
+		
+		if (!m_pRequestHandler->acceptConnection(connection))
+		{
+			delete pConnection;
+			return;
+		}
+	}
+	
+	size_t requestLength = 0;
+	
+	// if there's already a complete (pipelined) request buffered from a previous receive, handle that first
+	if (!connection.recvBuffer.findCompleteRequest(requestLength))
+	{
+		SocketRecvReturnCode recvRetCode = connection.pConnectionSocket->recvNonBlocking(connection.recvBuffer);
+		if (recvRetCode.type == eSockRecv_PeerClosed || recvRetCode.type == eSockRecv_Error)
+		{
+			connection.closeConnectionAndFreeSockets();
+			delete pConnection;
+			return;
+		}
+		
+		if (!connection.recvBuffer.findCompleteRequest(requestLength))
+		{
+			const Configuration& configuration = *connection.pThreadConfig->pConfiguration;
+			
+			unsigned int waitTimeout = connection.keepAliveRequestCount == 0 ? 5 : configuration.getKeepAliveTimeout();
+			
+			// we haven't got the full request yet, so give it back to the poller to wait for more.
+			if (!m_pEventPoller->addConnection(pConnection, waitTimeout))
+			{
+				connection.closeConnectionAndFreeSockets();
+				delete pConnection;
+			}
+			return;
+		}
+	}
+	
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+	if (m_pCoroutineReactor)
+	{
+		handleEventRequestAsync(pConnection, requestLength);
+		return;
+	}
+#endif
+	
+	// Note: this removes the request from the connection's receive buffer once it's been handled.
+	MainRequestHandler::RequestResult result = m_pRequestHandler->handleSingleRequest(connection, requestLength);
+	
+	finishEventRequest(pConnection, result);
+}
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+void WebServerService::resumeCoroutineTask(void* pCoroutineAddress)
+{
+	std::coroutine_handle<>::from_address(pCoroutineAddress).resume();
+}
+
+DetachedTask WebServerService::handleEventRequestAsync(RequestConnection* pConnection, size_t requestLength)
+{
+	m_numAsyncRequestsInFlight += 1;
+	
+	MainRequestHandler::RequestResult result = co_await m_pRequestHandler->handleSingleRequestAsync(*pConnection, requestLength);
+	
+	finishEventRequest(pConnection, result);
+	
+	m_numAsyncRequestsInFlight -= 1;
+}
+#endif
+
+void WebServerService::finishEventRequest(RequestConnection* pConnection, MainRequestHandler::RequestResult result)
+{
+	RequestConnection& connection = *pConnection;
+	
+	if (result != MainRequestHandler::eRequestKeepAlive)
+	{
+		connection.closeConnectionAndFreeSockets();
+		delete pConnection;
+		return;
+	}
+	
+	// Note: anything received after the request (i.e. further pipelined requests) has been kept in the receive buffer
+	const Configuration& configuration = *connection.pThreadConfig->pConfiguration;
+	
+	size_t nextRequestLength = 0;
+	if (connection.recvBuffer.findCompleteRequest(nextRequestLength))
+	{
+		// there's another complete request already, so it can be handled straight away without waiting for epoll,
+		// which wouldn't tell us about it anyway.
+		m_pEventPoller->addReadyConnection(pConnection);
+		return;
+	}
+	
+	if (connection.pConnectionSocket->hasBufferedRecvData())
+	{
+		// the TLS layer has already read data off the socket, so epoll won't necessarily tell us about it...
+		m_pEventPoller->addReadyConnection(pConnection);
+		return;
+	}
+	
+	if (!m_pEventPoller->addConnection(pConnection, configuration.getKeepAliveTimeout()))
+	{
+		connection.closeConnectionAndFreeSockets();
+		delete pConnection;
+	}
 }
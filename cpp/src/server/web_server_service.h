@@ -22,19 +22,24 @@
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <chrono>
 
 #include <vector>
-#include <queue>
 
 #include "utils/socket.h"
 #include "utils/logger.h"
+#include "utils/bounded_mpmc_queue.h"
+#include "utils/thread_parker.h"
 
 #include "configuration.h"
 
 #include "web_server_common.h"
 #include "main_request_handler.h"
+#include "listener_handoff.h"
 
 class SocketLayer;
+class ConnectionEventPoller;
+class CoroutineReactor;
 
 class WebServerService
 {
@@ -69,13 +74,143 @@ protected:
 
 	void workerThreadFunction(WebServerThreadConfig* pThreadConfig);
 
+	void startWorkerThread(unsigned int slotIndex);
+
+	// the actual function worker threads are started with: sets the thread's CPU affinity (if configured) and allocates
+	// its per-thread contexts from within the thread (so memory is local to its NUMA node), before running the
+	// appropriate worker thread function.
+	void workerThreadEntryFunction(WebServerThreadConfig* pThreadConfig);
+
+	// works out the CPU affinity and placement group of each worker thread slot, and the accept thread CPUs.
+	void configureThreadPlacement();
+
+	int getNUMANodeForCPU(int cpu) const;
+
+	// the placement group whose workers should preferably handle the connection, based on which CPU the
+	// connection's packets arrived on.
+	unsigned int getPlacementGroupForConnection(const RequestConnection& connection) const;
+
+	// tries the preferred placement group's pending connections queue first, and then steals from any others.
+	bool popPendingConnection(unsigned int preferredGroup, RequestConnection*& pConnection);
+
+	size_t getNumPendingConnections() const;
+
+	void allocateWorkerThreadContexts(WebServerThreadConfig* pThreadConfig);
+	void freeWorkerThreadContexts(WebServerThreadConfig* pThreadConfig);
+
+	// run from start() for the lifetime of the service if the elastic worker pool is enabled, and
+	// adds worker threads when required, and cleans up any which have retired.
+	void manageElasticWorkerPool();
+
+	// called by an idle worker thread to see if it can exit, which it can if there are more than the minimum
+	bool tryRetireWorkerThread();
+
+	static int64_t getSteadyTimeMS();
+
+	// worker thread function used with the event (epoll) connection engine, where connections
+	// are handed out by m_pEventPoller one request at a time.
+	void eventWorkerThreadFunction(WebServerThreadConfig* pThreadConfig);
+
+	// worker thread function used when each worker has its own SO_REUSEPORT listener sockets: it accepts
+	// connections on them itself, and polls them along with its own connections which are waiting for a request,
+	// so that it only ever handles complete requests, and idle keep-alive connections don't hold it up.
+	void listenerWorkerThreadFunction(WebServerThreadConfig* pThreadConfig);
+
+	// handles any complete requests the connection has received (receiving whatever's available first), for the
+	// per-worker listener worker threads. Returns true if the connection should be polled for its next request
+	// (with waitTimeoutSecs set to how long to wait for it), or false if it's been closed and freed.
+	bool handleWorkerConnection(RequestConnection* pConnection, unsigned int& waitTimeoutSecs);
 
 	void acceptConnectionThreadFunction(Socket* bindSocket, bool secureType);
 
+	// gives a newly-accepted connection to the event poller or the pending connection queues (shedding
+	// it if overloaded). Takes ownership of the connection.
+	void dispatchAcceptedConnection(RequestConnection* pNewConnection);
+
+	// used by the accept threads when upgrade handoff is enabled, as the listening sockets are non-blocking then.
+	// Returns true if there's a connection (probably) waiting to be accepted.
+	bool waitForIncomingConnection(const Socket* pBindSocket);
+	static bool acceptWouldHaveBlocked();
+
+	// wakes a single parked worker thread (if there are any) to handle a newly-queued connection,
+	// preferring one from the given placement group.
+	void wakeIdleWorker(unsigned int preferredGroup);
+
 	void handleConnection(RequestConnection& connection);
 
+	// for the event engine: records how long the connection waited in the ready queue for a worker thread, and returns
+	// whether it waited so long it should be shed.
+	bool shouldShedReadyConnection(const RequestConnection& connection);
+
+	// used to reject connections when overloaded: sends a minimal 503 response (without blocking) if configured to (and possible),
+	// and closes the connection.
+	void shedConnection(RequestConnection& connection);
+
+	// initialises the connection's IP info and allocates the connection socket for it from the
+	// appropriate socket layer. Returns false (with the connection closed) on failure.
+	bool setupConnectionSocket(RequestConnection& connection);
+
+	// processes a single ready connection given to us by the event poller, and either gives it back
+	// to the poller, or closes and frees it.
+	void handleEventConnection(RequestConnection* pConnection);
+
+	// gives the connection back to the event poller if it's to be kept alive after a request has been
+	// handled, otherwise closes and frees it.
+	void finishEventRequest(RequestConnection* pConnection, MainRequestHandler::RequestResult result);
+
+#if WEBSERVE_ENABLE_COROUTINE_HANDLERS
+	// handles the request with the coroutine handler variants: if these suspend waiting on IO, this returns to the
+	// calling worker thread, and the rest of the request is completed by whichever worker thread picks up the
+	// coroutine from the event poller's ready queue once the IO's ready.
+	DetachedTask handleEventRequestAsync(RequestConnection* pConnection, size_t requestLength);
+	
+	// event poller task function to resume a coroutine (given by its address) on a worker thread
+	static void resumeCoroutineTask(void* pCoroutineAddress);
+#endif
+
+	enum WorkerSlotState
+	{
+		eWorkerSlotUnused,
+		eWorkerSlotRunning,
+		eWorkerSlotRetired		// the thread has exited, but hasn't been joined yet
+	};
+
+	struct ListenerSocket
+	{
+		Socket*		pSocket		= nullptr;
+		bool		secure		= false;
+	};
+
+	// a connection owned by a per-worker listener worker thread, waiting for its next request
+	struct WorkerConnection
+	{
+		RequestConnection*						pConnection;
+		std::chrono::steady_clock::time_point	timeoutTime;
+	};
+
+	// upgrade handoff support
+	Socket* getMainSocketForListenerType(unsigned int listenerType);
+	void adoptHandedOverListeners(const std::vector<ListenerHandoff::Listener>& aListeners);
+	std::vector<ListenerHandoff::Listener> getHandoffListeners();
+
+	// called (on the handoff thread) once a new process has taken over our listening sockets and is ready:
+	// stops accepting connections, waits for existing ones to finish (up to the drain timeout), and then stops.
+	void drainForUpgrade();
+
+	// sets the configured TCP / socket tuning options for the HTTP or HTTPS listeners on the socket
+	void applyListenerTuning(Socket& listenerSocket, bool secure);
+	bool listenWithTuning(Socket& listenerSocket, bool secure);
+	// records the effective tuning values of the listening socket for the status page
+	void recordListenerTuning(const Socket& listenerSocket, const char* name, bool secure);
+
+	bool bindPerWorkerListenerSockets(unsigned int socketCreationFlags);
+	bool addPerWorkerListenerSocket(std::vector<ListenerSocket>& aListeners, unsigned int portNumber, unsigned int socketCreationFlags,
+									bool v6, bool secure);
+
 protected:
+	// these are indexed by worker slot (the threadID in the WebServerThreadConfig)
 	std::vector<std::thread>		m_aWorkerThreads;
+	std::vector<std::atomic<int> >	m_aWorkerSlotStates;
 	
 	std::thread						m_acceptHTTPV4ConnectionThread;
 #if WEBSERVE_ENABLE_HTTPS_SUPPORT
@@ -111,13 +246,54 @@ protected:
 
 	Logger							m_logger;
 
-	std::mutex						m_lock;
-	bool							m_active;
+	std::atomic<bool>				m_active;
+
+	// connections accepted by the accept threads, waiting for a worker thread, per placement group. We own these.
+	std::vector<BoundedMPMCQueue<RequestConnection*>*>	m_aPendingConnectionQueues;
+	// indices of worker threads which have parked waiting for new connections, per placement group
+	std::vector<BoundedMPMCQueue<unsigned int>*>		m_aIdleWorkerQueues;
+	// per-worker thread parking slots, indexed by threadID
+	std::vector<ThreadParker*>				m_aWorkerParkers;
+
+	ServerStatistics				m_serverStatistics;
+
+	// thread placement state. Placement groups are NUMA nodes which have worker threads on them if
+	// NUMA-aware placement is enabled, otherwise there's only a single group.
+	unsigned int					m_numPlacementGroups;
+	// NUMA node for each CPU index, or -1 if unknown
+	std::vector<int>				m_aCPUNUMANodes;
+	// placement group index for each NUMA node index, or -1 if there are no worker threads on that node
+	std::vector<int>				m_aNUMANodePlacementGroups;
+	std::vector<unsigned int>		m_aAcceptThreadCPUs;
+
+	// elastic worker pool state
+	bool							m_elasticWorkerPool;
+	std::atomic<unsigned int>		m_numActiveWorkers;
+	// worker threads currently handling a connection (or with the event engine, a request)
+	std::atomic<unsigned int>		m_numBusyWorkers;
+	// coroutine request handlers which have been started but haven't finished yet, which may not be
+	// running on (or known to) any worker thread or the event poller while they're waiting on IO.
+	std::atomic<unsigned int>		m_numAsyncRequestsInFlight;
+	std::atomic<int64_t>			m_lastDequeueTimeMS;
+	std::atomic<bool>				m_workerPoolGrowthRequested;
+
+	// only allocated if the event connection engine is being used
+	ConnectionEventPoller*			m_pEventPoller;
+
+	// only allocated if coroutine handlers are enabled (which requires the event connection engine)
+	CoroutineReactor*				m_pCoroutineReactor;
 
-	std::queue<RequestConnection>	m_aPendingConnections;
+	bool							m_usePerWorkerListeners;
+	// per-worker (indexed by threadID) listener sockets, only used if m_usePerWorkerListeners is set.
+	// We own the sockets.
+	std::vector<std::vector<ListenerSocket> >	m_aWorkerListenerSockets;
 
-	std::atomic<bool>				m_haveNewConnection;
-	std::condition_variable			m_newConnectionEvent;
+	// only allocated if upgrade handoff is configured
+	ListenerHandoff*				m_pListenerHandoff;
+	// unset when draining after an upgrade handoff
+	std::atomic<bool>				m_acceptingConnections;
+	// set once a new process has taken over the listening sockets, so that we don't shut them down
+	std::atomic<bool>				m_listenersHandedOver;
 
 	// once this has been set, we own it, and clean it up at the end...
 	MainRequestHandler*				m_pRequestHandler;
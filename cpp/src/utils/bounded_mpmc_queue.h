@@ -0,0 +1,158 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef BOUNDED_MPMC_QUEUE_H
+#define BOUNDED_MPMC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free bounded multi-producer / multi-consumer queue, based on Dmitry Vyukov's
+// bounded MPMC queue algorithm: each cell has a sequence number which producers and
+// consumers use to claim it, so the only contention is on the enqueue/dequeue positions.
+// Capacity is rounded up to a power of two.
+template<typename T>
+class BoundedMPMCQueue
+{
+public:
+	BoundedMPMCQueue(size_t capacity)
+	{
+		size_t actualCapacity = 2;
+		while (actualCapacity < capacity)
+		{
+			actualCapacity *= 2;
+		}
+
+		m_mask = actualCapacity - 1;
+		m_aCells = std::vector<Cell>(actualCapacity);
+		for (size_t i = 0; i < actualCapacity; i++)
+		{
+			m_aCells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		m_enqueuePos.store(0, std::memory_order_relaxed);
+		m_dequeuePos.store(0, std::memory_order_relaxed);
+	}
+
+	BoundedMPMCQueue(const BoundedMPMCQueue& rhs) = delete;
+	BoundedMPMCQueue& operator=(const BoundedMPMCQueue& rhs) = delete;
+
+	// returns false if the queue is full
+	bool tryPush(const T& item)
+	{
+		Cell* pCell = nullptr;
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			pCell = &m_aCells[pos & m_mask];
+			size_t seq = pCell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0)
+			{
+				if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				// full
+				return false;
+			}
+			else
+			{
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		pCell->data = item;
+		pCell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// returns false if the queue is empty
+	bool tryPop(T& item)
+	{
+		Cell* pCell = nullptr;
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			pCell = &m_aCells[pos & m_mask];
+			size_t seq = pCell->sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (diff == 0)
+			{
+				if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				// empty
+				return false;
+			}
+			else
+			{
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		item = pCell->data;
+		pCell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	// this is only approximate if there are concurrent pushes/pops going on
+	size_t getApproxSize() const
+	{
+		size_t enqueuePos = m_enqueuePos.load(std::memory_order_relaxed);
+		size_t dequeuePos = m_dequeuePos.load(std::memory_order_relaxed);
+		return (enqueuePos > dequeuePos) ? enqueuePos - dequeuePos : 0;
+	}
+
+	size_t getCapacity() const
+	{
+		return m_mask + 1;
+	}
+
+protected:
+	struct Cell
+	{
+		Cell()
+		{
+		}
+
+		// only needed for the std::vector construction above, before any concurrent use
+		Cell(const Cell& rhs) : sequence(rhs.sequence.load(std::memory_order_relaxed)), data(rhs.data)
+		{
+		}
+
+		std::atomic<size_t>		sequence;
+		T						data;
+	};
+
+	static const size_t kCacheLineSize = 64;
+
+	// keep the frequently-modified positions on different cache lines from each other and the cells
+	std::vector<Cell>			m_aCells;
+	size_t						m_mask;
+
+	alignas(kCacheLineSize) std::atomic<size_t>	m_enqueuePos;
+	alignas(kCacheLineSize) std::atomic<size_t>	m_dequeuePos;
+};
+
+#endif // BOUNDED_MPMC_QUEUE_H
@@ -0,0 +1,292 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#include "char_scanner.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	#define CHAR_SCANNER_X86_KERNELS 1
+	#include <immintrin.h>
+#else
+	#define CHAR_SCANNER_X86_KERNELS 0
+#endif
+
+typedef size_t (*FindHeaderEndFunc)(const char* pData, size_t length);
+typedef size_t (*FindLineEndFunc)(const char* pData, size_t length, size_t& separatorPos);
+
+static const char kHeaderEnd[4] = { '\r', '\n', '\r', '\n' };
+
+// scalar versions, also used for the tails of the SIMD ones
+
+static size_t findHeaderEndScalar(const char* pData, size_t length)
+{
+	size_t pos = 0;
+	while (pos + 4 <= length)
+	{
+		const char* pCR = (const char*)memchr(pData + pos, '\r', length - 3 - pos);
+		if (!pCR)
+			return CharScanner::npos;
+
+		pos = pCR - pData;
+		if (memcmp(pCR, kHeaderEnd, 4) == 0)
+			return pos;
+
+		pos++;
+	}
+
+	return CharScanner::npos;
+}
+
+static size_t findLineEndScalar(const char* pData, size_t length, size_t& separatorPos)
+{
+	const char* pLineEnd = (const char*)memchr(pData, '\n', length);
+	size_t lineLength = pLineEnd ? (pLineEnd - pData) : length;
+
+	if (separatorPos == CharScanner::npos)
+	{
+		const char* pSeparator = (const char*)memchr(pData, ':', lineLength);
+		if (pSeparator)
+		{
+			separatorPos = pSeparator - pData;
+		}
+	}
+
+	return pLineEnd ? lineLength : CharScanner::npos;
+}
+
+#if CHAR_SCANNER_X86_KERNELS
+
+// SSE4.2 versions, which use the string comparison instructions
+
+__attribute__((target("sse4.2")))
+static size_t findHeaderEndSSE42(const char* pData, size_t length)
+{
+	const __m128i needle = _mm_setr_epi8('\r', '\n', '\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+	size_t pos = 0;
+	while (pos + 16 <= length)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(pData + pos));
+		// this also finds partial matches which run off the end of the chunk
+		int index = _mm_cmpestri(needle, 4, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ORDERED | _SIDD_LEAST_SIGNIFICANT);
+		if (index == 16)
+		{
+			pos += 16;
+			continue;
+		}
+
+		if (pos + index + 4 <= length && memcmp(pData + pos + index, kHeaderEnd, 4) == 0)
+			return pos + index;
+
+		// it was a partial match at the end, so carry on from the start of it
+		pos += (index > 0) ? index : 1;
+	}
+
+	size_t tailPos = findHeaderEndScalar(pData + pos, length - pos);
+	return (tailPos != CharScanner::npos) ? pos + tailPos : CharScanner::npos;
+}
+
+__attribute__((target("sse4.2")))
+static size_t findLineEndSSE42(const char* pData, size_t length, size_t& separatorPos)
+{
+	// look for either delimiter until we've found the separator, and then just the line end
+	const __m128i delimiters = _mm_setr_epi8('\n', ':', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	int numDelimiters = (separatorPos == CharScanner::npos) ? 2 : 1;
+
+	size_t pos = 0;
+	while (pos + 16 <= length)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(pData + pos));
+		int index = _mm_cmpestri(delimiters, numDelimiters, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+		if (index == 16)
+		{
+			pos += 16;
+			continue;
+		}
+
+		pos += index;
+		if (pData[pos] == '\n')
+			return pos;
+
+		separatorPos = pos;
+		numDelimiters = 1;
+		pos++;
+	}
+
+	size_t tailSeparatorPos = CharScanner::npos;
+	size_t tailLineEndPos = findLineEndScalar(pData + pos, length - pos, tailSeparatorPos);
+	if (separatorPos == CharScanner::npos && tailSeparatorPos != CharScanner::npos)
+	{
+		separatorPos = pos + tailSeparatorPos;
+	}
+
+	return (tailLineEndPos != CharScanner::npos) ? pos + tailLineEndPos : CharScanner::npos;
+}
+
+// AVX2 versions, which compare 32 bytes at a time and use the resulting bitmasks
+
+__attribute__((target("avx2")))
+static size_t findHeaderEndAVX2(const char* pData, size_t length)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+
+	size_t pos = 0;
+	// each iteration looks at 3 bytes beyond the 32 it checks for the start of the terminator
+	while (pos + 32 + 3 <= length)
+	{
+		const char* pChunk = pData + pos;
+		__m256i matches = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)pChunk), cr),
+										   _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(pChunk + 1)), lf));
+		matches = _mm256_and_si256(matches, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(pChunk + 2)), cr));
+		matches = _mm256_and_si256(matches, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(pChunk + 3)), lf));
+
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(matches);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+
+		pos += 32;
+	}
+
+	size_t tailPos = findHeaderEndScalar(pData + pos, length - pos);
+	return (tailPos != CharScanner::npos) ? pos + tailPos : CharScanner::npos;
+}
+
+__attribute__((target("avx2")))
+static size_t findLineEndAVX2(const char* pData, size_t length, size_t& separatorPos)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i colon = _mm256_set1_epi8(':');
+
+	size_t pos = 0;
+	while (pos + 32 <= length)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)(pData + pos));
+		unsigned int lineEndMask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lf));
+
+		if (separatorPos == CharScanner::npos)
+		{
+			unsigned int separatorMask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, colon));
+			if (lineEndMask != 0)
+			{
+				// only separators before the line end count
+				separatorMask &= (lineEndMask & -lineEndMask) - 1;
+			}
+
+			if (separatorMask != 0)
+			{
+				separatorPos = pos + __builtin_ctz(separatorMask);
+			}
+		}
+
+		if (lineEndMask != 0)
+			return pos + __builtin_ctz(lineEndMask);
+
+		pos += 32;
+	}
+
+	size_t tailSeparatorPos = CharScanner::npos;
+	size_t tailLineEndPos = findLineEndScalar(pData + pos, length - pos, tailSeparatorPos);
+	if (separatorPos == CharScanner::npos && tailSeparatorPos != CharScanner::npos)
+	{
+		separatorPos = pos + tailSeparatorPos;
+	}
+
+	return (tailLineEndPos != CharScanner::npos) ? pos + tailLineEndPos : CharScanner::npos;
+}
+
+#endif // CHAR_SCANNER_X86_KERNELS
+
+struct ScannerKernels
+{
+	ScannerKernels()
+	{
+		select(detectKernelType());
+	}
+
+	static CharScanner::KernelType detectKernelType()
+	{
+#if CHAR_SCANNER_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return CharScanner::eKernelAVX2;
+		else if (__builtin_cpu_supports("sse4.2"))
+			return CharScanner::eKernelSSE42;
+#endif
+		return CharScanner::eKernelScalar;
+	}
+
+	void select(CharScanner::KernelType type)
+	{
+		kernelType = type;
+
+		switch (type)
+		{
+#if CHAR_SCANNER_X86_KERNELS
+			case CharScanner::eKernelAVX2:
+				pFindHeaderEnd = findHeaderEndAVX2;
+				pFindLineEnd = findLineEndAVX2;
+				break;
+			case CharScanner::eKernelSSE42:
+				pFindHeaderEnd = findHeaderEndSSE42;
+				pFindLineEnd = findLineEndSSE42;
+				break;
+#endif
+			default:
+				pFindHeaderEnd = findHeaderEndScalar;
+				pFindLineEnd = findLineEndScalar;
+				break;
+		}
+	}
+
+	CharScanner::KernelType		kernelType;
+	FindHeaderEndFunc			pFindHeaderEnd;
+	FindLineEndFunc				pFindLineEnd;
+};
+
+static ScannerKernels& getKernels()
+{
+	static ScannerKernels kernels;
+	return kernels;
+}
+
+size_t CharScanner::findHeaderEnd(const char* pData, size_t length)
+{
+	return getKernels().pFindHeaderEnd(pData, length);
+}
+
+size_t CharScanner::findLineEnd(const char* pData, size_t length, size_t& separatorPos)
+{
+	separatorPos = npos;
+	return getKernels().pFindLineEnd(pData, length, separatorPos);
+}
+
+CharScanner::KernelType CharScanner::getKernelType()
+{
+	return ScannerKernels::detectKernelType();
+}
+
+bool CharScanner::setKernelType(KernelType kernelType)
+{
+	if (kernelType > getKernelType())
+		return false;
+
+	getKernels().select(kernelType);
+	return true;
+}
@@ -0,0 +1,54 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef CHAR_SCANNER_H
+#define CHAR_SCANNER_H
+
+#include <cstddef>
+
+// Scanning functions for the delimiters in HTTP headers, which are the hot path of request parsing.
+// On x86_64, SSE4.2 or AVX2 versions are used if the CPU supports them (selected at runtime the first time
+// one is called), otherwise plain scalar versions are.
+class CharScanner
+{
+public:
+	static const size_t npos = (size_t)-1;
+
+	enum KernelType
+	{
+		eKernelScalar,
+		eKernelSSE42,
+		eKernelAVX2
+	};
+
+	// returns the position of the first "\r\n\r\n" (the end of an HTTP header), or npos if there isn't one.
+	static size_t findHeaderEnd(const char* pData, size_t length);
+
+	// returns the position of the first '\n', or npos if there isn't one. separatorPos is set to the position of
+	// the first ':' before it (i.e. the end of a header field's name), or npos if there isn't one.
+	static size_t findLineEnd(const char* pData, size_t length, size_t& separatorPos);
+
+	// the best kernel type the CPU supports
+	static KernelType getKernelType();
+
+	// mainly for testing / benchmarking - forces the given kernel type to be used, returning false if the
+	// CPU (or build) doesn't support it. Not thread-safe, so should be done before any scanning happens.
+	static bool setKernelType(KernelType kernelType);
+};
+
+#endif // CHAR_SCANNER_H
@@ -0,0 +1,368 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#include "recv_buffer.h"
+
+#include "char_scanner.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <strings.h>
+
+static const size_t kInitialCapacity = 8 * 1024;
+// if the buffer's grown beyond this (i.e. for a large POST request), it's freed again once it's empty,
+// so idle keep-alive connections don't hold on to lots of memory.
+static const size_t kMaxRetainedCapacity = 64 * 1024;
+
+RecvBuffer::RecvBuffer() :
+	m_pData(nullptr),
+	m_capacity(0),
+	m_readPos(0),
+	m_writePos(0),
+	m_maxHeaderSize(kDefaultMaxHeaderSize)
+{
+	resetMessageState();
+}
+
+RecvBuffer::~RecvBuffer()
+{
+	if (m_pData)
+	{
+		delete [] m_pData;
+		m_pData = nullptr;
+	}
+}
+
+char* RecvBuffer::getWritePointer(size_t minSpace)
+{
+	if (!m_pData)
+	{
+		// allocate lazily, so connections which never send anything don't cost us anything
+		m_capacity = (minSpace > kInitialCapacity) ? minSpace : kInitialCapacity;
+		m_pData = new char[m_capacity];
+	}
+
+	if (getWriteSpace() >= minSpace)
+		return m_pData + m_writePos;
+
+	size_t size = getSize();
+
+	// see if moving what we've still got to the start gives us enough space first...
+	if (m_readPos > 0)
+	{
+		memmove(m_pData, m_pData + m_readPos, size);
+		m_readPos = 0;
+		m_writePos = size;
+
+		if (getWriteSpace() >= minSpace)
+			return m_pData + m_writePos;
+	}
+
+	size_t newCapacity = m_capacity * 2;
+	while (newCapacity - size < minSpace)
+	{
+		newCapacity *= 2;
+	}
+
+	char* pNewData = new char[newCapacity];
+	memcpy(pNewData, m_pData, size);
+	delete [] m_pData;
+
+	m_pData = pNewData;
+	m_capacity = newCapacity;
+
+	return m_pData + m_writePos;
+}
+
+bool RecvBuffer::findMessage(size_t& messageLength, size_t maxBufferedBodySize)
+{
+	if (m_oversizedHeader)
+	{
+		messageLength = getSize();
+		return true;
+	}
+
+	if (m_headerLength == 0)
+	{
+		const char* pStart = getData();
+		size_t size = getSize();
+
+		// empty lines before the request line should be ignored (RFC 7230 3.5), so just drop them
+		while (size >= 2 && pStart[0] == '\r' && pStart[1] == '\n')
+		{
+			m_readPos += 2;
+			pStart = getData();
+			size = getSize();
+			m_scanPos = 0;
+		}
+
+		// the terminator could have been split across receives, so look back over the end of what's been scanned
+		size_t searchStart = (m_scanPos > 3) ? m_scanPos - 3 : 0;
+		size_t headerEndPos = CharScanner::findHeaderEnd(pStart + searchStart, size - searchStart);
+		if (headerEndPos == CharScanner::npos)
+		{
+			if (size > m_maxHeaderSize)
+			{
+				// there's no point waiting for any more, as it's too big anyway
+				m_oversizedHeader = true;
+				messageLength = size;
+				return true;
+			}
+
+			// nothing more for now, but remember we've looked at all this...
+			m_scanPos = size;
+			return false;
+		}
+
+		if (searchStart + headerEndPos + 4 > m_maxHeaderSize)
+		{
+			m_oversizedHeader = true;
+			messageLength = size;
+			return true;
+		}
+
+		m_headerLength = searchStart + headerEndPos + 4;
+		m_scanPos = m_headerLength;
+
+		// now we've got the complete header, look for the body framing fields in it (the last line is the empty one)
+		size_t lineStart = 0;
+		while (lineStart < m_headerLength - 2)
+		{
+			size_t separatorPos = 0;
+			size_t lineLength = CharScanner::findLineEnd(pStart + lineStart, m_headerLength - lineStart, separatorPos);
+
+			processHeaderLine(pStart + lineStart, lineLength);
+
+			lineStart += lineLength + 1;
+		}
+	}
+
+	if (m_chunked || m_invalidFraming || m_contentLength > maxBufferedBodySize)
+	{
+		// the body (if any) needs to be streamed (or the message rejected), so the header is all we wait for
+		messageLength = m_headerLength;
+		return true;
+	}
+
+	messageLength = m_headerLength + m_contentLength;
+
+	return getSize() >= messageLength;
+}
+
+bool RecvBuffer::findCompleteResponse(size_t& responseLength, bool headerOnlyResponse)
+{
+	if (!findMessage(responseLength, 0))
+		return false;
+
+	if (m_oversizedHeader || m_invalidFraming)
+	{
+		responseLength = getSize();
+		return true;
+	}
+
+	if (headerOnlyResponse || !responseCanHaveBody())
+	{
+		responseLength = m_headerLength;
+		return true;
+	}
+
+	if (m_chunked)
+	{
+		return findChunkedBodyEnd(responseLength);
+	}
+
+	if (!m_haveContentLength)
+	{
+		m_closeDelimited = true;
+		return false;
+	}
+
+	responseLength = m_headerLength + m_contentLength;
+
+	return getSize() >= responseLength;
+}
+
+bool RecvBuffer::findChunkedBodyEnd(size_t& messageLength)
+{
+	const char* pStart = getData();
+	size_t size = getSize();
+
+	if (m_bodyScanPos == 0)
+	{
+		m_bodyScanPos = m_headerLength;
+	}
+
+	while (true)
+	{
+		// the chunk size line, with the size in hex, optionally followed by chunk extensions
+		size_t chunkPos = m_bodyScanPos;
+		const char* pLineEnd = (const char*)memchr(pStart + chunkPos, '\n', size - chunkPos);
+		if (!pLineEnd)
+			return false;
+
+		// Note: this can't run off the end, as the line's terminated by a '\n'.
+		//       strtoull() allows leading whitespace and signs, so check it starts with a digit first.
+		char* pSizeEnd = nullptr;
+		unsigned long long chunkSize = 0;
+		if (isxdigit((unsigned char)pStart[chunkPos]))
+		{
+			errno = 0;
+			chunkSize = strtoull(pStart + chunkPos, &pSizeEnd, 16);
+		}
+		if (!pSizeEnd || errno == ERANGE || chunkSize > ((size_t)-1) / 2)
+		{
+			// not a number, or so big that working out where it ends would overflow
+			m_invalidFraming = true;
+			messageLength = size;
+			return true;
+		}
+
+		size_t dataPos = (pLineEnd - pStart) + 1;
+
+		if (chunkSize == 0)
+		{
+			// it's the last chunk, which is followed by any trailer fields, and then an empty line
+			size_t trailerLinePos = dataPos;
+			while (true)
+			{
+				const char* pTrailerLineEnd = (const char*)memchr(pStart + trailerLinePos, '\n', size - trailerLinePos);
+				if (!pTrailerLineEnd)
+					return false;
+
+				size_t trailerLineLength = pTrailerLineEnd - (pStart + trailerLinePos);
+				trailerLinePos += trailerLineLength + 1;
+
+				if (trailerLineLength == 0 || (trailerLineLength == 1 && pStart[trailerLinePos - 2] == '\r'))
+				{
+					messageLength = trailerLinePos;
+					return true;
+				}
+			}
+		}
+
+		// the chunk data is followed by a CRLF
+		size_t nextChunkPos = dataPos + (size_t)chunkSize + 2;
+		if (nextChunkPos > size)
+			return false;
+
+		m_bodyScanPos = nextChunkPos;
+	}
+}
+
+bool RecvBuffer::responseCanHaveBody() const
+{
+	// i.e. "HTTP/1.1 204 ..."
+	const char* pStart = getData();
+	if (m_headerLength < 12 || strncmp(pStart, "HTTP/", 5) != 0)
+		return true;
+
+	int statusCode = atoi(pStart + 9);
+
+	return !((statusCode >= 100 && statusCode < 200) || statusCode == 204 || statusCode == 304);
+}
+
+void RecvBuffer::processHeaderLine(const char* pLine, size_t lineLength)
+{
+	// Note: the line is always terminated by a '\n', so strtoull() can't run off the end.
+	if (lineLength > 15 && strncasecmp(pLine, "Content-Length:", 15) == 0)
+	{
+		const char* pValue = pLine + 15;
+		while (*pValue == ' ' || *pValue == '\t')
+		{
+			pValue++;
+		}
+
+		// strtoull() would accept a sign (and wrap negative values around), so it has to start with a digit
+		char* pValueEnd = nullptr;
+		unsigned long long contentLength = 0;
+		if (isdigit((unsigned char)*pValue))
+		{
+			errno = 0;
+			contentLength = strtoull(pValue, &pValueEnd, 10);
+		}
+		if (!pValueEnd || errno == ERANGE || contentLength > ((size_t)-1) / 2 ||
+			(*pValueEnd != '\r' && *pValueEnd != ' ' && *pValueEnd != '\t') ||
+			(m_haveContentLength && contentLength != m_contentLength))
+		{
+			// not a number, too big, or a different value to a previous Content-Length line
+			m_invalidFraming = true;
+		}
+
+		m_contentLength = (size_t)contentLength;
+		m_haveContentLength = true;
+	}
+	else if (lineLength > 18 && strncasecmp(pLine, "Transfer-Encoding:", 18) == 0)
+	{
+		// chunked must be the final encoding, so just look for it anywhere on the line
+		for (const char* pValue = pLine + 18; pValue + 7 <= pLine + lineLength; pValue++)
+		{
+			if (strncasecmp(pValue, "chunked", 7) == 0)
+			{
+				m_chunked = true;
+				break;
+			}
+		}
+	}
+
+	// having both is a request smuggling risk, so we don't allow it
+	if (m_chunked && m_haveContentLength)
+	{
+		m_invalidFraming = true;
+	}
+}
+
+void RecvBuffer::consume(size_t length)
+{
+	if (length >= getSize())
+	{
+		clear();
+		return;
+	}
+
+	m_readPos += length;
+	resetMessageState();
+}
+
+void RecvBuffer::clear()
+{
+	m_readPos = 0;
+	m_writePos = 0;
+	resetMessageState();
+
+	if (m_capacity > kMaxRetainedCapacity)
+	{
+		delete [] m_pData;
+		m_pData = nullptr;
+		m_capacity = 0;
+	}
+}
+
+void RecvBuffer::resetMessageState()
+{
+	m_scanPos = 0;
+	m_headerLength = 0;
+	m_contentLength = 0;
+	m_haveContentLength = false;
+	m_chunked = false;
+	m_invalidFraming = false;
+	m_oversizedHeader = false;
+	m_bodyScanPos = 0;
+	m_closeDelimited = false;
+}
@@ -0,0 +1,192 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef RECV_BUFFER_H
+#define RECV_BUFFER_H
+
+#include <cstddef>
+#include <string_view>
+
+// Reusable receive buffer, intended to be kept per-connection, which data is received directly into, and which
+// incrementally works out where HTTP messages end (the header terminator and any Content-Length), so that data
+// which has already been scanned isn't scanned again each time more arrives.
+// Unread data is always contiguous (it's moved back to the start of the buffer when more space is needed rather
+// than wrapping around), so complete messages can be handed out as views into the buffer rather than copies.
+class RecvBuffer
+{
+public:
+	RecvBuffer();
+	~RecvBuffer();
+
+	RecvBuffer(const RecvBuffer& rhs) = delete;
+	RecvBuffer& operator=(const RecvBuffer& rhs) = delete;
+
+	// returns a pointer to at least minSpace bytes of space to receive into, allocating, growing or compacting
+	// the buffer as needed. commitWrite() should then be called with how much was actually written.
+	char* getWritePointer(size_t minSpace);
+	size_t getWriteSpace() const
+	{
+		return m_capacity - m_writePos;
+	}
+
+	void commitWrite(size_t length)
+	{
+		m_writePos += length;
+	}
+
+	const char* getData() const
+	{
+		return m_pData + m_readPos;
+	}
+
+	size_t getSize() const
+	{
+		return m_writePos - m_readPos;
+	}
+
+	bool isEmpty() const
+	{
+		return m_writePos == m_readPos;
+	}
+
+	std::string_view getView(size_t length) const
+	{
+		return std::string_view(getData(), length);
+	}
+
+	// request bodies up to this size are received along with the header by findCompleteRequest(), larger ones
+	// are left to be streamed.
+	static const size_t kMaxBufferedRequestBodySize = 64 * 1024;
+
+	static const size_t kDefaultMaxHeaderSize = 32 * 1024;
+
+	// headers bigger than this are rejected: once this much has been received without the end of the header
+	// being found, the find functions below return true, with hasOversizedHeader() set.
+	void setMaxHeaderSize(size_t maxHeaderSize)
+	{
+		m_maxHeaderSize = maxHeaderSize;
+	}
+
+	// works out whether the data received so far contains a complete HTTP request (the header, and any body as
+	// specified by Content-Length), and if so, what its full length is. Only data which hasn't been scanned by a
+	// previous call is looked at.
+	// Chunked bodies and bodies larger than kMaxBufferedRequestBodySize aren't waited for, in which case requestLength
+	// is just the length of the header, and the body is left in the buffer for RequestBodyReader to stream. This is
+	// also the case if the body framing is invalid.
+	bool findCompleteRequest(size_t& requestLength)
+	{
+		return findMessage(requestLength, kMaxBufferedRequestBodySize);
+	}
+
+	// like the above, but for responses, where chunked bodies are waited for up to and including the last chunk
+	// (and any trailer), and the status code is taken into account. headerOnlyResponse is for responses to HEAD
+	// requests, which have the body framing fields of the equivalent GET response, but never a body.
+	// Responses with neither a Content-Length nor a chunked body are delimited by the connection being closed, so
+	// this never returns true for them, but sets isCloseDelimited(), and the caller should receive until the other
+	// side closes the connection.
+	// If the header's too big or the body framing is invalid, this returns true with everything received so far.
+	bool findCompleteResponse(size_t& responseLength, bool headerOnlyResponse);
+
+	// these are only valid once the header of the current message has been found by one of the above.
+
+	// whether the end of the header of the current message has been received yet
+	bool haveCompleteHeader() const
+	{
+		return m_headerLength > 0;
+	}
+
+	size_t getHeaderLength() const
+	{
+		return m_headerLength;
+	}
+
+	size_t getContentLength() const
+	{
+		return m_contentLength;
+	}
+
+	bool isChunkedBody() const
+	{
+		return m_chunked;
+	}
+
+	// i.e. both Content-Length and chunked Transfer-Encoding, or conflicting or invalid Content-Length values,
+	// in which case the message can't be safely framed.
+	bool hasInvalidBodyFraming() const
+	{
+		return m_invalidFraming;
+	}
+
+	// the header is bigger than the max header size, in which case none of the above are valid, and the
+	// message length given by the find functions is just everything received so far.
+	bool hasOversizedHeader() const
+	{
+		return m_oversizedHeader;
+	}
+
+	// only valid after findCompleteResponse() has been called: the response body continues until the connection's closed
+	bool isCloseDelimited() const
+	{
+		return m_closeDelimited;
+	}
+
+	// removes data (i.e. a message which has been handled) from the front of the buffer, and resets the
+	// message scanning state, ready for the next message.
+	void consume(size_t length);
+
+	void clear();
+
+protected:
+	bool findMessage(size_t& messageLength, size_t maxBufferedBodySize);
+
+	void processHeaderLine(const char* pLine, size_t lineLength);
+
+	// scans as many complete chunks of the current message's chunked body as have been received
+	bool findChunkedBodyEnd(size_t& messageLength);
+
+	// whether the response at the start of the buffer can have a body, based on its status code
+	bool responseCanHaveBody() const;
+
+	void resetMessageState();
+
+protected:
+	char*			m_pData;
+	size_t			m_capacity;
+
+	// both relative to m_pData
+	size_t			m_readPos;
+	size_t			m_writePos;
+
+	size_t			m_maxHeaderSize;
+
+	// message scanning state - all relative to m_readPos (i.e. the start of the current message)
+	// how far we've scanned for the end of the header
+	size_t			m_scanPos;
+	// 0 if we haven't found the end of the header yet
+	size_t			m_headerLength;
+	size_t			m_contentLength;
+	bool			m_haveContentLength;
+	bool			m_chunked;
+	bool			m_invalidFraming;
+	bool			m_oversizedHeader;
+	// for responses: how far we've scanned the chunks of a chunked body (0 if we haven't started yet)
+	size_t			m_bodyScanPos;
+	bool			m_closeDelimited;
+};
+
+#endif // RECV_BUFFER_H
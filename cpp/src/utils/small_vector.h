@@ -0,0 +1,143 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef SMALL_VECTOR_H
+#define SMALL_VECTOR_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// Vector which stores up to InlineCapacity items inline (i.e. on the stack, or within the object owning it),
+// and only allocates if it grows beyond that. It's intended for small per-request lists, so only supports
+// appending, and can't be copied.
+template <typename T, size_t InlineCapacity>
+class SmallVector
+{
+public:
+	SmallVector() : m_pData(reinterpret_cast<T*>(m_inlineStorage)), m_size(0), m_capacity(InlineCapacity)
+	{
+	}
+
+	~SmallVector()
+	{
+		clear();
+		freeHeapStorage();
+	}
+
+	SmallVector(const SmallVector& rhs) = delete;
+	SmallVector& operator=(const SmallVector& rhs) = delete;
+
+	template <typename... Args>
+	T& emplace_back(Args&&... args)
+	{
+		if (m_size < m_capacity)
+		{
+			T* pNewItem = new (m_pData + m_size) T(std::forward<Args>(args)...);
+			m_size++;
+			return *pNewItem;
+		}
+
+		// the new item's constructed before the existing ones are moved, as args could refer to one of them
+		size_t newCapacity = m_capacity * 2;
+		T* pNewData = static_cast<T*>(::operator new(newCapacity * sizeof(T)));
+		T* pNewItem = new (pNewData + m_size) T(std::forward<Args>(args)...);
+
+		moveToStorage(pNewData, newCapacity);
+
+		m_size++;
+		return *pNewItem;
+	}
+
+	void push_back(const T& item)
+	{
+		emplace_back(item);
+	}
+
+	void clear()
+	{
+		for (size_t i = 0; i < m_size; i++)
+		{
+			m_pData[i].~T();
+		}
+		m_size = 0;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+	// whether it's had to allocate
+	bool isOnHeap() const
+	{
+		return m_pData != reinterpret_cast<const T*>(m_inlineStorage);
+	}
+
+	T& operator[](size_t index)
+	{
+		return m_pData[index];
+	}
+
+	const T& operator[](size_t index) const
+	{
+		return m_pData[index];
+	}
+
+	T* begin() { return m_pData; }
+	T* end() { return m_pData + m_size; }
+	const T* begin() const { return m_pData; }
+	const T* end() const { return m_pData + m_size; }
+
+protected:
+	void moveToStorage(T* pNewData, size_t newCapacity)
+	{
+		for (size_t i = 0; i < m_size; i++)
+		{
+			new (pNewData + i) T(std::move(m_pData[i]));
+			m_pData[i].~T();
+		}
+
+		freeHeapStorage();
+
+		m_pData = pNewData;
+		m_capacity = newCapacity;
+	}
+
+	void freeHeapStorage()
+	{
+		if (isOnHeap())
+		{
+			::operator delete(m_pData);
+		}
+	}
+
+protected:
+	T*				m_pData;
+	size_t			m_size;
+	size_t			m_capacity;
+
+	alignas(T) unsigned char	m_inlineStorage[sizeof(T) * InlineCapacity];
+};
+
+#endif // SMALL_VECTOR_H
@@ -25,9 +25,16 @@
 #include <cstdlib>
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
-#include "string_helpers.h"
+#include "recv_buffer.h"
+
+#ifdef __linux__
+	#include <sys/sendfile.h>
+#endif
 
 #define DISABLE_SIGPIPE_SOCKET 1
 
@@ -45,17 +52,19 @@
 #define ENABLE_TCP_FASTOPEN_SUPPORT 0
 
 #if ENABLE_TCP_FASTOPEN_SUPPORT
-#ifdef __linux__
-	#include <netinet/tcp.h>
-#else
+#ifndef __linux__
 	#undef ENABLE_TCP_FASTOPEN_SUPPORT
 #endif
 #endif
 
 static const unsigned int kMaxSendLength = 1024;
+// max number of buffers sendv() passes to each sendmsg() call
+static const unsigned int kMaxSendIOVecs = 16;
 static const unsigned int kMaxRecvLength = 4096;
+// max amount passed to each sendfile() call (Linux won't send more than just under 2GB per call anyway)
+static const size_t kMaxSendFileLength = 1024 * 1024 * 1024;
 
-Socket::Socket() : m_version(0), m_sock(-1), m_port(-1), m_pLogger(nullptr)
+Socket::Socket() : m_version(0), m_sock(-1), m_port(-1), m_sendTimeoutSecs(0), m_pLogger(nullptr)
 #if SOCK_LEAK_DETECTOR
 	, m_pLeak(nullptr)
 #endif
@@ -63,7 +72,8 @@ Socket::Socket() : m_version(0), m_sock(-1), m_port(-1), m_pLogger(nullptr)
 	memset(&m_addr, 0, sizeof(m_addr));
 }
 
-Socket::Socket(Logger* pLogger, const std::string& host, int port, bool v6) : m_version(0), m_sock(-1), m_port(port), m_host(host), m_pLogger(nullptr)
+Socket::Socket(Logger* pLogger, const std::string& host, int port, bool v6) : m_version(0), m_sock(-1), m_port(port), m_host(host),
+	m_sendTimeoutSecs(0), m_pLogger(nullptr)
 #if SOCK_LEAK_DETECTOR
 	, m_pLeak(nullptr)
 #endif
@@ -128,6 +138,21 @@ bool Socket::create(Logger* pLogger, unsigned int flags, bool v6)
 	}
 #endif
 
+	if (flags & SOCKOPT_REUSEPORT)
+	{
+#ifdef SO_REUSEPORT
+		if (::setsockopt(m_sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&on, sizeof(on)) == -1)
+		{
+			int errorNumber = errno;
+			fprintf(stderr, "Socket setsockopt(..,SO_REUSEPORT,..) error: %s\n", strerror(errorNumber));
+			return false;
+		}
+#else
+		fprintf(stderr, "SO_REUSEPORT is not supported on this platform.\n");
+		return false;
+#endif
+	}
+
 	if (flags & SOCKOPT_FASTOPEN)
 	{
 #if ENABLE_TCP_FASTOPEN_SUPPORT
@@ -264,6 +289,132 @@ void Socket::close()
 	}
 }
 
+void Socket::closeWithoutShutdown()
+{
+	if (isValid())
+	{
+		::close(m_sock);
+		
+#if SOCK_LEAK_DETECTOR
+		if (m_pLeak)
+		{
+			delete [] m_pLeak;
+		}
+#endif
+
+		m_sock = -1;
+	}
+}
+
+bool Socket::adoptListeningSocket(Logger* pLogger, int socketFD)
+{
+	close();
+	
+	socklen_t addrLen = sizeof(m_addr);
+	if (::getsockname(socketFD, (struct sockaddr*)&m_addr, &addrLen) == -1)
+		return false;
+	
+	m_version = (m_addr.ss_family == AF_INET6) ? 6 : 4;
+	m_sock = socketFD;
+	m_pLogger = pLogger;
+	
+#if SOCK_LEAK_DETECTOR
+	m_pLeak = new char[64];
+	memset(m_pLeak, 0, 64);
+#endif
+	
+	return true;
+}
+
+bool Socket::setNonBlocking(bool nonBlocking)
+{
+	int flags = fcntl(m_sock, F_GETFL, 0);
+	if (flags == -1)
+		return false;
+	
+	flags = nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl(m_sock, F_SETFL, flags) == 0;
+}
+
+int Socket::getIncomingCPU() const
+{
+#ifdef SO_INCOMING_CPU
+	int cpu = -1;
+	socklen_t optionLength = sizeof(cpu);
+	if (::getsockopt(m_sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &optionLength) == -1)
+		return -1;
+	
+	return cpu;
+#else
+	return -1;
+#endif
+}
+
+bool Socket::setIncomingCPU(int cpu)
+{
+#ifdef SO_INCOMING_CPU
+	return ::setsockopt(m_sock, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == 0;
+#else
+	return false;
+#endif
+}
+
+bool Socket::setTCPDeferAccept(unsigned int timeoutSecs)
+{
+#ifdef TCP_DEFER_ACCEPT
+	int value = (int)timeoutSecs;
+	return ::setsockopt(m_sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &value, sizeof(value)) == 0;
+#else
+	return false;
+#endif
+}
+
+bool Socket::setTCPNoDelay(bool noDelay)
+{
+	int value = noDelay ? 1 : 0;
+	return ::setsockopt(m_sock, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) == 0;
+}
+
+bool Socket::setTCPNotSentLowat(unsigned int numBytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+	int value = (int)numBytes;
+	return ::setsockopt(m_sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &value, sizeof(value)) == 0;
+#else
+	return false;
+#endif
+}
+
+bool Socket::setSendBufferSize(unsigned int numBytes)
+{
+	int value = (int)numBytes;
+	return ::setsockopt(m_sock, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value)) == 0;
+}
+
+bool Socket::setRecvBufferSize(unsigned int numBytes)
+{
+	int value = (int)numBytes;
+	return ::setsockopt(m_sock, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value)) == 0;
+}
+
+bool Socket::setAbortiveClose()
+{
+	struct linger lingerValue;
+	lingerValue.l_onoff = 1;
+	lingerValue.l_linger = 0;
+	return ::setsockopt(m_sock, SOL_SOCKET, SO_LINGER, &lingerValue, sizeof(lingerValue)) == 0;
+}
+
+int Socket::getIntOption(int level, int optionName) const
+{
+	int value = -1;
+	socklen_t optionLength = sizeof(value);
+	if (::getsockopt(m_sock, level, optionName, &value, &optionLength) == -1)
+		return -1;
+
+	return value;
+}
+
 bool Socket::setRecvTimeoutOption(int timeoutSeconds)
 {
 	struct timeval timeout;
@@ -278,6 +429,21 @@ bool Socket::setRecvTimeoutOption(int timeoutSeconds)
 	return true;
 }
 
+bool Socket::setSendTimeout(unsigned int timeoutSecs)
+{
+	m_sendTimeoutSecs = timeoutSecs;
+
+	struct timeval timeout;
+	timeout.tv_sec = timeoutSecs;
+	timeout.tv_usec = 0;
+	if (setsockopt(m_sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0)
+	{
+		return false;
+	}
+
+	return true;
+}
+
 bool Socket::accept(Socket* sock) const
 {
 	if (!isValid())
@@ -289,6 +455,12 @@ bool Socket::accept(Socket* sock) const
 	if (sock->m_sock <= 0)
 		return false;
 
+#ifndef __linux__
+	// on BSD / macOS, accepted sockets inherit O_NONBLOCK from the listening socket (which is set when it
+	// can be handed over to another process), but everything using accepted sockets expects them to block.
+	sock->setNonBlocking(false);
+#endif
+
 	if (sock->m_addr.ss_family == AF_INET)
 	{
 		sock->m_version = 4;
@@ -310,68 +482,223 @@ bool Socket::accept(Socket* sock) const
 	return true;	
 }
 
-bool Socket::send(const std::string& data) const
+bool Socket::send(const std::string& data, const SendDeadline* pDeadline) const
 {
-	if (!isValid())
-		return false;
-	
-	// TODO: use kMaxSendLength
-#if USE_MSG_NOSIGNAL
-	int bytesSent = ::send(m_sock, data.c_str(), data.size(), MSG_NOSIGNAL);
-#else
-	int bytesSent = ::send(m_sock, data.c_str(), data.size(), 0);
-#endif
+	struct iovec dataIOVec;
+	dataIOVec.iov_base = (void*)data.c_str();
+	dataIOVec.iov_len = data.size();
 	
-	if (bytesSent == -1)
-		return false;
+	return sendv(&dataIOVec, 1, false, pDeadline);
+}
+
+bool Socket::send(unsigned char* pData, size_t dataLength, const SendDeadline* pDeadline) const
+{
+	struct iovec dataIOVec;
+	dataIOVec.iov_base = pData;
+	dataIOVec.iov_len = dataLength;
 	
-	return true;
+	return sendv(&dataIOVec, 1, false, pDeadline);
 }
 
-bool Socket::send(unsigned char* pData, size_t dataLength) const
+bool Socket::sendv(const struct iovec* pIOVecs, unsigned int count, bool moreToFollow, const SendDeadline* pDeadline) const
 {
 	if (!isValid())
 		return false;
 
-	// TODO: use kMaxSendLength
+	// Note: we don't block in the kernel even on blocking sockets, so that short writes to slow clients (which
+	//       previously aborted the transfer) can be resumed once the socket's writable again, within the deadline.
+	int baseFlags = MSG_DONTWAIT;
 #if USE_MSG_NOSIGNAL
-	int bytesSent = ::send(m_sock, pData, dataLength, MSG_NOSIGNAL);
-#else
-	int bytesSent = ::send(m_sock, pData, dataLength, 0);
+	baseFlags |= MSG_NOSIGNAL;
 #endif
 
-	if (bytesSent == -1)
+	SendDeadline deadline = pDeadline ? *pDeadline : SendDeadline(m_sendTimeoutSecs);
+
+	// the buffer we're up to, and how far into it
+	unsigned int index = 0;
+	size_t offset = 0;
+
+	while (index < count)
 	{
-		int errorNumber = errno;
-		if (errorNumber == EPIPE) // 32
+		// we need our own copy of the remaining buffers to send, as sendmsg() can send less than everything
+		struct iovec aIOVecs[kMaxSendIOVecs];
+		unsigned int numIOVecs = 0;
+		for (unsigned int i = index; i < count && numIOVecs < kMaxSendIOVecs; i++)
 		{
-			// client closed the connection
+			size_t skip = (i == index) ? offset : 0;
+			aIOVecs[numIOVecs].iov_base = (char*)pIOVecs[i].iov_base + skip;
+			aIOVecs[numIOVecs].iov_len = pIOVecs[i].iov_len - skip;
+			numIOVecs++;
+		}
+
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = aIOVecs;
+		message.msg_iovlen = numIOVecs;
+
+		int flags = baseFlags;
+#ifdef MSG_MORE
+		if (moreToFollow || index + numIOVecs < count)
+		{
+			flags |= MSG_MORE;
+		}
+#endif
+
+		ssize_t bytesSent = ::sendmsg(m_sock, &message, flags);
+		if (bytesSent == -1)
+		{
+			int errorNumber = errno;
+			if (errorNumber == EINTR)
+				continue;
+
+			if (errorNumber == EAGAIN || errorNumber == EWOULDBLOCK)
+			{
+				// the socket's send buffer is full, so wait for the client to read some of it
+				if (!waitForWritable(deadline))
+				{
+					if (m_pLogger)
+					{
+						m_pLogger->info("Timed out sending to client. Aborting transfer.");
+					}
+					return false;
+				}
+				continue;
+			}
+
+			// most likely the client closed the connection (EPIPE / ECONNRESET)
 			return false;
 		}
-		return false;
+
+		// work out where we got up to
+		size_t bytesRemaining = (size_t)bytesSent;
+		while (index < count && bytesRemaining >= pIOVecs[index].iov_len - offset)
+		{
+			bytesRemaining -= pIOVecs[index].iov_len - offset;
+			index++;
+			offset = 0;
+		}
+
+		if (index < count)
+		{
+			offset += bytesRemaining;
+		}
 	}
-	else if (bytesSent != (int)dataLength)
-	{
-		// not sure what we can/should do if we ever get here (but we do, both Firefox and Safari often do this)...
-		
-		// in blocking mode, send() should block until it can send, so it's effectively
-		// atomic in terms of either failing or sending all the data.
-		
-		// I assume the socket is actually getting closed by the client and because MSG_NOSIGNAL is set
-		// this is all the notification we get?
-		
-		// Sending it again in all cases so far returns -1, which seems to support the above...
-		
-		// TODO: maybe we should properly buffer the above sending in chunks, and attempt to retry when
-		//       this condition is hit, and then if that further attempt returns -1 abort?
-		m_pLogger->info("send() returned unexpected incomplete value. Aborting transfer.");
-		
+
+	return true;
+}
+
+bool Socket::sendFile(int fileFD, size_t offset, size_t length, const SendDeadline* pDeadline) const
+{
+#ifdef __linux__
+	if (!isValid())
 		return false;
+
+	SendDeadline deadline = pDeadline ? *pDeadline : SendDeadline(m_sendTimeoutSecs);
+
+	off_t fileOffset = (off_t)offset;
+	size_t bytesRemaining = length;
+
+	while (bytesRemaining > 0)
+	{
+		size_t thisLength = (bytesRemaining > kMaxSendFileLength) ? kMaxSendFileLength : bytesRemaining;
+
+		// Note: this updates fileOffset itself
+		ssize_t bytesSent = ::sendfile(m_sock, fileFD, &fileOffset, thisLength);
+		if (bytesSent == -1)
+		{
+			int errorNumber = errno;
+			if (errorNumber == EINTR)
+				continue;
+
+			if (errorNumber == EAGAIN || errorNumber == EWOULDBLOCK)
+			{
+				// the socket's send timeout expired (or it's non-blocking), so wait for the client to catch up
+				if (!waitForWritable(deadline))
+				{
+					if (m_pLogger)
+					{
+						m_pLogger->info("Timed out sending to client. Aborting transfer.");
+					}
+					return false;
+				}
+				continue;
+			}
+
+			return false;
+		}
+		else if (bytesSent == 0)
+		{
+			// the file's shorter than it was when we worked out the length (i.e. it was truncated), so we can't
+			// send as much as the Content-Length said.
+			return false;
+		}
+
+		bytesRemaining -= (size_t)bytesSent;
 	}
 
-	// TODO: check bytes sent was correct amount. Not sure how to recover from that if that isn't the case though...
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Socket::sendNonBlocking(const std::string& data) const
+{
+	if (!isValid())
+		return false;
+	
+	int flags = MSG_DONTWAIT;
+#if USE_MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	
+	ssize_t bytesSent = ::send(m_sock, data.c_str(), data.size(), flags);
+	return bytesSent == (ssize_t)data.size();
+}
 
+bool Socket::isSendFileSupported()
+{
+#ifdef __linux__
 	return true;
+#else
+	return false;
+#endif
+}
+
+bool Socket::waitForWritable(const SendDeadline& deadline) const
+{
+	while (true)
+	{
+		int timeoutMS = -1;
+		if (deadline.enabled)
+		{
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline.time - std::chrono::steady_clock::now());
+			if (remaining.count() <= 0)
+				return false;
+
+			timeoutMS = (int)remaining.count();
+		}
+
+		struct pollfd fd;
+		fd.fd = m_sock;
+		fd.events = POLLOUT;
+		fd.revents = 0;
+		int pollResult = poll(&fd, 1, timeoutMS);
+		if (pollResult == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+		else if (pollResult == 0)
+		{
+			return false;
+		}
+
+		// Note: if POLLERR or POLLHUP are set, the next send will tell us what happened
+		return true;
+	}
 }
 
 SocketRecvReturnCode Socket::recv(std::string& data) const
@@ -381,26 +708,17 @@ SocketRecvReturnCode Socket::recv(std::string& data) const
 	
 	int dataLength = 0;
 	
-	char buffer[kMaxRecvLength + 1];
+	char buffer[kMaxRecvLength];
 		
 	int ret = 0;
 	
 	do
 	{
-		// TODO: is this necessary given we're appending a NULL to the end of the buffer below? Possibly good practice, but
-		//       but could cost us a bit in performance... Currently this code isn't used for anything performance-critical, but...
-		memset(buffer, 0, sizeof(buffer));
-		
-		// TODO: we could also receive into a larger windowed buffer, and only do the conversion to std::string once at the end (or
-		//       at least not as often).
-		
 		ret = ::recv(m_sock, buffer, kMaxRecvLength, 0);
 		
 		if (ret > 0)
 		{
-			buffer[ret] = '\0';
-		
-			data.append(buffer);
+			data.append(buffer, ret);
 			dataLength += ret;
 		}
 		else
@@ -413,221 +731,221 @@ SocketRecvReturnCode Socket::recv(std::string& data) const
 	return dataLength > 0 ? eSockRecv_OK : eSockRecv_NoData;
 }
 
-// really hacky infrastructure to cope with Safari always sending POST params in a second TCP frame.
-// This really needs to be handled in a nicer and more generic/robust way, but using a timeout recv()
-// causes delays and doesn't completely fix the issue - this does (although there may still be other recv() issues).
-// TODO: long-term we probably want to try and decode headers as we receive them and make the decision generically
-//       based off Content-Length?
-SocketRecvReturnCode Socket::recvSmart(std::string& data) const
+// Safari always sends POST params in a second TCP frame, so rather than returning after the first recv(), keep
+// receiving until we've got a complete message. These are only used for receiving responses (i.e. from proxy targets),
+// so chunked bodies are received up to the last chunk, and ones with no Content-Length until the connection's closed.
+SocketRecvReturnCode Socket::recvSmart(std::string& data, bool headerOnlyResponse) const
+{
+	return recvSmartWithTimeout(data, 0, headerOnlyResponse);
+}
+
+SocketRecvReturnCode Socket::recvSmartWithTimeout(std::string& data, unsigned int timeoutSecs, bool headerOnlyResponse) const
 {
 	if (!isValid())
 		return eSockRecv_Error;
 
-	int dataLength = 0;
-
-	char buffer[kMaxRecvLength + 1];
-
-	int ret = 0;
+	RecvBuffer buffer;
 
-	do
+	SocketRecvReturnCode retCode(eSockRecv_OK);
+	size_t messageLength = 0;
+	bool haveCompleteResponse = false;
+	while (!(haveCompleteResponse = buffer.findCompleteResponse(messageLength, headerOnlyResponse)))
 	{
-		// TODO: is this necessary given we're appending a NULL to the end of the buffer below? Possibly good practice, but
-		//       but could cost us a bit in performance... Currently this code isn't used for anything performance-critical, but...
-		memset(buffer, 0, sizeof(buffer));
-
-		// TODO: we could also receive into a larger windowed buffer, and only do the conversion to std::string once at the end (or
-		//       at least not as often).
-
-		ret = ::recv(m_sock, buffer, kMaxRecvLength, 0);
-
-		if (ret > 0)
-		{
-			buffer[ret] = '\0';
-
-			data.append(buffer);
-			dataLength += ret;
-
-			// check it's a POST request
-			if (!StringHelpers::beginsWithStaticConst(data, "POST"))
-				continue;
+		retCode = recv(buffer, timeoutSecs);
+		if (retCode.type != eSockRecv_OK)
+			break;
+	}
 
-			// check there was no data payload
-			if (!StringHelpers::endsWithStaticConst(data, "\r\n\r\n"))
-				continue;
+	if (buffer.hasOversizedHeader() || buffer.hasInvalidBodyFraming())
+	{
+		return eSockRecv_Error;
+	}
 
-			// otherwise, we've got a POST request with no form data, so try and find the Content-Length:
+	if (buffer.isEmpty())
+	{
+		return retCode;
+	}
 
-			size_t contentLengthStart = data.find("Content-Length:");
-			if (contentLengthStart == std::string::npos)
-				continue;
+	data.append(buffer.getData(), buffer.getSize());
 
-			size_t contentLengthDataStart = contentLengthStart + 15;
+	if (haveCompleteResponse)
+	{
+		return eSockRecv_OK;
+	}
 
-			size_t lineEnd = data.find('\r', contentLengthDataStart);
-			if (lineEnd != std::string::npos)
-			{
-				std::string contentLengthString = data.substr(contentLengthDataStart, lineEnd - contentLengthDataStart);
+	if (retCode.type == eSockRecv_PeerClosed && buffer.isCloseDelimited())
+	{
+		// that's how HTTP/1.0-style responses without a Content-Length (or chunked body) signal their end
+		return eSockRecv_OK;
+	}
 
-				unsigned int contentLengthVal = atoi(contentLengthString.c_str());
+	if (retCode.type == eSockRecv_TimedOutNoData)
+	{
+		return eSockRecv_TimedOutWithData;
+	}
 
-				if (contentLengthVal > 0)
-				{
-					ret = ::recv(m_sock, buffer, kMaxRecvLength, 0);
+	// the connection was closed (or failed) part way through the response
+	return eSockRecv_Error;
+}
 
-					buffer[ret] = '\0';
+SocketRecvReturnCode Socket::recvWithTimeout(std::string& data, unsigned int timeoutSecs) const
+{
+	unsigned int dataLength = 0;
+	SocketRecvReturnCode returnCode;
+#if USE_POLL_FOR_RECV_TIMEOUT
+	returnCode = recvWithTimeoutPoll(data, dataLength, timeoutSecs);
+#else
+	returnCode = recvWithTimeoutSockOpt(data, dataLength, timeoutSecs);
 
-					data.append(buffer);
-					dataLength += ret;
-				}
-			}
-		}
-		else
-		{
-			break;
-		}
-	}
-	while (ret >= kMaxRecvLength);
+#endif
 
-	return dataLength > 0 ? eSockRecv_OK : eSockRecv_NoData;
+	return returnCode;
 }
 
-SocketRecvReturnCode Socket::recvSmartWithTimeout(std::string& data, unsigned int timeoutSecs) const
+// receives whatever's currently available on the socket without blocking (the socket itself is left in
+// blocking mode, we just use MSG_DONTWAIT for these calls). Used by the event-based connection engine, which
+// only calls this once the poller has said there's something to receive.
+SocketRecvReturnCode Socket::recvNonBlocking(std::string& data) const
 {
 	if (!isValid())
 		return eSockRecv_Error;
 
-	int dataLength = 0;
-
-	char buffer[kMaxRecvLength + 1];
-
-	int ret = 0;
+	unsigned int dataLength = 0;
 
-	// check if there's anything for us with a time-out...
-	struct pollfd fd;
-	fd.fd = m_sock;
-	fd.events = POLLIN | POLLPRI;// | POLLOUT;
-	// Note: we don't need to specify POLLERR or POLLHUP, as these are automatic according
-	//       to the poll() man page
-	unsigned int timeoutMS = timeoutSecs * 1000; // poll() deals in ms...
-	
-	bool timedOut = false;
-	
-	unsigned int loopCount = 0;
+	char buffer[kMaxRecvLength];
 
-	do
+	while (true)
 	{
-		if (timeoutSecs > 0)
+		int ret = ::recv(m_sock, buffer, kMaxRecvLength, MSG_DONTWAIT);
+
+		if (ret > 0)
 		{
-			int pollResult = poll(&fd, 1, timeoutMS);
-			if (pollResult == -1)
+			data.append(buffer, ret);
+			dataLength += ret;
+
+			if (ret < (int)kMaxRecvLength)
 			{
-				// there's been an error...
-	//			break;
-				return eSockRecv_Error;
+				// there's very likely nothing else there currently, so save the extra syscall...
+				break;
 			}
-			else if (pollResult == 0)
+		}
+		else if (ret == 0)
+		{
+			// the other side closed the connection, but return what we did get first if we got anything...
+			return dataLength > 0 ? eSockRecv_OK : eSockRecv_PeerClosed;
+		}
+		else
+		{
+			int errorNumber = errno;
+			if (errorNumber == EAGAIN || errorNumber == EWOULDBLOCK)
 			{
-				// timed out...
-				timedOut = true;
+				// nothing more for us currently
 				break;
 			}
-			
-			if (fd.revents & POLLERR)
+			else if (errorNumber == EINTR)
 			{
-				// an error occurred, possibly the socket was closed on the other end.
-				break;
+				continue;
 			}
-			else if (fd.revents & POLLHUP)
+			else if (errorNumber == ECONNRESET)
 			{
-				// peer closed its end of the socket
-				break;
+				return eSockRecv_PeerClosed;
 			}
-		}
 
-		// otherwise we should have data to receive...
-		
-		// TODO: is this necessary given we're appending a NULL to the end of the buffer below? Possibly good practice, but
-		//       but could cost us a bit in performance... Currently this code isn't used for anything performance-critical, but...
-		memset(buffer, 0, sizeof(buffer));
+			return dataLength > 0 ? eSockRecv_OK : eSockRecv_Error;
+		}
+	}
 
-		// TODO: we could also receive into a larger windowed buffer, and only do the conversion to std::string once at the end (or
-		//       at least not as often).
+	return dataLength > 0 ? eSockRecv_OK : eSockRecv_NoData;
+}
 
-		ret = ::recv(m_sock, buffer, kMaxRecvLength, 0);
+SocketRecvReturnCode Socket::recv(RecvBuffer& buffer, unsigned int timeoutSecs) const
+{
+	if (!isValid())
+		return eSockRecv_Error;
 
-		if (ret > 0)
+	if (timeoutSecs > 0)
+	{
+		struct pollfd fd;
+		fd.fd = m_sock;
+		fd.events = POLLIN | POLLPRI;
+		// Note: we don't need to specify POLLERR or POLLHUP, as these are automatic according
+		//       to the poll() man page. If either is set, the recv() below will tell us what happened.
+		int pollResult = poll(&fd, 1, timeoutSecs * 1000);
+		if (pollResult == -1)
 		{
-			buffer[ret] = '\0';
-
-			data.append(buffer);
-			dataLength += ret;
-			
-			// check it's a POST request
-			if (!StringHelpers::beginsWithStaticConst(data, "POST"))
-				continue;
-
-			// check there was no data payload
-			if (!StringHelpers::endsWithStaticConst(data, "\r\n\r\n"))
-				continue;
+			return eSockRecv_Error;
+		}
+		else if (pollResult == 0)
+		{
+			return eSockRecv_TimedOutNoData;
+		}
+	}
 
-			// otherwise, we've got a POST request with no form data, so try and find the Content-Length:
+	return recvAvailable(buffer, 0);
+}
 
-			size_t contentLengthStart = data.find("Content-Length:");
-			if (contentLengthStart == std::string::npos)
-				continue;
+SocketRecvReturnCode Socket::recvNonBlocking(RecvBuffer& buffer) const
+{
+	if (!isValid())
+		return eSockRecv_Error;
 
-			size_t contentLengthDataStart = contentLengthStart + 15;
+	return recvAvailable(buffer, MSG_DONTWAIT);
+}
 
-			size_t lineEnd = data.find('\r', contentLengthDataStart);
-			if (lineEnd != std::string::npos)
-			{
-				std::string contentLengthString = data.substr(contentLengthDataStart, lineEnd - contentLengthDataStart);
+SocketRecvReturnCode Socket::recvAvailable(RecvBuffer& buffer, int flags) const
+{
+	size_t dataLength = 0;
 
-				unsigned int contentLengthVal = atoi(contentLengthString.c_str());
+	while (true)
+	{
+		char* pWritePointer = buffer.getWritePointer(kMaxRecvLength);
+		size_t writeSpace = buffer.getWriteSpace();
 
-				if (contentLengthVal > 0)
-				{
-					ret = ::recv(m_sock, buffer, kMaxRecvLength, 0);
+		ssize_t ret = ::recv(m_sock, pWritePointer, writeSpace, flags);
 
-					buffer[ret] = '\0';
+		if (ret > 0)
+		{
+			buffer.commitWrite(ret);
+			dataLength += ret;
 
-					data.append(buffer);
-					dataLength += ret;
-				}
+			if ((size_t)ret < writeSpace)
+			{
+				// there's very likely nothing else there currently, so save the extra syscall...
+				break;
 			}
+
+			// there might be more, but we don't want to block waiting for it if not
+			flags |= MSG_DONTWAIT;
+		}
+		else if (ret == 0)
+		{
+			// the other side closed the connection, but return what we did get first if we got anything...
+			return dataLength > 0 ? eSockRecv_OK : eSockRecv_PeerClosed;
 		}
 		else
 		{
-			// if ret == 0, it was very likely closed by the client.
-			break;
+			int errorNumber = errno;
+			if (errorNumber == EAGAIN || errorNumber == EWOULDBLOCK)
+			{
+				// nothing more for us currently
+				break;
+			}
+			else if (errorNumber == EINTR)
+			{
+				continue;
+			}
+			else if (errorNumber == ECONNRESET)
+			{
+				return dataLength > 0 ? eSockRecv_OK : eSockRecv_PeerClosed;
+			}
+
+			return dataLength > 0 ? eSockRecv_OK : eSockRecv_Error;
 		}
-		
-		loopCount += 1;
-	}
-	while (ret >= kMaxRecvLength);
-	
-	if (timedOut)
-	{
-		return dataLength > 0 ? eSockRecv_TimedOutWithData : eSockRecv_TimedOutNoData;
 	}
 
 	return dataLength > 0 ? eSockRecv_OK : eSockRecv_NoData;
 }
 
-SocketRecvReturnCode Socket::recvWithTimeout(std::string& data, unsigned int timeoutSecs) const
-{
-	unsigned int dataLength = 0;
-	SocketRecvReturnCode returnCode;
-#if USE_POLL_FOR_RECV_TIMEOUT
-	returnCode = recvWithTimeoutPoll(data, dataLength, timeoutSecs);
-#else
-	returnCode = recvWithTimeoutSockOpt(data, dataLength, timeoutSecs);
-
-#endif
-
-	return returnCode;
-}
-
 int Socket::peekRecv() const
 {
 	if (!isValid())
@@ -688,7 +1006,7 @@ SocketRecvReturnCode Socket::recvWithTimeoutPoll(std::string& data, unsigned int
 
 	dataLength = 0;
 
-	char buffer[kMaxRecvLength + 1];
+	char buffer[kMaxRecvLength];
 
 	int ret = 0;
 
@@ -728,20 +1046,11 @@ SocketRecvReturnCode Socket::recvWithTimeoutPoll(std::string& data, unsigned int
 
 		// otherwise we should have data to receive...
 		
-		// TODO: is this necessary given we're appending a NULL to the end of the buffer below? Possibly good practice, but
-		//       but could cost us a bit in performance... Currently this code isn't used for anything performance-critical, but...
-		memset(buffer, 0, sizeof(buffer));
-
-		// TODO: we could also receive into a larger windowed buffer, and only do the conversion to std::string once at the end (or
-		//       at least not as often).
-
 		ret = ::recv(m_sock, buffer, kMaxRecvLength, 0);
 
 		if (ret > 0)
 		{
-			buffer[ret] = '\0';
-
-			data.append(buffer);
+			data.append(buffer, ret);
 			dataLength += ret;
 		}
 		else
@@ -762,7 +1071,7 @@ SocketRecvReturnCode Socket::recvWithTimeoutSockOpt(std::string& data, unsigned
 
 	dataLength = 0;
 
-	char buffer[kMaxRecvLength + 1];
+	char buffer[kMaxRecvLength];
 
 	int ret = 0;
 
@@ -785,13 +1094,6 @@ SocketRecvReturnCode Socket::recvWithTimeoutSockOpt(std::string& data, unsigned
 
 	do
 	{
-		// TODO: is this necessary given we're appending a NULL to the end of the buffer below? Possibly good practice, but
-		//       but could cost us a bit in performance... Currently this code isn't used for anything performance-critical, but...
-		memset(buffer, 0, sizeof(buffer));
-
-		// TODO: we could also receive into a larger windowed buffer, and only do the conversion to std::string once at the end (or
-		//       at least not as often).
-
 		ret = ::recv(m_sock, buffer, kMaxRecvLength, 0);
 
 		if (ret == -1)
@@ -802,9 +1104,7 @@ SocketRecvReturnCode Socket::recvWithTimeoutSockOpt(std::string& data, unsigned
 		}
 		else if (ret > 0)
 		{
-			buffer[ret] = '\0';
-
-			data.append(buffer);
+			data.append(buffer, ret);
 			dataLength += ret;
 		}
 		else
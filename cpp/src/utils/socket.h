@@ -24,9 +24,11 @@
 
 #include <cstdio>
 #include <cstring>
+#include <chrono>
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <string.h>
@@ -35,6 +37,8 @@
 
 #include "logger.h"
 
+class RecvBuffer;
+
 enum SocketRecvReturnCodeType
 {
 	eSockRecv_OK,
@@ -58,6 +62,26 @@ struct SocketRecvReturnCode
 	SocketRecvReturnCodeType type = eSockRecv_Error;
 };
 
+// the time by which a send (or series of sends, i.e. all of a response's) must have completed
+struct SendDeadline
+{
+	SendDeadline()
+	{
+	}
+
+	// a deadline timeoutSecs from now, or no deadline if timeoutSecs is 0
+	explicit SendDeadline(unsigned int timeoutSecs) : enabled(timeoutSecs > 0)
+	{
+		if (enabled)
+		{
+			time = std::chrono::steady_clock::now() + std::chrono::seconds(timeoutSecs);
+		}
+	}
+
+	std::chrono::steady_clock::time_point	time;
+	bool									enabled = false;
+};
+
 class Socket
 {
 public:
@@ -75,7 +99,8 @@ public:
 
 	enum SocketOptionFlags
 	{
-		SOCKOPT_FASTOPEN			= 1 << 0
+		SOCKOPT_FASTOPEN			= 1 << 0,
+		SOCKOPT_REUSEPORT			= 1 << 1
 	};
 	
 	bool create(Logger* pLogger, unsigned int flags, bool v6);
@@ -87,19 +112,87 @@ public:
 	bool connect();
 	bool connect(const std::string& host, const int port);
 	void close();
+	// closes the socket descriptor without shutting the socket down first, which for listening sockets
+	// shared with another process (i.e. after an upgrade handoff) would stop that process accepting on it too.
+	void closeWithoutShutdown();
+	
+	// takes ownership of an existing bound and listening socket descriptor (i.e. one received from another process)
+	bool adoptListeningSocket(Logger* pLogger, int socketFD);
+	
+	bool setNonBlocking(bool nonBlocking);
 	
 	bool setRecvTimeoutOption(int timeoutSeconds);
+
+	// max time (in seconds) each send can take to send all its data when the client isn't reading it as fast as
+	// we're sending it, after which the send fails. 0 means no limit.
+	// Note: this also sets SO_SNDTIMEO, so that layers which do their own sends on the socket (i.e. TLS) don't
+	//       block forever either.
+	bool setSendTimeout(unsigned int timeoutSecs);
+	unsigned int getSendTimeout() const
+	{
+		return m_sendTimeoutSecs;
+	}
 	
-	bool send(const std::string& data) const;
-	bool send(unsigned char* pData, size_t dataLength) const;
+	bool send(const std::string& data, const SendDeadline* pDeadline = nullptr) const;
+	bool send(unsigned char* pData, size_t dataLength, const SendDeadline* pDeadline = nullptr) const;
+	// sends all the buffers (i.e. a response header and body) with as few syscalls as possible, without them needing
+	// to be copied together first. If moreToFollow is set, the kernel is told more data is about to be sent (with
+	// MSG_MORE, where supported), so a partial packet isn't sent straight away.
+	// Sends never block in the kernel: partial writes are resumed once the socket is writable again, which is waited
+	// for up until pDeadline, or if that's nullptr, the send timeout from when this was called.
+	bool sendv(const struct iovec* pIOVecs, unsigned int count, bool moreToFollow = false, const SendDeadline* pDeadline = nullptr) const;
+
+	// sends length bytes of the file from offset with sendfile(), so the data doesn't need to be copied through user
+	// space. Partial sends are resumed in the same way as sendv(). Only supported on Linux, otherwise it returns false.
+	// Note: sendfile() can't be passed MSG_NOSIGNAL, so SIGPIPE needs to be ignored by the process.
+	bool sendFile(int fileFD, size_t offset, size_t length, const SendDeadline* pDeadline = nullptr) const;
+
+	// a single best-effort send which never waits for the socket to be writable (i.e. for sending a short response to
+	// a connection we're rejecting, without tying up the thread). Returns true only if all the data was sent.
+	bool sendNonBlocking(const std::string& data) const;
+
+	static bool isSendFileSupported();
+
+	// waits for the socket to be writable, up until the deadline (if it's enabled)
+	bool waitForWritable(const SendDeadline& deadline) const;
 
 	SocketRecvReturnCode recv(std::string& data) const;
-	SocketRecvReturnCode recvSmart(std::string& data) const;
-	SocketRecvReturnCode recvSmartWithTimeout(std::string& data, unsigned int timeoutSecs) const;
+	// headerOnlyResponse is for receiving responses to HEAD requests, which don't have a body whatever their header says
+	SocketRecvReturnCode recvSmart(std::string& data, bool headerOnlyResponse = false) const;
+	SocketRecvReturnCode recvSmartWithTimeout(std::string& data, unsigned int timeoutSecs, bool headerOnlyResponse = false) const;
 	SocketRecvReturnCode recvWithTimeout(std::string& data, unsigned int timeoutSecs) const;
+	SocketRecvReturnCode recvNonBlocking(std::string& data) const;
+	
+	// waits up to timeoutSecs (or indefinitely if 0) for data to be available, and then receives whatever's
+	// available directly into the buffer.
+	SocketRecvReturnCode recv(RecvBuffer& buffer, unsigned int timeoutSecs) const;
+	SocketRecvReturnCode recvNonBlocking(RecvBuffer& buffer) const;
 	
 	int peekRecv() const;
 	
+	// the CPU which the kernel processed the incoming packets for this socket on (i.e. the NIC queue's CPU),
+	// or -1 if unknown / not supported.
+	int getIncomingCPU() const;
+	// for listening sockets in a SO_REUSEPORT group, this makes the kernel prefer this socket for
+	// connections received on this CPU.
+	bool setIncomingCPU(int cpu);
+	
+	// tuning options, mostly for listening sockets, as accepted sockets inherit them (other than TCP_DEFER_ACCEPT).
+	// These return false if the option couldn't be set or isn't supported on this platform.
+	// Note: socket buffer sizes need to be set before listen() to affect the TCP window scaling used.
+	bool setTCPDeferAccept(unsigned int timeoutSecs);
+	bool setTCPNoDelay(bool noDelay);
+	bool setTCPNotSentLowat(unsigned int numBytes);
+	bool setSendBufferSize(unsigned int numBytes);
+	bool setRecvBufferSize(unsigned int numBytes);
+	// sets SO_LINGER with a zero timeout, so that closing the socket resets the connection straight away,
+	// discarding anything which hasn't been sent yet.
+	bool setAbortiveClose();
+
+	// returns the current value of an integer socket option (i.e. to see what the kernel actually applied),
+	// or -1 if it couldn't be got.
+	int getIntOption(int level, int optionName) const;
+	
 	bool isValid() const { return m_sock != -1; }
 	
 	// don't really like this...
@@ -111,6 +204,10 @@ public:
 */
 	
 protected:
+	// receives until there's nothing more immediately available (only the first recv() call will block,
+	// unless MSG_DONTWAIT is in flags).
+	SocketRecvReturnCode recvAvailable(RecvBuffer& buffer, int flags) const;
+	
 	SocketRecvReturnCode recvWithTimeoutPoll(std::string& data, unsigned int& dataLength, unsigned int timeoutSecs) const;
 	SocketRecvReturnCode recvWithTimeoutSockOpt(std::string& data, unsigned int& dataLength, unsigned int timeoutSecs) const;
 
@@ -123,6 +220,8 @@ protected:
 	int					m_port;
 	std::string			m_host;
 
+	unsigned int		m_sendTimeoutSecs;
+
 	// really dislike this, but again, there aren't really "better" options...
 	Logger*				m_pLogger;
 	
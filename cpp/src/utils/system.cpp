@@ -19,6 +19,10 @@
 #include "system.h"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
 
 #include <memory>
 #include <unistd.h>
@@ -27,6 +31,8 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include "string_helpers.h"
+
 #ifndef _MSC_VER
 #if __APPLE__
 #include <mach/host_info.h>
@@ -35,11 +41,37 @@
 #include <sys/sysctl.h>
 #else
 // linux / unix
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 #endif
 #else
 #include <windows.h>
 #endif
 
+#ifdef CPU_SETSIZE
+static const unsigned long kMaxCPUIndex = CPU_SETSIZE - 1;
+#else
+static const unsigned long kMaxCPUIndex = 1023;
+#endif
+
+// parses a single CPU index, which must be all digits, and a CPU we could actually set the affinity for
+static bool parseCPUIndex(const std::string& value, unsigned int& cpu)
+{
+	if (value.empty() || !isdigit((unsigned char)value[0]))
+		return false;
+
+	char* pEnd = nullptr;
+	errno = 0;
+	unsigned long parsedValue = strtoul(value.c_str(), &pEnd, 10);
+	if (errno == ERANGE || *pEnd != 0 || parsedValue > kMaxCPUIndex)
+		return false;
+
+	cpu = (unsigned int)parsedValue;
+	return true;
+}
+
 System::System()
 {
 
@@ -236,3 +268,109 @@ float System::getLoadAverage()
 {
 	return 1.0f;
 }
+
+bool System::parseCPUList(const std::string& cpuList, std::vector<unsigned int>& aCPUs)
+{
+	std::vector<std::string> aItems;
+	StringHelpers::split(cpuList, aItems, ",");
+
+	for (const std::string& item : aItems)
+	{
+		if (item.empty())
+			continue;
+
+		std::string rangeStart;
+		std::string rangeEnd;
+		if (StringHelpers::splitInTwo(item, rangeStart, rangeEnd, "-"))
+		{
+			unsigned int startCPU = 0;
+			unsigned int endCPU = 0;
+			if (!parseCPUIndex(rangeStart, startCPU) || !parseCPUIndex(rangeEnd, endCPU) || endCPU < startCPU)
+				return false;
+
+			for (unsigned int cpu = startCPU; cpu <= endCPU; cpu++)
+			{
+				aCPUs.emplace_back(cpu);
+			}
+		}
+		else
+		{
+			unsigned int cpu = 0;
+			if (!parseCPUIndex(item, cpu))
+				return false;
+
+			aCPUs.emplace_back(cpu);
+		}
+	}
+
+	return !aCPUs.empty();
+}
+
+bool System::setCurrentThreadCPUAffinity(const std::vector<unsigned int>& aCPUs)
+{
+#ifdef __linux__
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	for (unsigned int cpu : aCPUs)
+	{
+		if (cpu < CPU_SETSIZE)
+		{
+			CPU_SET(cpu, &cpuSet);
+		}
+	}
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+	return false;
+#endif
+}
+
+bool System::getCPUNUMANodes(std::vector<int>& aCPUNodes)
+{
+#ifdef __linux__
+	bool foundAny = false;
+
+	// node numbers can in theory be sparse, so check a reasonable range of them
+	for (unsigned int node = 0; node < 64; node++)
+	{
+		char szPath[128];
+		snprintf(szPath, 128, "/sys/devices/system/node/node%u/cpulist", node);
+
+		FILE* pFile = fopen(szPath, "r");
+		if (!pFile)
+			continue;
+
+		char szCPUList[1024];
+		memset(szCPUList, 0, sizeof(szCPUList));
+		if (fgets(szCPUList, sizeof(szCPUList), pFile))
+		{
+			std::string cpuList(szCPUList);
+			// remove the trailing newline
+			while (!cpuList.empty() && (cpuList.back() == '\n' || cpuList.back() == ' '))
+			{
+				cpuList.pop_back();
+			}
+
+			std::vector<unsigned int> aNodeCPUs;
+			if (parseCPUList(cpuList, aNodeCPUs))
+			{
+				for (unsigned int cpu : aNodeCPUs)
+				{
+					if (cpu >= aCPUNodes.size())
+					{
+						aCPUNodes.resize(cpu + 1, -1);
+					}
+					aCPUNodes[cpu] = (int)node;
+				}
+				foundAny = true;
+			}
+		}
+
+		fclose(pFile);
+	}
+
+	return foundAny;
+#else
+	return false;
+#endif
+}
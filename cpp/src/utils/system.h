@@ -20,6 +20,7 @@
 #define SYSTEM_H
 
 #include <string>
+#include <vector>
 #include <cstdint>
 
 class System
@@ -37,6 +38,17 @@ public:
 	static size_t getProcessCurrentMemUsage();
 
 	static float getLoadAverage();
+
+	// parses a Linux-style CPU list string, i.e. "0-3,8,10-11". Returns false if any of the items aren't valid
+	// CPU numbers (or are larger than the affinity functions support).
+	static bool parseCPUList(const std::string& cpuList, std::vector<unsigned int>& aCPUs);
+
+	// pins the calling thread to the specified CPUs. Currently only supported on Linux.
+	static bool setCurrentThreadCPUAffinity(const std::vector<unsigned int>& aCPUs);
+
+	// fills in the NUMA node for each CPU (indexed by CPU number) from sysfs.
+	// Returns false if the information isn't available (i.e. not Linux).
+	static bool getCPUNUMANodes(std::vector<int>& aCPUNodes);
 };
 
 #endif // SYSTEM_H
@@ -0,0 +1,91 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#include "thread_parker.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstdint>
+#else
+#include <chrono>
+#endif
+
+ThreadParker::ThreadParker() :
+	m_parked(false),
+	m_inIdleQueue(false)
+#ifdef __linux__
+	, m_eventFD(-1)
+#else
+	, m_signalled(false)
+#endif
+{
+#ifdef __linux__
+	m_eventFD = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#endif
+}
+
+ThreadParker::~ThreadParker()
+{
+#ifdef __linux__
+	if (m_eventFD != -1)
+	{
+		::close(m_eventFD);
+		m_eventFD = -1;
+	}
+#endif
+}
+
+bool ThreadParker::park(unsigned int timeoutMS)
+{
+#ifdef __linux__
+	struct pollfd fd;
+	fd.fd = m_eventFD;
+	fd.events = POLLIN;
+	fd.revents = 0;
+
+	int ret = poll(&fd, 1, (int)timeoutMS);
+	if (ret <= 0)
+		return false;
+
+	// reset the counter
+	uint64_t value = 0;
+	ssize_t readRet = ::read(m_eventFD, &value, sizeof(value));
+	return readRet == sizeof(value);
+#else
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	bool woken = m_event.wait_for(lock, std::chrono::milliseconds(timeoutMS), [this]{ return m_signalled; });
+	m_signalled = false;
+	return woken;
+#endif
+}
+
+void ThreadParker::unpark()
+{
+#ifdef __linux__
+	uint64_t value = 1;
+	ssize_t ret = ::write(m_eventFD, &value, sizeof(value));
+	(void)ret;
+#else
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_signalled = true;
+	m_event.notify_one();
+#endif
+}
@@ -0,0 +1,83 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef THREAD_PARKER_H
+#define THREAD_PARKER_H
+
+#include <atomic>
+
+#ifndef __linux__
+#include <mutex>
+#include <condition_variable>
+#endif
+
+// A per-thread parking slot, so that a specific thread can be woken without waking any others.
+// On Linux this uses an eventfd, elsewhere a mutex / condition variable pair.
+// Wake-ups are "sticky": if unpark() is called before park(), the next park() returns immediately.
+class ThreadParker
+{
+public:
+	ThreadParker();
+	~ThreadParker();
+
+	ThreadParker(const ThreadParker& rhs) = delete;
+	ThreadParker& operator=(const ThreadParker& rhs) = delete;
+
+	// blocks until unpark() is called or the timeout expires. Returns true if it was woken.
+	bool park(unsigned int timeoutMS);
+
+	void unpark();
+
+	// the parked state is managed by the caller, and is used to determine whether a thread
+	// needs waking or not: claimUnpark() atomically clears it, and returns whether it was set.
+	void setParked(bool parked)
+	{
+		m_parked.store(parked, std::memory_order_seq_cst);
+	}
+
+	bool claimUnpark()
+	{
+		return m_parked.exchange(false, std::memory_order_seq_cst);
+	}
+
+	// whether the thread has an entry in a queue of idle threads (also managed by the caller), so that
+	// it only ever has one: markInIdleQueue() returns false if it was already set.
+	bool markInIdleQueue()
+	{
+		return !m_inIdleQueue.exchange(true, std::memory_order_seq_cst);
+	}
+
+	void clearInIdleQueue()
+	{
+		m_inIdleQueue.store(false, std::memory_order_seq_cst);
+	}
+
+protected:
+	std::atomic<bool>			m_parked;
+	std::atomic<bool>			m_inIdleQueue;
+
+#ifdef __linux__
+	int							m_eventFD;
+#else
+	std::mutex					m_lock;
+	std::condition_variable		m_event;
+	bool						m_signalled;
+#endif
+};
+
+#endif // THREAD_PARKER_H
@@ -0,0 +1,261 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Tests for WebResponseAdvancedBinaryFile's byte range support: parsing Range header field values, and the 206 and
+// 416 responses sent for them, both through sendFileData() and with the file being read and sent in chunks.
+
+#include "test_harness.h"
+#include "test_fixtures.h"
+
+#include "server/web_response_advanced_binary_file.h"
+#include "server/web_response.h"
+#include "server/web_request.h"
+#include "server/configuration.h"
+#include "utils/logger.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+// so the range parsing can be tested directly
+class TestBinaryFile : public WebResponseAdvancedBinaryFile
+{
+public:
+	using WebResponseAdvancedBinaryFile::ByteRange;
+	using WebResponseAdvancedBinaryFile::parseRangeHeader;
+};
+
+static bool rangesMatch(const std::vector<TestBinaryFile::ByteRange>& aRanges, const std::vector<std::pair<size_t, size_t>>& aExpectedRanges)
+{
+	if (aRanges.size() != aExpectedRanges.size())
+		return false;
+
+	for (size_t i = 0; i < aRanges.size(); i++)
+	{
+		if (aRanges[i].start != aExpectedRanges[i].first || aRanges[i].length != aExpectedRanges[i].second)
+			return false;
+	}
+	return true;
+}
+
+static void testParseRangeHeader()
+{
+	std::vector<TestBinaryFile::ByteRange> aRanges;
+
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=0-499", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 0, 500 } }));
+
+	// suffix ranges
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=-300", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 700, 300 } }));
+
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=-5000", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 0, 1000 } }));
+
+	// open-ended, and past the end of the file, which are both limited to the end of it
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=900-", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 900, 100 } }));
+
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=500-2000", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 500, 500 } }));
+
+	// several ranges, with whitespace and empty list elements, and a case-insensitive unit
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("Bytes=0-0, ,10-19 ,\t-1", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 0, 1 }, { 10, 10 }, { 999, 1 } }));
+
+	// overlapping and adjacent ranges are merged (and sorted)
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=0-,0-,0-,-1000", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 0, 1000 } }));
+
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=500-599,100-199,0-99,550-700,-10", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 0, 200 }, { 500, 201 }, { 990, 10 } }));
+
+	// valid, but not satisfiable, so there are no ranges (i.e. a 416 response)
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=1000-", 1000, aRanges));
+	TEST_CHECK(aRanges.empty());
+
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=-0", 1000, aRanges));
+	TEST_CHECK(aRanges.empty());
+
+	// only the satisfiable ones are kept
+	aRanges.clear();
+	TEST_CHECK(TestBinaryFile::parseRangeHeader("bytes=2000-3000,0-9", 1000, aRanges));
+	TEST_CHECK(rangesMatch(aRanges, { { 0, 10 } }));
+
+	// invalid, so the whole file should be sent instead
+	const char* aInvalidValues[] = { "bytes=", "bytes=500-400", "bytes=abc-", "bytes=0-1x", "bytes=1", "items=0-1", "0-1", "bytes=--1" };
+	for (const char* pValue : aInvalidValues)
+	{
+		aRanges.clear();
+		TEST_CHECK(!TestBinaryFile::parseRangeHeader(pValue, 1000, aRanges));
+	}
+
+	// too many ranges
+	std::string manyRanges = "bytes=0-0";
+	for (unsigned int i = 1; i < 17; i++)
+	{
+		manyRanges += "," + std::to_string(i * 2) + "-" + std::to_string(i * 2);
+	}
+	aRanges.clear();
+	TEST_CHECK(!TestBinaryFile::parseRangeHeader(manyRanges, 1000, aRanges));
+}
+
+static std::string generateTestContent(size_t size)
+{
+	std::string content;
+	for (size_t i = 0; i < size; i++)
+	{
+		content += (char)('a' + (i % 26));
+	}
+	return content;
+}
+
+// sends the response for the file to a GET request with the extra header fields, both with and without sendFileData(),
+// checking both ways send exactly the same thing
+static void getResponse(const TestFile& file, const std::string& extraHeaderFields, std::string& header, std::string& body)
+{
+	Logger logger;
+	Configuration configuration;
+
+	std::string rawRequest = "GET /video.mp4 HTTP/1.1\r\nHost: localhost\r\n" + extraHeaderFields + "\r\n";
+	WebRequest request(rawRequest);
+	TEST_CHECK(request.parse(logger));
+
+	std::string sentWithSendFile;
+	for (int useSendFile = 1; useSendFile >= 0; useSendFile--)
+	{
+		WebResponseParams responseParams(configuration, false);
+		TestConnectionSocket socket(logger, useSendFile == 1);
+
+		WebResponseAdvancedBinaryFile response(file.m_path);
+		response.setRequest(&request);
+		TEST_CHECK(response.sendResponse(&socket, responseParams));
+
+		// the multipart boundary is random, so only the bodies of the others can be compared
+		if (useSendFile == 1)
+		{
+			header = socket.getHeader();
+			body = socket.getBody();
+		}
+		else if (header.find("multipart/byteranges") == std::string::npos)
+		{
+			TEST_CHECK(socket.getHeader() == header);
+			TEST_CHECK(socket.getBody() == body);
+		}
+		else
+		{
+			TEST_CHECK_EQUAL(socket.getBody().size(), body.size());
+		}
+	}
+}
+
+static void testResponses()
+{
+	TestFile file(generateTestContent(1000), ".mp4");
+	std::string header;
+	std::string body;
+
+	// no Range, so the whole file
+	getResponse(file, "", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Accept-Ranges: bytes"));
+	TEST_CHECK(body == file.m_content);
+
+	// a single range
+	getResponse(file, "Range: bytes=100-199\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 206\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Content-Range: bytes 100-199/1000"));
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: 100"));
+	TEST_CHECK(hasHeaderLine(header, "Content-Type: video/mp4"));
+	TEST_CHECK(body == file.m_content.substr(100, 100));
+
+	getResponse(file, "Range: bytes=-10\r\n", header, body);
+	TEST_CHECK(hasHeaderLine(header, "Content-Range: bytes 990-999/1000"));
+	TEST_CHECK(body == file.m_content.substr(990));
+
+	// overlapping ranges are merged, so this is just the whole file as a single range
+	getResponse(file, "Range: bytes=0-,0-,0-\r\n", header, body);
+	TEST_CHECK(header.compare(0, 12, "HTTP/1.1 206") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Content-Range: bytes 0-999/1000"));
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: 1000"));
+	TEST_CHECK(body == file.m_content);
+
+	// several ranges, as multipart/byteranges
+	getResponse(file, "Range: bytes=0-9,500-504\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 206\r") == 0);
+	TEST_CHECK(header.find("Content-Type: multipart/byteranges; boundary=") != std::string::npos);
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: " + std::to_string(body.size())));
+
+	size_t boundaryPos = header.find("boundary=") + 9;
+	std::string boundary = header.substr(boundaryPos, header.find("\r\n", boundaryPos) - boundaryPos);
+	std::string expectedBody = "\r\n--" + boundary + "\r\nContent-Type: video/mp4\r\nContent-Range: bytes 0-9/1000\r\n\r\n" +
+							   file.m_content.substr(0, 10) +
+							   "\r\n--" + boundary + "\r\nContent-Type: video/mp4\r\nContent-Range: bytes 500-504/1000\r\n\r\n" +
+							   file.m_content.substr(500, 5) +
+							   "\r\n--" + boundary + "--\r\n";
+	TEST_CHECK(body == expectedBody);
+
+	// not satisfiable
+	getResponse(file, "Range: bytes=1000-1010\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 416\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Content-Range: bytes */1000"));
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: 0"));
+	TEST_CHECK(body.empty());
+
+	// invalid, so ignored
+	getResponse(file, "Range: bytes=200-100\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(body == file.m_content);
+
+	// If-Range for a different version of the file, so the whole of it is sent
+	getResponse(file, "Range: bytes=0-9\r\nIf-Range: Sun, 06 Nov 1994 08:49:37 GMT\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(body == file.m_content);
+
+	getResponse(file, "Range: bytes=0-9\r\nIf-Range: \"not-the-etag\"\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+
+	// and for the current version, using its ETag
+	getResponse(file, "", header, body);
+	size_t eTagPos = header.find("\r\nETag: ") + 8;
+	std::string eTag = header.substr(eTagPos, header.find("\r\n", eTagPos) - eTagPos);
+
+	getResponse(file, "Range: bytes=0-9\r\nIf-Range: " + eTag + "\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 206\r") == 0);
+	TEST_CHECK(body == file.m_content.substr(0, 10));
+}
+
+int main(int argc, char** argv)
+{
+	testParseRangeHeader();
+	testResponses();
+
+	return testsResult("Binary file range tests");
+}
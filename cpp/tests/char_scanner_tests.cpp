@@ -0,0 +1,175 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Tests that each of CharScanner's SIMD kernels the CPU supports gives the same results as the scalar one,
+// with the delimiters at every position relative to the SIMD chunk boundaries, including split across them.
+
+#include "test_harness.h"
+
+#include "utils/char_scanner.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+struct ScanResults
+{
+	size_t		headerEndPos;
+	size_t		lineEndPos;
+	size_t		separatorPos;
+
+	bool operator==(const ScanResults& other) const
+	{
+		return headerEndPos == other.headerEndPos && lineEndPos == other.lineEndPos && separatorPos == other.separatorPos;
+	}
+};
+
+static ScanResults scan(CharScanner::KernelType kernelType, const std::string& data)
+{
+	CharScanner::setKernelType(kernelType);
+
+	// copy to an exactly-sized allocation, so that any reads past the end are more likely to be caught
+	// (i.e. by AddressSanitizer)
+	std::vector<char> aData(data.begin(), data.end());
+
+	ScanResults results;
+	results.headerEndPos = CharScanner::findHeaderEnd(aData.data(), aData.size());
+	results.lineEndPos = CharScanner::findLineEnd(aData.data(), aData.size(), results.separatorPos);
+	return results;
+}
+
+static void checkKernelsMatch(const std::string& data)
+{
+	ScanResults scalarResults = scan(CharScanner::eKernelScalar, data);
+
+	const CharScanner::KernelType aKernelTypes[] = { CharScanner::eKernelSSE42, CharScanner::eKernelAVX2 };
+	for (CharScanner::KernelType kernelType : aKernelTypes)
+	{
+		if (kernelType > CharScanner::getKernelType())
+			continue;
+
+		ScanResults results = scan(kernelType, data);
+		if (!(results == scalarResults))
+		{
+			fprintf(stderr, "Kernel %d mismatch on data of length %zu: header end: %zu vs %zu, line end: %zu vs %zu, separator: %zu vs %zu\n",
+					(int)kernelType, data.size(), results.headerEndPos, scalarResults.headerEndPos, results.lineEndPos, scalarResults.lineEndPos,
+					results.separatorPos, scalarResults.separatorPos);
+			gNumTestFailures++;
+		}
+	}
+}
+
+static void testScalarResults()
+{
+	CharScanner::setKernelType(CharScanner::eKernelScalar);
+
+	const std::string header = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	TEST_CHECK_EQUAL(CharScanner::findHeaderEnd(header.data(), header.size()), header.size() - 4);
+	TEST_CHECK_EQUAL(CharScanner::findHeaderEnd(header.data(), header.size() - 1), CharScanner::npos);
+
+	size_t separatorPos = 0;
+	TEST_CHECK_EQUAL(CharScanner::findLineEnd(header.data(), header.size(), separatorPos), 15);
+	// the request line has a ':' in it, but not before the line end
+	TEST_CHECK_EQUAL(separatorPos, CharScanner::npos);
+
+	TEST_CHECK_EQUAL(CharScanner::findLineEnd(header.data() + 16, header.size() - 16, separatorPos), 16);
+	TEST_CHECK_EQUAL(separatorPos, 4);
+
+	// a ':' with no line end after it
+	TEST_CHECK_EQUAL(CharScanner::findLineEnd("Host: x", 7, separatorPos), CharScanner::npos);
+	TEST_CHECK_EQUAL(separatorPos, 4);
+}
+
+static void testDelimiterPositions()
+{
+	// every position of each delimiter within data long enough for several chunks of the widest kernel
+	const size_t kMaxLength = 100;
+	for (size_t length = 0; length <= kMaxLength; length++)
+	{
+		std::string base(length, 'a');
+		checkKernelsMatch(base);
+
+		for (size_t pos = 0; pos < length; pos++)
+		{
+			std::string data = base;
+			data.replace(pos, std::min((size_t)4, length - pos), std::string("\r\n\r\n").substr(0, length - pos));
+			checkKernelsMatch(data);
+
+			data = base;
+			data[pos] = ':';
+			checkKernelsMatch(data);
+
+			data = base;
+			data[pos] = '\n';
+			checkKernelsMatch(data);
+
+			// a separator after the line end shouldn't count
+			if (pos + 1 < length)
+			{
+				data[pos + 1] = ':';
+				checkKernelsMatch(data);
+			}
+		}
+	}
+}
+
+static void testPartialTerminators()
+{
+	// near misses, which the SSE4.2 kernel's ordered comparison reports as possible matches
+	const char* aPatterns[] = { "\r\n\r", "\r\n", "\r", "\r\r\n\r\n", "\r\n\r\r\n\r\n", "\n\r\n\r\n" };
+	for (const char* pPattern : aPatterns)
+	{
+		for (size_t prefixLength = 0; prefixLength < 70; prefixLength++)
+		{
+			std::string data = std::string(prefixLength, 'x') + pPattern;
+			checkKernelsMatch(data);
+			checkKernelsMatch(data + "yyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyyy");
+		}
+	}
+}
+
+static void testRandomData()
+{
+	// mostly delimiters, so there are lots of near misses
+	const char aChars[] = { '\r', '\n', ':', 'a' };
+
+	srand(42);
+	for (unsigned int i = 0; i < 20000; i++)
+	{
+		size_t length = rand() % 200;
+		std::string data(length, 'a');
+		for (size_t j = 0; j < length; j++)
+		{
+			data[j] = (rand() % 4 == 0) ? aChars[rand() % 4] : 'b';
+		}
+
+		checkKernelsMatch(data);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	fprintf(stderr, "Best supported CharScanner kernel: %d\n", (int)CharScanner::getKernelType());
+
+	testScalarResults();
+	testDelimiterPositions();
+	testPartialTerminators();
+	testRandomData();
+
+	return testsResult("CharScanner tests");
+}
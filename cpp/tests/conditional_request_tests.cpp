@@ -0,0 +1,199 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Tests for conditional requests: the HTTP date and ETag helpers, how If-None-Match and If-Modified-Since are
+// evaluated, and the 304 responses file responses send when the client already has the current version of the file.
+
+#include "test_harness.h"
+#include "test_fixtures.h"
+
+#include "server/web_response_advanced_binary_file.h"
+#include "server/web_response_generators.h"
+#include "server/web_response.h"
+#include "server/web_request.h"
+#include "server/configuration.h"
+#include "utils/logger.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// "Sun, 06 Nov 1994 08:49:37 GMT"
+static const time_t kTestTime = 784111777;
+
+static void testHTTPDates()
+{
+	TEST_CHECK(WebResponseCommon::formatHTTPDate(kTestTime) == "Sun, 06 Nov 1994 08:49:37 GMT");
+
+	time_t time = 0;
+	TEST_CHECK(WebResponseCommon::parseHTTPDate("Sun, 06 Nov 1994 08:49:37 GMT", time));
+	TEST_CHECK_EQUAL(time, kTestTime);
+
+	TEST_CHECK(WebResponseCommon::parseHTTPDate(WebResponseCommon::formatHTTPDate(1700000000), time));
+	TEST_CHECK_EQUAL(time, 1700000000);
+
+	// the obsolete formats aren't supported, and neither is anything else
+	TEST_CHECK(!WebResponseCommon::parseHTTPDate("Sunday, 06-Nov-94 08:49:37 GMT", time));
+	TEST_CHECK(!WebResponseCommon::parseHTTPDate("Sun Nov  6 08:49:37 1994", time));
+	TEST_CHECK(!WebResponseCommon::parseHTTPDate("Sun, 06 Nov 1994 08:49:37", time));
+	TEST_CHECK(!WebResponseCommon::parseHTTPDate("", time));
+}
+
+static void testFileETags()
+{
+	struct stat fileStat;
+	memset(&fileStat, 0, sizeof(fileStat));
+	fileStat.st_ino = 1234;
+	fileStat.st_size = 5000;
+	fileStat.st_mtime = kTestTime;
+
+	std::string eTag = WebResponseCommon::generateFileETag(fileStat);
+	TEST_CHECK(eTag.size() > 2 && eTag.front() == '"' && eTag.back() == '"');
+	TEST_CHECK(WebResponseCommon::generateFileETag(fileStat) == eTag);
+
+	// any change to the file should change it
+	fileStat.st_mtime++;
+	TEST_CHECK(WebResponseCommon::generateFileETag(fileStat) != eTag);
+	fileStat.st_mtime--;
+	fileStat.st_size++;
+	TEST_CHECK(WebResponseCommon::generateFileETag(fileStat) != eTag);
+}
+
+// whether a request with the extra header fields would get a 304 for a resource with the ETag and modification time
+static bool isNotModified(const std::string& extraHeaderFields, const std::string& method = "GET")
+{
+	Logger logger;
+
+	std::string rawRequest = method + " /index.html HTTP/1.1\r\nHost: localhost\r\n" + extraHeaderFields + "\r\n";
+	WebRequest request(rawRequest);
+	TEST_CHECK(request.parse(logger));
+
+	return WebResponseCommon::isNotModified(request, "\"abc-123\"", kTestTime);
+}
+
+static void testConditions()
+{
+	TEST_CHECK(!isNotModified(""));
+
+	// If-None-Match, with the weak comparison
+	TEST_CHECK(isNotModified("If-None-Match: \"abc-123\"\r\n"));
+	TEST_CHECK(isNotModified("If-None-Match: W/\"abc-123\"\r\n"));
+	TEST_CHECK(isNotModified("If-None-Match: \"xyz\", \"abc-123\"\r\n"));
+	TEST_CHECK(isNotModified("If-None-Match: *\r\n"));
+	TEST_CHECK(!isNotModified("If-None-Match: \"abc-1234\"\r\n"));
+	TEST_CHECK(!isNotModified("If-None-Match: abc-123\r\n"));
+
+	// If-Modified-Since
+	TEST_CHECK(isNotModified("If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n"));
+	TEST_CHECK(isNotModified("If-Modified-Since: Mon, 07 Nov 1994 08:49:37 GMT\r\n"));
+	TEST_CHECK(!isNotModified("If-Modified-Since: Sun, 06 Nov 1994 08:49:36 GMT\r\n"));
+	TEST_CHECK(!isNotModified("If-Modified-Since: yesterday\r\n"));
+
+	// If-Modified-Since is ignored if there's an If-None-Match, whether or not that matches
+	TEST_CHECK(!isNotModified("If-None-Match: \"xyz\"\r\nIf-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n"));
+	TEST_CHECK(isNotModified("If-None-Match: \"abc-123\"\r\nIf-Modified-Since: Sun, 06 Nov 1994 08:49:36 GMT\r\n"));
+
+	// only GET and HEAD requests can be answered with a 304
+	TEST_CHECK(isNotModified("If-None-Match: \"abc-123\"\r\n", "HEAD"));
+	TEST_CHECK(!isNotModified("If-None-Match: \"abc-123\"\r\nContent-Length: 0\r\n", "POST"));
+}
+
+// gets the response to a GET request with the extra header fields from both of the file response types, which should
+// be the same
+static void getFileResponse(const TestFile& file, const std::string& extraHeaderFields, std::string& header, std::string& body)
+{
+	Logger logger;
+	Configuration configuration;
+
+	std::string rawRequest = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n" + extraHeaderFields + "\r\n";
+	WebRequest request(rawRequest);
+	TEST_CHECK(request.parse(logger));
+
+	WebResponseParams responseParams(configuration, false);
+
+	WebResponseAdvancedBinaryFile binaryFileResponse(file.m_path);
+	binaryFileResponse.setRequest(&request);
+	TestConnectionSocket socket(logger);
+	TEST_CHECK(binaryFileResponse.sendResponse(&socket, responseParams));
+
+	header = socket.getHeader();
+	body = socket.getBody();
+
+	WebResponseGeneratorFile generatorResponse(file.m_path);
+	generatorResponse.setRequest(&request);
+	std::string generatorHeader;
+	std::string generatorBody;
+	generatorResponse.getResponse(responseParams, generatorHeader, generatorBody);
+
+	TEST_CHECK(generatorHeader.compare(0, 13, header.substr(0, 13)) == 0);
+	TEST_CHECK(generatorBody == body);
+}
+
+static void testFileResponses()
+{
+	TestFile file("<html><body>Test</body></html>\n", ".html");
+	file.setModificationTime(kTestTime);
+	std::string header;
+	std::string body;
+
+	getFileResponse(file, "", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT"));
+	TEST_CHECK(body == file.m_content);
+
+	TEST_CHECK(header.find("\r\nETag: \"") != std::string::npos);
+	size_t eTagPos = header.find("\r\nETag: ") + 8;
+	std::string eTag = header.substr(eTagPos, header.find("\r\n", eTagPos) - eTagPos);
+
+	// the client has the current version, so a 304 with the same validators, and no body
+	getFileResponse(file, "If-None-Match: " + eTag + "\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 304\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "ETag: " + eTag));
+	TEST_CHECK(hasHeaderLine(header, "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT"));
+	TEST_CHECK(header.find("Content-Length:") == std::string::npos);
+	TEST_CHECK(body.empty());
+
+	getFileResponse(file, "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 304\r") == 0);
+	TEST_CHECK(body.empty());
+
+	// an older version
+	getFileResponse(file, "If-None-Match: \"something-else\"\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(body == file.m_content);
+
+	getFileResponse(file, "If-Modified-Since: Sat, 05 Nov 1994 08:49:37 GMT\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(body == file.m_content);
+}
+
+int main(int argc, char** argv)
+{
+	testHTTPDates();
+	testFileETags();
+	testConditions();
+	testFileResponses();
+
+	return testsResult("Conditional request tests");
+}
@@ -0,0 +1,242 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Tests for HEAD requests: that the file and generated responses send the same header as they would for a GET
+// (including the Content-Length, where the response has one), but no body, including for conditional and
+// range requests.
+
+#include "test_harness.h"
+#include "test_fixtures.h"
+
+#include "server/web_response_advanced_binary_file.h"
+#include "server/web_response_generators.h"
+#include "server/web_response.h"
+#include "server/web_request.h"
+#include "server/configuration.h"
+#include "utils/logger.h"
+
+#include <string>
+
+static const std::string kTestFileContent = "<html><body>HEAD test</body></html>\n";
+
+// the header field lines of a response header, without the status line and any Date (which can change between responses)
+static std::string getComparableHeader(const std::string& header)
+{
+	std::string comparable;
+	size_t lineStart = header.find("\r\n") + 2;
+	while (lineStart < header.size())
+	{
+		size_t lineEnd = header.find("\r\n", lineStart) + 2;
+		std::string line = header.substr(lineStart, lineEnd - lineStart);
+		if (line.compare(0, 5, "Date:") != 0)
+		{
+			comparable += line;
+		}
+		lineStart = lineEnd;
+	}
+	return comparable;
+}
+
+// sends WebResponseAdvancedBinaryFile's response to a request, both with and without sendFileData(), checking both
+// ways send the same header, and returns what was sent with sendFileData().
+static void getBinaryFileResponse(const std::string& path, const std::string& method, const std::string& extraHeaderFields,
+								  bool useChunkedLargeFiles, std::string& header, std::string& body)
+{
+	Logger logger;
+	Configuration configuration;
+
+	std::string rawRequest = method + " /index.html HTTP/1.1\r\nHost: localhost\r\n" + extraHeaderFields + "\r\n";
+	WebRequest request(rawRequest);
+	TEST_CHECK(request.parse(logger));
+
+	for (int useSendFile = 1; useSendFile >= 0; useSendFile--)
+	{
+		WebResponseParams responseParams(configuration, false, request.isHeadRequest());
+		responseParams.useChunkedLargeFiles = useChunkedLargeFiles;
+		TestConnectionSocket socket(logger, useSendFile == 1);
+
+		WebResponseAdvancedBinaryFile response(path);
+		response.setRequest(&request);
+		TEST_CHECK(response.sendResponse(&socket, responseParams));
+
+		if (useSendFile == 1)
+		{
+			header = socket.getHeader();
+			body = socket.getBody();
+		}
+		else
+		{
+			TEST_CHECK(getComparableHeader(socket.getHeader()) == getComparableHeader(header));
+			TEST_CHECK(socket.getBody() == body);
+		}
+	}
+}
+
+// only the file generator uses the request itself (for conditional requests), the others just need the params
+static void getGeneratorResponse(WebResponseGenerator& generator, const std::string& method, const std::string& extraHeaderFields,
+								 std::string& header, std::string& body)
+{
+	Logger logger;
+	Configuration configuration;
+
+	std::string rawRequest = method + " /index.html HTTP/1.1\r\nHost: localhost\r\n" + extraHeaderFields + "\r\n";
+	WebRequest request(rawRequest);
+	TEST_CHECK(request.parse(logger));
+
+	WebResponseGeneratorFile* pFileGenerator = dynamic_cast<WebResponseGeneratorFile*>(&generator);
+	if (pFileGenerator)
+	{
+		pFileGenerator->setRequest(&request);
+	}
+
+	WebResponseParams responseParams(configuration, false, request.isHeadRequest());
+	generator.getResponse(responseParams, header, body);
+
+	if (pFileGenerator)
+	{
+		pFileGenerator->setRequest(nullptr);
+	}
+}
+
+static void testBinaryFileResponses()
+{
+	TestFile file(kTestFileContent, ".html");
+
+	std::string getHeader;
+	std::string getBody;
+	getBinaryFileResponse(file.m_path, "GET", "", false, getHeader, getBody);
+	TEST_CHECK(getBody == kTestFileContent);
+
+	// the same header as for the GET, with the file's Content-Length, but without the body
+	std::string header;
+	std::string body;
+	getBinaryFileResponse(file.m_path, "HEAD", "", false, header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: " + std::to_string(kTestFileContent.size())));
+	TEST_CHECK(getComparableHeader(header) == getComparableHeader(getHeader));
+	TEST_CHECK(body.empty());
+
+	// even when the GET response would be chunked, so the client still gets the length
+	getBinaryFileResponse(file.m_path, "HEAD", "", true, header, body);
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: " + std::to_string(kTestFileContent.size())));
+	TEST_CHECK(header.find("Transfer-Encoding:") == std::string::npos);
+	TEST_CHECK(body.empty());
+}
+
+static void testGeneratorResponses()
+{
+	TestFile file(kTestFileContent, ".html");
+
+	std::string getHeader;
+	std::string getBody;
+	std::string header;
+	std::string body;
+
+	WebResponseGeneratorFile fileResponse(file.m_path);
+	getGeneratorResponse(fileResponse, "GET", "", getHeader, getBody);
+	TEST_CHECK(getBody == kTestFileContent);
+
+	getGeneratorResponse(fileResponse, "HEAD", "", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: " + std::to_string(kTestFileContent.size())));
+	TEST_CHECK(getComparableHeader(header) == getComparableHeader(getHeader));
+	TEST_CHECK(body.empty());
+
+	// the 404 for a missing file still has the length of the body a GET would get
+	WebResponseGeneratorFile missingFileResponse(file.m_path + ".missing");
+	getGeneratorResponse(missingFileResponse, "GET", "", getHeader, getBody);
+	header.clear();
+	getGeneratorResponse(missingFileResponse, "HEAD", "", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 404\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: " + std::to_string(getBody.size())));
+	TEST_CHECK(body.empty());
+
+	// templates aren't rendered for HEAD requests, so there's no Content-Length
+	WebResponseGeneratorTemplateFile templateResponse(file.m_path, "content");
+	header.clear();
+	getGeneratorResponse(templateResponse, "HEAD", "", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(header.find("Content-Length:") == std::string::npos);
+	TEST_CHECK(body.empty());
+
+	WebResponseGeneratorTemplateFile missingTemplateResponse(file.m_path + ".missing", "content");
+	header.clear();
+	getGeneratorResponse(missingTemplateResponse, "HEAD", "", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 404\r") == 0);
+	TEST_CHECK(body.empty());
+
+	WebResponseGeneratorBasicText textResponse(200, "Some text.\n");
+	header.clear();
+	getGeneratorResponse(textResponse, "HEAD", "", header, body);
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: 11"));
+	TEST_CHECK(body.empty());
+}
+
+static void testConditionalResponses()
+{
+	TestFile file(kTestFileContent, ".html");
+
+	// get the validators to use
+	std::string getHeader;
+	std::string getBody;
+	getBinaryFileResponse(file.m_path, "GET", "", false, getHeader, getBody);
+	size_t eTagPos = getHeader.find("\r\nETag: ") + 8;
+	std::string eTag = getHeader.substr(eTagPos, getHeader.find("\r\n", eTagPos) - eTagPos);
+
+	std::string header;
+	std::string body;
+	getBinaryFileResponse(file.m_path, "HEAD", "If-None-Match: " + eTag + "\r\n", false, header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 304\r") == 0);
+	TEST_CHECK(body.empty());
+
+	WebResponseGeneratorFile fileResponse(file.m_path);
+	header.clear();
+	getGeneratorResponse(fileResponse, "HEAD", "If-None-Match: " + eTag + "\r\n", header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 304\r") == 0);
+	TEST_CHECK(body.empty());
+}
+
+static void testRangeResponses()
+{
+	TestFile file(kTestFileContent, ".html");
+
+	// range requests are only defined for GET (RFC 7233 3.1), so for HEAD the Range is ignored, and the header is the
+	// whole file's 200 one, still without a body
+	std::string header;
+	std::string body;
+	getBinaryFileResponse(file.m_path, "HEAD", "Range: bytes=0-9\r\n", false, header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(hasHeaderLine(header, "Content-Length: " + std::to_string(kTestFileContent.size())));
+	TEST_CHECK(header.find("Content-Range:") == std::string::npos);
+	TEST_CHECK(body.empty());
+
+	// including unsatisfiable ones, which would otherwise be a 416
+	getBinaryFileResponse(file.m_path, "HEAD", "Range: bytes=5000-\r\n", false, header, body);
+	TEST_CHECK(header.compare(0, 13, "HTTP/1.1 200\r") == 0);
+	TEST_CHECK(body.empty());
+}
+
+int main(int argc, char** argv)
+{
+	testBinaryFileResponses();
+	testGeneratorResponses();
+	testConditionalResponses();
+	testRangeResponses();
+
+	return testsResult("HEAD request tests");
+}
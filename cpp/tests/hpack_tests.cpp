@@ -0,0 +1,244 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Tests for the HPACK decoder and encoder, mostly using the examples from RFC 7541 Appendix C, which are decoded
+// in sequence with the same decoder, as their dynamic table state carries on from one block to the next.
+
+#include "test_harness.h"
+
+#include "server/hpack.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// the hex strings can contain spaces, as the RFC's examples are laid out in groups of 4
+static std::string fromHex(const char* pHex)
+{
+	std::string data;
+	std::string byteHex;
+	for (const char* pChar = pHex; *pChar; pChar++)
+	{
+		if (*pChar == ' ')
+			continue;
+
+		byteHex += *pChar;
+		if (byteHex.size() == 2)
+		{
+			data += (char)strtoul(byteHex.c_str(), nullptr, 16);
+			byteHex.clear();
+		}
+	}
+	return data;
+}
+
+static HPACKDecoder::DecodeResult decode(HPACKDecoder& decoder, const std::string& block, std::vector<HPACKHeaderField>& aFields)
+{
+	aFields.clear();
+	return decoder.decodeHeaderBlock((const unsigned char*)block.data(), block.size(), aFields);
+}
+
+static bool fieldsMatch(const std::vector<HPACKHeaderField>& aFields, const std::vector<HPACKHeaderField>& aExpectedFields)
+{
+	if (aFields.size() != aExpectedFields.size())
+		return false;
+
+	for (size_t i = 0; i < aFields.size(); i++)
+	{
+		if (aFields[i].name != aExpectedFields[i].name || aFields[i].value != aExpectedFields[i].value)
+			return false;
+	}
+	return true;
+}
+
+// C.2: literal header field representations, each on their own
+static void testLiteralFields()
+{
+	std::vector<HPACKHeaderField> aFields;
+
+	// C.2.1: with indexing
+	HPACKDecoder decoder;
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { "custom-key", "custom-header" } }));
+
+	// ...which is now dynamic table entry 62
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("be"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { "custom-key", "custom-header" } }));
+
+	// C.2.2: without indexing
+	HPACKDecoder decoder2;
+	TEST_CHECK_EQUAL(decode(decoder2, fromHex("040c 2f73 616d 706c 652f 7061 7468"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { ":path", "/sample/path" } }));
+	TEST_CHECK_EQUAL(decode(decoder2, fromHex("be"), aFields), HPACKDecoder::eDecodeInvalid);
+
+	// C.2.3: never indexed
+	HPACKDecoder decoder3;
+	TEST_CHECK_EQUAL(decode(decoder3, fromHex("1008 7061 7373 776f 7264 0673 6563 7265 74"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { "password", "secret" } }));
+	TEST_CHECK_EQUAL(decode(decoder3, fromHex("be"), aFields), HPACKDecoder::eDecodeInvalid);
+
+	// C.2.4: indexed
+	HPACKDecoder decoder4;
+	TEST_CHECK_EQUAL(decode(decoder4, fromHex("82"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { ":method", "GET" } }));
+}
+
+static const std::vector<HPACKHeaderField> kRequest1Fields = { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+															   { ":authority", "www.example.com" } };
+static const std::vector<HPACKHeaderField> kRequest2Fields = { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+															   { ":authority", "www.example.com" }, { "cache-control", "no-cache" } };
+static const std::vector<HPACKHeaderField> kRequest3Fields = { { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+															   { ":authority", "www.example.com" }, { "custom-key", "custom-value" } };
+
+// C.3: requests without Huffman coding
+static void testRequests()
+{
+	HPACKDecoder decoder;
+	std::vector<HPACKHeaderField> aFields;
+
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, kRequest1Fields));
+
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("8286 84be 5808 6e6f 2d63 6163 6865"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, kRequest2Fields));
+
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65"), aFields),
+					 HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, kRequest3Fields));
+}
+
+// C.4: the same requests with Huffman coding
+static void testHuffmanRequests()
+{
+	HPACKDecoder decoder;
+	std::vector<HPACKHeaderField> aFields;
+
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, kRequest1Fields));
+
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("8286 84be 5886 a8eb 1064 9cbf"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, kRequest2Fields));
+
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, kRequest3Fields));
+}
+
+// C.6: responses with Huffman coding, with a 256 byte dynamic table, so entries are evicted as new ones are added
+static void testHuffmanResponsesWithEviction()
+{
+	HPACKDecoder decoder;
+	std::vector<HPACKHeaderField> aFields;
+
+	// the examples assume the table size was set with SETTINGS_HEADER_TABLE_SIZE, so set it with a size update instead
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("3fe1 01"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(aFields.empty());
+
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 "
+											 "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { ":status", "302" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+									  { "location", "https://www.example.com" } }));
+
+	// ":status: 302" is evicted to make room for ":status: 307"
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("4883 640e ffc1 c0bf"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { ":status", "307" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+									  { "location", "https://www.example.com" } }));
+
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab "
+											 "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f "
+											 "9587 3160 65c0 03ed 4ee5 b106 3d50 07"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { ":status", "200" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:22 GMT" },
+									  { "location", "https://www.example.com" }, { "content-encoding", "gzip" },
+									  { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" } }));
+
+	// only the 3 entries added by that last block fit now, so the oldest of them is 64
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("c0"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { "date", "Mon, 21 Oct 2013 20:13:22 GMT" } }));
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("c1"), aFields), HPACKDecoder::eDecodeInvalid);
+}
+
+static void testHeaderListSize()
+{
+	const std::string block1 = fromHex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d");
+	const std::string block2 = fromHex("8286 84be 5808 6e6f 2d63 6163 6865");
+
+	std::vector<HPACKHeaderField> aFields;
+
+	// the first request's fields are 42 + 43 + 38 + 57 = 180 bytes, including the 32 bytes for each
+	HPACKDecoder decoder;
+	decoder.setMaxHeaderListSize(180);
+	TEST_CHECK_EQUAL(decode(decoder, block1, aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, kRequest1Fields));
+
+	HPACKDecoder decoder2;
+	decoder2.setMaxHeaderListSize(179);
+	TEST_CHECK_EQUAL(decode(decoder2, block1, aFields), HPACKDecoder::eDecodeHeaderListTooLarge);
+	// only the fields before the limit was exceeded are kept
+	TEST_CHECK_EQUAL(aFields.size(), 3);
+
+	// but the rest of the block must still have been decoded, so the dynamic table is still in sync
+	decoder2.setMaxHeaderListSize(0);
+	TEST_CHECK_EQUAL(decode(decoder2, block2, aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, kRequest2Fields));
+}
+
+static void testInvalidBlocks()
+{
+	std::vector<HPACKHeaderField> aFields;
+
+	// index 0 isn't valid
+	HPACKDecoder decoder;
+	TEST_CHECK_EQUAL(decode(decoder, fromHex("80"), aFields), HPACKDecoder::eDecodeInvalid);
+
+	// the string length runs past the end of the block
+	HPACKDecoder decoder2;
+	TEST_CHECK_EQUAL(decode(decoder2, fromHex("400a 6375 7374 6f6d"), aFields), HPACKDecoder::eDecodeInvalid);
+
+	// a table size update larger than the limit we've set
+	HPACKDecoder decoder3;
+	decoder3.setMaxTableSizeLimit(256);
+	TEST_CHECK_EQUAL(decode(decoder3, fromHex("3fe1 01"), aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK_EQUAL(decode(decoder3, fromHex("3fe2 01"), aFields), HPACKDecoder::eDecodeInvalid);
+}
+
+static void testEncoderRoundTrip()
+{
+	std::string block;
+	HPACKEncoder::encodeStatus(block, 200);
+	HPACKEncoder::encodeStatus(block, 431);
+	HPACKEncoder::encodeHeaderField(block, "content-type", "text/html");
+	HPACKEncoder::encodeHeaderField(block, "x-custom-header", std::string(300, 'a'));
+
+	HPACKDecoder decoder;
+	std::vector<HPACKHeaderField> aFields;
+	TEST_CHECK_EQUAL(decode(decoder, block, aFields), HPACKDecoder::eDecodeOK);
+	TEST_CHECK(fieldsMatch(aFields, { { ":status", "200" }, { ":status", "431" }, { "content-type", "text/html" },
+									  { "x-custom-header", std::string(300, 'a') } }));
+}
+
+int main(int argc, char** argv)
+{
+	testLiteralFields();
+	testRequests();
+	testHuffmanRequests();
+	testHuffmanResponsesWithEviction();
+	testHeaderListSize();
+	testInvalidBlocks();
+	testEncoderRoundTrip();
+
+	return testsResult("HPACK tests");
+}
@@ -0,0 +1,312 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Tests for RecvBuffer's incremental message framing.
+
+#include "test_harness.h"
+
+#include "utils/recv_buffer.h"
+
+#include <cstring>
+#include <string>
+
+static void appendData(RecvBuffer& buffer, const std::string& data)
+{
+	char* pWrite = buffer.getWritePointer(data.size());
+	memcpy(pWrite, data.data(), data.size());
+	buffer.commitWrite(data.size());
+}
+
+static void testSimpleRequest()
+{
+	RecvBuffer buffer;
+	size_t length = 0;
+
+	const std::string request = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+	// split the header terminator across receives
+	appendData(buffer, request.substr(0, request.size() - 2));
+	TEST_CHECK(!buffer.findCompleteRequest(length));
+
+	appendData(buffer, request.substr(request.size() - 2));
+	TEST_CHECK(buffer.findCompleteRequest(length));
+	TEST_CHECK_EQUAL(length, request.size());
+	TEST_CHECK_EQUAL(buffer.getHeaderLength(), request.size());
+	TEST_CHECK_EQUAL(buffer.getContentLength(), 0);
+}
+
+static void testContentLengthBody()
+{
+	RecvBuffer buffer;
+	size_t length = 0;
+
+	const std::string header = "POST /form HTTP/1.1\r\nContent-Length: 11\r\n\r\n";
+	appendData(buffer, header + "hello");
+	TEST_CHECK(!buffer.findCompleteRequest(length));
+
+	appendData(buffer, " world");
+	TEST_CHECK(buffer.findCompleteRequest(length));
+	TEST_CHECK_EQUAL(length, header.size() + 11);
+	TEST_CHECK_EQUAL(buffer.getContentLength(), 11);
+}
+
+static void testPipelinedRequests()
+{
+	RecvBuffer buffer;
+	size_t length = 0;
+
+	const std::string request1 = "GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	const std::string request2 = "POST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc";
+	const std::string request3 = "GET /c HTTP/1.1\r\n";
+
+	appendData(buffer, "\r\n" + request1 + request2 + request3);
+
+	// the leading empty line should be skipped
+	TEST_CHECK(buffer.findCompleteRequest(length));
+	TEST_CHECK_EQUAL(length, request1.size());
+	TEST_CHECK(buffer.getView(length) == request1);
+	buffer.consume(length);
+
+	TEST_CHECK(buffer.findCompleteRequest(length));
+	TEST_CHECK_EQUAL(length, request2.size());
+	TEST_CHECK(buffer.getView(length) == request2);
+	buffer.consume(length);
+
+	// the last one's incomplete
+	TEST_CHECK(!buffer.findCompleteRequest(length));
+	appendData(buffer, "\r\n");
+	TEST_CHECK(buffer.findCompleteRequest(length));
+	TEST_CHECK_EQUAL(length, request3.size() + 2);
+	buffer.consume(length);
+
+	TEST_CHECK(buffer.isEmpty());
+}
+
+static void testStreamedRequestBodies()
+{
+	// chunked and large bodies aren't waited for, so only the header is returned
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+
+		const std::string header = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+		appendData(buffer, header + "5\r\nhel");
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK_EQUAL(length, header.size());
+		TEST_CHECK(buffer.isChunkedBody());
+	}
+
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+
+		const std::string header = "POST /upload HTTP/1.1\r\nContent-Length: 10000000\r\n\r\n";
+		appendData(buffer, header);
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK_EQUAL(length, header.size());
+		TEST_CHECK_EQUAL(buffer.getContentLength(), 10000000);
+	}
+}
+
+static void testInvalidFraming()
+{
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		appendData(buffer, "POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n");
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK(buffer.hasInvalidBodyFraming());
+	}
+
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		appendData(buffer, "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\n");
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK(buffer.hasInvalidBodyFraming());
+	}
+
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		appendData(buffer, "POST / HTTP/1.1\r\nContent-Length: abc\r\n\r\n");
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK(buffer.hasInvalidBodyFraming());
+	}
+}
+
+static void testInvalidContentLengthValues()
+{
+	// strtoull() would otherwise accept all of these (wrapping the negative ones around)
+	const char* aValues[] = { "-1", "-0", "+5", "18446744073709551616", "99999999999999999999999999", "-18446744073709551615" };
+	for (const char* pValue : aValues)
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		appendData(buffer, std::string("POST / HTTP/1.1\r\nContent-Length: ") + pValue + "\r\n\r\n");
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK(buffer.hasInvalidBodyFraming());
+	}
+
+	{
+		// leading whitespace is fine though
+		RecvBuffer buffer;
+		size_t length = 0;
+		appendData(buffer, "POST / HTTP/1.1\r\nContent-Length: \t0\r\n\r\n");
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK(!buffer.hasInvalidBodyFraming());
+		TEST_CHECK_EQUAL(buffer.getContentLength(), 0);
+	}
+}
+
+static void testOversizedHeader()
+{
+	// no terminator yet, but already too big
+	{
+		RecvBuffer buffer;
+		buffer.setMaxHeaderSize(100);
+		size_t length = 0;
+		appendData(buffer, "GET / HTTP/1.1\r\nCookie: " + std::string(200, 'a'));
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK(buffer.hasOversizedHeader());
+	}
+
+	// complete, but too big
+	{
+		RecvBuffer buffer;
+		buffer.setMaxHeaderSize(100);
+		size_t length = 0;
+		appendData(buffer, "GET / HTTP/1.1\r\nCookie: " + std::string(90, 'a') + "\r\n\r\n");
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK(buffer.hasOversizedHeader());
+	}
+
+	// just within the limit
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		const std::string request = "GET / HTTP/1.1\r\nCookie: " + std::string(50, 'a') + "\r\n\r\n";
+		buffer.setMaxHeaderSize(request.size());
+		appendData(buffer, request);
+		TEST_CHECK(buffer.findCompleteRequest(length));
+		TEST_CHECK(!buffer.hasOversizedHeader());
+		TEST_CHECK_EQUAL(length, request.size());
+	}
+}
+
+static void testChunkedResponse()
+{
+	RecvBuffer buffer;
+	size_t length = 0;
+
+	const std::string header = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+	const std::string body = "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nX-Trailer: y\r\n\r\n";
+
+	appendData(buffer, header + "5\r\nhel");
+	TEST_CHECK(!buffer.findCompleteResponse(length, false));
+
+	appendData(buffer, "lo\r\n6;ext=1\r\n world\r\n0\r\n");
+	TEST_CHECK(!buffer.findCompleteResponse(length, false));
+
+	// with the start of the next response after it
+	appendData(buffer, "X-Trailer: y\r\n\r\nHTTP/1.1");
+	TEST_CHECK(buffer.findCompleteResponse(length, false));
+	TEST_CHECK_EQUAL(length, header.size() + body.size());
+}
+
+static void testInvalidChunkedResponse()
+{
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+
+		appendData(buffer, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n");
+		TEST_CHECK(buffer.findCompleteResponse(length, false));
+		TEST_CHECK(buffer.hasInvalidBodyFraming());
+	}
+
+	{
+		// would otherwise be taken as the last chunk
+		RecvBuffer buffer;
+		size_t length = 0;
+
+		appendData(buffer, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n-0\r\n\r\n");
+		TEST_CHECK(buffer.findCompleteResponse(length, false));
+		TEST_CHECK(buffer.hasInvalidBodyFraming());
+	}
+}
+
+static void testResponseBodyFraming()
+{
+	// Content-Length
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		const std::string header = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\n";
+		appendData(buffer, header + "ab");
+		TEST_CHECK(!buffer.findCompleteResponse(length, false));
+		appendData(buffer, "cd");
+		TEST_CHECK(buffer.findCompleteResponse(length, false));
+		TEST_CHECK_EQUAL(length, header.size() + 4);
+	}
+
+	// close-delimited
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		appendData(buffer, "HTTP/1.0 200 OK\r\n\r\nabc");
+		TEST_CHECK(!buffer.findCompleteResponse(length, false));
+		TEST_CHECK(buffer.isCloseDelimited());
+	}
+
+	// statuses which never have a body
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		const std::string response = "HTTP/1.1 304 Not Modified\r\nContent-Length: 100\r\n\r\n";
+		appendData(buffer, response);
+		TEST_CHECK(buffer.findCompleteResponse(length, false));
+		TEST_CHECK_EQUAL(length, response.size());
+	}
+
+	// responses to HEAD requests
+	{
+		RecvBuffer buffer;
+		size_t length = 0;
+		const std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n";
+		appendData(buffer, response);
+		TEST_CHECK(buffer.findCompleteResponse(length, true));
+		TEST_CHECK_EQUAL(length, response.size());
+	}
+}
+
+int main(int argc, char** argv)
+{
+	testSimpleRequest();
+	testContentLengthBody();
+	testPipelinedRequests();
+	testStreamedRequestBodies();
+	testInvalidFraming();
+	testInvalidContentLengthValues();
+	testOversizedHeader();
+	testChunkedResponse();
+	testInvalidChunkedResponse();
+	testResponseBodyFraming();
+
+	return testsResult("RecvBuffer tests");
+}
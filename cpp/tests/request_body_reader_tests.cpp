@@ -0,0 +1,243 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Tests for RequestBodyReader, using a connection socket which returns scripted data.
+
+#include "test_harness.h"
+#include "test_fixtures.h"
+
+#include "request_body_reader.h"
+#include "web_server_common.h"
+
+#include <cstring>
+#include <deque>
+#include <string>
+
+// sets up a connection with the given data already received (as if along with the header), and the rest to be
+// received in the given pieces.
+struct TestConnection
+{
+	TestConnection(const std::string& alreadyReceived, const std::deque<std::string>& aRecvData = std::deque<std::string>())
+	{
+		pSocket = new TestConnectionSocket(logger);
+		pSocket->m_aRecvData = aRecvData;
+		connection.pConnectionSocket = pSocket;
+
+		char* pWrite = connection.recvBuffer.getWritePointer(alreadyReceived.size());
+		memcpy(pWrite, alreadyReceived.data(), alreadyReceived.size());
+		connection.recvBuffer.commitWrite(alreadyReceived.size());
+
+		size_t requestLength = 0;
+		connection.recvBuffer.findCompleteRequest(requestLength);
+	}
+
+	RequestBodyReader createReader(size_t maxBodySize = 0)
+	{
+		const RecvBuffer& recvBuffer = connection.recvBuffer;
+		return RequestBodyReader(connection, recvBuffer.getHeaderLength(), recvBuffer.getContentLength(), recvBuffer.isChunkedBody(),
+								 maxBodySize, 1);
+	}
+
+	Logger					logger;
+	RequestConnection		connection;
+	// owned by the connection
+	TestConnectionSocket*	pSocket;
+};
+
+static void testContentLengthBody()
+{
+	TestConnection test("POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\nhell", { "o wo", "rldGET / HTTP/1.1\r\n\r\n" });
+	RequestBodyReader reader = test.createReader();
+
+	TEST_CHECK(reader.hasBody());
+	TEST_CHECK_EQUAL(reader.getContentLength(), 10);
+
+	std::string body;
+	TEST_CHECK(reader.readAll(body));
+	TEST_CHECK_EQUAL(body, "hello worl");
+	TEST_CHECK(reader.isComplete());
+
+	// the rest should be kept for the next request
+	reader.consumeRequest();
+	TEST_CHECK(test.connection.recvBuffer.getView(test.connection.recvBuffer.getSize()) == "dGET / HTTP/1.1\r\n\r\n");
+}
+
+static void testChunkedBody()
+{
+	// with the framing split awkwardly across receives
+	TestConnection test("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r", { "\nhel", "lo\r\n6;name=value\r\n wor", "ld\r\n0\r\nX-Trailer: 1\r\n", "\r\nNEXT" });
+	RequestBodyReader reader = test.createReader();
+
+	TEST_CHECK(reader.isChunked());
+	TEST_CHECK_EQUAL(reader.getContentLength(), 0);
+
+	std::string body;
+	TEST_CHECK(reader.readAll(body));
+	TEST_CHECK_EQUAL(body, "hello world");
+	TEST_CHECK(reader.isComplete());
+
+	reader.consumeRequest();
+	TEST_CHECK(test.connection.recvBuffer.getView(test.connection.recvBuffer.getSize()) == "NEXT");
+}
+
+static void testSmallReads()
+{
+	TestConnection test("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n");
+	RequestBodyReader reader = test.createReader();
+
+	char buffer[2];
+	std::string body;
+	long ret = 0;
+	while ((ret = reader.read(buffer, sizeof(buffer))) > 0)
+	{
+		TEST_CHECK(ret <= 2);
+		body.append(buffer, ret);
+	}
+
+	TEST_CHECK_EQUAL(ret, 0);
+	TEST_CHECK_EQUAL(body, "abcde");
+}
+
+static void testInvalidChunkedBody()
+{
+	{
+		TestConnection test("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nxyz\r\nabc\r\n0\r\n\r\n");
+		RequestBodyReader reader = test.createReader();
+
+		std::string body;
+		TEST_CHECK(!reader.readAll(body));
+		TEST_CHECK(!reader.exceededMaxSize());
+	}
+
+	// chunk data not followed by a CRLF
+	{
+		TestConnection test("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcdef\r\n0\r\n\r\n");
+		RequestBodyReader reader = test.createReader();
+
+		std::string body;
+		TEST_CHECK(!reader.readAll(body));
+	}
+
+	// connection closed part way through
+	{
+		TestConnection test("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n10\r\nabc");
+		RequestBodyReader reader = test.createReader();
+
+		std::string body;
+		TEST_CHECK(!reader.readAll(body));
+	}
+}
+
+static void testMaxBodySize()
+{
+	// chunked bodies are checked as they're read
+	{
+		TestConnection test("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n4\r\nabcd\r\n4\r\nefgh\r\n0\r\n\r\n");
+		RequestBodyReader reader = test.createReader(6);
+
+		std::string body;
+		TEST_CHECK(!reader.readAll(body));
+		TEST_CHECK(reader.exceededMaxSize());
+		TEST_CHECK_EQUAL(body, "abcd");
+	}
+
+	{
+		TestConnection test("POST / HTTP/1.1\r\nContent-Length: 8\r\n\r\nabcdefgh");
+		RequestBodyReader reader = test.createReader(6);
+
+		std::string body;
+		TEST_CHECK(!reader.readAll(body));
+		TEST_CHECK(reader.exceededMaxSize());
+	}
+
+	// exactly the limit is fine
+	{
+		TestConnection test("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nabcdef\r\n0\r\n\r\n");
+		RequestBodyReader reader = test.createReader(6);
+
+		std::string body;
+		TEST_CHECK(reader.readAll(body));
+		TEST_CHECK(!reader.exceededMaxSize());
+	}
+}
+
+static void testDiscardRemaining()
+{
+	TestConnection test("POST / HTTP/1.1\r\nContent-Length: 6\r\n\r\nabc", { "defNEXT" });
+	RequestBodyReader reader = test.createReader();
+
+	char buffer[2];
+	TEST_CHECK_EQUAL(reader.read(buffer, sizeof(buffer)), 2);
+	TEST_CHECK(reader.discardRemaining());
+	TEST_CHECK(reader.isComplete());
+
+	reader.consumeRequest();
+	TEST_CHECK(test.connection.recvBuffer.getView(test.connection.recvBuffer.getSize()) == "NEXT");
+}
+
+static void testExpectContinue()
+{
+	// "100 Continue" should be sent just before the first receive of the body
+	{
+		TestConnection test("POST / HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 5\r\n\r\n", { "hello" });
+		RequestBodyReader reader = test.createReader();
+		reader.setExpectContinue(true);
+
+		TEST_CHECK(test.pSocket->m_sentData.empty());
+
+		std::string body;
+		TEST_CHECK(reader.readAll(body));
+		TEST_CHECK_EQUAL(body, "hello");
+		TEST_CHECK_EQUAL(test.pSocket->m_sentData, "HTTP/1.1 100 Continue\r\n\r\n");
+	}
+
+	// but not if the client sent the body anyway
+	{
+		TestConnection test("POST / HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 5\r\n\r\nhello");
+		RequestBodyReader reader = test.createReader();
+		reader.setExpectContinue(true);
+
+		std::string body;
+		TEST_CHECK(reader.readAll(body));
+		TEST_CHECK(test.pSocket->m_sentData.empty());
+	}
+
+	// if the body isn't read, it can't be discarded, as we don't know whether the client will send it
+	{
+		TestConnection test("POST / HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 5\r\n\r\n", { "hello" });
+		RequestBodyReader reader = test.createReader();
+		reader.setExpectContinue(true);
+
+		TEST_CHECK(!reader.discardRemaining());
+		TEST_CHECK(test.pSocket->m_sentData.empty());
+		TEST_CHECK_EQUAL(test.pSocket->m_numRecvs, 0);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	testContentLengthBody();
+	testChunkedBody();
+	testSmallReads();
+	testInvalidChunkedBody();
+	testMaxBodySize();
+	testDiscardRemaining();
+	testExpectContinue();
+
+	return testsResult("RequestBodyReader tests");
+}
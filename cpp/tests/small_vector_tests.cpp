@@ -0,0 +1,187 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+// Tests for SmallVector, including that items are constructed and destroyed the right number of times
+// when it moves from inline to heap storage.
+
+#include "test_harness.h"
+
+#include "utils/small_vector.h"
+
+#include <string>
+#include <string_view>
+
+// counts the live instances, so leaks and double destructions show up
+struct CountedItem
+{
+	CountedItem(int val) : value(val)
+	{
+		numLive++;
+	}
+
+	CountedItem(const CountedItem& other) : value(other.value)
+	{
+		numLive++;
+	}
+
+	CountedItem(CountedItem&& other) : value(other.value)
+	{
+		other.value = -1;
+		numLive++;
+	}
+
+	~CountedItem()
+	{
+		numLive--;
+	}
+
+	int			value;
+
+	static int	numLive;
+};
+
+int CountedItem::numLive = 0;
+
+static void testInline()
+{
+	SmallVector<int, 4> vec;
+	TEST_CHECK(vec.empty());
+	TEST_CHECK(!vec.isOnHeap());
+
+	for (int i = 0; i < 4; i++)
+	{
+		vec.push_back(i * 10);
+	}
+
+	TEST_CHECK_EQUAL(vec.size(), 4);
+	TEST_CHECK(!vec.isOnHeap());
+	TEST_CHECK_EQUAL(vec[3], 30);
+
+	int total = 0;
+	for (int value : vec)
+	{
+		total += value;
+	}
+	TEST_CHECK_EQUAL(total, 60);
+}
+
+static void testGrowth()
+{
+	SmallVector<std::string, 2> vec;
+
+	for (int i = 0; i < 50; i++)
+	{
+		vec.emplace_back(std::to_string(i) + "-a-string-long-enough-to-be-heap-allocated");
+	}
+
+	TEST_CHECK(vec.isOnHeap());
+	TEST_CHECK_EQUAL(vec.size(), 50);
+
+	bool allCorrect = true;
+	for (int i = 0; i < 50; i++)
+	{
+		allCorrect &= (vec[i] == std::to_string(i) + "-a-string-long-enough-to-be-heap-allocated");
+	}
+	TEST_CHECK(allCorrect);
+
+	vec.clear();
+	TEST_CHECK(vec.empty());
+
+	// the heap storage is kept after clear()
+	vec.emplace_back("a");
+	TEST_CHECK(vec.isOnHeap());
+	TEST_CHECK_EQUAL(vec[0], "a");
+}
+
+static void testLifetimes()
+{
+	{
+		SmallVector<CountedItem, 3> vec;
+		for (int i = 0; i < 3; i++)
+		{
+			vec.emplace_back(i);
+		}
+		TEST_CHECK_EQUAL(CountedItem::numLive, 3);
+
+		// moving to the heap
+		for (int i = 3; i < 20; i++)
+		{
+			vec.emplace_back(i);
+		}
+		TEST_CHECK_EQUAL(CountedItem::numLive, 20);
+
+		bool allCorrect = true;
+		for (int i = 0; i < 20; i++)
+		{
+			allCorrect &= (vec[i].value == i);
+		}
+		TEST_CHECK(allCorrect);
+
+		vec.clear();
+		TEST_CHECK_EQUAL(CountedItem::numLive, 0);
+
+		vec.emplace_back(100);
+	}
+
+	TEST_CHECK_EQUAL(CountedItem::numLive, 0);
+}
+
+static void testAppendingOwnItem()
+{
+	// appending a copy of an existing item when it needs to grow, as the item's storage is freed by the growth
+	SmallVector<std::string, 2> vec;
+	vec.push_back("first-string-long-enough-to-be-heap-allocated");
+	vec.push_back("second");
+
+	vec.push_back(vec[0]);
+	TEST_CHECK_EQUAL(vec.size(), 3);
+	TEST_CHECK_EQUAL(vec[2], "first-string-long-enough-to-be-heap-allocated");
+	TEST_CHECK_EQUAL(vec[0], vec[2]);
+
+	vec.emplace_back(vec[1]);
+	vec.emplace_back(vec[1]);
+	TEST_CHECK_EQUAL(vec.size(), 5);
+	TEST_CHECK_EQUAL(vec[4], "second");
+}
+
+static void testStringViewPairs()
+{
+	// the way WebRequest uses it, for the views of header fields
+	SmallVector<std::pair<std::string_view, std::string_view>, 8> vec;
+
+	const std::string header = "Name0: Value0";
+	for (int i = 0; i < 12; i++)
+	{
+		vec.emplace_back(std::string_view(header).substr(0, 5), std::string_view(header).substr(7));
+	}
+
+	TEST_CHECK_EQUAL(vec.size(), 12);
+	TEST_CHECK(vec[11].first == "Name0");
+	TEST_CHECK(vec[11].second == "Value0");
+}
+
+int main(int argc, char** argv)
+{
+	testInline();
+	testGrowth();
+	testLifetimes();
+	testAppendingOwnItem();
+	testStringViewPairs();
+
+	return testsResult("SmallVector tests");
+}
@@ -0,0 +1,181 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef TEST_FIXTURES_H
+#define TEST_FIXTURES_H
+
+// Test doubles shared by the unit tests which send responses or read request bodies: a connection socket which
+// captures everything sent (and returns scripted data when received from), and a temporary file with known content.
+
+#include "test_harness.h"
+
+#include "server/connection_socket.h"
+#include "utils/recv_buffer.h"
+#include "utils/logger.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+class TestConnectionSocket : public ConnectionSocket
+{
+public:
+	// if supportsSendFile is set, file data is read in the same way the real sockets would, rather than being sent
+	// through the normal send functions in chunks.
+	TestConnectionSocket(Logger& logger, bool supportsSendFile = false) : ConnectionSocket(logger),
+		m_supportsSendFile(supportsSendFile)
+	{
+	}
+
+	virtual bool send(const std::string& data, unsigned int flags = 0) const override
+	{
+		m_sentData += data;
+		return true;
+	}
+
+	virtual bool send(unsigned char* pData, size_t dataLength) const override
+	{
+		m_sentData.append((const char*)pData, dataLength);
+		return true;
+	}
+
+	virtual bool sendv(const struct iovec* pIOVecs, unsigned int count, unsigned int flags = 0) const override
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			m_sentData.append((const char*)pIOVecs[i].iov_base, pIOVecs[i].iov_len);
+		}
+		return true;
+	}
+
+	virtual bool supportsSendFileData() const override
+	{
+		return m_supportsSendFile;
+	}
+
+	virtual bool sendFileData(int fileFD, size_t offset, size_t length) const override
+	{
+		std::string data(length, '\0');
+		if (pread(fileFD, &data[0], length, offset) != (ssize_t)length)
+			return false;
+
+		m_sentData += data;
+		return true;
+	}
+
+	// returns the next item of m_aRecvData, or that the peer closed the connection once there are none left
+	virtual SocketRecvReturnCode recv(RecvBuffer& buffer, unsigned int timeoutSecs) const override
+	{
+		m_numRecvs++;
+
+		if (m_aRecvData.empty())
+			return SocketRecvReturnCode(eSockRecv_PeerClosed);
+
+		const std::string& data = m_aRecvData.front();
+		char* pWrite = buffer.getWritePointer(data.size());
+		memcpy(pWrite, data.data(), data.size());
+		buffer.commitWrite(data.size());
+
+		m_aRecvData.pop_front();
+
+		return SocketRecvReturnCode(eSockRecv_OK);
+	}
+
+	virtual SocketRecvReturnCode recvNonBlocking(RecvBuffer& buffer) const override
+	{
+		return recv(buffer, 0);
+	}
+
+	virtual bool close(bool deleteRawSocket) override
+	{
+		return true;
+	}
+
+	// these assume a single response has been sent
+	std::string getHeader() const
+	{
+		return m_sentData.substr(0, m_sentData.find("\r\n\r\n") + 4);
+	}
+
+	std::string getBody() const
+	{
+		return m_sentData.substr(m_sentData.find("\r\n\r\n") + 4);
+	}
+
+public:
+	// each is returned by a separate recv()
+	mutable std::deque<std::string>	m_aRecvData;
+	mutable std::string				m_sentData;
+	mutable unsigned int			m_numRecvs = 0;
+
+protected:
+	bool							m_supportsSendFile;
+};
+
+// a file with known content, which is deleted again afterwards. extension is used to give it a known content type.
+class TestFile
+{
+public:
+	TestFile(const std::string& content, const std::string& extension) :
+		m_content(content)
+	{
+		std::string pathTemplate = "/tmp/webserve_testXXXXXX" + extension;
+		std::vector<char> aPath(pathTemplate.begin(), pathTemplate.end());
+		aPath.emplace_back(0);
+
+		int fileFD = mkstemps(aPath.data(), (int)extension.size());
+		m_path = aPath.data();
+
+		if (fileFD != -1)
+		{
+			TEST_CHECK_EQUAL(write(fileFD, m_content.data(), m_content.size()), (ssize_t)m_content.size());
+			close(fileFD);
+		}
+	}
+
+	~TestFile()
+	{
+		unlink(m_path.c_str());
+	}
+
+	void setModificationTime(time_t modificationTime)
+	{
+		struct timeval aTimes[2];
+		aTimes[0].tv_sec = modificationTime;
+		aTimes[0].tv_usec = 0;
+		aTimes[1] = aTimes[0];
+		TEST_CHECK_EQUAL(utimes(m_path.c_str(), aTimes), 0);
+	}
+
+	std::string		m_path;
+	std::string		m_content;
+};
+
+static inline bool hasHeaderLine(const std::string& header, const std::string& line)
+{
+	return header.find("\r\n" + line + "\r\n") != std::string::npos;
+}
+
+#endif // TEST_FIXTURES_H
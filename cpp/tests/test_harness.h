@@ -0,0 +1,61 @@
+/*
+ WebServe
+ Copyright 2018-2022 Peter Pearson.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ You may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ---------
+*/
+
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+// Minimal assertion helpers for the unit tests, so they don't need any external test framework.
+// Each test program runs its tests from main(), and returns the result of testsResult().
+
+#include <cstdio>
+
+static unsigned int gNumTestFailures = 0;
+
+#define TEST_CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			gNumTestFailures++; \
+		} \
+	} while (0)
+
+#define TEST_CHECK_EQUAL(actual, expected) \
+	do \
+	{ \
+		if (!((actual) == (expected))) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s == %s\n", __FILE__, __LINE__, #actual, #expected); \
+			gNumTestFailures++; \
+		} \
+	} while (0)
+
+static inline int testsResult(const char* testsName)
+{
+	if (gNumTestFailures > 0)
+	{
+		fprintf(stderr, "%s: %u check(s) failed.\n", testsName, gNumTestFailures);
+		return 1;
+	}
+
+	fprintf(stderr, "%s: all passed.\n", testsName);
+	return 0;
+}
+
+#endif // TEST_HARNESS_H